@@ -0,0 +1,62 @@
+#pragma once
+
+/* OpenHaptics entry point. With HD_SIMULATION defined the platform builds
+   without OpenHaptics, and this header supplies the few HDAPI/HDU types the
+   platform headers use (see hd_simdevice.h for the simulated device). */
+
+#ifndef HD_SIMULATION
+
+#include <HD/hd.h>
+#include <HDU/hduVector.h>
+
+#else
+
+#include <math.h>
+
+typedef unsigned int HHD;
+typedef double HDdouble;
+typedef unsigned int HDCallbackCode;
+typedef unsigned long HDSchedulerHandle;
+
+#define HDCALLBACK
+#define HD_CALLBACK_DONE 0
+#define HD_CALLBACK_CONTINUE 1
+#define HD_INVALID_HANDLE 0xFFFFFFFF
+
+template <typename T>
+class hduVector3D {
+	/* subset of the HDU vector interface used by the platform */
+private:
+	T v[3];
+
+public:
+	hduVector3D() { v[0] = v[1] = v[2] = 0; }
+	hduVector3D(T x, T y, T z) { v[0] = x; v[1] = y; v[2] = z; }
+	hduVector3D(const T *p) { v[0] = p[0]; v[1] = p[1]; v[2] = p[2]; }
+
+	operator T*() { return v; }
+	operator const T*() const { return v; }
+
+	T magnitude() const { return sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]); }
+	T dotProduct(const hduVector3D &o) const { return v[0] * o.v[0] + v[1] * o.v[1] + v[2] * o.v[2]; }
+
+	hduVector3D& operator+=(const hduVector3D &o) { v[0] += o.v[0]; v[1] += o.v[1]; v[2] += o.v[2]; return *this; }
+	hduVector3D& operator-=(const hduVector3D &o) { v[0] -= o.v[0]; v[1] -= o.v[1]; v[2] -= o.v[2]; return *this; }
+	hduVector3D& operator*=(T s) { v[0] *= s; v[1] *= s; v[2] *= s; return *this; }
+	hduVector3D& operator/=(T s) { v[0] /= s; v[1] /= s; v[2] /= s; return *this; }
+
+	hduVector3D operator+(const hduVector3D &o) const { hduVector3D r(*this); return r += o; }
+	hduVector3D operator-(const hduVector3D &o) const { hduVector3D r(*this); return r -= o; }
+	hduVector3D operator-() const { return hduVector3D(-v[0], -v[1], -v[2]); }
+	hduVector3D operator*(T s) const { hduVector3D r(*this); return r *= s; }
+	hduVector3D operator/(T s) const { hduVector3D r(*this); return r /= s; }
+};
+
+template <typename T>
+hduVector3D<T> operator*(T s, const hduVector3D<T> &v) {
+	return v * s;
+}
+
+typedef hduVector3D<double> hduVector3Dd;
+
+#endif
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hd_types.h"
+
+#define CLOCK_PROBE_INTERVAL_US 100000	// timing datagram per direction at most this often
+#define CLOCK_FILTER_SIZE 8				// recent exchanges; the one with the lowest RTT sets the offset
+#define CLOCK_SMOOTHING 0.125			// EWMA weight of a new offset/RTT/one-way delay sample
+#define CLOCK_SKEW_SPAN_US 10000000		// offset drift is measured over at least this long
+#define CLOCK_SKEW_SMOOTHING 0.25		// EWMA weight of a new skew measurement
+#define CLOCK_MAX_SKEW_PPM 500			// larger drifts are measurement noise
+
+#define TIMING_SIZE 40					// timing datagram, told apart from packets by size
+#define TIMING_MAGIC 0x4b434448			// "HDCK"
+
+struct ClockStats {
+	double offset_us;			// remote clock minus local clock
+	double skew_ppm;			// drift of that offset
+	double rtt_us;				// smoothed round trip, without the peer's hold time
+	double one_way_us;			// smoothed one-way delay of data packets
+	uint64_t probes_sent;
+	uint64_t probes_received;
+	uint64_t exchanges;			// probes that completed a round trip
+	bool synced;				// offset is measured, not assumed zero
+
+	ClockStats() {
+		memset(this, 0, sizeof(ClockStats));
+	}
+};
+
+class ClockEstimator {
+	/* NTP-style offset/RTT estimation from timing datagrams riding along the
+	   packet exchange. Every probe carries its send time and echoes the
+	   newest probe received from the peer together with how long it was
+	   held, which gives the four timestamps of an NTP exchange:
+	     t1 our send, t2 = t3 - hold peer receive, t3 peer send, t4 our receive
+	     offset = ((t2 - t1) + (t3 - t4)) / 2, rtt = (t4 - t1) - hold
+	   The exchange with the lowest RTT among the last CLOCK_FILTER_SIZE is the
+	   least queued, so it sets the offset (NTP clock filter). Timestamps of
+	   data packets are then mapped to the local clock to get one-way delay,
+	   assuming a symmetric path.
+	//
+	// timing: # magic # pad # t_send # t_echo # hold # reserved #
+	*/
+private:
+	struct Exchange {
+		double offset;
+		double rtt;
+		ts_t at;			// local time it completed
+	};
+
+	ts_t last_probe_sent;
+	ts_t peer_send;			// newest peer probe: its send time and our arrival time, echoed back
+	ts_t peer_arrival;
+	bool has_peer_probe;
+
+	Exchange filter[CLOCK_FILTER_SIZE];
+	int filter_count;
+	int filter_head;
+
+	ts_t offset_at;			// local time stats.offset_us refers to
+	double skew_anchor_offset;
+	ts_t skew_anchor_at;
+	bool has_skew_anchor;
+	bool has_one_way;
+	ClockStats stats;
+
+	static void PutTs(char *out, ts_t v) {
+		memcpy(out, &v, sizeof(ts_t));
+	}
+
+	static ts_t GetTs(const char *in) {
+		ts_t v;
+		memcpy(&v, in, sizeof(ts_t));
+		return v;
+	}
+
+	static double Smooth(double current, double sample, double weight) {
+		return current + weight * (sample - current);
+	}
+
+	void AddExchange(double offset, double rtt, ts_t now) {
+		filter[filter_head] = { offset, rtt, now };
+		filter_head = (filter_head + 1) % CLOCK_FILTER_SIZE;
+		if (filter_count < CLOCK_FILTER_SIZE)
+			filter_count++;
+
+		const Exchange *best = &filter[0];
+		for (int i = 1; i < filter_count; i++)
+			if (filter[i].rtt < best->rtt)
+				best = &filter[i];
+
+		// the best exchange may be a few probes old: carry it forward with the known drift
+		double best_offset = best->offset + stats.skew_ppm * 1e-6 * (now - best->at);
+		if (!stats.synced) {
+			stats.offset_us = best_offset;
+			stats.rtt_us = rtt;
+			stats.synced = true;
+		}
+		else {
+			stats.offset_us = Smooth(Offset(now), best_offset, CLOCK_SMOOTHING);
+			stats.rtt_us = Smooth(stats.rtt_us, rtt, CLOCK_SMOOTHING);
+		}
+		offset_at = now;
+
+		if (!has_skew_anchor) {
+			skew_anchor_offset = stats.offset_us;
+			skew_anchor_at = now;
+			has_skew_anchor = true;
+		}
+		else if (now - skew_anchor_at >= CLOCK_SKEW_SPAN_US) {
+			double skew = (stats.offset_us - skew_anchor_offset) / (now - skew_anchor_at) * 1e6;
+			if (skew > -CLOCK_MAX_SKEW_PPM && skew < CLOCK_MAX_SKEW_PPM)
+				stats.skew_ppm = Smooth(stats.skew_ppm, skew, CLOCK_SKEW_SMOOTHING);
+			skew_anchor_offset = stats.offset_us;
+			skew_anchor_at = now;
+		}
+		stats.exchanges++;
+	}
+
+public:
+	ClockEstimator() : last_probe_sent(0), peer_send(0), peer_arrival(0), has_peer_probe(false),
+					   filter_count(0), filter_head(0), offset_at(0), skew_anchor_offset(0), skew_anchor_at(0),
+					   has_skew_anchor(false), has_one_way(false) {}
+
+	bool ProbeDue(ts_t now) const {
+		return now - last_probe_sent >= CLOCK_PROBE_INTERVAL_US;
+	}
+
+	int BuildProbe(ts_t now, char *out) {
+		/* timing datagram for the peer into out (TIMING_SIZE bytes). returns its length. */
+		memset(out, 0, TIMING_SIZE);
+		uint32_t magic = TIMING_MAGIC;
+		memcpy(out, &magic, sizeof(magic));
+		PutTs(out + 8, now);
+		if (has_peer_probe) {
+			PutTs(out + 16, peer_send);
+			PutTs(out + 24, now - peer_arrival);
+		}
+		last_probe_sent = now;
+		stats.probes_sent++;
+		return TIMING_SIZE;
+	}
+
+	bool ReceiveProbe(const char *data, ts_t now) {
+		/* timing datagram from the peer, arrived at now. false if it is not one. */
+		uint32_t magic;
+		memcpy(&magic, data, sizeof(magic));
+		if (magic != TIMING_MAGIC)
+			return false;
+		stats.probes_received++;
+
+		ts_t t3 = GetTs(data + 8);
+		ts_t t1 = GetTs(data + 16);
+		ts_t hold = GetTs(data + 24);
+		peer_send = t3;
+		peer_arrival = now;
+		has_peer_probe = true;
+
+		// t1 == 0: the peer has not seen one of our probes yet
+		if (t1 != 0 && hold >= 0) {
+			double rtt = (double)(now - t1) - hold;
+			if (rtt >= 0) {
+				ts_t t2 = t3 - hold;
+				AddExchange(((double)(t2 - t1) + (double)(t3 - now)) / 2, rtt, now);
+			}
+		}
+		return true;
+	}
+
+	double Offset(ts_t now) const {
+		/* remote clock minus local clock at local time now */
+		return stats.offset_us + stats.skew_ppm * 1e-6 * (now - offset_at);
+	}
+
+	ts_t ToLocal(ts_t remote_ts, ts_t now) const {
+		/* remote timestamp on the local clock. before the first exchange both clocks are taken as one. */
+		return stats.synced ? remote_ts - (ts_t)Offset(now) : remote_ts;
+	}
+
+	ts_t OneWayDelay(ts_t remote_ts, ts_t arrival) {
+		/* one-way delay of a data packet stamped remote_ts by the peer, arrived at local time arrival */
+		ts_t delay = arrival - ToLocal(remote_ts, arrival);
+		stats.one_way_us = has_one_way ? Smooth(stats.one_way_us, (double)delay, CLOCK_SMOOTHING) : delay;
+		has_one_way = true;
+		return delay;
+	}
+
+	const ClockStats& getStats() const {
+		return stats;
+	}
+};
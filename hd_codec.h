@@ -0,0 +1,252 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hd_api.h"
+#include "hd_types.h"
+#include "hd_packet.h"
+
+#define COMPACT_STEP_MM 0.01		// position quantization step; int16 covers +-327 mm around the workspace center
+#define COMPACT_HISTORY 64			// samples remembered per direction for delta references, power of two
+#define COMPACT_MAX_TS_DELTA (1LL << 35)	// larger timestamp deltas are sent as keyframes
+
+#define COMPACT_FLAG_KEY 0x01		// absolute sample, no reference
+#define COMPACT_FLAG_ACK 0x02		// ack field is valid
+
+enum PacketEncoding {
+	ENCODING_RAW,			// 24 byte HapticPacket layout
+	ENCODING_COMPACT		// CompactCodec, always shorter than PACKET_SIZE
+};
+
+struct CodecStats {
+	uint64_t encoded;
+	uint64_t keyframes;
+	uint64_t encoded_bytes;
+	uint64_t decoded;
+	uint64_t missing_refs;		// delta against a sample this side never got, dropped
+	uint64_t malformed;
+
+	CodecStats() {
+		memset(this, 0, sizeof(CodecStats));
+	}
+
+	double MeanBytes() const {
+		return encoded ? (double)encoded_bytes / encoded : 0;
+	}
+};
+
+class CompactCodec {
+// key:   # flags # seq16 # ack16 # ts varint # x int16 # y int16 # z int16 #
+// delta: # flags # seq16 # ack16 # ref16 # dts varint # dx # dy # dz (zigzag varints) #
+
+	/* Compact wire format, one instance per session (both directions).
+	   Positions are quantized to COMPACT_STEP_MM around the workspace
+	   center. Deltas are taken against the newest of our samples the peer
+	   has acknowledged (the ack field of its packets), so a lost packet
+	   never breaks decoding; without a usable reference a keyframe is sent.
+	   seq16 is the low half of the packet number and is unwrapped against
+	   the newest one received. */
+private:
+	struct Entry {
+		int16_t q[3];
+		ts_t ts;
+		uint16_t seq;
+		bool valid;
+	};
+
+	Entry sent[COMPACT_HISTORY];
+	Entry received[COMPACT_HISTORY];
+	uint16_t peer_ack;			// newest of our samples the peer has decoded
+	bool has_peer_ack;
+	cnt_t newest_received;		// unwrapped packet number of the newest decoded sample, echoed as ack
+	bool has_received;
+	CodecStats stats;
+
+	static int16_t Quantize(double v) {
+		double q = floor(v / COMPACT_STEP_MM + 0.5);
+		if (q > 32767) q = 32767;
+		if (q < -32768) q = -32768;
+		return (int16_t)q;
+	}
+
+	static int PutVarint(char *out, uint64_t v) {
+		int n = 0;
+		while (v >= 0x80) {
+			out[n++] = (char)(v | 0x80);
+			v >>= 7;
+		}
+		out[n++] = (char)v;
+		return n;
+	}
+
+	static bool GetVarint(const char *in, int len, int &pos, uint64_t &v) {
+		v = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (pos >= len)
+				return false;
+			uint8_t b = (uint8_t)in[pos++];
+			v |= (uint64_t)(b & 0x7f) << shift;
+			if (!(b & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	static uint64_t ZigZag(int64_t v) {
+		return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+	}
+
+	static int64_t UnZigZag(uint64_t v) {
+		return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+	}
+
+	static void Put16(char *out, uint16_t v) {
+		out[0] = (char)(v & 0xff);
+		out[1] = (char)(v >> 8);
+	}
+
+	static uint16_t Get16(const char *in) {
+		return (uint16_t)((uint8_t)in[0] | ((uint8_t)in[1] << 8));
+	}
+
+	static Entry& Slot(Entry *ring, uint16_t seq) {
+		return ring[seq & (COMPACT_HISTORY - 1)];
+	}
+
+public:
+	CompactCodec() : peer_ack(0), has_peer_ack(false), newest_received(0), has_received(false) {
+		memset(sent, 0, sizeof(sent));
+		memset(received, 0, sizeof(received));
+	}
+
+	int Encode(HapticPacket &packet, char *out) {
+		/* serialize packet into out (at least PACKET_SIZE bytes). returns the length, < PACKET_SIZE. */
+		uint16_t seq = (uint16_t)packet.GetPacketNum();
+		ts_t ts = packet.GetTimestamp();
+		hduVector3Dd pos = packet.GetPos();
+		int16_t q[3] = { Quantize(pos[0]), Quantize(pos[1]), Quantize(pos[2]) };
+
+		const Entry *ref = NULL;
+		if (has_peer_ack) {
+			const Entry &e = Slot(sent, peer_ack);
+			int16_t age = (int16_t)(seq - peer_ack);
+			if (e.valid && e.seq == peer_ack && age > 0 && age < COMPACT_HISTORY &&
+				ts >= e.ts && ts - e.ts < COMPACT_MAX_TS_DELTA)
+				ref = &e;
+		}
+
+		int n = 0;
+		out[n++] = (char)((ref ? 0 : COMPACT_FLAG_KEY) | (has_received ? COMPACT_FLAG_ACK : 0));
+		Put16(out + n, seq);
+		n += 2;
+		Put16(out + n, (uint16_t)newest_received);
+		n += 2;
+		if (ref) {
+			Put16(out + n, ref->seq);
+			n += 2;
+			n += PutVarint(out + n, (uint64_t)(ts - ref->ts));
+			for (int i = 0; i < 3; i++)
+				n += PutVarint(out + n, ZigZag((int64_t)q[i] - ref->q[i]));
+		}
+		else {
+			n += PutVarint(out + n, (uint64_t)ts);
+			for (int i = 0; i < 3; i++) {
+				Put16(out + n, (uint16_t)q[i]);
+				n += 2;
+			}
+			stats.keyframes++;
+		}
+
+		Entry &e = Slot(sent, seq);
+		memcpy(e.q, q, sizeof(q));
+		e.ts = ts;
+		e.seq = seq;
+		e.valid = true;
+		stats.encoded++;
+		stats.encoded_bytes += n;
+		return n;
+	}
+
+	bool Decode(const char *in, int len, HapticPacket &packet) {
+		/* parse a compact datagram into packet (full packet number and timestamp). false if unusable. */
+		if (len < 5 || len >= PACKET_SIZE) {
+			stats.malformed++;
+			return false;
+		}
+		uint8_t flags = (uint8_t)in[0];
+		uint16_t seq = Get16(in + 1);
+		uint16_t ack = Get16(in + 3);
+		int pos = 5;
+
+		int16_t q[3];
+		ts_t ts;
+		if (flags & COMPACT_FLAG_KEY) {
+			uint64_t v;
+			if (!GetVarint(in, len, pos, v) || pos + 6 != len) {
+				stats.malformed++;
+				return false;
+			}
+			ts = (ts_t)v;
+			for (int i = 0; i < 3; i++)
+				q[i] = (int16_t)Get16(in + pos + 2 * i);
+		}
+		else {
+			if (pos + 2 > len) {
+				stats.malformed++;
+				return false;
+			}
+			uint16_t ref_seq = Get16(in + pos);
+			pos += 2;
+			uint64_t dts, d[3];
+			if (!GetVarint(in, len, pos, dts) || !GetVarint(in, len, pos, d[0]) ||
+				!GetVarint(in, len, pos, d[1]) || !GetVarint(in, len, pos, d[2]) || pos != len) {
+				stats.malformed++;
+				return false;
+			}
+			const Entry &ref = Slot(received, ref_seq);
+			if (!ref.valid || ref.seq != ref_seq) {
+				stats.missing_refs++;
+				return false;
+			}
+			ts = ref.ts + (ts_t)dts;
+			for (int i = 0; i < 3; i++)
+				q[i] = (int16_t)(ref.q[i] + UnZigZag(d[i]));
+		}
+
+		if ((flags & COMPACT_FLAG_ACK) && (!has_peer_ack || (int16_t)(ack - peer_ack) > 0)) {
+			peer_ack = ack;
+			has_peer_ack = true;
+		}
+
+		// unwrap against the newest sample received so far
+		cnt_t num = has_received ? newest_received + (int16_t)(seq - (uint16_t)newest_received) : seq;
+		if (!has_received || (int32_t)(num - newest_received) > 0) {
+			newest_received = num;
+			has_received = true;
+		}
+
+		Entry &e = Slot(received, seq);
+		memcpy(e.q, q, sizeof(q));
+		e.ts = ts;
+		e.seq = seq;
+		e.valid = true;
+
+		packet.UpdatePacket(hduVector3Dd(q[0] * COMPACT_STEP_MM, q[1] * COMPACT_STEP_MM, q[2] * COMPACT_STEP_MM), num, ts);
+		stats.decoded++;
+		return true;
+	}
+
+	const CodecStats& getStats() const {
+		return stats;
+	}
+};
+
+inline bool CompactPeekSequence(const char *data, int32_t len, uint16_t &seq) {
+	/* low 16 bits of the packet number of a compact datagram, without decoding it */
+	if (len < 5 || len >= PACKET_SIZE)
+		return false;
+	seq = (uint16_t)((uint8_t)data[1] | ((uint8_t)data[2] << 8));
+	return true;
+}
@@ -1,83 +1,584 @@
 #pragma once
 
-#include <WS2tcpip.h>
 #include <stdio.h>
+#include <string.h>
 #include <string>
 #include <sstream>
+#include <chrono>
+#include <thread>
 
-#include <HD/hd.h>
-#include <HDU/hduVector.h>
+#include "hd_api.h"
+#include "hd_socket.h"
+#include "hd_locallink.h"
+#include "hd_relay.h"
 
 #include "hd_packet.h"
+#include "hd_codec.h"
+#include "hd_clock.h"
+#include "hd_redundancy.h"
+#include "hd_seqwindow.h"
 #include "hd_types.h"
 #include "hd_time.h"
 #include "hd_logger.h"
+#include "hd_metrics.h"
+
+#define RECV_BATCH_SIZE 32		// max datagrams pulled by one recvmmsg call
+#define SEND_BATCH_SIZE 8		// max datagrams flushed by one sendmmsg call
+
+struct BatchStats {
+	/* per-call batch size statistics for the batched socket path */
+	uint64_t calls;								// syscalls issued
+	uint64_t datagrams;							// datagrams moved by those calls
+	uint32_t max_batch;							// largest batch seen
+	uint64_t histogram[RECV_BATCH_SIZE + 1];	// calls by batch size
+
+	BatchStats() {
+		memset(this, 0, sizeof(BatchStats));
+	}
+
+	void Record(uint32_t batch) {
+		calls++;
+		datagrams += batch;
+		if (batch > max_batch)
+			max_batch = batch;
+		histogram[batch > RECV_BATCH_SIZE ? RECV_BATCH_SIZE : batch]++;
+	}
+
+	double MeanBatch() const {
+		return calls ? (double)datagrams / calls : 0;
+	}
+};
+
+struct CommMetrics {
+	/* registry handles of one communicator, see HDCommunicator::SetMetrics */
+	MetricValue *received;
+	MetricValue *lost;
+	MetricValue *duplicates;
+	MetricValue *reordered;
+	MetricValue *recovered;
+	MetricValue *datagrams_sent;
+	MetricValue *datagrams_received;
+	MetricValue *rtt;
+	MetricValue *one_way_delay;
+	MetricValue *clock_offset;
+};
 
 class HDCommunicator {
 private:
 	SOCKET socket;
 	sockaddr_in* sock_addr;
-	int32_t sock_addr_size;
+	socklen_t sock_addr_size;
 
 	char alias;
-	char rcvbuf[PACKET_SIZE];
-	uint32_t last_received_packet = 0;
-	uint32_t packet_receive_counter = 0;
+	char rcvbuf[BUNDLE_MAX_SIZE];
+	HapticPacket received_packet;		// storage for the packet returned by ReceivePacket
 	HHD device_id;
 	Logger *sndlogger;
 	Logger *rcvlogger;
 	Logger *errlogger;
 
+	BatchStats recv_stats;
+	BatchStats send_stats;
+	PacketEncoding encoding = ENCODING_RAW;	// wire format for outgoing packets; incoming ones are told apart by size
+	CompactCodec codec;
+	RedundancyCodec redundancy;			// repeated samples / parity on send, loss recovery on receive
+	ClockEstimator clock;				// remote clock offset and RTT from timing datagrams
+	ts_t last_one_way_delay = 0;		// of the packet last returned by ReceivePacket
+	SequenceWindow window;				// packet numbers received or recovered: freshness, loss, reorder, duplicates
+	SocketPoller poller;				// readiness wait for WaitForPacket
+	LocalLink* local_link = NULL;		// memory link to a peer on this host, see EnableLocalTransport
+	int local_side = 0;					// our side of local_link: we send on rings[local_side]
+	bool local_registered = false;		// local_link is from LocalLinkRegistry, not the caller's (AttachLocalLink)
+	bool local_active = false;			// peer attached too: datagrams go through local_link, not the socket
+	ts_t local_checked = 0;				// when the peer's process was last seen alive
+	CommMetrics metrics;				// exported counters, if has_metrics (SetMetrics)
+	bool has_metrics = false;
+	ts_t last_metrics_publish = 0;
+	char relay_join[RELAY_JOIN_SIZE];	// join datagram for a relay in between, see SetRelaySession
+	bool has_relay_session = false;
+	ts_t last_relay_join = 0;
+	const ts_t* time_source = NULL;		// per-instance clock, see SetTimeSource
+
+#ifdef HD_LINUX_SOCKETS
+	// preallocated recvmmsg/sendmmsg descriptors; datagrams land in recv_buffers and are decoded into recv_packets
+	char recv_buffers[RECV_BATCH_SIZE][BUNDLE_MAX_SIZE];
+	HapticPacket recv_packets[RECV_BATCH_SIZE];
+	sockaddr_in recv_addrs[RECV_BATCH_SIZE];
+	iovec recv_iovecs[RECV_BATCH_SIZE];
+	mmsghdr recv_msgs[RECV_BATCH_SIZE];
+	iovec send_iovecs[SEND_BATCH_SIZE];
+	mmsghdr send_msgs[SEND_BATCH_SIZE];
+	char send_encoded[SEND_BATCH_SIZE][PACKET_SIZE];
+
+	void InitBatches() {
+		memset(recv_msgs, 0, sizeof(recv_msgs));
+		for (int i = 0; i < RECV_BATCH_SIZE; i++) {
+			recv_iovecs[i].iov_base = recv_buffers[i];
+			recv_iovecs[i].iov_len = BUNDLE_MAX_SIZE;
+			recv_msgs[i].msg_hdr.msg_iov = &recv_iovecs[i];
+			recv_msgs[i].msg_hdr.msg_iovlen = 1;
+			recv_msgs[i].msg_hdr.msg_name = &recv_addrs[i];
+		}
+		memset(send_msgs, 0, sizeof(send_msgs));
+		for (int i = 0; i < SEND_BATCH_SIZE; i++) {
+			send_msgs[i].msg_hdr.msg_iov = &send_iovecs[i];
+			send_msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+	}
+#else
+	void InitBatches() {}
+#endif
+
+	ts_t Now() const {
+		return time_source ? *time_source : getCurrentTime();
+	}
+
+	bool LocalActive() {
+		// the memory link carries the datagrams while the peer endpoint is attached as well. a peer that detaches
+		// or whose process died hands them back to the socket instead of leaving us writing into a full ring.
+		if (local_link == NULL)
+			return false;
+		if (!local_link->attached[1 - local_side].load(std::memory_order_acquire))
+			return local_active = false;
+		ts_t now = Now();
+		if (!local_active || now - local_checked >= LOCAL_PEER_CHECK_US) {
+			// kill(pid, 0) is a syscall: only every LOCAL_PEER_CHECK_US
+			local_active = LocalProcessAlive(local_link->pid[1 - local_side].load(std::memory_order_relaxed));
+			local_checked = now;
+		}
+		return local_active;
+	}
+
+	bool SendDatagram(const char* data, int len) {
+		// one datagram to the remote device, through the memory link when active. a full ring drops it like a full socket buffer.
+		if (LocalActive()) {
+			DatagramRing& ring = local_link->rings[local_side];
+			char* slot = ring.Reserve();
+			if (slot == NULL)
+				return false;
+			memcpy(slot, data, len);
+			ring.Commit(len);
+			return true;
+		}
+		return sendto(socket, data, len, 0, (sockaddr*)sock_addr, sock_addr_size) != SOCKET_ERROR;
+	}
+
+	bool LocalPending() {
+		// receive from the memory link while it is active, and after that until what the peer left there is read
+		return LocalActive() || (local_link && !local_link->rings[1 - local_side].IsEmpty());
+	}
+
+	HapticPacket* ReceiveLocal() {
+		// drain the memory link, decoding each datagram in place; the freshest packet is kept as on the socket paths
+		DatagramRing& ring = local_link->rings[1 - local_side];
+		bool has_received = false;
+		uint32_t batch = 0;
+		HapticPacket incoming;
+		const char* data;
+		int len;
+		while ((data = ring.Peek(len)) != NULL) {
+			batch++;
+			if (Decode(data, len, incoming)) {
+				received_packet = incoming;
+				has_received = true;
+			}
+			ring.Release();
+		}
+		recv_stats.Record(batch);
+		if (has_received)
+			last_one_way_delay = clock.OneWayDelay(received_packet.GetTimestamp(), Now());
+		return has_received ? &received_packet : NULL;
+	}
+
+	bool Decode(const char* data, int len, HapticPacket& packet) {
+		// datagram of either wire format into packet. raw packets and bundles are copied, compact ones decoded.
+		// true only for a sample newer than any before; duplicates and stale packets are dropped, late ones
+		// go to TakeRecovered like the repeated samples of a bundle. parity and timing datagrams are consumed here.
+		if (len == TIMING_SIZE) {
+			clock.ReceiveProbe(data, Now());
+			return false;
+		}
+		if (len == RELAY_JOIN_SIZE)		// a direct peer that was told to join a relay
+			return false;
+		if (len == PARITY_SIZE) {
+			redundancy.ReceiveParity(data, window);
+			return false;
+		}
+		if (len >= PACKET_SIZE && len % PACKET_SIZE == 0) {
+			packet.UpdatePacket(data);
+		}
+		else {
+			HapticPacket decoded;
+			if (!codec.Decode(data, len, decoded))
+				return false;
+			packet = decoded;
+		}
+		SequenceStatus status = window.Receive(packet.GetPacketNum());
+		if (status == SEQ_DUPLICATE || status == SEQ_STALE)
+			return false;
+		redundancy.Remember(packet);
+		if (len > PACKET_SIZE)
+			redundancy.ReceiveBundle(data, len, window);
+		if (status == SEQ_REORDERED) {
+			redundancy.Enqueue(packet);
+			return false;
+		}
+		return true;
+	}
+
+	void SendProbe() {
+		// timing datagram for the peer's ClockEstimator, riding along the packet flow; the relay join too
+		ts_t now = Now();
+		if (has_relay_session && !LocalActive() && (last_relay_join == 0 || now - last_relay_join >= RELAY_JOIN_INTERVAL_US) &&
+			SendDatagram(relay_join, RELAY_JOIN_SIZE)) {
+			last_relay_join = now;
+			send_stats.Record(1);
+		}
+		if (!clock.ProbeDue(now))
+			return;
+		char probe[TIMING_SIZE];
+		int len = clock.BuildProbe(now, probe);
+		if (SendDatagram(probe, len))
+			send_stats.Record(1);
+	}
+
 public:
 	HDCommunicator(const HHD device_id, const SOCKET socket,
 				   sockaddr_in* sock_addr, const int32_t sock_addr_size, const char alias,
 				   Logger* sndlogger, Logger* rcvlogger, Logger* errlogger) :
 		device_id(device_id), socket(socket), sock_addr(sock_addr), sock_addr_size(sock_addr_size),
-		alias(alias), sndlogger(sndlogger), rcvlogger(rcvlogger), errlogger(errlogger) {}
+		alias(alias), sndlogger(sndlogger), rcvlogger(rcvlogger), errlogger(errlogger) {
+		InitBatches();
+		if (socket != INVALID_SOCKET)	// none for an endpoint on a caller's LocalLink only
+			poller.Add(socket);
+	}
+
+	~HDCommunicator() {
+		if (local_link && local_registered)
+			LocalLinkRegistry::Instance().Detach(local_link, local_side);
+		else if (local_link)
+			local_link->attached[local_side].store(0, std::memory_order_release);
+	}
+
+	bool EnableLocalTransport() {
+		// exchange datagrams with a peer on this host through a memory link (hd_locallink.h) instead of UDP.
+		// a loopback peer attaches us to the link named by both ports; we switch over as soon as the peer has
+		// called this too, and stay on the socket otherwise (e.g. a proxy or relay in between).
+		// false if the peer address is not loopback, the socket is not bound to a port (the link could not
+		// tell the two sides apart) or the link can't be mapped.
+		sockaddr_in local_addr;
+		socklen_t local_addr_size = sizeof(local_addr);
+		if (local_link || (ntohl(sock_addr->sin_addr.s_addr) >> 24) != 127 ||
+			getsockname(socket, (sockaddr*)&local_addr, &local_addr_size) != 0 || local_addr.sin_port == 0)
+			return false;
+		local_link = LocalLinkRegistry::Instance().Attach(ntohs(local_addr.sin_port), ntohs(sock_addr->sin_port), local_side);
+		local_registered = local_link != NULL;
+		return local_registered;
+	}
+
+	void AttachLocalLink(LocalLink* link, int side) {
+		// exchange datagrams over link, owned by the caller, as its side: an endpoint in the same process
+		// with no socket at all, e.g. the simulated pairs of hd_sweep.h. the link must outlive us.
+		local_link = link;
+		local_side = side;
+		local_registered = false;
+		link->pid[side].store(LocalProcessId());
+		link->attached[side].store(1, std::memory_order_release);
+	}
+
+	void SetTimeSource(const ts_t* now) {
+		// read the time from *now instead of getCurrentTime, for this communicator only, so simulations
+		// running side by side each keep their own clock (SetVirtualClock is process-wide). NULL: real clock.
+		time_source = now;
+	}
+
+	void SetRelaySession(const std::string& key) {
+		// pair with the peer through a relay (hd_relay.h) by a key both ends share. the join datagram repeats
+		// every RELAY_JOIN_INTERVAL_US along the packet flow, so a restarted relay or client pairs up again.
+		BuildRelayJoin(key, alias, relay_join);
+		has_relay_session = !key.empty();
+		last_relay_join = 0;
+	}
+
+	bool IsLocalTransportActive() {
+		return LocalActive();
+	}
+
+	bool WaitForPacket(int timeout_us) {
+		// block until a datagram is pending or timeout_us elapses (epoll on Linux). returns if readable
+		if (LocalActive()) {
+			// no descriptor to wait on: poll the ring
+			DatagramRing& ring = local_link->rings[1 - local_side];
+			// a real wait: on the steady clock even with SetTimeSource
+			ts_t deadline = getCurrentTime() + timeout_us;
+			while (ring.IsEmpty()) {
+				if (getCurrentTime() >= deadline)
+					return false;
+				std::this_thread::sleep_for(std::chrono::microseconds(LOCAL_POLL_US));
+			}
+			return true;
+		}
+		return poller.Wait(timeout_us) > 0;
+	}
+
+	void SetEncoding(PacketEncoding wire_encoding) {
+		// wire format for packets to the remote device. both formats are always accepted on receive.
+		encoding = wire_encoding;
+	}
+
+	PacketEncoding getEncoding() {
+		return encoding;
+	}
+
+	void SetRedundancy(RedundancyMode mode, int level) {
+		// loss protection for outgoing raw packets: REPEAT carries the previous level samples in every
+		// datagram, PARITY adds one xor datagram per level packets. not applied with ENCODING_COMPACT.
+		redundancy.Configure(mode, level);
+	}
+
+	RedundancyMode getRedundancyMode() {
+		return redundancy.getMode();
+	}
+
+	int getRedundancyLevel() {
+		return redundancy.getLevel();
+	}
 
 	bool SendPacket(HapticPacket* packet, bool debug) {
 		// send packet to remote device. return if it succeded
-		if (sendto(socket, packet->ToArray(), packet->GetSize(), 0, (sockaddr*)sock_addr, sock_addr_size) != SOCKET_ERROR) {
-			return true;
+		char encoded[BUNDLE_MAX_SIZE];
+		const char* data = packet->ToArray();
+		int len = packet->GetSize();
+		if (encoding == ENCODING_COMPACT) {
+			len = codec.Encode(*packet, encoded);
+			data = encoded;
 		}
-		else {
+		else if (redundancy.getMode() == REDUNDANCY_REPEAT) {
+			len = redundancy.Bundle(*packet, encoded);
+			data = encoded;
+		}
+		if (!SendDatagram(data, len)) {
 			errlogger->log("Packet send failed!");
 			return false;
 		}
+		send_stats.Record(1);
+
+		// a completed parity group goes out right behind its last packet
+		if (encoding == ENCODING_RAW && redundancy.getMode() == REDUNDANCY_PARITY && redundancy.Parity(*packet, encoded) &&
+			SendDatagram(encoded, PARITY_SIZE))
+			send_stats.Record(1);
+		SendProbe();
+		return true;
+	}
+
+	int SendPackets(HapticPacket* packets, int count, sockaddr_in* const* dest_addrs = NULL, bool debug = true) {
+		// send several packets (e.g. several devices or redundant copies) with as few syscalls as possible.
+		// dest_addrs gives a per-packet destination; NULL sends everything to the remote device.
+		// the session encoding only applies to the remote device, packets with dest_addrs go out raw.
+		// returns number of packets sent
+		int sent = 0;
+		if (dest_addrs == NULL && (LocalActive() || (encoding == ENCODING_RAW && redundancy.getMode() != REDUNDANCY_OFF))) {
+			// redundancy changes datagram sizes and count, the memory link has no batch call: one at a time
+			while (sent < count && SendPacket(&packets[sent], debug))
+				sent++;
+			return sent;
+		}
+#ifdef HD_LINUX_SOCKETS
+		while (sent < count) {
+			int batch = count - sent < SEND_BATCH_SIZE ? count - sent : SEND_BATCH_SIZE;
+			for (int i = 0; i < batch; i++) {
+				if (encoding == ENCODING_COMPACT && dest_addrs == NULL) {
+					send_iovecs[i].iov_base = send_encoded[i];
+					send_iovecs[i].iov_len = codec.Encode(packets[sent + i], send_encoded[i]);
+				}
+				else {
+					send_iovecs[i].iov_base = packets[sent + i].ToArray();
+					send_iovecs[i].iov_len = packets[sent + i].GetSize();
+				}
+				send_msgs[i].msg_hdr.msg_name = dest_addrs ? dest_addrs[sent + i] : sock_addr;
+				send_msgs[i].msg_hdr.msg_namelen = sock_addr_size;
+			}
+			int n = sendmmsg(socket, send_msgs, batch, 0);
+			if (n <= 0)
+				break;
+			send_stats.Record(n);
+			sent += n;
+		}
+#else
+		for (; sent < count; sent++) {
+			sockaddr_in* dest = dest_addrs ? dest_addrs[sent] : sock_addr;
+			char encoded[PACKET_SIZE];
+			const char* data = packets[sent].ToArray();
+			int len = packets[sent].GetSize();
+			if (encoding == ENCODING_COMPACT && dest_addrs == NULL) {
+				len = codec.Encode(packets[sent], encoded);
+				data = encoded;
+			}
+			if (sendto(socket, data, len, 0, (sockaddr*)dest, sock_addr_size) == SOCKET_ERROR)
+				break;
+			send_stats.Record(1);
+		}
+#endif
+		if (sent < count)
+			errlogger->log("Packet send failed!");
+		if (sent > 0 && dest_addrs == NULL)
+			SendProbe();
+		return sent;
 	}
 
+#ifdef HD_LINUX_SOCKETS
 	HapticPacket* ReceivePacket(bool debug = true) {
-		// recieve packet from remote device. returns ptr of packet, or NULL if failed
+		// recieve packet from remote device. returns ptr of packet, or NULL if failed.
+		// returned packet is owned by the communicator and valid until the next call.
+		// all pending datagrams are drained with recvmmsg and the freshest (highest packet number) is kept.
+		if (LocalPending())
+			return ReceiveLocal();
 		bool has_received = false;
-		HapticPacket* received_packet = NULL;
 		while (true) {
-			uint32_t bytesIn = recvfrom(socket, rcvbuf, sizeof(rcvbuf), 0, (sockaddr*)sock_addr, &sock_addr_size);
-			if (bytesIn != SOCKET_ERROR && bytesIn == sizeof(rcvbuf)) {
-				received_packet = new HapticPacket(rcvbuf);
-				packet_receive_counter++;
+			for (int i = 0; i < RECV_BATCH_SIZE; i++)
+				recv_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
 
-				if (received_packet->GetPacketNum() > last_received_packet) {
-					last_received_packet = received_packet->GetPacketNum();
-				}
+			int n = recvmmsg(socket, recv_msgs, RECV_BATCH_SIZE, MSG_DONTWAIT, NULL);
+			recv_stats.Record(n > 0 ? n : 0);
+			if (n <= 0)
+				break;
+
+			int freshest = -1;
+			for (int i = 0; i < n; i++) {
+				// only a new highest packet number decodes, so the last one that does is the freshest
+				if (Decode(recv_buffers[i], recv_msgs[i].msg_len, recv_packets[i]))
+					freshest = i;
+			}
+			if (freshest >= 0) {
+				received_packet.UpdatePacket(recv_packets[freshest].ToArray());
+				*sock_addr = recv_addrs[freshest];
 				has_received = true;
 			}
-			else {
+			if (n < RECV_BATCH_SIZE)
+				break;
+		}
+		if (has_received)
+			last_one_way_delay = clock.OneWayDelay(received_packet.GetTimestamp(), Now());
+		return has_received ? &received_packet : NULL;
+	}
+#else
+	HapticPacket* ReceivePacket(bool debug = true) {
+		// recieve packet from remote device. returns ptr of packet, or NULL if failed.
+		// returned packet is owned by the communicator and valid until the next call.
+		// all pending datagrams are drained and the freshest (highest packet number) is kept.
+		if (LocalPending())
+			return ReceiveLocal();
+		bool has_received = false;
+		uint32_t batch = 0;
+		HapticPacket incoming;
+		while (true) {
+			int bytesIn = recvfrom(socket, rcvbuf, sizeof(rcvbuf), 0, (sockaddr*)sock_addr, &sock_addr_size);
+			if (bytesIn == SOCKET_ERROR || bytesIn <= 0)
 				break;
+			batch++;
+			if (Decode(rcvbuf, bytesIn, incoming)) {
+				received_packet = incoming;
+				has_received = true;
 			}
 		}
-		return received_packet;
+		recv_stats.Record(batch);
+		if (has_received)
+			last_one_way_delay = clock.OneWayDelay(received_packet.GetTimestamp(), Now());
+		return has_received ? &received_packet : NULL;
 	}
+#endif
 
 	bool IsLatestPacket(HapticPacket packet) {
 		// returns if given packet is latest packet received by this communicator.
-		return (last_received_packet == packet.GetPacketNum());
+		return (window.getHighest() == packet.GetPacketNum());
 	}
 
 	uint32_t getReceivedPacketCount() {
-		return packet_receive_counter;
+		// distinct packets received, duplicates and stale ones excluded
+		return (uint32_t)window.getStats().received;
 	}
 
 	uint32_t getLatestPacketCount() {
-		return last_received_packet;
+		return window.getHighest();
+	}
+
+	ts_t getLastOneWayDelay() {
+		// one-way delay of the packet last returned by ReceivePacket, on the local clock (see ClockEstimator)
+		return last_one_way_delay;
+	}
+
+	const ClockStats& getClockStats() {
+		// remote clock offset, skew, RTT and smoothed one-way delay
+		return clock.getStats();
+	}
+
+	const SequenceStats& getSequenceStats() {
+		// duplicates, stale drops, reordering depth
+		return window.getStats();
+	}
+
+	SequenceInterval TakeLossInterval() {
+		// exact loss over the packet numbers settled since the previous call
+		return window.Interval();
+	}
+
+	const BatchStats& getReceiveBatchStats() {
+		return recv_stats;
+	}
+
+	const BatchStats& getSendBatchStats() {
+		return send_stats;
+	}
+
+	const CodecStats& getCodecStats() {
+		return codec.getStats();
+	}
+
+	int TakeRecovered(HapticPacket* out, int max) {
+		// samples rebuilt from bundles and parity since the last call, oldest first
+		return redundancy.TakeRecovered(out, max);
+	}
+
+	const RedundancyStats& getRedundancyStats() {
+		return redundancy.getStats();
+	}
+
+	void SetMetrics(MetricsRegistry* registry, const std::string& labels) {
+		// export receive, loss and timing counters to registry. the thread doing the I/O calls PublishMetrics.
+		metrics.received = registry->Counter("hd_packets_received_total", "Distinct packets received.", labels);
+		metrics.lost = registry->Counter("hd_packets_lost_total", "Packet numbers never received nor recovered.", labels);
+		metrics.duplicates = registry->Counter("hd_packets_duplicate_total", "Duplicate packets dropped.", labels);
+		metrics.reordered = registry->Counter("hd_packets_reordered_total", "Packets arriving behind a newer one.", labels);
+		metrics.recovered = registry->Counter("hd_packets_recovered_total", "Samples rebuilt from redundancy.", labels);
+		metrics.datagrams_sent = registry->Counter("hd_datagrams_sent_total", "Datagrams sent, including parity and timing.", labels);
+		metrics.datagrams_received = registry->Counter("hd_datagrams_received_total", "Datagrams received.", labels);
+		metrics.rtt = registry->Gauge("hd_rtt_seconds", "Smoothed round trip time.", labels);
+		metrics.one_way_delay = registry->Gauge("hd_one_way_delay_seconds", "Smoothed one-way delay of data packets.", labels);
+		metrics.clock_offset = registry->Gauge("hd_clock_offset_seconds", "Remote clock minus local clock.", labels);
+		has_metrics = true;
+	}
+
+	void PublishMetrics(ts_t now) {
+		// copy the counters to the registry, at most every METRICS_PUBLISH_US. same thread as the socket I/O.
+		if (!has_metrics || now - last_metrics_publish < METRICS_PUBLISH_US)
+			return;
+		last_metrics_publish = now;
+		const SequenceStats& seq = window.getStats();
+		const ClockStats& timing = clock.getStats();
+		metrics.received->Set((double)seq.received);
+		metrics.lost->Set((double)window.getLost());
+		metrics.duplicates->Set((double)seq.duplicates);
+		metrics.reordered->Set((double)seq.reordered);
+		metrics.recovered->Set((double)redundancy.getStats().recovered);
+		metrics.datagrams_sent->Set((double)send_stats.datagrams);
+		metrics.datagrams_received->Set((double)recv_stats.datagrams);
+		metrics.rtt->Set(timing.rtt_us * 1e-6);
+		metrics.one_way_delay->Set(timing.one_way_us * 1e-6);
+		metrics.clock_offset->Set(timing.offset_us * 1e-6);
+	}
+
+	uint64_t getLostPacketCount() {
+		// packet numbers never received nor recovered, exact once they leave the sequence window
+		return window.getLost();
 	}
 };
@@ -1,38 +1,93 @@
 #pragma once
 
-#include <list>
-#include <string>
+#include <algorithm>
 #include <sstream>
+#include <string>
 
-#include <HD/hd.h>
-#include <HDU/hduVector.h>
-
+#include "hd_api.h"
+#include "hd_device.h"
 #include "hd_comm.h"
+#include "hd_netthread.h"
 #include "hd_time.h"
 #include "hd_logger.h"
-
-#define PREDICTOR_QUEUE_SIZE 5 // received_queue Size
-#define PREDICTOR_CONSTANT_K -1 // K in Weber's law
-#define FORCE_STRENGTH 0.3
+#include "hd_history.h"
+#include "hd_jitter.h"
+#include "hd_upsampler.h"
+#include "hd_predictor.h"
+#include "hd_deadband.h"
+#include "hd_ratecontrol.h"
+#include "hd_profiler.h"
+#include "hd_deadline.h"
+#include "hd_metrics.h"
+
+#define REMOTE_TIMEOUT_HEARTBEATS 3 // remote is considered gone after this many missed heartbeats
+#define FORCE_STRENGTH 0.3	// default spring constant towards the remote position (N/mm), see SetForceStrength
+
+struct ControllerMetrics {
+	/* registry handles of one controller, see HapticDeviceController::SetMetrics */
+	MetricValue *ticks;
+	MetricValue *overruns;
+	MetricValue *shed_level;
+	MetricValue *packets_sent;
+	MetricValue *send_ratio;
+	MetricValue *send_rate_bound;
+	MetricValue *snd_dropped;
+	MetricValue *rcv_dropped;
+	MetricValue *err_dropped;
+};
 
 class HapticDeviceController {
 private:
 	/* Charge (positive/negative) */
 	const int kCharge = 1;
+	double force_strength;						// spring constant of PosToForce (N/mm)
 
-	HHD device_id;								// haptic device ID
+	HapticDevice *device;						// haptic device backend
+	bool owns_device;							// device was created by this controller
 	char alias;									// alias - 'M' for master, 'S' for slave
 	HDCommunicator *hdcomm;						// HDCommunicator for udp packet exchange
-	std::list<HapticPacket*> received_queue;	// queue used for predictive coding
-	std::list<HapticPacket*> sent_queue;		// queue used for predictive coding
+	HDNetworkThread *netthread;					// if set, owns hdcomm; exchange goes through its mailboxes
+	RemoteState remote_state;					// last sample fetched from netthread
+	JitterBuffer *jitter;						// if set, remote positions are played out through it
+	Upsampler *upsampler;						// if set (and no jitter buffer), remote positions are rendered through it
+	cnt_t lost_count;							// packet numbers lost so far (for loss logging)
+	cnt_t latest_count;							// highest packet number received so far
+	HapticPacket recovered[RECOVERED_QUEUE_SIZE];	// samples recovered by redundancy along with the fetched packet
+	int recovered_count;
+	Predictor *received_predictor;				// extrapolates the remote stream between packets
+	Predictor *sent_predictor;					// mirrors what the remote extrapolates from our packets
+	Predictor *fallback_predictor;				// cheap average predictor, used while SHED_PREDICTOR is shed
+	DeadbandCodec deadband;						// perception based send decision
+	RateController rate;						// motion dependent bound on the send rate
+	DeadlineMonitor deadline;					// tick budget, sheds optional work on overruns
+	RedundancyMode shed_redundancy_mode;		// redundancy to restore after SHED_REDUNDANCY
+	int shed_redundancy_level;
 	Logger *errlogger;
-	Logger *rcvlogger;
-	Logger *sndlogger;
+	RCVLogger *rcvlogger;
+	SNDLogger *sndlogger;
+#ifdef HD_PROFILE
+	StageProfiler profiler;						// per-stage tick timing, see PROFILE_SCOPE
+#endif
+	LatencyHistogram tick_us;					// whole tick duration, always recorded
+	LatencyHistogram prediction_error_um;		// predicted vs received remote position, at packet arrival
+	bool deferred_send;							// hold the tick's packet until FlushSend (SetDeferredSend)
+	bool has_deferred;
+	HapticPacket deferred_packet;
+	ControllerMetrics metrics;					// exported counters, if has_metrics (SetMetrics)
+	bool has_metrics;
+	ts_t last_metrics_publish;
 
 	cnt_t current_packet_num;
 
 	ts_t last_received_timestamp;
-	float pos_delta;							// last movement difference, used for perception based coding
+	ts_t last_received_arrival;					// local time the last packet arrived
+	ts_t last_observed_timestamp;				// newest remote timestamp given to received_predictor
+	hduVector3Dd rendered_target;				// remote position the last UpdateState pulled the device towards
+	const ts_t *time_source;					// per-instance clock, see SetTimeSource
+
+	ts_t Now() const {
+		return time_source ? *time_source : getCurrentTime();
+	}
 
 	hduVector3Dd PosToForce(const hduVector3Dd pos)
 	{
@@ -41,159 +96,442 @@ private:
 		hduVector3Dd force_vec(0, 0, 0);
 
 		// Attract the kCharge to the center of the sphere.
-		force_vec = -1 * FORCE_STRENGTH * pos;
+		force_vec = -1 * force_strength * pos;
 		force_vec *= kCharge;
 
 		return force_vec;
 	}
 
-	HapticPacket* PreparePacket() {
-		/* create packet from current device state. */
+	void PreparePacket(HapticPacket &packet) {
+		/* fill packet from current device state. */
 
 		// get current device position
 		hduVector3Dd pos;
-		hdGetDoublev(HD_CURRENT_POSITION, pos);
+		device->GetPosition(pos);
 
-		HapticPacket *sending_packet = new HapticPacket(pos, current_packet_num, last_received_timestamp);
-		return sending_packet;
+		// stamp with the send time; the receiver schedules playout against it
+		packet.UpdatePacket(pos, current_packet_num, Now());
 	}
 
-	hduVector3Dd PredictPos(const hduVector3Dd base_pos, std::list<HapticPacket*>& queue) {
-		std::list<HapticPacket*>::iterator iter;
-		hduVector3Dd prev(0, 0, 0);
-		if (queue.size() > 1)
-			prev = queue.front()->GetPos();
-		else
-			return base_pos;
-
-		hduVector3Dd acc(0, 0, 0);
+	HapticPacket* FetchPacket(bool debug) {
+		/* latest packet from remote, or NULL. never makes a syscall in network thread mode. */
+		if (netthread == NULL) {
+			HapticPacket* packet = hdcomm->ReceivePacket(debug);
+			lost_count = (cnt_t)hdcomm->getLostPacketCount();
+			latest_count = hdcomm->getLatestPacketCount();
+			recovered_count = packet ? hdcomm->TakeRecovered(recovered, RECOVERED_QUEUE_SIZE) : 0;
+			return packet;
+		}
+		if (!netthread->FetchRemote(remote_state))
+			return NULL;
+		lost_count = remote_state.lost_count;
+		latest_count = remote_state.latest_count;
+		recovered_count = remote_state.recovered_count;
+		std::copy(remote_state.recovered, remote_state.recovered + recovered_count, recovered);
+		return &remote_state.packet;
+	}
 
-		for (iter = ++queue.begin(); iter != queue.end(); ++iter) {
-			// calculate vector slope
-			acc += ((**iter).GetPos() - prev);
-			prev = (**iter).GetPos();
+	void ObserveRemote(HapticPacket &packet) {
+		/* feed a received or recovered remote sample to the predictor and the jitter buffer */
+		if (packet.GetTimestamp() > last_observed_timestamp) {
+			// predictors take samples in time order; a recovered one older than that is history only
+			if (!deadline.Sheds(SHED_PREDICTOR))
+				received_predictor->Observe(packet.GetPos(), packet.GetTimestamp());
+			fallback_predictor->Observe(packet.GetPos(), packet.GetTimestamp());
+			last_observed_timestamp = packet.GetTimestamp();
 		}
+		if (jitter)
+			jitter->Insert(packet.GetPacketNum(), packet.GetTimestamp(), packet.GetPos(), last_received_arrival);
+		else if (upsampler)
+			upsampler->Observe(packet.GetPos(), packet.GetTimestamp(), last_received_arrival);
+	}
 
-		acc /= queue.size() - 1;
-		acc += base_pos;
+	bool PredictRemote(ts_t ts, hduVector3Dd &out) {
+		/* remote position at remote time ts. the average predictor stands in while the configured one is shed or warming up. */
+		if (!deadline.Sheds(SHED_PREDICTOR) && received_predictor->Predict(ts, out))
+			return true;
+		return fallback_predictor->Predict(ts, out);
+	}
 
-		return acc;
+	void Shed(ShedLevel from, ShedLevel to) {
+		/* apply a deadline monitor level change */
+		if (from < SHED_REDUNDANCY && to >= SHED_REDUNDANCY && netthread == NULL) {
+			// with a network thread the communicator belongs to it, redundancy stays as configured
+			shed_redundancy_mode = hdcomm->getRedundancyMode();
+			shed_redundancy_level = hdcomm->getRedundancyLevel();
+			hdcomm->SetRedundancy(REDUNDANCY_OFF, 0);
+		}
+		else if (from >= SHED_REDUNDANCY && to < SHED_REDUNDANCY && netthread == NULL) {
+			hdcomm->SetRedundancy(shed_redundancy_mode, shed_redundancy_level);
+		}
+		if (from >= SHED_PREDICTOR && to < SHED_PREDICTOR) {
+			// it missed samples while shed: start over, PredictRemote bridges the warm-up
+			received_predictor->Reset();
+		}
+		std::ostringstream msg;
+		msg << "Deadline: shed level " << SHED_LEVEL_NAMES[from] << " -> " << SHED_LEVEL_NAMES[to];
+		errlogger->log(msg.str());
+	}
+
+	bool PostPacket(HapticPacket* packet, bool debug) {
+		/* send packet to remote. in network thread mode it is queued and sent asynchronously (false if
+		   the queue is full), with deferred send it is held for FlushSend. */
+		if (netthread)
+			return netthread->PostLocal(*packet);
+		if (deferred_send) {
+			deferred_packet = *packet;
+			has_deferred = true;
+			return true;
+		}
+		return hdcomm->SendPacket(packet, debug);
 	}
 
 	void UpdateState(bool debug=true) {
 		// recieve packet from remote, and update current device's state with the packet
-		HapticPacket* packet = hdcomm->ReceivePacket(debug);
+		HapticPacket* packet;	// owned by hdcomm/controller, valid until next fetch
+		{
+			PROFILE_SCOPE(profiler, PROFILE_RECEIVE);
+			packet = FetchPacket(debug);
+		}
 		hduVector3Dd target_pos(0, 0, 0);
 		hduVector3Dd current_pos;
-		hdGetDoublev(HD_CURRENT_POSITION, current_pos);
-
-		printf("Running\n");
+		device->GetPosition(current_pos);
+
+		ts_t now = Now();
+		{
+			PROFILE_SCOPE(profiler, PROFILE_PREDICT);
+			if (packet) {
+				last_received_arrival = netthread ? remote_state.receive_time : now;
+				hduVector3Dd predicted;
+				if (has_metrics && PredictRemote(packet->GetTimestamp(), predicted))
+					prediction_error_um.Record((uint64_t)((predicted - packet->GetPos()).magnitude() * 1000));
+				for (int i = 0; i < recovered_count; i++)
+					ObserveRemote(recovered[i]);
+				ObserveRemote(*packet);
+			}
 
-		if (packet == NULL) {
-			// No received pos
-			hduVector3Dd base_pos = received_queue.size()? received_queue.back()->GetPos() : current_pos;
-			target_pos = PredictPos(base_pos, received_queue);
+			if (jitter) {
+				hduVector3Dd played;
+				JitterPlayout playout = jitter->Playout(now, played);
+				if (playout == JITTER_INTERPOLATED)
+					target_pos = played;
+				else if (playout == JITTER_UNDERRUN && !PredictRemote(jitter->PlayoutTimestamp(), target_pos))
+					target_pos = played;
+				else if (playout == JITTER_EMPTY)
+					target_pos = current_pos;	// nothing received yet: no force
+			}
 
-			std::stringstream msg_stream;
+			else if (upsampler) {
+				if (!upsampler->Render(now, target_pos))
+					target_pos = current_pos;	// nothing received yet: no force
+			}
 
-			// Predict? , PacketTime, Delay, PacketNo, PosX, PosY, PosZ, Loss
-			msg_stream << 1 << ",,,," << target_pos[0] << "," << target_pos[1] << "," << target_pos[2] << ",";
-			rcvlogger->log(msg_stream.str());
+			if (packet == NULL) {
+				// No received pos: extrapolate to the sender time elapsed since the last packet
+				if (jitter == NULL && upsampler == NULL &&
+					!PredictRemote(last_received_timestamp + (now - last_received_arrival), target_pos))
+					target_pos = current_pos;
+			}
+			else {
+				if (jitter == NULL && upsampler == NULL)
+					target_pos = packet->GetPos();
+				last_received_timestamp = packet->GetTimestamp();
+			}
 		}
-		else {
-			target_pos = packet->GetPos();
-			last_received_timestamp = packet->GetTimestamp();
-
-			std::stringstream msg_stream;
 
-			// Predict? , PacketTime, Delay, PacketNo, PosX, PosY, PosZ, Loss
-			msg_stream << 0 << "," <<
-					      packet->GetTimestamp() << "," <<
-				          getCurrentTime() - packet->GetTimestamp() << "," <<
-				          packet->GetPacketNum() << "," <<
-				          target_pos[0] << "," << target_pos[1] << "," << target_pos[2] << "," << 
-				          hdcomm->getLatestPacketCount() - hdcomm->getReceivedPacketCount() << "/" << hdcomm->getLatestPacketCount();
-			rcvlogger->log(msg_stream.str());
+		{
+			PROFILE_SCOPE(profiler, PROFILE_LOG);
+			if (packet == NULL) {
+				if (!deadline.Sheds(SHED_VERBOSE_LOG))
+					rcvlogger->logPredicted(target_pos);
+			}
+			else if (!deadline.Sheds(SHED_ALL_LOG)) {
+				// the packet was stamped on the remote clock: the communicator maps it to ours
+				ts_t delay = netthread ? remote_state.one_way_delay : hdcomm->getLastOneWayDelay();
+				rcvlogger->logReceived(packet->GetTimestamp(),
+									   delay,
+									   packet->GetPacketNum(),
+									   target_pos,
+									   lost_count,
+									   latest_count);
+			}
 		}
 
+		PROFILE_SCOPE(profiler, PROFILE_FORCE);
+		rendered_target = target_pos;
 		hduVector3Dd posDiff = current_pos - target_pos;
 		hduVector3Dd force_vec = PosToForce(posDiff);
-		hdSetDoublev(HD_CURRENT_FORCE, force_vec);
-
-		if (packet) {
-			hduVector3Dd prevPos(0, 0, 0);
-			if (received_queue.size() > 0)
-				prevPos = (*received_queue.back()).GetPos();
-			pos_delta = ((*packet).GetPos() - prevPos).magnitude();
-			received_queue.push_back(packet);
-			if (received_queue.size() > PREDICTOR_QUEUE_SIZE) {
-				delete received_queue.front();
-				received_queue.pop_front();
-			}
-		}
+		device->SetForce(force_vec);
 	}
 
 	void SendState(bool debug = true) {
-		// predictive, perception-based packet sending
-		HapticPacket* packet = PreparePacket();
-		hduVector3Dd real_pos = packet->GetPos();
-		hduVector3Dd prev_pos;
-
-		// predictive packet sending
-		if (sent_queue.back())
-			prev_pos = sent_queue.back()->GetPos();
-		else
-			prev_pos = hduVector3Dd(0, 0, 0);
-
-		// perception-based packet sending
-		if (!IsPerceptable(PredictPos(prev_pos, sent_queue), real_pos)) {
-			if (debug) {
-				sndlogger->log("1,");
+		// predictive, perception-based packet sending at a velocity-adaptive rate
+		HapticPacket packet;
+		PreparePacket(packet);
+		hduVector3Dd real_pos = packet.GetPos();
+		ts_t now = packet.GetTimestamp();
+
+		DeadbandDecision decision;
+		{
+			PROFILE_SCOPE(profiler, PROFILE_PREDICT);
+
+			// predictive packet sending: what the remote extrapolates from what we sent so far
+			hduVector3Dd pred_pos(0, 0, 0);
+			bool has_prediction = sent_predictor->Predict(now, pred_pos);
+
+			// perception-based packet sending
+			decision = deadband.Decide(real_pos, has_prediction, pred_pos, now);
+
+			// no faster than the hand's motion calls for; the deadband asks again next tick
+			rate.Track(real_pos, now);
+			if (decision == DEADBAND_SEND && !rate.Due(now)) {
+				rate.OnHeld();
+				decision = DEADBAND_SKIP;
+			}
+		}
+		if (decision == DEADBAND_SKIP) {
+			if (debug && !deadline.Sheds(SHED_VERBOSE_LOG)) {
+				PROFILE_SCOPE(profiler, PROFILE_LOG);
+				sndlogger->logSkipped();
 			}
 		}
 		else {
-			if (hdcomm->SendPacket(packet, debug)) {
-				current_packet_num++;
-
-				std::stringstream msg_stream;
-				hduVector3Dd &packet_pos = packet->GetPos();
-
-				// Predict? , PacketTime, PacketNo, PosX, PosY, PosZ
-				msg_stream << "," << 0 << "," << packet->GetTimestamp() << "," << packet->GetPacketNum() << "," <<
-					packet_pos[0] << "," << packet_pos[1] << "," << packet_pos[2];
-
-				sndlogger->log(msg_stream.str());
+			bool posted;
+			{
+				PROFILE_SCOPE(profiler, PROFILE_SEND);
+				posted = PostPacket(&packet, debug);
 			}
-			sent_queue.push_back(packet);
-			if (sent_queue.size() > PREDICTOR_QUEUE_SIZE) {
-				delete sent_queue.front();
-				sent_queue.pop_front();
+			if (posted) {
+				current_packet_num++;
+				deadband.OnSent(decision, now);
+				rate.OnSent(now);
+				PROFILE_SCOPE(profiler, PROFILE_LOG);
+				if (!deadline.Sheds(SHED_ALL_LOG))
+					sndlogger->logSent(packet.GetTimestamp(), packet.GetPacketNum(), real_pos);
 			}
+			PROFILE_SCOPE(profiler, PROFILE_PREDICT);
+			sent_predictor->Observe(real_pos, packet.GetTimestamp());
 		}
 	}
 
-	bool IsPerceptable(const hduVector3Dd pred_pos, const hduVector3Dd real_pos) {
-		float i = (pred_pos - real_pos).magnitude();
-		float delta_i = PREDICTOR_CONSTANT_K * (pos_delta + 0.0001);
-		return i >= delta_i;
+	void PublishMetrics(ts_t now) {
+		/* copy the counters to the registry, at most every METRICS_PUBLISH_US */
+		if (now - last_metrics_publish < METRICS_PUBLISH_US)
+			return;
+		last_metrics_publish = now;
+		const DeadlineStats &ds = deadline.getStats();
+		metrics.ticks->Set((double)ds.ticks);
+		metrics.overruns->Set((double)ds.overruns);
+		metrics.shed_level->Set(deadline.getLevel());
+		metrics.packets_sent->Set((double)(current_packet_num - 1));
+		metrics.send_ratio->Set(deadband.getStats().SendRatio());
+		metrics.send_rate_bound->Set(rate.getRateHz());
+		metrics.snd_dropped->Set((double)sndlogger->getDroppedCount());
+		metrics.rcv_dropped->Set((double)rcvlogger->getDroppedCount());
+		metrics.err_dropped->Set((double)errlogger->getDroppedCount());
+		if (netthread == NULL)
+			hdcomm->PublishMetrics(now);	// otherwise the network thread publishes them
+	}
+
+	void Init() {
+		time_source = NULL;
+		last_received_timestamp = getCurrentTime();
+		last_received_arrival = last_received_timestamp;
+		received_predictor = CreatePredictor(PREDICTOR_AVERAGE);
+		sent_predictor = CreatePredictor(PREDICTOR_AVERAGE);
+		fallback_predictor = CreatePredictor(PREDICTOR_AVERAGE);
+		shed_redundancy_mode = REDUNDANCY_OFF;
+		shed_redundancy_level = 0;
+		current_packet_num = 1;
+		force_strength = FORCE_STRENGTH;
+		lost_count = 0;
+		recovered_count = 0;
+		last_observed_timestamp = 0;
+		rendered_target = hduVector3Dd(0, 0, 0);
+		latest_count = 0;
+		has_metrics = false;
+		last_metrics_publish = 0;
+		deferred_send = false;
+		has_deferred = false;
 	}
 
 public:
+#ifndef HD_SIMULATION
 	HapticDeviceController(const HHD device_id, const char alias, HDCommunicator* hdcomm,
-						   Logger* sndlogger, Logger* rcvlogger, Logger* errlogger) :
-						   device_id(device_id), alias(alias), hdcomm(hdcomm),
+						   SNDLogger* sndlogger, RCVLogger* rcvlogger, Logger* errlogger) :
+						   device(new OpenHapticsDevice(device_id)), owns_device(true),
+						   alias(alias), hdcomm(hdcomm), netthread(NULL), jitter(NULL), upsampler(NULL),
 						   sndlogger(sndlogger), rcvlogger(rcvlogger), errlogger(errlogger){
-		pos_delta = 0;
-		std::string alias_str("");
-		alias_str.push_back(alias);
-		last_received_timestamp = getCurrentTime();
-		current_packet_num = 1;
+		Init();
+	}
+#endif
+
+	HapticDeviceController(HapticDevice* device, const char alias, HDCommunicator* hdcomm,
+						   SNDLogger* sndlogger, RCVLogger* rcvlogger, Logger* errlogger) :
+						   device(device), owns_device(false),
+						   alias(alias), hdcomm(hdcomm), netthread(NULL), jitter(NULL), upsampler(NULL),
+						   sndlogger(sndlogger), rcvlogger(rcvlogger), errlogger(errlogger){
+		Init();
+	}
+
+	~HapticDeviceController() {
+#ifdef HD_PROFILE
+		DumpProfile(stdout);
+#endif
+		if (owns_device)
+			delete device;
+		delete received_predictor;
+		delete sent_predictor;
+		delete fallback_predictor;
+	}
+
+	void SetNetworkThread(HDNetworkThread* thread) {
+		/* route packet exchange through a network thread (NULL: inline socket I/O in tick) */
+		netthread = thread;
+	}
+
+	void SetDeferredSend(bool on) {
+		/* keep the packet a tick decides to send until FlushSend, e.g. to send only after every
+		   device of a session has its force (SessionManager). no effect in network thread mode. */
+		deferred_send = on;
+	}
+
+	bool FlushSend(bool debug = true) {
+		/* send the packet held back by the last tick, if any. false if the send failed. */
+		if (!has_deferred)
+			return true;
+		has_deferred = false;
+		return hdcomm->SendPacket(&deferred_packet, debug);
+	}
+
+	void SetTimeSource(const ts_t* now) {
+		/* read the time from *now instead of getCurrentTime, here and in the communicator, so simulated
+		   controllers each run on their own clock (hd_sweep.h). NULL: real clock. call before the first tick. */
+		time_source = now;
+		hdcomm->SetTimeSource(now);
+		last_received_timestamp = Now();
+		last_received_arrival = last_received_timestamp;
+	}
+
+	void SetPredictors(PredictorType received, PredictorType sent, int history = PREDICTOR_QUEUE_SIZE) {
+		/* extrapolation used between received packets and for the send decision. call before the first tick. */
+		delete received_predictor;
+		delete sent_predictor;
+		received_predictor = CreatePredictor(received, history);
+		sent_predictor = CreatePredictor(sent, history);
+	}
+
+	void SetForceStrength(double strength) {
+		/* spring constant pulling the device towards the remote position (N/mm) */
+		force_strength = strength;
+	}
+
+	void SetDeadband(const DeadbandConfig& config) {
+		/* perceptual deadband for sending; config.enabled = false streams every tick */
+		deadband.Configure(config);
+	}
+
+	const DeadbandStats& getDeadbandStats() const {
+		return deadband.getStats();
+	}
+
+	cnt_t getSentPacketCount() const {
+		return current_packet_num - 1;
+	}
+
+	const hduVector3Dd& getRenderedTarget() const {
+		/* remote position the device was last pulled towards (received, predicted or played out) */
+		return rendered_target;
+	}
+
+	void SetRateControl(const RateControlConfig& config) {
+		/* bound the send rate by the hand's speed and acceleration; config.enabled = false leaves it to the deadband */
+		rate.Configure(config);
+	}
+
+	const RateStats& getRateStats() const {
+		/* time, ticks and packets per rate band */
+		return rate.getStats();
+	}
+
+	double getSendRateBound() const {
+		/* current send rate bound (Hz), 0 without rate control */
+		return rate.getRateHz();
+	}
+
+	ts_t getRemoteSilenceUs() const {
+		/* time since the last packet from remote arrived */
+		return Now() - last_received_arrival;
+	}
+
+	bool IsRemoteStale() const {
+		/* remote missed several heartbeats: link loss or peer gone, not deadband silence */
+		double heartbeat_ms = deadband.getConfig().heartbeat_ms;
+		return heartbeat_ms > 0 && getRemoteSilenceUs() > (ts_t)(REMOTE_TIMEOUT_HEARTBEATS * heartbeat_ms * 1000);
+	}
+
+	void SetJitterBuffer(JitterBuffer* buffer) {
+		/* play remote positions out through a jitter buffer (NULL: apply the freshest packet immediately) */
+		jitter = buffer;
+	}
+
+	void SetUpsampler(Upsampler* reconstruction) {
+		/* render remote positions through a smoothing upsampler, for senders below the servo rate
+		   (NULL: freshest packet, predictor in between). a jitter buffer takes precedence. */
+		upsampler = reconstruction;
+	}
+
+	void SetDeadline(ts_t budget_us) {
+		/* tick duration budget for load shedding (0: never shed) */
+		deadline.SetBudget(budget_us);
+	}
+
+	const DeadlineStats& getDeadlineStats() const {
+		/* overruns, shed/restore steps and ticks spent at each shed level */
+		return deadline.getStats();
+	}
+
+	ShedLevel getShedLevel() const {
+		return deadline.getLevel();
+	}
+
+	void SetMetrics(MetricsRegistry* registry, const std::string& session) {
+		/* export tick timing, shedding, send and prediction counters (and those of the communicator)
+		   to registry, labelled with session and the alias. call before the first tick. */
+		std::string labels = MetricLabels(session, alias);
+		metrics.ticks = registry->Counter("hd_ticks_total", "Servo ticks.", labels);
+		metrics.overruns = registry->Counter("hd_tick_overruns_total", "Ticks over the deadline budget.", labels);
+		metrics.shed_level = registry->Gauge("hd_shed_level", "Deadline monitor shed level (0: nothing shed).", labels);
+		registry->Summary("hd_tick_seconds", "Servo tick duration.", labels, &tick_us, 1e-6);
+		metrics.packets_sent = registry->Counter("hd_packets_sent_total", "Packets sent after the deadband decision.", labels);
+		metrics.send_ratio = registry->Gauge("hd_send_ratio", "Fraction of ticks that sent a packet.", labels);
+		metrics.send_rate_bound = registry->Gauge("hd_send_rate_bound_hz", "Velocity-adaptive bound on the send rate (0: none).", labels);
+		registry->Summary("hd_prediction_error_millimeters", "Distance of the predicted remote position to the received one.",
+						  labels, &prediction_error_um, 1e-3);
+		metrics.snd_dropped = registry->Counter("hd_logger_dropped_total", "Log records dropped on a full ring.", labels + ",logger=\"snd\"");
+		metrics.rcv_dropped = registry->Counter("hd_logger_dropped_total", "Log records dropped on a full ring.", labels + ",logger=\"rcv\"");
+		metrics.err_dropped = registry->Counter("hd_logger_dropped_total", "Log records dropped on a full ring.", labels + ",logger=\"err\"");
+		hdcomm->SetMetrics(registry, labels);
+		has_metrics = true;
+	}
+
+	void DumpProfile(FILE* out) {
+		/* per-stage tick timing so far (p50/p99/p99.9/max). builds without HD_PROFILE have nothing to dump. */
+#ifdef HD_PROFILE
+		char title[64];
+		snprintf(title, sizeof(title), "profile %c", alias);
+		profiler.Dump(out, title);
+#endif
 	}
 
 	void tick() {
-		hdBeginFrame(device_id);
-		hdMakeCurrentDevice(device_id);
-		
+		ts_t tick_start = Now();
+		PROFILE_SCOPE(profiler, PROFILE_TICK);
+		{
+			PROFILE_SCOPE(profiler, PROFILE_BEGIN_FRAME);
+			device->BeginFrame();
+		}
+
 		if (alias == 'M') {
 			SendState();
 			UpdateState(true);
@@ -206,6 +544,17 @@ public:
 			errlogger->log("Err: Alias should be either M or S\n");
 			exit(-1);
 		}
-		hdEndFrame(device_id);
+		{
+			PROFILE_SCOPE(profiler, PROFILE_END_FRAME);
+			device->EndFrame();
+		}
+
+		ts_t tick_end = Now();
+		tick_us.Record(tick_end - tick_start);
+		ShedLevel level = deadline.getLevel();
+		if (deadline.EndTick(tick_end - tick_start))
+			Shed(level, deadline.getLevel());
+		if (has_metrics)
+			PublishMetrics(tick_end);
 	}
 };
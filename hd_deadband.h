@@ -0,0 +1,162 @@
+#pragma once
+
+#include <string>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hd_api.h"
+#include "hd_types.h"
+
+#define DEADBAND_K 0.1					// Weber fraction applied to the motion over the reference window
+#define DEADBAND_FLOOR_MM 0.3			// threshold at rest (mm)
+#define DEADBAND_REFERENCE_MS 50		// velocity scaling: motion over this window is the Weber stimulus
+#define DEADBAND_HEARTBEAT_MS 100		// send at least this often, even when nothing changed
+#define DEADBAND_VELOCITY_SMOOTHING 0.1	// EWMA weight of a new per-tick velocity sample
+
+enum DeadbandMode {
+	DEADBAND_MAGNITUDE,		// compare the euclidean prediction error with one threshold
+	DEADBAND_PER_AXIS		// compare every axis with its own threshold
+};
+
+enum DeadbandDecision {
+	DEADBAND_SKIP,			// receiver's prediction is within the threshold
+	DEADBAND_SEND,			// threshold exceeded
+	DEADBAND_HEARTBEAT		// within threshold, but silent for too long
+};
+
+struct DeadbandConfig {
+	/* threshold = floor_mm + k * (speed * reference_ms), per axis or on the magnitude */
+	DeadbandMode mode;
+	double k;
+	double floor_mm;
+	double reference_ms;		// 0: fixed threshold of floor_mm
+	double heartbeat_ms;		// 0: no heartbeat
+	bool enabled;				// false: send every tick
+
+	DeadbandConfig() : mode(DEADBAND_MAGNITUDE), k(DEADBAND_K), floor_mm(DEADBAND_FLOOR_MM),
+		reference_ms(DEADBAND_REFERENCE_MS), heartbeat_ms(DEADBAND_HEARTBEAT_MS), enabled(true) {}
+
+	bool Set(const std::string &key, double value) {
+		/* set a field by name (key=value on the command line). returns false for unknown keys. */
+		if (key == "k") k = value;
+		else if (key == "floor") floor_mm = value;
+		else if (key == "ref") reference_ms = value;
+		else if (key == "heartbeat") heartbeat_ms = value;
+		else if (key == "axis") mode = value != 0 ? DEADBAND_PER_AXIS : DEADBAND_MAGNITUDE;
+		else if (key == "on") enabled = value != 0;
+		else return false;
+		return true;
+	}
+};
+
+struct DeadbandStats {
+	uint64_t ticks;
+	uint64_t sent;				// threshold exceeded (including the first sample)
+	uint64_t heartbeats;
+	double error_sum;			// receiver reconstruction error vs the full-rate signal, every tick (mm)
+	double error_max;
+
+	DeadbandStats() {
+		memset(this, 0, sizeof(DeadbandStats));
+	}
+
+	double SendRatio() const {
+		return ticks ? (double)(sent + heartbeats) / ticks : 0;
+	}
+
+	double Reduction() const {
+		/* fraction of the full-rate stream that was not sent */
+		return ticks ? 1 - SendRatio() : 0;
+	}
+
+	double MeanError() const {
+		return ticks ? error_sum / ticks : 0;
+	}
+};
+
+class DeadbandCodec {
+	/* Perceptual deadband on the send side. The sender runs the same
+	   predictor as the receiver and only transmits when the receiver's
+	   extrapolation would be off by more than a just-noticeable
+	   difference, which grows with the speed of motion (Weber's law). */
+private:
+	DeadbandConfig cfg;
+	DeadbandStats stats;
+	hduVector3Dd last_pos;
+	double velocity[3];			// smoothed local velocity (mm/s)
+	ts_t last_ts;
+	ts_t last_sent;
+	bool started;
+
+	void Track(const hduVector3Dd &pos, ts_t now) {
+		if (started && now > last_ts) {
+			double dt = (now - last_ts) * 1e-6;
+			for (int i = 0; i < 3; i++)
+				velocity[i] += DEADBAND_VELOCITY_SMOOTHING * ((pos[i] - last_pos[i]) / dt - velocity[i]);
+		}
+		last_pos = pos;
+		last_ts = now;
+	}
+
+	bool Exceeds(const hduVector3Dd &error) const {
+		double window = cfg.reference_ms * 1e-3;
+		if (cfg.mode == DEADBAND_PER_AXIS) {
+			for (int i = 0; i < 3; i++) {
+				if (fabs(error[i]) > cfg.floor_mm + cfg.k * fabs(velocity[i]) * window)
+					return true;
+			}
+			return false;
+		}
+		double speed = sqrt(velocity[0] * velocity[0] + velocity[1] * velocity[1] + velocity[2] * velocity[2]);
+		return error.magnitude() > cfg.floor_mm + cfg.k * speed * window;
+	}
+
+public:
+	DeadbandCodec(const DeadbandConfig &cfg = DeadbandConfig()) : cfg(cfg), last_ts(0), last_sent(0), started(false) {
+		memset(velocity, 0, sizeof(velocity));
+	}
+
+	void Configure(const DeadbandConfig &config) {
+		cfg = config;
+	}
+
+	const DeadbandConfig& getConfig() const {
+		return cfg;
+	}
+
+	DeadbandDecision Decide(const hduVector3Dd &real_pos, bool has_prediction, const hduVector3Dd &pred_pos, ts_t now) {
+		/* whether the sample at now has to be sent. has_prediction is false before the first send. */
+		Track(real_pos, now);
+		started = true;
+		stats.ticks++;
+
+		DeadbandDecision decision = DEADBAND_SKIP;
+		double error = has_prediction ? (pred_pos - real_pos).magnitude() : 0;
+		if (!cfg.enabled || !has_prediction || Exceeds(pred_pos - real_pos))
+			decision = DEADBAND_SEND;
+		else if (cfg.heartbeat_ms > 0 && now - last_sent >= (ts_t)(cfg.heartbeat_ms * 1000))
+			decision = DEADBAND_HEARTBEAT;
+
+		if (decision == DEADBAND_SKIP) {
+			stats.error_sum += error;
+			if (error > stats.error_max)
+				stats.error_max = error;
+		}
+		return decision;
+	}
+
+	void OnSent(DeadbandDecision decision, ts_t now) {
+		/* account a sample that actually went out */
+		if (decision == DEADBAND_HEARTBEAT)
+			stats.heartbeats++;
+		else
+			stats.sent++;
+		last_sent = now;
+	}
+
+	const DeadbandStats& getStats() const {
+		return stats;
+	}
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hd_types.h"
+
+#define DEADLINE_BUDGET_US 500			// tick duration budget, half of the 1 kHz servo period
+#define DEADLINE_WINDOW_TICKS 100		// overruns are counted over windows of this many ticks
+#define DEADLINE_SHED_OVERRUNS 2		// overruns within one window that shed one more level
+#define DEADLINE_RESTORE_TICKS 2000		// ticks without overrun before one level is restored...
+#define DEADLINE_HEADROOM 0.5			// ...if at most 1% of them took more than this fraction of the budget
+
+enum ShedLevel {
+	SHED_NONE,
+	SHED_VERBOSE_LOG,		// no skipped/predicted log records
+	SHED_REDUNDANCY,		// no redundant or parity datagrams
+	SHED_PREDICTOR,			// received stream extrapolated by the cheap average predictor
+	SHED_ALL_LOG,			// no packet log records at all
+	SHED_LEVEL_COUNT
+};
+
+static const char* const SHED_LEVEL_NAMES[SHED_LEVEL_COUNT] = {
+	"none", "verbose_log", "redundancy", "predictor", "all_log"
+};
+
+struct DeadlineStats {
+	uint64_t ticks;
+	uint64_t overruns;				// ticks over the budget
+	ts_t max_tick_us;
+	uint64_t sheds;					// level increases
+	uint64_t restores;				// level decreases
+	uint64_t ticks_at_level[SHED_LEVEL_COUNT];
+
+	DeadlineStats() {
+		memset(this, 0, sizeof(DeadlineStats));
+	}
+};
+
+class DeadlineMonitor {
+	/* Tick duration against a budget. Repeated overruns shed optional work
+	   one level at a time (at most one level per window); a long run of
+	   ticks without overrun, nearly all well under budget, restores one
+	   level. A single slow tick never sheds anything, a sustained overload
+	   sheds everything optional in a few hundred milliseconds. */
+private:
+	ts_t budget_us;
+	ShedLevel level;
+	uint32_t window_ticks;
+	uint32_t window_overruns;
+	uint32_t calm_ticks;		// since the last overrun or level change
+	uint32_t busy_ticks;		// of those, ticks without headroom
+	DeadlineStats stats;
+
+public:
+	DeadlineMonitor(ts_t budget_us = DEADLINE_BUDGET_US) :
+		budget_us(budget_us), level(SHED_NONE), window_ticks(0), window_overruns(0), calm_ticks(0), busy_ticks(0) {}
+
+	void SetBudget(ts_t budget) {
+		/* 0 disables the monitor (never sheds) */
+		budget_us = budget;
+	}
+
+	bool EndTick(ts_t duration_us) {
+		/* account one tick. returns true if the shed level changed. */
+		stats.ticks++;
+		stats.ticks_at_level[level]++;
+		if (duration_us > stats.max_tick_us)
+			stats.max_tick_us = duration_us;
+		if (budget_us <= 0)
+			return false;
+
+		if (duration_us > budget_us) {
+			stats.overruns++;
+			window_overruns++;
+			calm_ticks = 0;
+			busy_ticks = 0;
+		}
+		else {
+			calm_ticks++;
+			if (duration_us > budget_us * DEADLINE_HEADROOM)
+				busy_ticks++;
+		}
+
+		if (window_overruns >= DEADLINE_SHED_OVERRUNS && level < SHED_LEVEL_COUNT - 1) {
+			level = (ShedLevel)(level + 1);
+			stats.sheds++;
+			window_ticks = 0;
+			window_overruns = 0;
+			calm_ticks = 0;
+			busy_ticks = 0;
+			return true;
+		}
+		if (++window_ticks >= DEADLINE_WINDOW_TICKS) {
+			window_ticks = 0;
+			window_overruns = 0;
+		}
+		if (calm_ticks >= DEADLINE_RESTORE_TICKS && level > SHED_NONE) {
+			bool headroom = busy_ticks <= calm_ticks / 100;
+			calm_ticks = 0;
+			busy_ticks = 0;
+			if (headroom) {
+				level = (ShedLevel)(level - 1);
+				stats.restores++;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool Sheds(ShedLevel work) const {
+		/* work at this level is currently shed */
+		return level >= work;
+	}
+
+	ShedLevel getLevel() const {
+		return level;
+	}
+
+	const DeadlineStats& getStats() const {
+		return stats;
+	}
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "hd_api.h"
+
+class HapticDevice {
+	/* Device backend used by HapticDeviceController. All calls are made from
+	   the servo callback, between BeginFrame and EndFrame. */
+public:
+	virtual ~HapticDevice() {}
+
+	virtual void BeginFrame() = 0;
+	virtual void EndFrame() = 0;
+	virtual void MakeCurrent() {}		// select this device for the next Get/Set when several share the servo thread
+	virtual void GetPosition(hduVector3Dd &pos) = 0;
+	virtual void SetForce(const hduVector3Dd &force) = 0;
+};
+
+#ifndef HD_SIMULATION
+class OpenHapticsDevice : public HapticDevice {
+	/* Geomagic Touch through HDAPI. */
+private:
+	HHD device_id;
+
+public:
+	OpenHapticsDevice(const HHD device_id) : device_id(device_id) {}
+
+	void BeginFrame() {
+		hdBeginFrame(device_id);
+		hdMakeCurrentDevice(device_id);
+	}
+
+	void MakeCurrent() {
+		hdMakeCurrentDevice(device_id);
+	}
+
+	void EndFrame() {
+		hdEndFrame(device_id);
+	}
+
+	void GetPosition(hduVector3Dd &pos) {
+		hdGetDoublev(HD_CURRENT_POSITION, pos);
+	}
+
+	void SetForce(const hduVector3Dd &force) {
+		hdSetDoublev(HD_CURRENT_FORCE, force);
+	}
+};
+#endif
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "hd_api.h"
+
+#include "hd_types.h"
+
+template <size_t N>
+class PositionHistory {
+	/* Ring of the last `length` positions and their timestamps, length at
+	   most N (fixed at construction). Struct-of-arrays layout, no heap
+	   allocation; with PREDICTOR_QUEUE_MAX the whole history spans three
+	   cache lines. */
+	static_assert(N >= 2, "PositionHistory needs at least two samples");
+
+private:
+	pos_t x[N];
+	pos_t y[N];
+	pos_t z[N];
+	ts_t timestamp[N];
+	uint32_t length;	// samples kept, 2..N
+	uint32_t head;		// slot of the oldest sample
+	uint32_t count;		// number of valid samples
+
+	uint32_t Slot(size_t i) const {
+		// i-th sample, 0 = oldest
+		uint32_t s = head + (uint32_t)i;
+		return s >= length ? s - length : s;
+	}
+
+public:
+	PositionHistory(size_t length = N) : length((uint32_t)(length < 2 ? 2 : (length > N ? N : length))), head(0), count(0) {}
+
+	void Push(const hduVector3Dd &pos, ts_t ts) {
+		/* append newest sample, overwriting the oldest when full */
+		uint32_t slot;
+		if (count < length) {
+			slot = Slot(count);
+			count++;
+		}
+		else {
+			slot = head;
+			head = (head + 1 == length) ? 0 : head + 1;
+		}
+		x[slot] = (pos_t)pos[0];
+		y[slot] = (pos_t)pos[1];
+		z[slot] = (pos_t)pos[2];
+		timestamp[slot] = ts;
+	}
+
+	void Clear() {
+		head = 0;
+		count = 0;
+	}
+
+	size_t Size() const {
+		return count;
+	}
+
+	bool IsEmpty() const {
+		return count == 0;
+	}
+
+	hduVector3Dd At(size_t i) const {
+		/* i-th sample, 0 = oldest */
+		uint32_t s = Slot(i);
+		return hduVector3Dd(x[s], y[s], z[s]);
+	}
+
+	ts_t TimestampAt(size_t i) const {
+		return timestamp[Slot(i)];
+	}
+
+	hduVector3Dd Front() const {
+		return At(0);
+	}
+
+	hduVector3Dd Back() const {
+		return At(count - 1);
+	}
+
+	ts_t BackTimestamp() const {
+		return TimestampAt(count - 1);
+	}
+};
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hd_socket.h"
+
+#define IMPAIR_MAX_DATAGRAM 512		// largest datagram the proxy forwards (bytes)
+
+enum DelayDistribution {
+	DELAY_UNIFORM,		// delay +- jitter, uniform
+	DELAY_NORMAL,		// delay + N(0, jitter), clipped at 0
+	DELAY_PARETO		// delay + pareto tail with mean jitter (heavy-tailed wireless stalls)
+};
+
+struct ImpairmentConfig {
+	/* one direction of an emulated link. times in ms, probabilities in [0, 1]. */
+	double delay_ms;				// base one-way delay
+	double jitter_ms;				// delay variation, see distribution
+	DelayDistribution distribution;
+	double p_good_to_bad;			// Gilbert-Elliott transition probabilities (per packet)
+	double p_bad_to_good;
+	double loss_good;				// loss probability in good / bad state
+	double loss_bad;
+	double reorder;					// probability a packet skips the delay line and overtakes
+	double duplicate;				// probability a packet is delivered twice
+	double bandwidth_kbps;			// serialization rate cap, 0 = unlimited
+	double queue_limit_ms;			// drop when the bandwidth queue exceeds this backlog
+	uint32_t seed;
+
+	ImpairmentConfig() :
+		delay_ms(0), jitter_ms(0), distribution(DELAY_UNIFORM),
+		p_good_to_bad(0), p_bad_to_good(1), loss_good(0), loss_bad(0),
+		reorder(0), duplicate(0), bandwidth_kbps(0), queue_limit_ms(100), seed(1) {}
+
+	bool Set(const std::string &key, double value) {
+		/* set a field by name, as used on the command line (key=value). returns false for unknown keys. */
+		if (key == "delay") delay_ms = value;
+		else if (key == "jitter") jitter_ms = value;
+		else if (key == "dist") distribution = (DelayDistribution)(int)value;
+		else if (key == "p_gb") p_good_to_bad = value;
+		else if (key == "p_bg") p_bad_to_good = value;
+		else if (key == "loss_good" || key == "loss") loss_good = value;
+		else if (key == "loss_bad") loss_bad = value;
+		else if (key == "reorder") reorder = value;
+		else if (key == "duplicate") duplicate = value;
+		else if (key == "bandwidth") bandwidth_kbps = value;
+		else if (key == "queue") queue_limit_ms = value;
+		else if (key == "seed") seed = (uint32_t)value;
+		else return false;
+		return true;
+	}
+};
+
+struct ImpairmentStats {
+	/* written by the proxy thread, read by whoever reports them: relaxed atomics */
+	std::atomic<uint64_t> submitted;
+	std::atomic<uint64_t> delivered;
+	std::atomic<uint64_t> lost;				// dropped by the loss model
+	std::atomic<uint64_t> queue_drops;		// dropped by the bandwidth queue limit
+	std::atomic<uint64_t> reordered;
+	std::atomic<uint64_t> duplicated;
+
+	ImpairmentStats() : submitted(0), delivered(0), lost(0), queue_drops(0), reordered(0), duplicated(0) {}
+};
+
+class GilbertElliott {
+	/* two-state burst loss model */
+private:
+	bool bad;
+
+public:
+	GilbertElliott() : bad(false) {}
+
+	bool Lose(const ImpairmentConfig &cfg, std::mt19937 &rng) {
+		std::uniform_real_distribution<double> u(0, 1);
+		if (bad) {
+			if (u(rng) < cfg.p_bad_to_good)
+				bad = false;
+		}
+		else if (u(rng) < cfg.p_good_to_bad) {
+			bad = true;
+		}
+		return u(rng) < (bad ? cfg.loss_bad : cfg.loss_good);
+	}
+
+	bool IsBad() const {
+		return bad;
+	}
+};
+
+class ImpairmentLink {
+	/* Delay line for one direction. Submit schedules a datagram, PopDue hands
+	   back the ones whose delivery time has passed. Times in microseconds. */
+private:
+	struct Scheduled {
+		int64_t due;
+		uint64_t order;		// tie-break so equal due times stay FIFO
+		int32_t len;
+		char data[IMPAIR_MAX_DATAGRAM];
+	};
+
+	struct Later {
+		bool operator()(const Scheduled *a, const Scheduled *b) const {
+			return a->due != b->due ? a->due > b->due : a->order > b->order;
+		}
+	};
+
+	ImpairmentConfig cfg;
+	std::mt19937 rng;
+	GilbertElliott loss_model;
+	std::priority_queue<Scheduled*, std::vector<Scheduled*>, Later> pending;
+	std::vector<Scheduled*> free_slots;
+	uint64_t order;
+	int64_t link_free;			// when the bandwidth-limited link is idle again
+	int64_t last_due;			// latest in-order delivery time (keeps jitter FIFO)
+	ImpairmentStats stats;
+
+	int64_t DrawDelay() {
+		double d = cfg.delay_ms;
+		if (cfg.jitter_ms > 0) {
+			if (cfg.distribution == DELAY_NORMAL) {
+				std::normal_distribution<double> n(0, cfg.jitter_ms);
+				d += n(rng);
+			}
+			else if (cfg.distribution == DELAY_PARETO) {
+				// shape 2.5: mean of the tail equals jitter_ms
+				const double shape = 2.5;
+				std::uniform_real_distribution<double> u(1e-9, 1);
+				double scale = cfg.jitter_ms * (shape - 1) / shape;
+				d += scale / pow(u(rng), 1 / shape);
+			}
+			else {
+				std::uniform_real_distribution<double> u(-cfg.jitter_ms, cfg.jitter_ms);
+				d += u(rng);
+			}
+		}
+		return d > 0 ? (int64_t)(d * 1000) : 0;
+	}
+
+	void Schedule(const char *data, int32_t len, int64_t due) {
+		Scheduled *s;
+		if (free_slots.empty()) {
+			s = new Scheduled;
+		}
+		else {
+			s = free_slots.back();
+			free_slots.pop_back();
+		}
+		s->due = due;
+		s->order = order++;
+		s->len = len;
+		memcpy(s->data, data, len);
+		pending.push(s);
+	}
+
+public:
+	ImpairmentLink(const ImpairmentConfig &cfg = ImpairmentConfig()) :
+		cfg(cfg), rng(cfg.seed), order(0), link_free(0), last_due(0) {}
+
+	~ImpairmentLink() {
+		while (!pending.empty()) {
+			delete pending.top();
+			pending.pop();
+		}
+		for (size_t i = 0; i < free_slots.size(); i++)
+			delete free_slots[i];
+	}
+
+	void Submit(const char *data, int32_t len, int64_t now) {
+		stats.submitted.fetch_add(1, std::memory_order_relaxed);
+		if (len <= 0 || len > IMPAIR_MAX_DATAGRAM || loss_model.Lose(cfg, rng)) {
+			stats.lost.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		// serialization through the bandwidth cap
+		int64_t sent = now;
+		if (cfg.bandwidth_kbps > 0) {
+			if (link_free < now)
+				link_free = now;
+			if (link_free - now > (int64_t)(cfg.queue_limit_ms * 1000)) {
+				stats.queue_drops.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			link_free += (int64_t)(len * 8 * 1000 / cfg.bandwidth_kbps);
+			sent = link_free;
+		}
+
+		std::uniform_real_distribution<double> u(0, 1);
+		int64_t due;
+		if (cfg.reorder > 0 && u(rng) < cfg.reorder) {
+			// skip the delay line: overtakes everything still in flight
+			due = sent + (int64_t)(cfg.delay_ms * 1000 * 0.5);
+			stats.reordered.fetch_add(1, std::memory_order_relaxed);
+		}
+		else {
+			due = sent + DrawDelay();
+			if (due < last_due)
+				due = last_due;
+			last_due = due;
+		}
+		Schedule(data, len, due);
+
+		if (cfg.duplicate > 0 && u(rng) < cfg.duplicate) {
+			Schedule(data, len, due + DrawDelay() / 4 + 1);
+			stats.duplicated.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	int32_t PopDue(int64_t now, char *out) {
+		/* copy the next datagram due at or before now into out. returns its length, 0 if none. */
+		if (pending.empty() || pending.top()->due > now)
+			return 0;
+		Scheduled *s = pending.top();
+		pending.pop();
+		int32_t len = s->len;
+		memcpy(out, s->data, len);
+		free_slots.push_back(s);
+		stats.delivered.fetch_add(1, std::memory_order_relaxed);
+		return len;
+	}
+
+	int64_t NextDue() const {
+		/* delivery time of the next pending datagram, -1 if none */
+		return pending.empty() ? -1 : pending.top()->due;
+	}
+
+	const ImpairmentStats& getStats() const {
+		return stats;
+	}
+};
+
+class ImpairmentProxy {
+	/* UDP proxy between two endpoints. Datagrams arriving on port_a go out
+	   of the port_b socket to peer_b through link a_to_b, and vice versa.
+	   Runs on its own thread. */
+private:
+	SOCKET sock_a;
+	SOCKET sock_b;
+	sockaddr_in peer_a;
+	sockaddr_in peer_b;
+	ImpairmentLink a_to_b;
+	ImpairmentLink b_to_a;
+	SocketPoller poller;
+	std::thread *thread;
+	std::atomic<bool> running;
+
+	static int64_t Now() {
+		using namespace std::chrono;
+		return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+	}
+
+	void Drain(SOCKET from, ImpairmentLink &link, int64_t now) {
+		char buf[IMPAIR_MAX_DATAGRAM];
+		while (true) {
+			int n = recvfrom(from, buf, sizeof(buf), 0, NULL, NULL);
+			if (n <= 0)
+				break;
+			link.Submit(buf, n, now);
+		}
+	}
+
+	void Flush(ImpairmentLink &link, SOCKET out, const sockaddr_in &peer, int64_t now) {
+		char buf[IMPAIR_MAX_DATAGRAM];
+		int32_t len;
+		while ((len = link.PopDue(now, buf)) > 0)
+			sendto(out, buf, len, 0, (const sockaddr*)&peer, sizeof(sockaddr_in));
+	}
+
+	void Run() {
+		while (running.load(std::memory_order_acquire)) {
+			int64_t now = Now();
+			int64_t next = -1;
+			int64_t due_ab = a_to_b.NextDue();
+			int64_t due_ba = b_to_a.NextDue();
+			if (due_ab >= 0) next = due_ab;
+			if (due_ba >= 0 && (next < 0 || due_ba < next)) next = due_ba;
+
+			int timeout = 1000;
+			if (next >= 0)
+				timeout = next <= now ? 0 : (int)(next - now < 1000 ? next - now : 1000);
+			poller.Wait(timeout);
+
+			now = Now();
+			Drain(sock_a, a_to_b, now);
+			Drain(sock_b, b_to_a, now);
+			Flush(a_to_b, sock_b, peer_b, now);
+			Flush(b_to_a, sock_a, peer_a, now);
+		}
+	}
+
+public:
+	ImpairmentProxy(uint32_t port_a, const sockaddr_in &peer_a, uint32_t port_b, const sockaddr_in &peer_b,
+					const ImpairmentConfig &cfg_a_to_b, const ImpairmentConfig &cfg_b_to_a) :
+		peer_a(peer_a), peer_b(peer_b), a_to_b(cfg_a_to_b), b_to_a(cfg_b_to_a), thread(NULL), running(false) {
+		sockaddr_in addr;
+		MakeAddress(addr, "127.0.0.1", port_a);
+		sock_a = CreateUDPSocket(&addr);
+		MakeAddress(addr, "127.0.0.1", port_b);
+		sock_b = CreateUDPSocket(&addr);
+		poller.Add(sock_a);
+		poller.Add(sock_b);
+	}
+
+	~ImpairmentProxy() {
+		Stop();
+		closesocket(sock_a);
+		closesocket(sock_b);
+	}
+
+	bool IsOpen() const {
+		return sock_a != INVALID_SOCKET && sock_b != INVALID_SOCKET;
+	}
+
+	void Start() {
+		if (thread)
+			return;
+		running = true;
+		thread = new std::thread(&ImpairmentProxy::Run, this);
+	}
+
+	void Stop() {
+		if (thread == NULL)
+			return;
+		running.store(false, std::memory_order_release);
+		thread->join();
+		delete thread;
+		thread = NULL;
+	}
+
+	const ImpairmentStats& getStatsAToB() const { return a_to_b.getStats(); }
+	const ImpairmentStats& getStatsBToA() const { return b_to_a.getStats(); }
+};
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+#include "hd_api.h"
+#include "hd_types.h"
+
+#define JITTER_BUFFER_SIZE 64			// buffered samples, power of two
+#define JITTER_WINDOW 1024				// age samples (one per Playout call) the target is estimated from
+#define JITTER_ADAPT_INTERVAL 64		// re-estimate the target every N Playout calls
+#define JITTER_PERCENTILE 0.95			// fraction of Playout calls that should not underrun
+#define JITTER_MARGIN_US 200			// safety margin added on top of the percentile (us)
+#define JITTER_MAX_DELAY_US 100000		// cap on added playout delay (us)
+#define JITTER_SLEW_UP_US 50			// max increase of the playout delay per Playout call (us)
+#define JITTER_SLEW_DOWN_US 5			// max decrease of the playout delay per Playout call (us)
+
+enum JitterPlayout {
+	JITTER_EMPTY,			// nothing received yet
+	JITTER_INTERPOLATED,	// playout point lies between two buffered samples
+	JITTER_UNDERRUN			// playout point is past the newest sample, caller should extrapolate
+};
+
+struct JitterStats {
+	uint64_t inserted;
+	uint64_t late;					// arrived after their playout time, discarded
+	uint64_t duplicates;
+	uint64_t plays;
+	uint64_t interpolated;
+	uint64_t underruns;
+	int64_t added_latency_sum_us;	// sum over plays of (playout delay - lowest observed delay)
+	int64_t target_delay_us;		// current playout delay target (relative, includes clock offset)
+	int64_t min_delay_us;			// lowest transit delay seen in the last adapt interval
+
+	JitterStats() {
+		memset(this, 0, sizeof(JitterStats));
+	}
+
+	double UnderrunRate() const {
+		return plays ? (double)underruns / plays : 0;
+	}
+
+	double MeanAddedLatencyUs() const {
+		return plays ? (double)added_latency_sum_us / plays : 0;
+	}
+};
+
+class JitterBuffer {
+	/* Receive-side jitter buffer. Samples are keyed by packet number and
+	   played out at (sender timestamp + playout delay). Every Playout call
+	   records the age of the newest sample (now - its sender timestamp); a
+	   playout delay above that age would not have underrun at that call.
+	   The delay target tracks a percentile of these ages (the unknown clock
+	   offset cancels out) and the applied delay slews
+	   towards it so the rendered trajectory is not time-warped abruptly.
+	   Between samples the position is interpolated; past the newest one
+	   the caller extrapolates. */
+private:
+	struct Sample {
+		pos_t pos[3];
+		ts_t source_ts;
+		cnt_t seq;
+		bool valid;
+	};
+
+	Sample slots[JITTER_BUFFER_SIZE];
+	int64_t ages[JITTER_WINDOW];		// ring of recent ages of the newest sample
+	int64_t scratch[JITTER_WINDOW];
+	uint32_t age_count;
+	uint32_t age_head;
+	int64_t target_delay;				// wanted playout delay
+	int64_t playout_delay;				// applied playout delay, slews towards target_delay
+	int64_t min_delay;					// lowest transit delay of the last interval (latency baseline)
+	int64_t interval_min_delay;
+	ts_t newest_ts;
+	cnt_t newest_seq;
+	ts_t play_ts;						// sender time rendered by the last Playout call
+	cnt_t cursor_seq;					// newest sample at or before the playout point
+	bool has_cursor;
+	bool started;
+	JitterStats stats;
+
+	Sample& Slot(cnt_t seq) {
+		return slots[seq & (JITTER_BUFFER_SIZE - 1)];
+	}
+
+	bool Find(cnt_t seq, Sample *&sample) {
+		Sample &s = Slot(seq);
+		if (!s.valid || s.seq != seq)
+			return false;
+		sample = &s;
+		return true;
+	}
+
+	void Adapt() {
+		uint32_t n = age_count < JITTER_WINDOW ? age_count : JITTER_WINDOW;
+		memcpy(scratch, ages, n * sizeof(int64_t));
+		uint32_t k = (uint32_t)((n - 1) * JITTER_PERCENTILE);
+		std::nth_element(scratch, scratch + k, scratch + n);
+		min_delay = interval_min_delay;
+		interval_min_delay = INT64_MAX;
+		target_delay = scratch[k] + JITTER_MARGIN_US;
+		if (target_delay - min_delay > JITTER_MAX_DELAY_US)
+			target_delay = min_delay + JITTER_MAX_DELAY_US;
+		stats.target_delay_us = target_delay;
+		stats.min_delay_us = min_delay;
+	}
+
+	bool NextAfter(cnt_t seq, Sample *&sample) {
+		// first buffered sample after seq, skipping holes (at most one buffer length)
+		cnt_t s = seq + 1;
+		if ((int32_t)(newest_seq - s) >= JITTER_BUFFER_SIZE)
+			s = newest_seq - JITTER_BUFFER_SIZE + 1;
+		for (; (int32_t)(newest_seq - s) >= 0; s++) {
+			if (Find(s, sample))
+				return true;
+		}
+		return false;
+	}
+
+public:
+	JitterBuffer() : age_count(0), age_head(0), target_delay(0), playout_delay(0), min_delay(0),
+		interval_min_delay(INT64_MAX), newest_ts(0), newest_seq(0), play_ts(0), cursor_seq(0), has_cursor(false), started(false) {
+		memset(slots, 0, sizeof(slots));
+	}
+
+	void Insert(cnt_t seq, ts_t source_ts, const hduVector3Dd &pos, ts_t arrival) {
+		if (started && has_cursor && (int32_t)(seq - cursor_seq) <= 0) {
+			stats.late++;
+			return;
+		}
+		Sample *existing;
+		if (Find(seq, existing)) {
+			stats.duplicates++;
+			return;
+		}
+
+		Sample &s = Slot(seq);
+		s.pos[0] = (pos_t)pos[0];
+		s.pos[1] = (pos_t)pos[1];
+		s.pos[2] = (pos_t)pos[2];
+		s.source_ts = source_ts;
+		s.seq = seq;
+		s.valid = true;
+		stats.inserted++;
+
+		int64_t transit = arrival - source_ts;
+		if (transit < interval_min_delay)
+			interval_min_delay = transit;
+		if (!started) {
+			// start with no added delay, the window fills quickly
+			target_delay = playout_delay = min_delay = transit;
+			newest_seq = seq;
+			newest_ts = source_ts;
+			started = true;
+			return;
+		}
+		if ((int32_t)(seq - newest_seq) > 0) {
+			newest_seq = seq;
+			newest_ts = source_ts;
+		}
+	}
+
+	JitterPlayout Playout(ts_t now, hduVector3Dd &out) {
+		/* position to render at local time now. on underrun out is the newest sample. */
+		if (!started)
+			return JITTER_EMPTY;
+
+		ages[age_head] = now - newest_ts;
+		age_head = (age_head + 1) % JITTER_WINDOW;
+		age_count++;
+		if (age_count % JITTER_ADAPT_INTERVAL == 0)
+			Adapt();
+
+		if (playout_delay < target_delay)
+			playout_delay += std::min<int64_t>(JITTER_SLEW_UP_US, target_delay - playout_delay);
+		else if (playout_delay > target_delay)
+			playout_delay -= std::min<int64_t>(JITTER_SLEW_DOWN_US, playout_delay - target_delay);
+		play_ts = now - playout_delay;
+
+		stats.plays++;
+		stats.added_latency_sum_us += playout_delay - min_delay;
+
+		// advance the cursor to the newest sample due at play_ts
+		Sample *a = NULL;
+		Sample *b = NULL;
+		if (has_cursor)
+			Find(cursor_seq, a);
+		cnt_t from = has_cursor ? cursor_seq : newest_seq - JITTER_BUFFER_SIZE;
+		while (NextAfter(from, b) && b->source_ts <= play_ts) {
+			if (a)
+				a->valid = false;	// passed, free the slot
+			a = b;
+			from = cursor_seq = b->seq;
+			has_cursor = true;
+			b = NULL;
+		}
+		if (b && b->source_ts <= play_ts)
+			b = NULL;
+
+		if (a && b && b->source_ts > a->source_ts) {
+			double t = (double)(play_ts - a->source_ts) / (b->source_ts - a->source_ts);
+			out = hduVector3Dd(a->pos[0] + (b->pos[0] - a->pos[0]) * t,
+							   a->pos[1] + (b->pos[1] - a->pos[1]) * t,
+							   a->pos[2] + (b->pos[2] - a->pos[2]) * t);
+			stats.interpolated++;
+			return JITTER_INTERPOLATED;
+		}
+		if (a == NULL && b) {
+			// first sample not due yet: hold it
+			out = hduVector3Dd(b->pos[0], b->pos[1], b->pos[2]);
+			stats.interpolated++;
+			return JITTER_INTERPOLATED;
+		}
+
+		if (a)
+			out = hduVector3Dd(a->pos[0], a->pos[1], a->pos[2]);
+		stats.underruns++;
+		return JITTER_UNDERRUN;
+	}
+
+	ts_t PlayoutTimestamp() const {
+		/* sender time rendered by the last Playout call (extrapolation target on underrun) */
+		return play_ts;
+	}
+
+	const JitterStats& getStats() const {
+		return stats;
+	}
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <signal.h>
+#include <stddef.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#endif
+
+/* Run/shutdown lifecycle of the programs: InstallShutdownHandlers turns
+   Ctrl+C, SIGTERM (and closing the console on Windows) into a shutdown
+   request, WaitForShutdown parks the main thread until then without
+   taking any CPU from the servo loop. The program then stops the servo
+   callback first and tears down what it used. SIGUSR1 (Ctrl+Break on
+   Windows) asks for a dump of the running counters instead, which
+   WaitForShutdown runs on the main thread. */
+
+#define LIFECYCLE_POLL_MS 50			// how often WaitForShutdown checks the request
+#define LIFECYCLE_CLOSE_GRACE_MS 3000	// Windows kills the process when the close handler returns
+
+inline std::atomic<bool>& ShutdownFlag() {
+	static std::atomic<bool> requested(false);
+	return requested;
+}
+
+inline void RequestShutdown() {
+	ShutdownFlag().store(true, std::memory_order_release);
+}
+
+inline bool ShutdownRequested() {
+	return ShutdownFlag().load(std::memory_order_acquire);
+}
+
+inline void OnShutdownSignal(int) {
+	// async-signal-safe: a lock-free atomic store only
+	RequestShutdown();
+}
+
+inline std::atomic<bool>& DumpFlag() {
+	static std::atomic<bool> requested(false);
+	return requested;
+}
+
+inline void RequestDump() {
+	DumpFlag().store(true, std::memory_order_release);
+}
+
+inline bool TakeDumpRequest() {
+	/* whether a dump was asked for since the last call */
+	return DumpFlag().exchange(false, std::memory_order_acq_rel);
+}
+
+inline void OnDumpSignal(int) {
+	RequestDump();
+}
+
+#if defined(_WIN32)
+inline BOOL WINAPI OnConsoleEvent(DWORD event) {
+	if (event == CTRL_BREAK_EVENT) {
+		RequestDump();
+		return TRUE;
+	}
+	RequestShutdown();
+	if (event == CTRL_CLOSE_EVENT)
+		Sleep(LIFECYCLE_CLOSE_GRACE_MS);	// let the main thread shut down before the process is killed
+	return TRUE;
+}
+#endif
+
+inline void InstallShutdownHandlers() {
+	ShutdownFlag();		// constructed here, not in a signal handler
+	DumpFlag();
+	signal(SIGINT, OnShutdownSignal);
+	signal(SIGTERM, OnShutdownSignal);
+#if defined(_WIN32)
+	SetConsoleCtrlHandler(OnConsoleEvent, TRUE);
+#else
+	signal(SIGHUP, OnShutdownSignal);
+	signal(SIGUSR1, OnDumpSignal);
+#endif
+}
+
+inline void WaitForShutdown(void (*on_dump)() = NULL) {
+	/* block the calling thread until a shutdown is requested. on_dump runs here for every dump request. */
+	while (!ShutdownRequested()) {
+		if (on_dump && TakeDumpRequest())
+			on_dump();
+		std::this_thread::sleep_for(std::chrono::milliseconds(LIFECYCLE_POLL_MS));
+	}
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hd_socket.h"
+#include "hd_redundancy.h"		// BUNDLE_MAX_SIZE
+
+#ifdef HD_LINUX_SOCKETS
+#define HD_SHARED_LINKS			// links are POSIX shared memory segments, so two processes can share them
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#endif
+
+/* Memory transport for endpoints on the same host. Two datagram rings,
+   one per direction, replace the UDP loopback round trip through the
+   kernel: a send copies the datagram into a ring slot, a receive decodes
+   it straight out of the slot, neither makes a syscall. A link is named
+   by the two UDP ports of its endpoints; with HD_SHARED_LINKS it lives
+   in a POSIX shared memory segment, otherwise in process memory. See
+   HDCommunicator::EnableLocalTransport. */
+
+#define LOCAL_RING_SLOTS 64				// datagrams in flight per direction (power of two)
+#define LOCAL_LINK_MAGIC 0x48444c4bU	// "HDLK": state of a link ready for use
+#define LOCAL_LINK_RESETTING 0x52444c4bU	// "HDLR": a process is (re)initializing the link
+#define LOCAL_LINK_VERSION 2
+#define LOCAL_POLL_US 20				// sleep between ring checks in WaitForPacket
+#define LOCAL_INIT_TIMEOUT_MS 200		// a link not ready after this long was left half initialized: take it over
+#define LOCAL_PEER_CHECK_US 100000		// how often a sender checks that the peer process is still alive
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+			  "local links need address-free atomics to live in shared memory");
+
+class DatagramRing {
+	/* Single-producer/single-consumer ring of fixed size datagram slots,
+	   like SPSCRing but read and written in place: Reserve/Commit on the
+	   producer side, Peek/Release on the consumer side. Plain data only,
+	   so it can sit in a shared memory segment. */
+private:
+	struct Slot {
+		uint32_t len;
+		char data[BUNDLE_MAX_SIZE];
+	};
+
+	alignas(64) std::atomic<uint64_t> head;	// next slot to write, owned by producer
+	alignas(64) std::atomic<uint64_t> tail;	// next slot to read, owned by consumer
+	alignas(64) Slot slots[LOCAL_RING_SLOTS];
+
+public:
+	DatagramRing() : head(0), tail(0) {}
+
+	char* Reserve() {
+		/* producer: slot to write the next datagram into, NULL if the ring is full */
+		uint64_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) >= LOCAL_RING_SLOTS)
+			return NULL;
+		return slots[h & (LOCAL_RING_SLOTS - 1)].data;
+	}
+
+	void Commit(int len) {
+		/* producer: publish the reserved slot with len bytes */
+		uint64_t h = head.load(std::memory_order_relaxed);
+		slots[h & (LOCAL_RING_SLOTS - 1)].len = (uint32_t)len;
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	const char* Peek(int &len) {
+		/* consumer: oldest datagram, valid until Release. NULL if the ring is empty */
+		uint64_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire))
+			return NULL;
+		const Slot &slot = slots[t & (LOCAL_RING_SLOTS - 1)];
+		len = (int)slot.len;
+		return slot.data;
+	}
+
+	void Release() {
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	void Drain() {
+		/* consumer: drop everything pending, e.g. left for a previous consumer that died */
+		tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+	}
+
+	bool IsEmpty() const {
+		return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+	}
+};
+
+inline int32_t LocalProcessId() {
+#ifdef HD_SHARED_LINKS
+	return (int32_t)getpid();
+#else
+	return 1;
+#endif
+}
+
+inline bool LocalProcessAlive(int32_t pid) {
+#ifdef HD_SHARED_LINKS
+	return pid == LocalProcessId() || (pid > 0 && (kill(pid, 0) == 0 || errno == EPERM));
+#else
+	return pid != 0;
+#endif
+}
+
+struct LocalLink {
+	/* the memory both endpoints map: side 0 (lower port) sends on rings[0], side 1 on rings[1].
+	   state is epoch << 32 | phase; a fresh segment is all zero (phase 0: the creator is still
+	   initializing it). Whoever (re)initializes the link first moves it to LOCAL_LINK_RESETTING
+	   with a CAS and publishes LOCAL_LINK_MAGIC with a release store, under a new epoch so a
+	   CAS based on an older look fails. The rest is read only after acquiring LOCAL_LINK_MAGIC. */
+	std::atomic<uint64_t> state;
+	uint32_t version;
+	std::atomic<uint32_t> attached[2];	// endpoint of that side is using the link
+	std::atomic<int32_t> pid[2];		// its process, to tell a live peer from a crashed one
+	DatagramRing rings[2];
+
+	LocalLink() : state(LOCAL_LINK_MAGIC), version(LOCAL_LINK_VERSION) {
+		attached[0] = attached[1] = 0;
+		pid[0] = pid[1] = 0;
+	}
+
+	bool Claim(uint64_t seen, int side) {
+		/* take the link over from state seen and start it afresh: empty rings, only side attached.
+		   false if another process changed the state first. */
+		uint64_t epoch = (seen >> 32) + 1;
+		if (!state.compare_exchange_strong(seen, (epoch << 32) | LOCAL_LINK_RESETTING, std::memory_order_acquire))
+			return false;
+		version = LOCAL_LINK_VERSION;
+		for (int i = 0; i < 2; i++)
+			new (&rings[i]) DatagramRing();
+		attached[1 - side].store(0, std::memory_order_relaxed);
+		pid[1 - side].store(0, std::memory_order_relaxed);
+		pid[side].store(LocalProcessId(), std::memory_order_relaxed);
+		attached[side].store(1, std::memory_order_relaxed);
+		state.store((epoch << 32) | LOCAL_LINK_MAGIC, std::memory_order_release);
+		return true;
+	}
+
+	bool PeerAlive(int side) {
+		/* whether the endpoint across from side is attached and its process still runs */
+		return attached[1 - side].load(std::memory_order_acquire) && LocalProcessAlive(pid[1 - side].load());
+	}
+};
+
+class LocalLinkRegistry {
+	/* Process-wide table of the links in use, keyed by their port pair,
+	   so two endpoints of one process share one mapping. Only touched
+	   when endpoints attach and detach, never per packet. */
+private:
+	struct Entry {
+		LocalLink *link;
+		int users;						// endpoints of this process on the link
+	};
+
+	std::map<std::pair<uint32_t, uint32_t>, Entry> links;
+	std::mutex mutex;
+
+	static std::string SegmentName(uint32_t low_port, uint32_t high_port) {
+		char name[64];
+		snprintf(name, sizeof(name), "/hd_link_%u_%u", low_port, high_port);
+		return name;
+	}
+
+	static LocalLink* Map(uint32_t low_port, uint32_t high_port, int side) {
+		/* open or create the link memory. the process creating the segment initializes it, one opening
+		   it waits until that is published. a segment left behind by dead processes is reset. */
+#ifdef HD_SHARED_LINKS
+		std::string name = SegmentName(low_port, high_port);
+		bool created = true;
+		int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd < 0 && errno == EEXIST) {
+			created = false;
+			fd = shm_open(name.c_str(), O_RDWR, 0600);
+		}
+		if (fd < 0)
+			return NULL;
+		// either side may size it: growing to the same length keeps what the other already wrote
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (st.st_size < (off_t)sizeof(LocalLink) && ftruncate(fd, sizeof(LocalLink)) != 0)) {
+			close(fd);
+			return NULL;
+		}
+		void *memory = mmap(NULL, sizeof(LocalLink), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (memory == MAP_FAILED)
+			return NULL;
+		LocalLink *link = (LocalLink*)memory;
+		if (created && link->Claim(0, side))
+			return link;
+
+		std::chrono::steady_clock::time_point deadline =
+			std::chrono::steady_clock::now() + std::chrono::milliseconds(LOCAL_INIT_TIMEOUT_MS);
+		while (true) {
+			uint64_t state = link->state.load(std::memory_order_acquire);
+			uint32_t phase = (uint32_t)state;
+			if (phase == LOCAL_LINK_MAGIC && link->version == LOCAL_LINK_VERSION) {
+				if (link->PeerAlive(side)) {
+					link->rings[1 - side].Drain();	// a previous process on our side may have left datagrams
+					return link;
+				}
+				if (link->Claim(state, side))		// nobody else on it: start from empty rings
+					return link;
+				continue;							// the peer just claimed it: look again
+			}
+			if (phase != LOCAL_LINK_MAGIC && std::chrono::steady_clock::now() < deadline) {
+				std::this_thread::sleep_for(std::chrono::microseconds(LOCAL_POLL_US));
+				continue;
+			}
+			// left half initialized by a process that died, or another version: take it over
+			if (link->Claim(state, side))
+				return link;
+		}
+#else
+		(void)low_port; (void)high_port; (void)side;
+		return new LocalLink();
+#endif
+	}
+
+	static void Unmap(LocalLink *link, uint32_t low_port, uint32_t high_port, bool last) {
+#ifdef HD_SHARED_LINKS
+		munmap(link, sizeof(LocalLink));
+		if (last)
+			shm_unlink(SegmentName(low_port, high_port).c_str());
+#else
+		(void)low_port; (void)high_port; (void)last;
+		delete link;
+#endif
+	}
+
+public:
+	static LocalLinkRegistry& Instance() {
+		// never destroyed: communicators held by globals detach during static destruction
+		static LocalLinkRegistry *registry = new LocalLinkRegistry();
+		return *registry;
+	}
+
+	LocalLink* Attach(uint32_t local_port, uint32_t peer_port, int &side) {
+		/* join the link between the two ports as the side of local_port. NULL if it can't be mapped. */
+		side = local_port < peer_port ? 0 : 1;
+		std::pair<uint32_t, uint32_t> key(std::min(local_port, peer_port), std::max(local_port, peer_port));
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<std::pair<uint32_t, uint32_t>, Entry>::iterator it = links.find(key);
+		if (it == links.end()) {
+			LocalLink *link = Map(key.first, key.second, side);
+			if (link == NULL)
+				return NULL;
+			Entry entry = { link, 0 };
+			it = links.insert(std::make_pair(key, entry)).first;
+		}
+		LocalLink *link = it->second.link;
+		it->second.users++;
+		link->pid[side].store(LocalProcessId());
+		link->attached[side].store(1, std::memory_order_release);
+		return link;
+	}
+
+	void Detach(LocalLink *link, int side) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (std::map<std::pair<uint32_t, uint32_t>, Entry>::iterator it = links.begin(); it != links.end(); ++it) {
+			if (it->second.link != link)
+				continue;
+			link->attached[side].store(0, std::memory_order_release);
+			if (--it->second.users == 0) {
+				Unmap(link, it->first.first, it->first.second, link->attached[1 - side].load() == 0);
+				links.erase(it);
+			}
+			return;
+		}
+	}
+};
@@ -1,61 +1,232 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <fstream>
+#include <mutex>
 #include <string>
+#include <thread>
 
+#include "hd_types.h"
 #include "hd_time.h"
+#include "hd_ring.h"
+#include "hd_realtime.h"
+
+#define LOG_RING_SIZE 4096	// records buffered between servo thread and writer thread
+#define LOG_TEXT_SIZE 64	// max length of a free-text message (longer ones are truncated)
+
+enum LogRecordKind {
+	LOG_TEXT,				// free-text message
+	LOG_RCV_PREDICTED,		// no packet received, position predicted
+	LOG_RCV_PACKET,			// packet received
+	LOG_SND_SKIPPED,		// packet not sent (not perceptable)
+	LOG_SND_SENT			// packet sent
+};
+
+struct LogRecord {
+	/* fixed-size binary log record. formatted into csv columns by the writer. */
+	ts_t event_time;
+	ts_t packet_time;
+	ts_t delay;
+	double pos[3];
+	cnt_t packet_num;
+	cnt_t lost;
+	cnt_t latest;
+	int32_t kind;
+	char text[LOG_TEXT_SIZE];
+};
 
 class Logger {
 private:
-protected:
 	std::ofstream *output_file;
-	virtual void writeHeader() {}
+	SPSCRing<LogRecord, LOG_RING_SIZE> *ring;	// non-NULL in asynchronous mode
+	MPSCRing<LogRecord, LOG_RING_SIZE> *shared_ring;	// instead of ring when several threads log
+	std::mutex write_mutex;						// synchronous mode with several threads logging
+	bool multi_producer;						// records may come from several threads at once
+	std::thread *writer;
+	std::atomic<bool> running;
+	std::atomic<uint64_t> dropped;
+
+	void write(const LogRecord &record) {
+		/* format one record as a csv row. */
+		*output_file << record.event_time << ",";
+		switch (record.kind) {
+		case LOG_RCV_PREDICTED:
+			// Predict? , PacketTime, Delay, PacketNo, PosX, PosY, PosZ, Loss
+			*output_file << 1 << ",,,," << record.pos[0] << "," << record.pos[1] << "," << record.pos[2] << ",";
+			break;
+		case LOG_RCV_PACKET:
+			*output_file << 0 << "," << record.packet_time << "," << record.delay << "," << record.packet_num << "," <<
+				record.pos[0] << "," << record.pos[1] << "," << record.pos[2] << "," <<
+				record.lost << "/" << record.latest;
+			break;
+		case LOG_SND_SKIPPED:
+			// Predict? , PacketTime, PacketNo, PosX, PosY, PosZ
+			*output_file << 1 << ",";
+			break;
+		case LOG_SND_SENT:
+			*output_file << 0 << "," << record.packet_time << "," << record.packet_num << "," <<
+				record.pos[0] << "," << record.pos[1] << "," << record.pos[2];
+			break;
+		default:
+			*output_file << record.text;
+			break;
+		}
+		*output_file << "\n";
+	}
+
+	void writerLoop() {
+		/* background thread: drain the ring, format and flush. */
+		LogRecord record;
+		while (true) {
+			bool was_running = running.load(std::memory_order_acquire);
+			bool wrote = false;
+			while (ring ? ring->Pop(record) : shared_ring->Pop(record)) {
+				write(record);
+				wrote = true;
+			}
+			if (wrote)
+				output_file->flush();
+			else if (!was_running)
+				break;
+			else
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+protected:
+	void submit(LogRecord &record) {
+		/* stamp and hand record to the file (synchronous) or the writer thread (asynchronous). */
+		if (!output_file->is_open())
+			return;
+		record.event_time = getCurrentTime();
+		if (!isAsync()) {
+			if (multi_producer) {
+				std::lock_guard<std::mutex> lock(write_mutex);
+				write(record);
+			}
+			else {
+				write(record);
+			}
+		}
+		else if (!(ring ? ring->Push(record) : shared_ring->Push(record))) {
+			// never block the caller; count what we could not keep
+			dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
 public:
-	Logger(const std::string &filename) {
+	Logger(const std::string &filename, const char *header, bool async = false, bool multi_producer = false) :
+		ring(NULL), shared_ring(NULL), multi_producer(multi_producer), writer(NULL), running(false), dropped(0) {
 		output_file = new std::ofstream(filename);
 		*output_file << "EventTime,"; // First column header is always event time
-		writeHeader();
+		*output_file << header;
 		*output_file << "\n";
+
+		if (async) {
+			if (multi_producer)
+				shared_ring = new MPSCRing<LogRecord, LOG_RING_SIZE>();
+			else
+				ring = new SPSCRing<LogRecord, LOG_RING_SIZE>();
+			running = true;
+			writer = new std::thread(&Logger::writerLoop, this);
+		}
 	}
 
 	virtual ~Logger() {
+		if (writer) {
+			running.store(false, std::memory_order_release);
+			writer->join();
+			delete writer;
+			delete ring;
+			delete shared_ring;
+		}
 		delete output_file;
 	}
 
+	void log(const char *text) {
+		LogRecord record;
+		record.kind = LOG_TEXT;
+		strncpy(record.text, text, LOG_TEXT_SIZE - 1);
+		record.text[LOG_TEXT_SIZE - 1] = '\0';
+		submit(record);
+	}
+
 	void log(const std::string &text) {
-		if (output_file->is_open()) {
-			*output_file << getCurrentTime();
-			*output_file << ",";
-			*output_file << text;
-			*output_file << "\n";
-		}
+		log(text.c_str());
 	}
 
+	bool isAsync() const {
+		return ring != NULL || shared_ring != NULL;
+	}
+
+	int ApplyRealtime(const RealtimeThreadConfig &config) {
+		/* pin / prioritize the writer thread (asynchronous mode). returns RT_* bits */
+		return writer ? ConfigureThread(writer->native_handle(), config) : 0;
+	}
+
+	uint64_t getDroppedCount() const {
+		/* number of records discarded because the ring was full */
+		return dropped.load(std::memory_order_relaxed);
+	}
 };
 
 class RCVLogger : public Logger {
-protected:
-	void writeHeader() {
-		*output_file << "Predict?,PacketTime,Delay,PacketNo,PosX,PosY,PosZ,Loss";
-	}
 public:
-	RCVLogger(const std::string &filename) : Logger(filename) {}
+	RCVLogger(const std::string &filename, bool async = false) :
+		Logger(filename, "Predict?,PacketTime,Delay,PacketNo,PosX,PosY,PosZ,Loss", async) {}
+
+	void logPredicted(const double *pos) {
+		LogRecord record;
+		record.kind = LOG_RCV_PREDICTED;
+		record.pos[0] = pos[0];
+		record.pos[1] = pos[1];
+		record.pos[2] = pos[2];
+		submit(record);
+	}
+
+	void logReceived(ts_t packet_time, ts_t delay, cnt_t packet_num, const double *pos, cnt_t lost, cnt_t latest) {
+		LogRecord record;
+		record.kind = LOG_RCV_PACKET;
+		record.packet_time = packet_time;
+		record.delay = delay;
+		record.packet_num = packet_num;
+		record.pos[0] = pos[0];
+		record.pos[1] = pos[1];
+		record.pos[2] = pos[2];
+		record.lost = lost;
+		record.latest = latest;
+		submit(record);
+	}
 };
 
 class SNDLogger : public Logger {
-protected:
-	void writeHeader() {
-		*output_file << "Predict?,PacketTime,PacketNo,PosX,PosY,PosZ";
-	}
 public:
-	SNDLogger(const std::string &filename) : Logger(filename) {}
+	SNDLogger(const std::string &filename, bool async = false) :
+		Logger(filename, "Predict?,PacketTime,PacketNo,PosX,PosY,PosZ", async) {}
+
+	void logSkipped() {
+		LogRecord record;
+		record.kind = LOG_SND_SKIPPED;
+		submit(record);
+	}
+
+	void logSent(ts_t packet_time, cnt_t packet_num, const double *pos) {
+		LogRecord record;
+		record.kind = LOG_SND_SENT;
+		record.packet_time = packet_time;
+		record.packet_num = packet_num;
+		record.pos[0] = pos[0];
+		record.pos[1] = pos[1];
+		record.pos[2] = pos[2];
+		submit(record);
+	}
 };
 
 class ERRLogger : public Logger {
-protected:
-	void writeHeader() {
-		*output_file << "msg";
-	}
+	/* the controller (servo thread) and its communicator (network thread with HDNetworkThread) both report here */
 public:
-	ERRLogger(const std::string &filename) : Logger(filename) {}
+	ERRLogger(const std::string &filename, bool async = false) :
+		Logger(filename, "msg", async, true) {}
 };
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+#define MAILBOX_READ_ATTEMPTS 16	// bound on reader retries while the writer is mid-update
+
+template <typename T>
+class SeqlockMailbox {
+	/* Single-writer "latest value" mailbox based on a sequence lock.
+	   The writer never waits. Readers copy the value and retry if a write
+	   overlapped, giving up after MAILBOX_READ_ATTEMPTS so that a preempted
+	   writer can never stall the reader. T must be trivially copyable. */
+
+private:
+	alignas(64) std::atomic<uint32_t> seq;	// odd while a write is in progress
+	T value;
+
+public:
+	SeqlockMailbox() : seq(0), value() {}
+
+	void Write(const T &v) {
+		uint32_t s = seq.load(std::memory_order_relaxed);
+		seq.store(s + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		value = v;
+		seq.store(s + 2, std::memory_order_release);
+	}
+
+	bool Read(T &out, uint32_t &version) const {
+		/* copy latest value. version counts completed writes (0 = never written).
+		   returns false if no consistent snapshot could be taken. */
+		for (int attempt = 0; attempt < MAILBOX_READ_ATTEMPTS; attempt++) {
+			uint32_t s1 = seq.load(std::memory_order_acquire);
+			if (s1 & 1)
+				continue;
+			out = value;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			uint32_t s2 = seq.load(std::memory_order_relaxed);
+			if (s1 == s2) {
+				version = s1 / 2;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	uint32_t Version() const {
+		return seq.load(std::memory_order_acquire) / 2;
+	}
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hd_socket.h"
+#include "hd_profiler.h"
+
+#ifdef HD_LINUX_SOCKETS
+#include <pthread.h>
+#include <sched.h>
+#define METRICS_SEND_FLAGS MSG_NOSIGNAL		// a scraper hanging up must not SIGPIPE the process
+#else
+#define METRICS_SEND_FLAGS 0
+#endif
+
+#define METRICS_PUBLISH_US 100000		// owners copy their counters into the registry this often
+#define METRICS_POLL_US 200000			// server wait for a connection; bounds Stop latency
+#define METRICS_REQUEST_TIMEOUT_US 100000	// a scraper gets this long to send its request
+#define METRICS_SEND_STALLS 100			// 1 ms waits on a full send buffer before a scrape is dropped
+
+enum MetricType {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_SUMMARY			// quantiles of a LatencyHistogram
+};
+
+class MetricValue {
+	/* one exported time series. written by a single owner thread, read by the server, no locks. */
+private:
+	std::atomic<double> value;
+
+public:
+	MetricValue() : value(0) {}
+
+	void Set(double v) {
+		value.store(v, std::memory_order_relaxed);
+	}
+
+	double Get() const {
+		return value.load(std::memory_order_relaxed);
+	}
+};
+
+inline std::string MetricLabels(const std::string &session, char side) {
+	/* label set for one side of a session: session="name",side="M" */
+	std::ostringstream labels;
+	labels << "session=\"" << session << "\",side=\"" << side << "\"";
+	return labels.str();
+}
+
+class MetricsRegistry {
+	/* Metrics in Prometheus text exposition format. Registration takes a
+	   lock and happens at setup; updates are relaxed atomic stores by the
+	   thread owning the numbers (servo or network thread), so scraping
+	   never blocks them. */
+private:
+	struct Entry {
+		std::string name;
+		std::string help;
+		std::string labels;
+		MetricType type;
+		MetricValue value;
+		const LatencyHistogram *histogram;
+		double scale;				// histogram unit to exported unit
+	};
+
+	std::deque<Entry> entries;		// stable addresses for the returned handles
+	std::mutex mutex;
+
+	Entry& Add(const std::string &name, const std::string &help, const std::string &labels, MetricType type) {
+		std::lock_guard<std::mutex> lock(mutex);
+		entries.emplace_back();
+		Entry &e = entries.back();
+		e.name = name;
+		e.help = help;
+		e.labels = labels;
+		e.type = type;
+		e.histogram = NULL;
+		e.scale = 1;
+		return e;
+	}
+
+	static void Sample(std::ostringstream &out, const std::string &name, const std::string &labels, double value) {
+		out << name;
+		if (!labels.empty())
+			out << "{" << labels << "}";
+		out << " " << value << "\n";
+	}
+
+public:
+	MetricValue* Counter(const std::string &name, const std::string &help, const std::string &labels = "") {
+		return &Add(name, help, labels, METRIC_COUNTER).value;
+	}
+
+	MetricValue* Gauge(const std::string &name, const std::string &help, const std::string &labels = "") {
+		return &Add(name, help, labels, METRIC_GAUGE).value;
+	}
+
+	void Summary(const std::string &name, const std::string &help, const std::string &labels,
+				 const LatencyHistogram *histogram, double scale = 1) {
+		/* p50/p90/p99/p99.9 plus _sum and _count of a histogram that outlives the registry's use */
+		Entry &e = Add(name, help, labels, METRIC_SUMMARY);
+		e.histogram = histogram;
+		e.scale = scale;
+	}
+
+	std::string Render() {
+		/* exposition text; series of the same name are grouped under one HELP/TYPE */
+		static const char* const TYPE_NAMES[] = { "counter", "gauge", "summary" };
+		static const double QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+		std::lock_guard<std::mutex> lock(mutex);
+		std::ostringstream out;
+		out.precision(10);
+		for (size_t i = 0; i < entries.size(); i++) {
+			bool seen = false;
+			for (size_t j = 0; j < i && !seen; j++)
+				seen = entries[j].name == entries[i].name;
+			if (seen)
+				continue;
+			out << "# HELP " << entries[i].name << " " << entries[i].help << "\n";
+			out << "# TYPE " << entries[i].name << " " << TYPE_NAMES[entries[i].type] << "\n";
+			for (size_t j = i; j < entries.size(); j++) {
+				const Entry &e = entries[j];
+				if (e.name != entries[i].name)
+					continue;
+				if (e.type != METRIC_SUMMARY) {
+					Sample(out, e.name, e.labels, e.value.Get());
+					continue;
+				}
+				std::string sep = e.labels.empty() ? "" : ",";
+				for (size_t q = 0; q < sizeof(QUANTILES) / sizeof(QUANTILES[0]); q++) {
+					std::ostringstream quantile;
+					quantile << e.labels << sep << "quantile=\"" << QUANTILES[q] << "\"";
+					Sample(out, e.name, quantile.str(), e.histogram->Percentile(QUANTILES[q]) * e.scale);
+				}
+				Sample(out, e.name + "_sum", e.labels, e.histogram->Sum() * e.scale);
+				Sample(out, e.name + "_count", e.labels, (double)e.histogram->Count());
+			}
+		}
+		return out.str();
+	}
+};
+
+class MetricsServer {
+	/* Serves the registry over HTTP on its own lowest-priority thread
+	   (SCHED_IDLE on Linux): any GET gets the exposition text, one request
+	   per connection. Point a Prometheus scrape job at host:port/metrics. */
+private:
+	MetricsRegistry *registry;
+	sockaddr_in addr;
+	SOCKET listener;
+	std::thread *thread;
+	std::atomic<bool> running;
+	std::atomic<uint64_t> scrapes;
+
+	static void LowerPriority() {
+#ifdef HD_LINUX_SOCKETS
+		sched_param param;
+		param.sched_priority = 0;
+		pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#else
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#endif
+	}
+
+	void Serve(SOCKET client) {
+		// read the request head (content ignored), answer, close
+		SetNonBlocking(client);
+		SocketPoller poller;
+		poller.Add(client);
+		char request[1024];
+		int received = 0;
+		while (received < (int)sizeof(request) - 1 && poller.Wait(METRICS_REQUEST_TIMEOUT_US) > 0) {
+			int n = recv(client, request + received, sizeof(request) - 1 - received, 0);
+			if (n <= 0)
+				break;
+			received += n;
+			request[received] = '\0';
+			if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+				break;
+		}
+
+		std::string body = registry->Render();
+		std::ostringstream response;
+		response << "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " << body.size()
+				 << "\r\nConnection: close\r\n\r\n" << body;
+		std::string data = response.str();
+		// the socket is non-blocking: a full send buffer is retried for a while, then the scrape is dropped
+		size_t sent = 0;
+		for (int stalls = 0; sent < data.size() && stalls < METRICS_SEND_STALLS; ) {
+			int n = send(client, data.data() + sent, (int)(data.size() - sent), METRICS_SEND_FLAGS);
+			if (n > 0)
+				sent += n;
+			else {
+				stalls++;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+		closesocket(client);
+		scrapes.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void Run() {
+		LowerPriority();
+		SocketPoller poller;
+		poller.Add(listener);
+		while (running.load(std::memory_order_acquire)) {
+			if (poller.Wait(METRICS_POLL_US) == 0)
+				continue;
+			SOCKET client;
+			while ((client = accept(listener, NULL, NULL)) != INVALID_SOCKET)
+				Serve(client);
+		}
+	}
+
+public:
+	MetricsServer(MetricsRegistry *registry, uint32_t port, const char *host = "0.0.0.0") :
+		registry(registry), listener(INVALID_SOCKET), thread(NULL), running(false), scrapes(0) {
+		MakeAddress(addr, host, port);
+	}
+
+	~MetricsServer() {
+		Stop();
+	}
+
+	bool Start() {
+		/* bind and start serving. false if the port is taken. */
+		if (thread)
+			return true;
+		listener = CreateTCPListener(&addr);
+		if (listener == INVALID_SOCKET)
+			return false;
+		running = true;
+		thread = new std::thread(&MetricsServer::Run, this);
+		return true;
+	}
+
+	void Stop() {
+		if (thread == NULL)
+			return;
+		running.store(false, std::memory_order_release);
+		thread->join();
+		delete thread;
+		thread = NULL;
+		closesocket(listener);
+		listener = INVALID_SOCKET;
+	}
+
+	uint64_t getScrapeCount() const {
+		return scrapes.load(std::memory_order_relaxed);
+	}
+};
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "hd_comm.h"
+#include "hd_packet.h"
+#include "hd_mailbox.h"
+#include "hd_ring.h"
+#include "hd_realtime.h"
+
+#define NET_THREAD_IDLE_US 100	// max wait for a datagram when there is nothing to do; bounds send latency
+#define NET_OUTBOX_SIZE 16		// packets posted by the servo thread and not yet sent (power of two)
+
+struct RemoteState {
+	/* latest remote sample as seen by the network thread */
+	HapticPacket packet;
+	ts_t receive_time;
+	ts_t one_way_delay;			// of packet, on the local clock (see ClockEstimator)
+	cnt_t lost_count;			// packet numbers lost so far (settled by the sequence window)
+	cnt_t latest_count;			// highest packet number received so far
+	HapticPacket recovered[RECOVERED_QUEUE_SIZE];	// samples recovered since the servo last fetched, oldest first per receive
+	int recovered_count;
+};
+
+class HDNetworkThread {
+	/* Owns the HDCommunicator socket on a separate thread. The servo loop
+	   exchanges data with it only through lock-free structures, so it never
+	   makes a syscall. Only the latest remote sample is kept; outgoing
+	   packets are queued, so every packet the servo counts as sent goes out
+	   (a full queue refuses the post instead of overwriting one). */
+
+private:
+	HDCommunicator *hdcomm;
+	SeqlockMailbox<RemoteState> inbox;		// written by network thread, read by servo thread
+	SPSCRing<HapticPacket, NET_OUTBOX_SIZE> outbox;	// written by servo thread, read by network thread
+	HapticPacket send_batch[NET_OUTBOX_SIZE];	// network thread: outbox drained for one SendPackets call
+	uint32_t last_fetched;					// inbox version last seen by the servo thread
+	std::atomic<uint32_t> fetched_version;	// last_fetched, published for the network thread
+	uint32_t recovered_version[RECOVERED_QUEUE_SIZE];	// network thread: inbox version first carrying state.recovered[i]
+	HapticPacket taken[RECOVERED_QUEUE_SIZE];	// network thread: samples just taken from the communicator
+	std::thread *thread;
+	std::atomic<bool> running;
+	std::atomic<uint64_t> sent_count;
+	std::atomic<uint64_t> send_failures;
+	std::atomic<uint64_t> post_drops;		// posts refused because the outbox was full
+	RealtimeThreadConfig realtime;			// applied by the thread itself when it starts
+	std::atomic<int> realtime_applied;
+
+	void KeepRecovered(RemoteState &state) {
+		// recovered samples stay in the state until the servo has fetched a version carrying them, so none
+		// is lost when it misses a version. a full state drops the oldest, like the communicator's queue.
+		uint32_t fetched = fetched_version.load(std::memory_order_acquire);
+		int seen = 0;
+		while (seen < state.recovered_count && recovered_version[seen] <= fetched)
+			seen++;
+		std::copy(state.recovered + seen, state.recovered + state.recovered_count, state.recovered);
+		std::copy(recovered_version + seen, recovered_version + state.recovered_count, recovered_version);
+		state.recovered_count -= seen;
+
+		int count = hdcomm->TakeRecovered(taken, RECOVERED_QUEUE_SIZE);
+		int overflow = state.recovered_count + count - RECOVERED_QUEUE_SIZE;
+		if (overflow > 0) {
+			std::copy(state.recovered + overflow, state.recovered + state.recovered_count, state.recovered);
+			std::copy(recovered_version + overflow, recovered_version + state.recovered_count, recovered_version);
+			state.recovered_count -= overflow;
+		}
+		uint32_t version = inbox.Version() + 1;		// of the write about to carry them
+		for (int i = 0; i < count; i++) {
+			state.recovered[state.recovered_count] = taken[i];
+			recovered_version[state.recovered_count++] = version;
+		}
+	}
+
+	void Run() {
+		realtime_applied.store(ConfigureCurrentThread(realtime), std::memory_order_release);
+		RemoteState state;
+		state.recovered_count = 0;
+		while (running.load(std::memory_order_acquire)) {
+			bool idle = true;
+
+			HapticPacket *packet = hdcomm->ReceivePacket(false);
+			if (packet) {
+				state.packet = *packet;
+				state.receive_time = getCurrentTime();
+				state.one_way_delay = hdcomm->getLastOneWayDelay();
+				state.lost_count = (cnt_t)hdcomm->getLostPacketCount();
+				state.latest_count = hdcomm->getLatestPacketCount();
+				KeepRecovered(state);
+				inbox.Write(state);
+				idle = false;
+			}
+
+			// everything posted since the last pass, oldest first, with as few syscalls as possible
+			int count = 0;
+			while (count < NET_OUTBOX_SIZE && outbox.Pop(send_batch[count]))
+				count++;
+			if (count > 0) {
+				int sent = hdcomm->SendPackets(send_batch, count, NULL, false);
+				sent_count.fetch_add(sent, std::memory_order_relaxed);
+				send_failures.fetch_add(count - sent, std::memory_order_relaxed);
+				idle = false;
+			}
+
+			hdcomm->PublishMetrics(getCurrentTime());
+			if (idle)
+				hdcomm->WaitForPacket(NET_THREAD_IDLE_US);
+		}
+	}
+
+public:
+	HDNetworkThread(HDCommunicator *hdcomm) :
+		hdcomm(hdcomm), last_fetched(0), fetched_version(0), thread(NULL), running(false), sent_count(0), send_failures(0), post_drops(0),
+		realtime_applied(-1) {}
+
+	~HDNetworkThread() {
+		Stop();
+	}
+
+	// heap instances keep the cache line alignment of the mailbox and ring indices (-std=c++11 new does not)
+	static void* operator new(size_t size) {
+		return AlignedAlloc(size);
+	}
+
+	static void operator delete(void *p) {
+		AlignedFree(p);
+	}
+
+	void SetRealtime(const RealtimeThreadConfig &config) {
+		/* core, priority and stack pre-fault of the thread. call before Start. */
+		realtime = config;
+	}
+
+	int getRealtimeApplied() const {
+		/* RT_* bits of what SetRealtime achieved, -1 until the thread has started */
+		return realtime_applied.load(std::memory_order_acquire);
+	}
+
+	void Start() {
+		if (thread)
+			return;
+		running = true;
+		thread = new std::thread(&HDNetworkThread::Run, this);
+	}
+
+	void Stop() {
+		if (thread == NULL)
+			return;
+		running.store(false, std::memory_order_release);
+		thread->join();
+		delete thread;
+		thread = NULL;
+	}
+
+	bool PostLocal(const HapticPacket &packet) {
+		/* servo thread: queue a local sample for sending. false if the queue is full (network thread stalled) */
+		if (outbox.Push(packet))
+			return true;
+		post_drops.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	bool FetchRemote(RemoteState &state) {
+		/* servo thread: returns true if a sample newer than the last fetched one is available */
+		uint32_t version;
+		if (!inbox.Read(state, version) || version == last_fetched)
+			return false;
+		last_fetched = version;
+		fetched_version.store(version, std::memory_order_release);
+		return true;
+	}
+
+	uint64_t getSentCount() const {
+		return sent_count.load(std::memory_order_relaxed);
+	}
+
+	uint64_t getSendFailureCount() const {
+		return send_failures.load(std::memory_order_relaxed);
+	}
+
+	uint64_t getPostDropCount() const {
+		return post_drops.load(std::memory_order_relaxed);
+	}
+};
@@ -1,6 +1,8 @@
 #pragma once
 
-#include <HDU/hduVector.h>
+#include <string.h>
+
+#include "hd_api.h"
 
 #include "hd_types.h"
 #include "hd_time.h"
@@ -0,0 +1,360 @@
+#pragma once
+
+#include <string>
+
+#include <math.h>
+#include <string.h>
+
+#include "hd_api.h"
+#include "hd_types.h"
+#include "hd_history.h"
+
+#define PREDICTOR_QUEUE_SIZE 5			// samples kept by history based predictors (default)
+#define PREDICTOR_QUEUE_MAX 8			// most samples a history based predictor can be configured to keep
+#define KALMAN_PROCESS_NOISE 1e7		// spectral density of the highest modelled derivative (mm^2/s^(2S-1))
+#define KALMAN_MEASUREMENT_NOISE 1e-2	// position measurement variance (mm^2)
+#define KALMAN_INITIAL_VARIANCE 1e6		// initial variance of the unobserved derivatives
+
+enum PredictorType {
+	PREDICTOR_AVERAGE,		// last sample + mean successive difference (ignores timestamps)
+	PREDICTOR_KALMAN_CV,	// constant-velocity Kalman filter
+	PREDICTOR_KALMAN_CA,	// constant-acceleration Kalman filter
+	PREDICTOR_POLY1,		// least-squares line over the history
+	PREDICTOR_POLY2			// least-squares parabola over the history
+};
+
+class Predictor {
+	/* Extrapolates a position stream. Samples are fed in with Observe,
+	   Predict estimates the position at a timestamp of the same clock
+	   (microseconds). */
+public:
+	virtual ~Predictor() {}
+
+	virtual void Reset() = 0;
+
+	virtual void Observe(const hduVector3Dd &pos, ts_t ts) = 0;
+
+	// false if nothing was observed yet
+	virtual bool Predict(ts_t ts, hduVector3Dd &out) const = 0;
+
+	virtual const char* Name() const = 0;
+};
+
+class AveragePredictor : public Predictor {
+	/* Original predictive coding scheme: newest sample plus the mean
+	   successive difference, one step ahead regardless of ts. */
+private:
+	PositionHistory<PREDICTOR_QUEUE_MAX> history;
+
+public:
+	AveragePredictor(int length = PREDICTOR_QUEUE_SIZE) : history(length) {}
+
+	void Reset() {
+		history.Clear();
+	}
+
+	void Observe(const hduVector3Dd &pos, ts_t ts) {
+		history.Push(pos, ts);
+	}
+
+	bool Predict(ts_t ts, hduVector3Dd &out) const {
+		if (history.IsEmpty())
+			return false;
+		out = history.Back();
+		if (history.Size() > 1) {
+			// mean of successive differences; the sum telescopes to (newest - oldest)
+			hduVector3Dd step = history.Back() - history.Front();
+			step /= history.Size() - 1;
+			out += step;
+		}
+		return true;
+	}
+
+	const char* Name() const {
+		return "avg";
+	}
+};
+
+template <int S>
+class KalmanAxis {
+	/* One axis of a linear Kalman filter over position and its first S-1
+	   derivatives, driven by continuous white noise on the highest one. */
+private:
+	double x[S];
+	double P[S][S];
+
+	static double Factorial(int n) {
+		double f = 1;
+		for (int i = 2; i <= n; i++)
+			f *= i;
+		return f;
+	}
+
+public:
+	void Reset(double pos, double r) {
+		memset(x, 0, sizeof(x));
+		memset(P, 0, sizeof(P));
+		x[0] = pos;
+		P[0][0] = r;
+		for (int i = 1; i < S; i++)
+			P[i][i] = KALMAN_INITIAL_VARIANCE;
+	}
+
+	void Step(double dt, double q, double r, double z) {
+		if (dt > 0) {
+			// F[i][j] = dt^(j-i) / (j-i)!
+			double F[S][S];
+			memset(F, 0, sizeof(F));
+			for (int i = 0; i < S; i++)
+				for (int j = i; j < S; j++)
+					F[i][j] = pow(dt, j - i) / Factorial(j - i);
+
+			double nx[S];
+			for (int i = 0; i < S; i++) {
+				nx[i] = 0;
+				for (int j = i; j < S; j++)
+					nx[i] += F[i][j] * x[j];
+			}
+			memcpy(x, nx, sizeof(x));
+
+			// P = F P F' + Q
+			double FP[S][S];
+			for (int i = 0; i < S; i++)
+				for (int j = 0; j < S; j++) {
+					FP[i][j] = 0;
+					for (int k = i; k < S; k++)
+						FP[i][j] += F[i][k] * P[k][j];
+				}
+			for (int i = 0; i < S; i++)
+				for (int j = 0; j < S; j++) {
+					double v = 0;
+					for (int k = j; k < S; k++)
+						v += FP[i][k] * F[j][k];
+					int e = 2 * S - 1 - i - j;
+					P[i][j] = v + q * pow(dt, e) / (e * Factorial(S - 1 - i) * Factorial(S - 1 - j));
+				}
+		}
+
+		// measurement of the position
+		double s = P[0][0] + r;
+		double K[S];
+		for (int i = 0; i < S; i++)
+			K[i] = P[i][0] / s;
+		double y = z - x[0];
+		for (int i = 0; i < S; i++)
+			x[i] += K[i] * y;
+		double P0[S];
+		for (int j = 0; j < S; j++)
+			P0[j] = P[0][j];
+		for (int i = 0; i < S; i++)
+			for (int j = 0; j < S; j++)
+				P[i][j] -= K[i] * P0[j];
+	}
+
+	double Extrapolate(double dt) const {
+		double p = 0;
+		double f = 1;
+		for (int j = 0; j < S; j++) {
+			p += x[j] * f;
+			f *= dt / (j + 1);
+		}
+		return p;
+	}
+};
+
+template <int S>
+class KalmanPredictor : public Predictor {
+	/* Per-axis Kalman filter with the true sample spacing as time step,
+	   so skipped or late packets do not bias the velocity estimate. */
+private:
+	KalmanAxis<S> axis[3];
+	double q;
+	double r;
+	ts_t last_ts;
+	bool started;
+
+public:
+	KalmanPredictor(double q = KALMAN_PROCESS_NOISE, double r = KALMAN_MEASUREMENT_NOISE) :
+		q(q), r(r), last_ts(0), started(false) {}
+
+	void Reset() {
+		started = false;
+	}
+
+	void Observe(const hduVector3Dd &pos, ts_t ts) {
+		if (!started) {
+			for (int i = 0; i < 3; i++)
+				axis[i].Reset(pos[i], r);
+			last_ts = ts;
+			started = true;
+			return;
+		}
+		if (ts < last_ts)
+			return;		// older than the filter state
+		double dt = (ts - last_ts) * 1e-6;
+		for (int i = 0; i < 3; i++)
+			axis[i].Step(dt, q, r, pos[i]);
+		last_ts = ts;
+	}
+
+	bool Predict(ts_t ts, hduVector3Dd &out) const {
+		if (!started)
+			return false;
+		double dt = ts > last_ts ? (ts - last_ts) * 1e-6 : 0;
+		out = hduVector3Dd(axis[0].Extrapolate(dt), axis[1].Extrapolate(dt), axis[2].Extrapolate(dt));
+		return true;
+	}
+
+	const char* Name() const {
+		return S == 2 ? "kcv" : "kca";
+	}
+};
+
+typedef KalmanPredictor<2> KalmanCVPredictor;
+typedef KalmanPredictor<3> KalmanCAPredictor;
+
+class PolynomialPredictor : public Predictor {
+	/* Least-squares polynomial through the history, time measured from the
+	   newest sample. The order drops when there are too few samples. The
+	   fit is redone on Observe, so Predict only evaluates it. */
+private:
+	PositionHistory<PREDICTOR_QUEUE_MAX> history;
+	int order;
+	double coef[3][3];		// coef[i][axis]: t^i coefficient
+	int terms;				// number of valid coefficients
+	ts_t t0;				// timestamp of the newest sample
+
+	void Fit() {
+		terms = 1;
+		t0 = history.BackTimestamp();
+		hduVector3Dd newest = history.Back();
+		for (int k = 0; k < 3; k++)
+			coef[0][k] = newest[k];
+
+		int n = order + 1;
+		if ((int)history.Size() < n)
+			n = (int)history.Size();
+		if (n < 2)
+			return;
+
+		// normal equations in t (seconds, relative to the newest sample)
+		double A[3][3] = { { 0 } };
+		double b[3][3] = { { 0 } };
+		for (size_t s = 0; s < history.Size(); s++) {
+			double t = (history.TimestampAt(s) - t0) * 1e-6;
+			hduVector3Dd p = history.At(s);
+			double tp[5] = { 1, t, t * t, t * t * t, t * t * t * t };
+			for (int i = 0; i < n; i++) {
+				for (int j = 0; j < n; j++)
+					A[i][j] += tp[i + j];
+				for (int k = 0; k < 3; k++)
+					b[i][k] += tp[i] * p[k];
+			}
+		}
+		if (!Solve(A, b, n))
+			return;		// all samples at one instant: hold the newest
+		for (int i = 0; i < n; i++)
+			for (int k = 0; k < 3; k++)
+				coef[i][k] = b[i][k];
+		terms = n;
+	}
+
+	static bool Solve(double A[3][3], double b[3][3], int n) {
+		// gaussian elimination with partial pivoting, three right hand sides
+		for (int c = 0; c < n; c++) {
+			int pivot = c;
+			for (int i = c + 1; i < n; i++)
+				if (fabs(A[i][c]) > fabs(A[pivot][c]))
+					pivot = i;
+			if (fabs(A[pivot][c]) < 1e-12)
+				return false;
+			for (int j = 0; j < n; j++) {
+				double t = A[c][j]; A[c][j] = A[pivot][j]; A[pivot][j] = t;
+			}
+			for (int k = 0; k < 3; k++) {
+				double t = b[c][k]; b[c][k] = b[pivot][k]; b[pivot][k] = t;
+			}
+			for (int i = 0; i < n; i++) {
+				if (i == c)
+					continue;
+				double f = A[i][c] / A[c][c];
+				for (int j = c; j < n; j++)
+					A[i][j] -= f * A[c][j];
+				for (int k = 0; k < 3; k++)
+					b[i][k] -= f * b[c][k];
+			}
+		}
+		for (int i = 0; i < n; i++)
+			for (int k = 0; k < 3; k++)
+				b[i][k] /= A[i][i];
+		return true;
+	}
+
+public:
+	PolynomialPredictor(int order = 1, int length = PREDICTOR_QUEUE_SIZE) :
+		history(length), order(order < 1 ? 1 : (order > 2 ? 2 : order)), terms(1), t0(0) {}
+
+	void Reset() {
+		history.Clear();
+	}
+
+	void Observe(const hduVector3Dd &pos, ts_t ts) {
+		history.Push(pos, ts);
+		Fit();
+	}
+
+	bool Predict(ts_t ts, hduVector3Dd &out) const {
+		if (history.IsEmpty())
+			return false;
+		double t = (ts - t0) * 1e-6;
+		for (int k = 0; k < 3; k++) {
+			double v = 0;
+			for (int i = terms - 1; i >= 0; i--)
+				v = v * t + coef[i][k];
+			out[k] = v;
+		}
+		return true;
+	}
+
+	const char* Name() const {
+		return order == 1 ? "poly1" : "poly2";
+	}
+};
+
+inline Predictor* CreatePredictor(PredictorType type, int history = PREDICTOR_QUEUE_SIZE) {
+	/* history: samples kept by avg/poly1/poly2 (2..PREDICTOR_QUEUE_MAX); the Kalman filters keep none */
+	switch (type) {
+	case PREDICTOR_KALMAN_CV:	return new KalmanCVPredictor();
+	case PREDICTOR_KALMAN_CA:	return new KalmanCAPredictor();
+	case PREDICTOR_POLY1:		return new PolynomialPredictor(1, history);
+	case PREDICTOR_POLY2:		return new PolynomialPredictor(2, history);
+	default:					return new AveragePredictor(history);
+	}
+}
+
+inline const char* PredictorTypeName(PredictorType type) {
+	/* Name() of the predictor CreatePredictor makes for type, see ParsePredictorType */
+	switch (type) {
+	case PREDICTOR_KALMAN_CV:	return "kcv";
+	case PREDICTOR_KALMAN_CA:	return "kca";
+	case PREDICTOR_POLY1:		return "poly1";
+	case PREDICTOR_POLY2:		return "poly2";
+	default:					return "avg";
+	}
+}
+
+inline bool UsesHistory(PredictorType type) {
+	/* the history length changes this predictor's output */
+	return type == PREDICTOR_AVERAGE || type == PREDICTOR_POLY1 || type == PREDICTOR_POLY2;
+}
+
+inline bool ParsePredictorType(const std::string &name, PredictorType &type) {
+	/* predictor by its Name(). returns false for unknown names. */
+	if (name == "avg") type = PREDICTOR_AVERAGE;
+	else if (name == "kcv") type = PREDICTOR_KALMAN_CV;
+	else if (name == "kca") type = PREDICTOR_KALMAN_CA;
+	else if (name == "poly1") type = PREDICTOR_POLY1;
+	else if (name == "poly2") type = PREDICTOR_POLY2;
+	else return false;
+	return true;
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Servo-loop instrumentation. Build with -DHD_PROFILE (make sim PROFILE=1) to
+   enable; otherwise PROFILE_SCOPE expands to nothing and the controller
+   carries no profiler at all. */
+
+#define PROFILE_SUB_BITS 4				// 16 linear sub-buckets per power of two: <= 6.25% relative error
+#define PROFILE_SUB_BUCKETS (1 << PROFILE_SUB_BITS)
+#define PROFILE_BUCKETS ((64 - PROFILE_SUB_BITS + 1) * PROFILE_SUB_BUCKETS)
+
+enum ProfileStage {
+	PROFILE_BEGIN_FRAME,	// device frame start (hdBeginFrame)
+	PROFILE_RECEIVE,		// fetch from the socket or network thread
+	PROFILE_PREDICT,		// predictors, jitter buffer, deadband decision
+	PROFILE_FORCE,			// PosToForce and SetForce
+	PROFILE_SEND,			// socket send or hand-off to the network thread
+	PROFILE_LOG,			// logger calls
+	PROFILE_END_FRAME,		// device frame end (hdEndFrame)
+	PROFILE_TICK,			// whole tick
+	PROFILE_STAGE_COUNT
+};
+
+static const char* const PROFILE_STAGE_NAMES[PROFILE_STAGE_COUNT] = {
+	"begin_frame", "receive", "predict", "force", "send", "log", "end_frame", "tick"
+};
+
+inline uint64_t ProfileCycles() {
+	/* cheap timestamp: TSC where available, nanoseconds otherwise */
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+class LatencyHistogram {
+	/* Log-linear (HDR-style) histogram of integer samples (cycles, us): values below
+	   PROFILE_SUB_BUCKETS are exact, above that every power of two is split
+	   into PROFILE_SUB_BUCKETS equal buckets. Single writer, lock-free:
+	   counts are relaxed atomics, so a concurrent dump sees each bucket
+	   whole but the set only approximately consistent. */
+private:
+	std::atomic<uint64_t> counts[PROFILE_BUCKETS];
+	std::atomic<uint64_t> total;
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> max_value;
+
+	static int HighestBit(uint64_t v) {
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanReverse64(&index, v);
+		return (int)index;
+#else
+		return 63 - __builtin_clzll(v);
+#endif
+	}
+
+	static int Bucket(uint64_t v) {
+		if (v < PROFILE_SUB_BUCKETS)
+			return (int)v;
+		int shift = HighestBit(v) - PROFILE_SUB_BITS;
+		return (shift + 1) * PROFILE_SUB_BUCKETS + (int)((v >> shift) & (PROFILE_SUB_BUCKETS - 1));
+	}
+
+	static uint64_t BucketTop(int bucket) {
+		// highest value falling into bucket
+		if (bucket < PROFILE_SUB_BUCKETS)
+			return bucket;
+		int shift = bucket / PROFILE_SUB_BUCKETS - 1;
+		uint64_t low = (uint64_t)(PROFILE_SUB_BUCKETS + bucket % PROFILE_SUB_BUCKETS) << shift;
+		return low + ((uint64_t)1 << shift) - 1;
+	}
+
+	static void Bump(std::atomic<uint64_t> &counter, uint64_t by) {
+		// single writer: no read-modify-write instruction needed
+		counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+	}
+
+public:
+	LatencyHistogram() : total(0), sum(0), max_value(0) {
+		for (int i = 0; i < PROFILE_BUCKETS; i++)
+			counts[i].store(0, std::memory_order_relaxed);
+	}
+
+	void Record(uint64_t v) {
+		Bump(counts[Bucket(v)], 1);
+		Bump(total, 1);
+		Bump(sum, v);
+		if (v > max_value.load(std::memory_order_relaxed))
+			max_value.store(v, std::memory_order_relaxed);
+	}
+
+	uint64_t Count() const {
+		return total.load(std::memory_order_relaxed);
+	}
+
+	uint64_t Sum() const {
+		return sum.load(std::memory_order_relaxed);
+	}
+
+	uint64_t Max() const {
+		return max_value.load(std::memory_order_relaxed);
+	}
+
+	uint64_t Percentile(double p) const {
+		/* upper bound of the bucket holding the p-quantile (0..1) */
+		uint64_t n = Count();
+		if (n == 0)
+			return 0;
+		uint64_t rank = (uint64_t)(p * n);
+		if (rank >= n)
+			rank = n - 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < PROFILE_BUCKETS; i++) {
+			seen += counts[i].load(std::memory_order_relaxed);
+			if (seen > rank)
+				return BucketTop(i) < Max() ? BucketTop(i) : Max();
+		}
+		return Max();
+	}
+};
+
+class StageProfiler {
+	/* one LatencyHistogram per ProfileStage, written by the servo thread. a stage entered several
+	   times in one tick (predict, log) is summed over the tick and recorded once when the
+	   PROFILE_TICK scope closes, so every histogram holds per-tick values. */
+private:
+	LatencyHistogram stages[PROFILE_STAGE_COUNT];
+	uint64_t tick_cycles[PROFILE_STAGE_COUNT];	// spent in each stage so far this tick
+	uint32_t tick_entered;						// bit per stage entered this tick
+	uint64_t start_cycles;
+	std::chrono::steady_clock::time_point start_time;
+
+	void EndTick() {
+		for (int i = 0; i < PROFILE_STAGE_COUNT; i++) {
+			if (tick_entered & (1u << i)) {
+				stages[i].Record(tick_cycles[i]);
+				tick_cycles[i] = 0;
+			}
+		}
+		tick_entered = 0;
+	}
+
+public:
+	StageProfiler() : tick_entered(0), start_cycles(ProfileCycles()), start_time(std::chrono::steady_clock::now()) {
+		for (int i = 0; i < PROFILE_STAGE_COUNT; i++)
+			tick_cycles[i] = 0;
+	}
+
+	void Add(ProfileStage stage, uint64_t cycles) {
+		/* time spent in stage; closing PROFILE_TICK records the tick */
+		tick_cycles[stage] += cycles;
+		tick_entered |= 1u << stage;
+		if (stage == PROFILE_TICK)
+			EndTick();
+	}
+
+	double NsPerCycle() const {
+		/* calibrated against steady_clock over the profiler's lifetime */
+		double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+		uint64_t cycles = ProfileCycles() - start_cycles;
+		return cycles ? ns / cycles : 1;
+	}
+
+	void Dump(FILE *out, const char *title) const {
+		/* p50/p99/p99.9/max per stage in microseconds */
+		double scale = NsPerCycle() / 1000;
+		fprintf(out, "%s\n%-12s %10s %9s %9s %9s %9s\n", title, "stage", "count", "p50_us", "p99_us", "p99.9_us", "max_us");
+		for (int i = 0; i < PROFILE_STAGE_COUNT; i++) {
+			const LatencyHistogram &h = stages[i];
+			if (h.Count() == 0)
+				continue;
+			fprintf(out, "%-12s %10llu %9.2f %9.2f %9.2f %9.2f\n", PROFILE_STAGE_NAMES[i], (unsigned long long)h.Count(),
+					h.Percentile(0.5) * scale, h.Percentile(0.99) * scale, h.Percentile(0.999) * scale, h.Max() * scale);
+		}
+		fflush(out);
+	}
+};
+
+class ProfileScope {
+	/* adds the cycles between construction and destruction to one stage */
+private:
+	StageProfiler &profiler;
+	ProfileStage stage;
+	uint64_t start;
+
+public:
+	ProfileScope(StageProfiler &profiler, ProfileStage stage) : profiler(profiler), stage(stage), start(ProfileCycles()) {}
+
+	~ProfileScope() {
+		profiler.Add(stage, ProfileCycles() - start);
+	}
+};
+
+#ifdef HD_PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(profiler, stage) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(profiler, stage)
+#else
+#define PROFILE_SCOPE(profiler, stage)
+#endif
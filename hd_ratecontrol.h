@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hd_api.h"
+#include "hd_types.h"
+
+#define RATE_MIN_HZ 50					// send rate while the hand is still
+#define RATE_MAX_HZ 1000				// send rate in fast motion (the servo rate)
+#define RATE_SLOW_MM_S 20				// at or below this speed the minimum rate applies
+#define RATE_FAST_MM_S 300				// at or above this speed the maximum rate applies
+#define RATE_ACCEL_MM_S2 5000			// acceleration that alone asks for the maximum rate
+#define RATE_HOLD_MS 200				// a higher rate is kept this long after the motion slows down
+#define RATE_WINDOW_MS 5				// velocity and acceleration are differences over this window (tick jitter)
+#define RATE_SMOOTHING 0.5				// EWMA weight of a new velocity/acceleration sample, once per window
+#define RATE_SLACK_US 500				// a send due within this much of now is due (servo jitter)
+
+enum RateBand {
+	RATE_STILL,			// minimum rate
+	RATE_MOVING,		// between the bounds, scaled with speed/acceleration
+	RATE_FAST,			// maximum rate
+	RATE_BANDS
+};
+
+const char *const RATE_BAND_NAMES[RATE_BANDS] = { "still", "moving", "fast" };
+
+struct RateControlConfig {
+	/* send rate bounds and the motion that maps onto them */
+	double min_hz;				// 0: a still hand only sends deadband heartbeats
+	double max_hz;
+	double slow_mm_s;
+	double fast_mm_s;
+	double accel_mm_s2;			// 0: speed only
+	double hold_ms;
+	bool enabled;				// false: no limit, the deadband alone decides
+
+	RateControlConfig() : min_hz(RATE_MIN_HZ), max_hz(RATE_MAX_HZ), slow_mm_s(RATE_SLOW_MM_S), fast_mm_s(RATE_FAST_MM_S),
+		accel_mm_s2(RATE_ACCEL_MM_S2), hold_ms(RATE_HOLD_MS), enabled(false) {}
+
+	bool Set(const std::string &key, double value) {
+		/* set a field by name (key=value on the command line). returns false for unknown keys. */
+		if (key == "min") min_hz = value;
+		else if (key == "max") max_hz = value;
+		else if (key == "slow") slow_mm_s = value;
+		else if (key == "fast") fast_mm_s = value;
+		else if (key == "accel") accel_mm_s2 = value;
+		else if (key == "hold") hold_ms = value;
+		else if (key == "on") enabled = value != 0;
+		else return false;
+		return true;
+	}
+
+	void SetFixed(double hz) {
+		/* the same rate in every band */
+		min_hz = max_hz = hz;
+		enabled = true;
+	}
+};
+
+struct RateStats {
+	uint64_t ticks[RATE_BANDS];		// ticks spent in each band
+	uint64_t time_us[RATE_BANDS];	// time spent in each band
+	uint64_t sent[RATE_BANDS];		// packets sent in each band
+	uint64_t held;					// sends the deadband asked for before the interval was up
+
+	RateStats() {
+		memset(this, 0, sizeof(RateStats));
+	}
+
+	double TimeShare(int band) const {
+		uint64_t total = time_us[RATE_STILL] + time_us[RATE_MOVING] + time_us[RATE_FAST];
+		return total ? (double)time_us[band] / total : 0;
+	}
+
+	double SendRate(int band) const {
+		/* packets/s while in band */
+		return time_us[band] ? sent[band] * 1e6 / time_us[band] : 0;
+	}
+};
+
+class RateController {
+	/* Velocity-adaptive send rate. Tracks the local hand's speed and
+	   acceleration every tick and turns them into a minimum interval
+	   between packets: min_hz while the hand is still, max_hz in fast
+	   motion or on a sharp acceleration, linear in between. The rate goes
+	   up at once and comes down only after hold_ms, so a pause within a
+	   stroke keeps the stroke's rate. It limits what the deadband wants
+	   to send (heartbeats pass); with the deadband off it is the send
+	   schedule itself. */
+private:
+	RateControlConfig cfg;
+	RateStats stats;
+	hduVector3Dd window_pos;	// position at window_ts, start of the current difference window
+	double velocity[3];			// smoothed (mm/s)
+	double accel[3];			// smoothed derivative of velocity (mm/s^2)
+	ts_t window_ts;
+	double activity;			// 0: min_hz .. 1: max_hz, held
+	ts_t activity_at;			// when activity was last set
+	ts_t last_ts;
+	ts_t last_sent;
+	bool started;
+	bool has_sent;
+	RateBand band;
+
+	double Measure() const {
+		/* where the current motion lies between the bounds, 0..1 */
+		double speed = sqrt(velocity[0] * velocity[0] + velocity[1] * velocity[1] + velocity[2] * velocity[2]);
+		double level = cfg.fast_mm_s > cfg.slow_mm_s ? (speed - cfg.slow_mm_s) / (cfg.fast_mm_s - cfg.slow_mm_s)
+													 : (speed > cfg.slow_mm_s ? 1 : 0);
+		if (cfg.accel_mm_s2 > 0) {
+			double a = sqrt(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+			level = std::max(level, a / cfg.accel_mm_s2);
+		}
+		return std::min(1.0, std::max(0.0, level));
+	}
+
+public:
+	RateController(const RateControlConfig &cfg = RateControlConfig()) : cfg(cfg), window_ts(0), activity(0), activity_at(0),
+		last_ts(0), last_sent(0), started(false), has_sent(false), band(RATE_STILL) {
+		memset(velocity, 0, sizeof(velocity));
+		memset(accel, 0, sizeof(accel));
+	}
+
+	void Configure(const RateControlConfig &config) {
+		cfg = config;
+	}
+
+	const RateControlConfig& getConfig() const {
+		return cfg;
+	}
+
+	void Track(const hduVector3Dd &pos, ts_t now) {
+		/* local position at now, every tick */
+		if (!started) {
+			window_pos = pos;
+			window_ts = now;
+		}
+		else if (now > last_ts) {
+			stats.time_us[band] += now - last_ts;
+		}
+		if (now - window_ts >= (ts_t)(RATE_WINDOW_MS * 1000)) {
+			// per-tick differences would turn a few 100 us of tick jitter into large accelerations
+			double dt = (now - window_ts) * 1e-6;
+			for (int i = 0; i < 3; i++) {
+				double v = velocity[i] + RATE_SMOOTHING * ((pos[i] - window_pos[i]) / dt - velocity[i]);
+				accel[i] += RATE_SMOOTHING * ((v - velocity[i]) / dt - accel[i]);
+				velocity[i] = v;
+			}
+			window_pos = pos;
+			window_ts = now;
+		}
+		last_ts = now;
+		started = true;
+
+		double level = Measure();
+		if (level >= activity || now - activity_at > (ts_t)(cfg.hold_ms * 1000)) {
+			activity = level;
+			activity_at = now;
+		}
+		band = activity <= 0 ? RATE_STILL : activity >= 1 ? RATE_FAST : RATE_MOVING;
+		stats.ticks[band]++;
+	}
+
+	double getRateHz() const {
+		/* current bound on the send rate (Hz), 0 when disabled */
+		if (!cfg.enabled)
+			return 0;
+		return cfg.min_hz + activity * (cfg.max_hz - cfg.min_hz);
+	}
+
+	RateBand getBand() const {
+		return band;
+	}
+
+	bool Due(ts_t now) const {
+		/* whether a packet may go out at now. heartbeats are not limited. */
+		if (!cfg.enabled || !has_sent)
+			return true;
+		double hz = getRateHz();
+		return hz > 0 && now - last_sent + RATE_SLACK_US >= (ts_t)(1e6 / hz);
+	}
+
+	void OnHeld() {
+		/* a send the deadband asked for was deferred because it was not Due */
+		stats.held++;
+	}
+
+	void OnSent(ts_t now) {
+		stats.sent[band]++;
+		last_sent = now;
+		has_sent = true;
+	}
+
+	const RateStats& getStats() const {
+		return stats;
+	}
+};
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hd_api.h"
+
+#if defined(linux) || defined(__linux__)
+#define HD_LINUX_REALTIME
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#else
+#include <Windows.h>
+#endif
+
+/* Optional real-time profile of a station: lock the process memory,
+   pre-fault the stacks of the hot threads, pin servo, network and logger
+   threads to their own cores and raise the network thread to a real-time
+   scheduling class. Every step is best effort (missing privileges just
+   skip it); the Configure functions return the RT_* bits of what took. */
+
+#define RT_STACK_PREFAULT_BYTES (256 * 1024)	// stack touched by PrefaultStack
+#define RT_NETWORK_PRIORITY 80				// SCHED_FIFO priority of the network thread, below the HDAPI servo
+#define RT_SERVO_PRIORITY 90				// for SimScheduler; HDAPI runs its servo thread at its own priority
+
+#define RT_MEMORY_LOCKED 1
+#define RT_PINNED 2
+#define RT_PRIORITY 4
+#define RT_PREFAULTED 8
+
+#ifdef HD_LINUX_REALTIME
+typedef pthread_t RealtimeThreadHandle;
+#else
+typedef HANDLE RealtimeThreadHandle;
+#endif
+
+struct RealtimeThreadConfig {
+	/* what to do to one thread */
+	int cpu;						// core to pin to, -1: leave unpinned
+	int priority;					// real-time priority (SCHED_FIFO on Linux, time critical on Windows), 0: leave
+	bool prefault_stack;			// touch RT_STACK_PREFAULT_BYTES of stack (only from the thread itself)
+
+	RealtimeThreadConfig(int cpu = -1, int priority = 0, bool prefault_stack = false) :
+		cpu(cpu), priority(priority), prefault_stack(prefault_stack) {}
+};
+
+struct RealtimeProfile {
+	bool enabled;
+	bool lock_memory;				// mlockall: no page faults once running
+	RealtimeThreadConfig servo;
+	RealtimeThreadConfig network;
+	RealtimeThreadConfig logger;	// all logger writer threads share it
+
+	RealtimeProfile() : enabled(false), lock_memory(true) {}
+
+	void Enable(int servo_cpu, int network_cpu, int logger_cpu) {
+		enabled = true;
+		servo = RealtimeThreadConfig(servo_cpu, 0, true);
+		network = RealtimeThreadConfig(network_cpu, RT_NETWORK_PRIORITY, true);
+		logger = RealtimeThreadConfig(logger_cpu, 0, false);
+	}
+
+	void EnableDefault() {
+		/* servo on the last core, network on the one before, loggers on core 0. no pinning below 3 cores. */
+		int cores = (int)std::thread::hardware_concurrency();
+		if (cores >= 3)
+			Enable(cores - 1, cores - 2, 0);
+		else
+			Enable(-1, -1, -1);
+	}
+
+	bool Parse(const std::string &arg) {
+		/* "rt" (EnableDefault) or "rt=<servo cpu>,<network cpu>,<logger cpu>". false if arg is neither. */
+		if (arg == "rt") {
+			EnableDefault();
+			return true;
+		}
+		int cpus[3];
+		if (arg.compare(0, 3, "rt=") != 0 || sscanf(arg.c_str() + 3, "%d,%d,%d", &cpus[0], &cpus[1], &cpus[2]) != 3)
+			return false;
+		Enable(cpus[0], cpus[1], cpus[2]);
+		return true;
+	}
+};
+
+inline std::string RealtimeSummary(int applied) {
+	/* human readable RT_* bits */
+	std::string out;
+	if (applied & RT_MEMORY_LOCKED) out += " memory-locked";
+	if (applied & RT_PINNED) out += " pinned";
+	if (applied & RT_PRIORITY) out += " rt-priority";
+	if (applied & RT_PREFAULTED) out += " stack-prefaulted";
+	return out.empty() ? " nothing" : out;
+}
+
+inline bool LockMemory() {
+	/* lock current and future pages; new thread stacks are then faulted in when created */
+#ifdef HD_LINUX_REALTIME
+	return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+#else
+	return false;	// no mlockall; the working set can only be raised, not locked, per process
+#endif
+}
+
+inline void PrefaultStack() {
+	/* grow the calling thread's stack now rather than in the middle of a tick */
+	volatile char stack[RT_STACK_PREFAULT_BYTES];
+	for (size_t i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+}
+
+inline RealtimeThreadHandle CurrentThreadHandle() {
+#ifdef HD_LINUX_REALTIME
+	return pthread_self();
+#else
+	return GetCurrentThread();
+#endif
+}
+
+inline bool PinThread(RealtimeThreadHandle thread, int cpu) {
+#ifdef HD_LINUX_REALTIME
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set) == 0;
+#else
+	return SetThreadAffinityMask(thread, (DWORD_PTR)1 << cpu) != 0;
+#endif
+}
+
+inline bool SetThreadRealtime(RealtimeThreadHandle thread, int priority) {
+#ifdef HD_LINUX_REALTIME
+	sched_param param;
+	param.sched_priority = priority;
+	return pthread_setschedparam(thread, SCHED_FIFO, &param) == 0;
+#else
+	(void)priority;
+	return SetThreadPriority(thread, THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#endif
+}
+
+inline int ConfigureThread(RealtimeThreadHandle thread, const RealtimeThreadConfig &config) {
+	/* pinning and priority of any thread. returns RT_* bits */
+	int applied = 0;
+	if (config.cpu >= 0 && PinThread(thread, config.cpu))
+		applied |= RT_PINNED;
+	if (config.priority > 0 && SetThreadRealtime(thread, config.priority))
+		applied |= RT_PRIORITY;
+	return applied;
+}
+
+inline int ConfigureCurrentThread(const RealtimeThreadConfig &config) {
+	/* ConfigureThread plus the stack pre-fault, which only the thread itself can do */
+	int applied = ConfigureThread(CurrentThreadHandle(), config);
+	if (config.prefault_stack) {
+		PrefaultStack();
+		applied |= RT_PREFAULTED;
+	}
+	return applied;
+}
+
+struct RealtimeServoSetup {
+	/* request for ConfigureServoThread; applied is -1 until the servo thread ran it */
+	RealtimeThreadConfig config;
+	std::atomic<int> applied;
+
+	RealtimeServoSetup(const RealtimeThreadConfig &config) : config(config), applied(-1) {}
+};
+
+inline HDCallbackCode HDCALLBACK ConfigureServoThread(void *data) {
+	/* one-shot scheduler callback (hdScheduleSynchronous, SimScheduler::Schedule): configures the thread it runs on */
+	RealtimeServoSetup *setup = static_cast<RealtimeServoSetup *>(data);
+	setup->applied.store(ConfigureCurrentThread(setup->config), std::memory_order_release);
+	return HD_CALLBACK_DONE;
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hd_types.h"
+#include "hd_packet.h"
+#include "hd_seqwindow.h"
+
+#define REDUNDANCY_MAX 4				// previous samples repeated per datagram, at most
+#define PARITY_GROUP_MAX 8				// packets covered by one parity datagram, at most
+#define PARITY_SIZE 32					// parity datagram: xor of the group + first packet number + group size
+#define BUNDLE_MAX_SIZE (PACKET_SIZE * (1 + REDUNDANCY_MAX))
+#define RECOVERED_QUEUE_SIZE 16			// recovered samples waiting to be taken
+
+enum RedundancyMode {
+	REDUNDANCY_OFF,
+	REDUNDANCY_REPEAT,		// every datagram carries the current sample plus the previous level samples
+	REDUNDANCY_PARITY		// after every level packets, one xor parity datagram over them
+};
+
+struct RedundancyStats {
+	uint64_t redundant_bytes;		// sent on top of the plain stream
+	uint64_t parity_sent;
+	uint64_t recovered;				// missing samples rebuilt from later datagrams
+	uint64_t parity_unusable;		// parity datagrams with more than one packet of their group missing
+
+	RedundancyStats() {
+		memset(this, 0, sizeof(RedundancyStats));
+	}
+};
+
+class RedundancyCodec {
+	/* Forward error correction for the raw packet layout, one instance per
+	   session. Datagram kinds are told apart by size: a bundle is a multiple
+	   of PACKET_SIZE (newest sample first), a parity datagram is PARITY_SIZE.
+	//
+	// parity: # xor of the group's packets (24) # first packet number # group size # pad #
+	*/
+private:
+	RedundancyMode mode;
+	int level;
+
+	// send side
+	HapticPacket history[REDUNDANCY_MAX];	// previous samples, history[0] newest
+	int history_count;
+	char parity[PACKET_SIZE];
+	cnt_t group_first;
+	int group_count;
+
+	// receive side
+	HapticPacket store[SEQ_WINDOW_SIZE];	// recently received packets by number, for parity
+	cnt_t store_num[SEQ_WINDOW_SIZE];
+	bool store_valid[SEQ_WINDOW_SIZE];
+	HapticPacket recovered[RECOVERED_QUEUE_SIZE];
+	int recovered_count;
+
+	RedundancyStats stats;
+
+	void Recover(HapticPacket &packet, SequenceWindow &window) {
+		window.Mark(packet.GetPacketNum());
+		Remember(packet);
+		Enqueue(packet);
+		stats.recovered++;
+	}
+
+public:
+	RedundancyCodec() : mode(REDUNDANCY_OFF), level(0), history_count(0), group_first(0), group_count(0), recovered_count(0) {
+		memset(parity, 0, sizeof(parity));
+		memset(store_num, 0, sizeof(store_num));
+		memset(store_valid, 0, sizeof(store_valid));
+	}
+
+	void Configure(RedundancyMode redundancy_mode, int redundancy_level) {
+		/* level: repeated samples (REPEAT) or parity group size (PARITY) */
+		mode = redundancy_mode;
+		int max_level = mode == REDUNDANCY_PARITY ? PARITY_GROUP_MAX : REDUNDANCY_MAX;
+		level = std::max(1, std::min(redundancy_level, max_level));
+		history_count = 0;
+		group_count = 0;
+	}
+
+	RedundancyMode getMode() const {
+		return mode;
+	}
+
+	int getLevel() const {
+		return level;
+	}
+
+	int Bundle(HapticPacket &packet, char *out) {
+		/* REPEAT: current sample followed by up to level previous ones. returns the datagram length. */
+		memcpy(out, packet.ToArray(), PACKET_SIZE);
+		for (int i = 0; i < history_count; i++)
+			memcpy(out + (i + 1) * PACKET_SIZE, history[i].ToArray(), PACKET_SIZE);
+		int len = (history_count + 1) * PACKET_SIZE;
+		stats.redundant_bytes += len - PACKET_SIZE;
+
+		for (int i = std::min(history_count, level - 1); i > 0; i--)
+			history[i] = history[i - 1];
+		history[0] = packet;
+		if (history_count < level)
+			history_count++;
+		return len;
+	}
+
+	bool Parity(HapticPacket &packet, char *out) {
+		/* PARITY: add packet to the current group. true when the group is complete and out holds its parity datagram. */
+		if (group_count == 0) {
+			memset(parity, 0, sizeof(parity));
+			group_first = packet.GetPacketNum();
+		}
+		const char *data = packet.ToArray();
+		for (int i = 0; i < PACKET_SIZE; i++)
+			parity[i] ^= data[i];
+		if (++group_count < level)
+			return false;
+
+		memset(out, 0, PARITY_SIZE);
+		memcpy(out, parity, PACKET_SIZE);
+		memcpy(out + PACKET_SIZE, &group_first, sizeof(cnt_t));
+		out[PACKET_SIZE + sizeof(cnt_t)] = (char)group_count;
+		group_count = 0;
+		stats.parity_sent++;
+		stats.redundant_bytes += PARITY_SIZE;
+		return true;
+	}
+
+	void Remember(HapticPacket &packet) {
+		/* keep a received packet for parity recovery */
+		cnt_t num = packet.GetPacketNum();
+		uint32_t slot = num % SEQ_WINDOW_SIZE;
+		store[slot] = packet;
+		store_num[slot] = num;
+		store_valid[slot] = true;
+	}
+
+	void Enqueue(HapticPacket &packet) {
+		/* hand a sample that is not the newest to TakeRecovered (also used for late reordered packets) */
+		if (recovered_count == RECOVERED_QUEUE_SIZE) {
+			// nobody takes them: drop the oldest
+			std::copy(recovered + 1, recovered + RECOVERED_QUEUE_SIZE, recovered);
+			recovered_count--;
+		}
+		recovered[recovered_count++] = packet;
+	}
+
+	void ReceiveBundle(const char *data, int len, SequenceWindow &window) {
+		/* recover the repeated samples of a bundle that never arrived on their own */
+		for (int offset = PACKET_SIZE; offset + PACKET_SIZE <= len; offset += PACKET_SIZE) {
+			HapticPacket extra(data + offset);
+			cnt_t num = extra.GetPacketNum();
+			if (window.InWindow(num) && !window.Contains(num))
+				Recover(extra, window);
+		}
+	}
+
+	void ReceiveParity(const char *data, SequenceWindow &window) {
+		/* rebuild the one missing packet of a parity group, if exactly one is missing */
+		cnt_t first;
+		memcpy(&first, data + PACKET_SIZE, sizeof(cnt_t));
+		int count = (uint8_t)data[PACKET_SIZE + sizeof(cnt_t)];
+		if (count < 1 || count > PARITY_GROUP_MAX)
+			return;
+
+		char rebuilt[PACKET_SIZE];
+		memcpy(rebuilt, data, PACKET_SIZE);
+		int missing = 0;
+		for (int i = 0; i < count; i++) {
+			cnt_t num = first + i;
+			uint32_t slot = num % SEQ_WINDOW_SIZE;
+			if (store_valid[slot] && store_num[slot] == num) {
+				const char *member = store[slot].ToArray();
+				for (int b = 0; b < PACKET_SIZE; b++)
+					rebuilt[b] ^= member[b];
+			}
+			else if (window.InWindow(num) && !window.Contains(num)) {
+				missing++;
+			}
+			else {
+				missing = 2;	// received but no longer stored: cannot rebuild
+				break;
+			}
+		}
+		if (missing == 0)
+			return;
+		if (missing > 1) {
+			stats.parity_unusable++;
+			return;
+		}
+		HapticPacket packet(rebuilt);
+		Recover(packet, window);
+	}
+
+	int TakeRecovered(HapticPacket *out, int max) {
+		/* recovered samples since the last call, oldest packet number first */
+		int n = std::min(recovered_count, max);
+		std::copy(recovered, recovered + n, out);
+		std::sort(out, out + n, [](HapticPacket &a, HapticPacket &b) { return (int32_t)(a.GetPacketNum() - b.GetPacketNum()) < 0; });
+		std::copy(recovered + n, recovered + recovered_count, recovered);
+		recovered_count -= n;
+		return n;
+	}
+
+	const RedundancyStats& getStats() const {
+		return stats;
+	}
+};
@@ -0,0 +1,623 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hd_socket.h"
+#include "hd_packet.h"
+#include "hd_codec.h"
+#include "hd_types.h"
+
+#define RELAY_BATCH_SIZE 64			// datagrams per recvmmsg/sendmmsg call
+#define RELAY_MAX_DATAGRAM 256		// larger datagrams are dropped
+#define RELAY_POLL_US 1000			// worker wait when idle
+#define RELAY_JOIN_SIZE 36			// join datagram, told apart from packets by size
+#define RELAY_JOIN_MAGIC 0x4a524448	// "HDRJ"
+#define RELAY_KEY_SIZE 28			// session key bytes in a join, NUL padded
+#define RELAY_JOIN_INTERVAL_US 1000000	// clients repeat their join this often
+#define RELAY_TAKEOVER_MS 500		// a side silent this long goes to a new endpoint joining with the same key
+#define RELAY_IDLE_S 10				// endpoints (and then their sessions) silent this long expire
+
+inline int BuildRelayJoin(const std::string &key, char role, char *out) {
+	/* join datagram asking the relay to pair us with the other endpoint using key (RELAY_JOIN_SIZE bytes).
+	   role 'M' prefers side 0, anything else side 1. returns its length. */
+	memset(out, 0, RELAY_JOIN_SIZE);
+	uint32_t magic = RELAY_JOIN_MAGIC;
+	memcpy(out, &magic, sizeof(magic));
+	out[4] = role;
+	memcpy(out + 8, key.data(), key.size() < RELAY_KEY_SIZE ? key.size() : RELAY_KEY_SIZE);
+	return RELAY_JOIN_SIZE;
+}
+
+inline bool ParseRelayJoin(const char *data, int len, std::string &key, char &role) {
+	/* false if data is not a join datagram */
+	uint32_t magic;
+	if (len != RELAY_JOIN_SIZE)
+		return false;
+	memcpy(&magic, data, sizeof(magic));
+	if (magic != RELAY_JOIN_MAGIC)
+		return false;
+	role = data[4];
+	key.assign(data + 8, strnlen(data + 8, RELAY_KEY_SIZE));
+	return !key.empty();
+}
+
+struct RelayDirection {
+	/* counters for one direction of a session. written by the shard
+	   receiving from that side (two shards while a new endpoint takes it
+	   over), read by the stats reporter. */
+	std::atomic<uint64_t> packets;
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> lost;				// gaps in packet numbers
+	std::atomic<uint64_t> reordered;		// packets older than the newest seen
+	std::atomic<uint64_t> residence_ns;		// total time from receive to forward
+	std::atomic<uint64_t> max_residence_ns;
+	std::atomic<cnt_t> highest_num;			// newest packet number of the current endpoint, 0: none yet
+
+	RelayDirection() : packets(0), bytes(0), lost(0), reordered(0), residence_ns(0), max_residence_ns(0), highest_num(0) {}
+
+	void Restart() {
+		/* a new endpoint took this side: its packet numbers start over. the totals carry on. */
+		highest_num.store(0, std::memory_order_relaxed);
+	}
+
+	void Count(const char *data, int32_t len) {
+		packets.fetch_add(1, std::memory_order_relaxed);
+		bytes.fetch_add(len, std::memory_order_relaxed);
+		cnt_t num = 0;
+		uint16_t seq;
+		bool compact = false;
+		if (len >= PACKET_SIZE && len % PACKET_SIZE == 0)	// raw, or a redundancy bundle led by its current sample
+			memcpy(&num, data + COUNT_OFFSET, sizeof(cnt_t));
+		else if (CompactPeekSequence(data, len, seq))
+			compact = true;
+		else
+			return;
+		// during a handover the shards of the old and the new endpoint may both count here: CAS, not a store
+		cnt_t highest = highest_num.load(std::memory_order_relaxed);
+		while (true) {
+			if (compact)
+				num = highest ? highest + (int16_t)(seq - (uint16_t)highest) : seq;	// 16-bit, unwrap
+			if (highest != 0 && num <= highest) {
+				reordered.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			if (highest_num.compare_exchange_weak(highest, num, std::memory_order_relaxed))
+				break;
+		}
+		if (highest != 0 && num > highest + 1)
+			lost.fetch_add(num - highest - 1, std::memory_order_relaxed);
+	}
+
+	void Residence(uint64_t ns) {
+		residence_ns.fetch_add(ns, std::memory_order_relaxed);
+		if (ns > max_residence_ns.load(std::memory_order_relaxed))
+			max_residence_ns.store(ns, std::memory_order_relaxed);
+	}
+};
+
+struct RelaySession {
+	/* a master/slave pair. side 0 and 1 are the two endpoints; an endpoint
+	   with port 0 has not joined yet (or expired). */
+	uint32_t id;
+	std::string key;				// join key, empty for configured and arrival-order sessions
+	bool configured;				// from AddPair/LoadPairs: never expires
+	sockaddr_in endpoint[2];
+	std::atomic<bool> paired;
+	std::atomic<int64_t> last_seen_ms[2];	// last datagram or join from each side, relaxed
+	RelayDirection forward[2];		// forward[i]: traffic received from endpoint i
+
+	RelaySession(uint32_t id) : id(id), configured(false), paired(false) {
+		memset(endpoint, 0, sizeof(endpoint));
+		last_seen_ms[0] = last_seen_ms[1] = 0;
+	}
+
+	bool HasEndpoint(int side) const {
+		return endpoint[side].sin_port != 0;
+	}
+
+	void Touch(int side, int64_t now_ms) {
+		// once per datagram from the shard owning that endpoint; skip the store when nothing changed
+		if (last_seen_ms[side].load(std::memory_order_relaxed) != now_ms)
+			last_seen_ms[side].store(now_ms, std::memory_order_relaxed);
+	}
+};
+
+inline uint64_t EndpointKey(const sockaddr_in &addr) {
+	return ((uint64_t)addr.sin_addr.s_addr << 16) | addr.sin_port;
+}
+
+inline int64_t RelayNowMs() {
+	using namespace std::chrono;
+	return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+class RelaySessionTable {
+	/* Endpoint -> session map shared by all shards. Lookups go through a
+	   per-shard cache; the table itself is only locked when an endpoint is
+	   seen for the first time, on joins and by Expire. Endpoints are paired
+	   by the key in their join datagrams (see BuildRelayJoin) or by a pairs
+	   file; arrival-order pairing of unknown endpoints is opt-in, since one
+	   stray datagram or a restarted client shifts every later pair. Any
+	   change to the routes bumps the generation, which makes the shards drop
+	   their caches. Joined and arrival-order endpoints expire after a quiet
+	   period, their session once both sides are gone; removed sessions are
+	   deleted one Expire later, when no shard can still hold them. */
+public:
+	struct Route {
+		RelaySession *session;
+		int side;
+		sockaddr_in peer;			// where traffic from this endpoint goes, copied when paired
+	};
+
+private:
+	std::mutex mutex;
+	std::unordered_map<uint64_t, Route> routes;
+	std::unordered_map<std::string, RelaySession*> keyed;
+	std::deque<RelaySession*> sessions;
+	std::vector<RelaySession*> retired;		// removed by the last Expire, deleted by the next
+	RelaySession *waiting;			// arrival order: session with one endpoint, waiting for its peer
+	bool auto_pair;
+	uint32_t next_id;
+	std::atomic<uint64_t> generation;
+	uint64_t joins;
+	uint64_t refused_joins;			// both sides of the key held by live endpoints
+
+	RelaySession* NewSession() {
+		RelaySession *s = new RelaySession(next_id++);
+		sessions.push_back(s);
+		return s;
+	}
+
+	void Changed() {
+		generation.fetch_add(1, std::memory_order_release);
+	}
+
+	void SetEndpoint(RelaySession *s, int side, const sockaddr_in &addr) {
+		// every change of endpoint[side] goes through here: a new endpoint numbers its packets afresh
+		s->endpoint[side] = addr;
+		s->forward[side].Restart();
+	}
+
+	void SetRoute(RelaySession *s, int side) {
+		Route r = { s, side, s->endpoint[1 - side] };
+		routes[EndpointKey(s->endpoint[side])] = r;
+	}
+
+	void Link(RelaySession *s) {
+		// both sides present: point each route at the other endpoint
+		bool paired = s->HasEndpoint(0) && s->HasEndpoint(1);
+		for (int side = 0; side < 2; side++)
+			if (s->HasEndpoint(side))
+				SetRoute(s, side);
+		s->paired.store(paired, std::memory_order_release);
+		Changed();
+	}
+
+	void Leave(RelaySession *s, int side) {
+		routes.erase(EndpointKey(s->endpoint[side]));
+		sockaddr_in none;
+		memset(&none, 0, sizeof(none));
+		SetEndpoint(s, side, none);
+		Link(s);
+	}
+
+	void Remove(RelaySession *s) {
+		for (int side = 0; side < 2; side++)
+			if (s->HasEndpoint(side))
+				routes.erase(EndpointKey(s->endpoint[side]));
+		if (!s->key.empty())
+			keyed.erase(s->key);
+		if (waiting == s)
+			waiting = NULL;
+		for (std::deque<RelaySession*>::iterator it = sessions.begin(); it != sessions.end(); ++it) {
+			if (*it == s) {
+				sessions.erase(it);
+				break;
+			}
+		}
+		retired.push_back(s);
+		Changed();
+	}
+
+public:
+	RelaySessionTable(bool auto_pair = false) :
+		waiting(NULL), auto_pair(auto_pair), next_id(0), generation(0), joins(0), refused_joins(0) {}
+
+	~RelaySessionTable() {
+		for (size_t i = 0; i < sessions.size(); i++)
+			delete sessions[i];
+		for (size_t i = 0; i < retired.size(); i++)
+			delete retired[i];
+	}
+
+	void AddPair(const sockaddr_in &a, const sockaddr_in &b) {
+		std::lock_guard<std::mutex> lock(mutex);
+		RelaySession *s = NewSession();
+		s->configured = true;
+		s->endpoint[0] = a;
+		s->endpoint[1] = b;
+		Link(s);
+	}
+
+	bool LoadPairs(const std::string &filename) {
+		/* one pair per line: "hostA portA hostB portB" */
+		std::ifstream in(filename.c_str());
+		if (!in.is_open())
+			return false;
+		std::string line;
+		while (std::getline(in, line)) {
+			std::istringstream fields(line);
+			std::string host_a, host_b;
+			uint32_t port_a, port_b;
+			if (fields >> host_a >> port_a >> host_b >> port_b) {
+				sockaddr_in a, b;
+				MakeAddress(a, host_a.c_str(), port_a);
+				MakeAddress(b, host_b.c_str(), port_b);
+				AddPair(a, b);
+			}
+		}
+		return true;
+	}
+
+	bool Join(const sockaddr_in &from, const std::string &key, char role, int64_t now_ms) {
+		/* join datagram from an endpoint: put it on a side of the session named key. an endpoint
+		   rejoining the same side only refreshes it; a new one (a restarted client on another port)
+		   takes its role's side once that has been silent for RELAY_TAKEOVER_MS, else the other side
+		   if free. false if both sides are held by live endpoints. */
+		std::lock_guard<std::mutex> lock(mutex);
+		joins++;
+		uint64_t endpoint_key = EndpointKey(from);
+		std::unordered_map<uint64_t, Route>::iterator it = routes.find(endpoint_key);
+		if (it != routes.end()) {
+			if (it->second.session->key == key) {
+				it->second.session->Touch(it->second.side, now_ms);
+				return true;
+			}
+			if (it->second.session->configured)
+				return false;
+			// the endpoint switches sessions
+			Leave(it->second.session, it->second.side);
+		}
+
+		RelaySession *s;
+		std::unordered_map<std::string, RelaySession*>::iterator found = keyed.find(key);
+		if (found != keyed.end()) {
+			s = found->second;
+		}
+		else {
+			s = NewSession();
+			s->key = key;
+			keyed[key] = s;
+		}
+
+		int preferred = role == 'M' ? 0 : 1;
+		int side = -1;
+		for (int i = 0; i < 2 && side < 0; i++) {
+			int candidate = i == 0 ? preferred : 1 - preferred;
+			if (!s->HasEndpoint(candidate) ||
+				now_ms - s->last_seen_ms[candidate].load(std::memory_order_relaxed) > RELAY_TAKEOVER_MS)
+				side = candidate;
+		}
+		if (side < 0) {
+			refused_joins++;
+			return false;
+		}
+		if (s->HasEndpoint(side))
+			routes.erase(EndpointKey(s->endpoint[side]));
+		SetEndpoint(s, side, from);
+		s->last_seen_ms[side].store(now_ms, std::memory_order_relaxed);
+		Link(s);
+		return true;
+	}
+
+	bool Lookup(const sockaddr_in &from, Route &route) {
+		/* slow path: find or (arrival-order pairing) create the route for an endpoint */
+		std::lock_guard<std::mutex> lock(mutex);
+		uint64_t key = EndpointKey(from);
+		std::unordered_map<uint64_t, Route>::iterator it = routes.find(key);
+		if (it != routes.end()) {
+			route = it->second;
+			return true;
+		}
+		if (!auto_pair)
+			return false;
+
+		RelaySession *s = waiting;
+		int side = 1;
+		if (s == NULL) {
+			s = waiting = NewSession();
+			side = 0;
+		}
+		else {
+			waiting = NULL;
+		}
+		SetEndpoint(s, side, from);
+		s->last_seen_ms[side].store(RelayNowMs(), std::memory_order_relaxed);
+		Link(s);
+		route = routes[key];
+		return true;
+	}
+
+	size_t Expire(int64_t now_ms, int64_t idle_ms) {
+		/* drop joined and arrival-order endpoints silent for idle_ms, and sessions left without any.
+		   sessions removed by the previous call are deleted now. returns the number of endpoints dropped. */
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < retired.size(); i++)
+			delete retired[i];
+		retired.clear();
+
+		size_t expired = 0;
+		std::vector<RelaySession*> empty;
+		for (size_t i = 0; i < sessions.size(); i++) {
+			RelaySession *s = sessions[i];
+			if (s->configured)
+				continue;
+			for (int side = 0; side < 2; side++) {
+				if (s->HasEndpoint(side) && now_ms - s->last_seen_ms[side].load(std::memory_order_relaxed) > idle_ms) {
+					Leave(s, side);
+					expired++;
+				}
+			}
+			if (!s->HasEndpoint(0) && !s->HasEndpoint(1))
+				empty.push_back(s);
+		}
+		for (size_t i = 0; i < empty.size(); i++)
+			Remove(empty[i]);
+		return expired;
+	}
+
+	uint64_t getGeneration() const {
+		return generation.load(std::memory_order_acquire);
+	}
+
+	uint64_t getJoins() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return joins;
+	}
+
+	uint64_t getRefusedJoins() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return refused_joins;
+	}
+
+	size_t SessionCount() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return sessions.size();
+	}
+
+	RelaySession* Session(size_t i) {
+		/* valid until the Expire after next; call from the thread running Expire */
+		std::lock_guard<std::mutex> lock(mutex);
+		return i < sessions.size() ? sessions[i] : NULL;
+	}
+
+	void Endpoints(const RelaySession *s, sockaddr_in out[2]) {
+		/* consistent copy of a session's endpoints (joins may change them) */
+		std::lock_guard<std::mutex> lock(mutex);
+		memcpy(out, s->endpoint, 2 * sizeof(sockaddr_in));
+	}
+};
+
+class RelayShard {
+	/* One worker thread with its own SO_REUSEPORT socket. The kernel hashes
+	   each source to one shard; replies can leave from any shard socket since
+	   they all share the relay port. Datagrams are forwarded from the receive
+	   buffers without copying. */
+private:
+	RelaySessionTable *table;
+	SOCKET sock;
+	SocketPoller poller;
+	std::unordered_map<uint64_t, RelaySessionTable::Route> cache;
+	uint64_t cache_generation;		// table generation the cache was filled under
+	std::thread *thread;
+	std::atomic<bool> running;
+	std::atomic<uint64_t> unpaired_drops;
+	std::atomic<uint64_t> send_failures;
+	std::atomic<uint64_t> batches;
+	std::atomic<uint64_t> datagrams;
+
+#ifdef HD_LINUX_SOCKETS
+	char buffers[RELAY_BATCH_SIZE][RELAY_MAX_DATAGRAM];
+	sockaddr_in sources[RELAY_BATCH_SIZE];
+	iovec recv_iovecs[RELAY_BATCH_SIZE];
+	mmsghdr recv_msgs[RELAY_BATCH_SIZE];
+	iovec send_iovecs[RELAY_BATCH_SIZE];
+	mmsghdr send_msgs[RELAY_BATCH_SIZE];
+	sockaddr_in send_addrs[RELAY_BATCH_SIZE];
+	RelayDirection *send_dirs[RELAY_BATCH_SIZE];
+#endif
+
+	static uint64_t NowNs() {
+		using namespace std::chrono;
+		return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+	}
+
+	bool Route(const sockaddr_in &from, RelaySessionTable::Route &route) {
+		uint64_t key = EndpointKey(from);
+		uint64_t generation = table->getGeneration();
+		if (generation != cache_generation) {
+			// a session was paired, rejoined or expired somewhere: cached routes may be stale
+			cache.clear();
+			cache_generation = generation;
+		}
+		std::unordered_map<uint64_t, RelaySessionTable::Route>::iterator it = cache.find(key);
+		if (it != cache.end()) {
+			route = it->second;
+			return true;
+		}
+		if (!table->Lookup(from, route))
+			return false;
+		// cache only complete sessions; a waiting endpoint is looked up again until paired
+		if (route.session->paired.load(std::memory_order_acquire))
+			cache[key] = route;
+		return true;
+	}
+
+	bool Join(const sockaddr_in &from, const char *data, int len, int64_t now_ms) {
+		// join datagrams are handled here and never forwarded
+		std::string key;
+		char role;
+		if (!ParseRelayJoin(data, len, key, role))
+			return false;
+		table->Join(from, key, role, now_ms);
+		return true;
+	}
+
+#ifdef HD_LINUX_SOCKETS
+	void Run() {
+		memset(recv_msgs, 0, sizeof(recv_msgs));
+		memset(send_msgs, 0, sizeof(send_msgs));
+		for (int i = 0; i < RELAY_BATCH_SIZE; i++) {
+			recv_iovecs[i].iov_base = buffers[i];
+			recv_iovecs[i].iov_len = RELAY_MAX_DATAGRAM;
+			recv_msgs[i].msg_hdr.msg_iov = &recv_iovecs[i];
+			recv_msgs[i].msg_hdr.msg_iovlen = 1;
+			recv_msgs[i].msg_hdr.msg_name = &sources[i];
+			send_msgs[i].msg_hdr.msg_iov = &send_iovecs[i];
+			send_msgs[i].msg_hdr.msg_iovlen = 1;
+			send_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+		}
+
+		while (running.load(std::memory_order_acquire)) {
+			for (int i = 0; i < RELAY_BATCH_SIZE; i++)
+				recv_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+			int n = recvmmsg(sock, recv_msgs, RELAY_BATCH_SIZE, MSG_DONTWAIT, NULL);
+			if (n <= 0) {
+				poller.Wait(RELAY_POLL_US);
+				continue;
+			}
+			uint64_t received_at = NowNs();
+			batches.fetch_add(1, std::memory_order_relaxed);
+			datagrams.fetch_add(n, std::memory_order_relaxed);
+
+			int64_t now_ms = (int64_t)(received_at / 1000000);
+			int out = 0;
+			for (int i = 0; i < n; i++) {
+				if (Join(sources[i], buffers[i], recv_msgs[i].msg_len, now_ms))
+					continue;
+				RelaySessionTable::Route route;
+				if (!Route(sources[i], route) || !route.session->paired.load(std::memory_order_acquire)) {
+					unpaired_drops.fetch_add(1, std::memory_order_relaxed);
+					continue;
+				}
+				route.session->Touch(route.side, now_ms);
+				RelayDirection &dir = route.session->forward[route.side];
+				dir.Count(buffers[i], recv_msgs[i].msg_len);
+				send_iovecs[out].iov_base = buffers[i];
+				send_iovecs[out].iov_len = recv_msgs[i].msg_len;
+				send_addrs[out] = route.peer;
+				send_msgs[out].msg_hdr.msg_name = &send_addrs[out];
+				send_dirs[out] = &dir;
+				out++;
+			}
+
+			// sendmmsg stops at the first datagram that fails: count that one and carry on with the rest
+			int sent = 0;
+			uint64_t residence = 0;
+			while (sent < out) {
+				int m = sendmmsg(sock, send_msgs + sent, out - sent, 0);
+				residence = NowNs() - received_at;
+				for (int i = sent; i < sent + m; i++)
+					send_dirs[i]->Residence(residence);
+				if (m <= 0) {
+					send_failures.fetch_add(1, std::memory_order_relaxed);
+					m = 1;
+				}
+				sent += m;
+			}
+		}
+	}
+#else
+	void Run() {
+		// portable fallback: one datagram per syscall
+		char buffer[RELAY_MAX_DATAGRAM];
+		while (running.load(std::memory_order_acquire)) {
+			sockaddr_in from;
+			socklen_t from_len = sizeof(from);
+			int len = recvfrom(sock, buffer, sizeof(buffer), 0, (sockaddr*)&from, &from_len);
+			if (len <= 0) {
+				poller.Wait(RELAY_POLL_US);
+				continue;
+			}
+			uint64_t received_at = NowNs();
+			batches.fetch_add(1, std::memory_order_relaxed);
+			datagrams.fetch_add(1, std::memory_order_relaxed);
+			int64_t now_ms = (int64_t)(received_at / 1000000);
+			if (Join(from, buffer, len, now_ms))
+				continue;
+			RelaySessionTable::Route route;
+			if (!Route(from, route) || !route.session->paired.load(std::memory_order_acquire)) {
+				unpaired_drops.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+			route.session->Touch(route.side, now_ms);
+			RelayDirection &dir = route.session->forward[route.side];
+			dir.Count(buffer, len);
+			if (sendto(sock, buffer, len, 0, (sockaddr*)&route.peer, sizeof(sockaddr_in)) == SOCKET_ERROR)
+				send_failures.fetch_add(1, std::memory_order_relaxed);
+			else
+				dir.Residence(NowNs() - received_at);
+		}
+	}
+#endif
+
+public:
+	RelayShard(RelaySessionTable *table, uint32_t port) :
+		table(table), cache_generation(0), thread(NULL), running(false), unpaired_drops(0), send_failures(0), batches(0), datagrams(0) {
+		sockaddr_in addr;
+		MakeAddress(addr, "0.0.0.0", port);
+		UDPSocketOptions options;
+		options.reuse_port = true;
+		options.rcvbuf = 8 * SOCKET_BUFFER_SIZE;
+		options.sndbuf = 8 * SOCKET_BUFFER_SIZE;
+		sock = CreateUDPSocket(&addr, options);
+		if (sock != INVALID_SOCKET)
+			poller.Add(sock);
+	}
+
+	~RelayShard() {
+		Stop();
+		if (sock != INVALID_SOCKET)
+			closesocket(sock);
+	}
+
+	bool IsOpen() const {
+		return sock != INVALID_SOCKET;
+	}
+
+	void Start() {
+		if (thread)
+			return;
+		running = true;
+		thread = new std::thread(&RelayShard::Run, this);
+	}
+
+	void Stop() {
+		if (thread == NULL)
+			return;
+		running.store(false, std::memory_order_release);
+		thread->join();
+		delete thread;
+		thread = NULL;
+	}
+
+	uint64_t getUnpairedDrops() const { return unpaired_drops.load(std::memory_order_relaxed); }
+	uint64_t getSendFailures() const { return send_failures.load(std::memory_order_relaxed); }
+	uint64_t getDatagrams() const { return datagrams.load(std::memory_order_relaxed); }
+	double getMeanBatch() const {
+		uint64_t b = batches.load(std::memory_order_relaxed);
+		return b ? (double)datagrams.load(std::memory_order_relaxed) / b : 0;
+	}
+};
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "hd_api.h"
+#include "hd_device.h"
+#include "hd_locallink.h"
+#include "hd_comm.h"
+#include "hd_controller.h"
+#include "hd_logger.h"
+#include "hd_time.h"
+
+/* Trace replay: re-run a recorded session through HapticDeviceController
+   on a virtual clock (SetVirtualClock, simulation builds only), as fast as
+   the controller goes. See ReplayEngine. */
+
+#define REPLAY_TICK_US 1000				// servo period of the replay
+#define REPLAY_DIGEST_SEED 0xcbf29ce484222325ULL	// FNV-1a 64 offset basis
+#define REPLAY_DIGEST_PRIME 0x100000001b3ULL
+
+struct ReplaySample {
+	ts_t time;					// local clock
+	hduVector3Dd pos;
+};
+
+struct ReplayPacket {
+	ts_t arrival;				// local clock
+	ts_t timestamp;				// remote clock, as stamped by the sender
+	cnt_t num;
+	hduVector3Dd pos;
+};
+
+class ReplayTrace {
+	/* One side of a recorded session, from the csv files of its loggers:
+	   local positions from the sent rows of the SNDLogger file, remote
+	   packets with their arrival times from the received rows of the
+	   RCVLogger file. Skipped ticks carry no position, so the local
+	   trajectory is only known at the sent samples; with the deadband on
+	   it is off by at most the deadband threshold in between. */
+public:
+	std::vector<ReplaySample> local;
+	std::vector<ReplayPacket> remote;
+
+private:
+	static void Split(const std::string &line, std::vector<std::string> &fields) {
+		fields.clear();
+		std::stringstream row(line);
+		std::string field;
+		while (std::getline(row, field, ','))
+			fields.push_back(field);
+	}
+
+	static ts_t ParseTs(const std::string &field) {
+		return strtoll(field.c_str(), NULL, 10);
+	}
+
+public:
+	bool LoadSend(const std::string &path) {
+		/* EventTime,Predict?,PacketTime,PacketNo,PosX,PosY,PosZ. false if the file can't be read. */
+		std::ifstream in(path);
+		if (!in.is_open())
+			return false;
+		std::string line;
+		std::vector<std::string> fields;
+		std::getline(in, line);		// header
+		while (std::getline(in, line)) {
+			Split(line, fields);
+			if (fields.size() < 7 || fields[1] != "0")
+				continue;
+			ReplaySample sample;
+			sample.time = ParseTs(fields[2]);
+			for (int i = 0; i < 3; i++)
+				sample.pos[i] = atof(fields[4 + i].c_str());
+			local.push_back(sample);
+		}
+		std::stable_sort(local.begin(), local.end(),
+						 [](const ReplaySample &a, const ReplaySample &b) { return a.time < b.time; });
+		return true;
+	}
+
+	bool LoadReceive(const std::string &path) {
+		/* EventTime,Predict?,PacketTime,Delay,PacketNo,PosX,PosY,PosZ,Loss. the event time is the arrival.
+		   the logged position is the packet's as long as the recording ran without a jitter buffer. */
+		std::ifstream in(path);
+		if (!in.is_open())
+			return false;
+		std::string line;
+		std::vector<std::string> fields;
+		std::getline(in, line);		// header
+		while (std::getline(in, line)) {
+			Split(line, fields);
+			if (fields.size() < 8 || fields[1] != "0")
+				continue;
+			ReplayPacket packet;
+			packet.arrival = ParseTs(fields[0]);
+			packet.timestamp = ParseTs(fields[2]);
+			packet.num = (cnt_t)strtoul(fields[4].c_str(), NULL, 10);
+			for (int i = 0; i < 3; i++)
+				packet.pos[i] = atof(fields[5 + i].c_str());
+			remote.push_back(packet);
+		}
+		std::stable_sort(remote.begin(), remote.end(),
+						 [](const ReplayPacket &a, const ReplayPacket &b) { return a.arrival < b.arrival; });
+		return true;
+	}
+
+	ts_t Begin() const {
+		ts_t begin = local.empty() ? 0 : local.front().time;
+		if (!remote.empty() && (local.empty() || remote.front().arrival < begin))
+			begin = remote.front().arrival;
+		return begin;
+	}
+
+	ts_t End() const {
+		ts_t end = local.empty() ? 0 : local.back().time;
+		if (!remote.empty() && remote.back().arrival > end)
+			end = remote.back().arrival;
+		return end;
+	}
+};
+
+class ReplayDevice : public HapticDevice {
+	/* Plays the recorded local positions back, linearly interpolated at
+	   the (virtual) current time. Open loop: the commanded force is kept
+	   for the output but does not move the device. */
+private:
+	const std::vector<ReplaySample> &samples;
+	size_t next;				// first sample later than the last query
+	hduVector3Dd force;
+
+public:
+	ReplayDevice(const std::vector<ReplaySample> &samples) : samples(samples), next(0), force(0, 0, 0) {}
+
+	void BeginFrame() {}
+	void EndFrame() {}
+
+	void GetPosition(hduVector3Dd &pos) {
+		if (samples.empty()) {
+			pos = hduVector3Dd(0, 0, 0);
+			return;
+		}
+		ts_t now = getCurrentTime();
+		while (next < samples.size() && samples[next].time <= now)
+			next++;
+		if (next == 0) {
+			pos = samples.front().pos;
+			return;
+		}
+		if (next == samples.size()) {
+			pos = samples.back().pos;
+			return;
+		}
+		const ReplaySample &a = samples[next - 1];
+		const ReplaySample &b = samples[next];
+		double w = (double)(now - a.time) / (b.time - a.time);
+		pos = a.pos + (b.pos - a.pos) * w;
+	}
+
+	void SetForce(const hduVector3Dd &f) {
+		force = f;
+	}
+
+	const hduVector3Dd& getForce() const {
+		return force;
+	}
+};
+
+struct ReplayResult {
+	uint64_t ticks;
+	uint64_t packets_injected;	// recorded remote packets fed to the controller
+	uint64_t datagrams_sent;	// everything the controller sent, timing datagrams included
+	uint64_t packets_sent;
+	double force_mean;			// magnitude (N)
+	double force_max;
+	double force_jump_max;		// largest change between consecutive ticks (N)
+	double wall_seconds;
+	uint64_t digest;			// FNV-1a over forces and sent datagrams
+
+	ReplayResult() {
+		memset(this, 0, sizeof(ReplayResult));
+	}
+
+	double Speedup() const {
+		return wall_seconds > 0 ? ticks * REPLAY_TICK_US * 1e-6 / wall_seconds : 0;
+	}
+};
+
+class ReplayEngine {
+	/* Drives a HapticDeviceController through a ReplayTrace on a virtual
+	   clock stepped by REPLAY_TICK_US, with no waiting between ticks.
+	   The device is a ReplayDevice; the communicator is a real
+	   HDCommunicator on an in-process LocalLink (AttachLocalLink) with
+	   the engine on the other side, which puts the recorded remote
+	   packets on it at their recorded arrival times and drains whatever
+	   the controller sends. No sockets, so replays never wait on the
+	   kernel and several can run at once. Everything runs on
+	   the calling thread with synchronous loggers, so the same trace and
+	   settings always give the same forces, packets and digest.
+	   Configure the controller (getController) before Run. */
+private:
+	const ReplayTrace &trace;
+	ReplayDevice device;
+	LocalLink link;					// side 0: the controller's communicator, side 1: the engine
+	SNDLogger sndlogger;
+	RCVLogger rcvlogger;
+	ERRLogger errlogger;
+	HDCommunicator *hdcomm;
+	HapticDeviceController *controller;
+	std::ofstream forces;
+
+	static void Hash(uint64_t &digest, const void *data, size_t len) {
+		const unsigned char *bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < len; i++) {
+			digest ^= bytes[i];
+			digest *= REPLAY_DIGEST_PRIME;
+		}
+	}
+
+public:
+	ReplayEngine(const ReplayTrace &trace, char alias, const std::string &out_prefix) :
+		trace(trace), device(trace.local),
+		sndlogger(out_prefix + "_snd.csv"), rcvlogger(out_prefix + "_rcv.csv"), errlogger(out_prefix + "_err.csv"),
+		forces(out_prefix + "_force.csv") {
+		link.pid[1].store(LocalProcessId());
+		link.attached[1].store(1, std::memory_order_release);
+		hdcomm = new HDCommunicator(0, INVALID_SOCKET, NULL, 0, alias, &sndlogger, &rcvlogger, &errlogger);
+		hdcomm->AttachLocalLink(&link, 0);
+		controller = new HapticDeviceController(&device, alias, hdcomm, &sndlogger, &rcvlogger, &errlogger);
+		forces << "Time,PosX,PosY,PosZ,ForceX,ForceY,ForceZ\n";
+	}
+
+	~ReplayEngine() {
+		delete controller;
+		delete hdcomm;
+	}
+
+	HapticDeviceController* getController() {
+		return controller;
+	}
+
+	HDCommunicator* getCommunicator() {
+		return hdcomm;
+	}
+
+	ReplayResult Run() {
+		/* replay the whole trace. forces go to <out_prefix>_force.csv, packets to the controller's loggers. */
+		ReplayResult result;
+		result.digest = REPLAY_DIGEST_SEED;
+		std::chrono::steady_clock::time_point wall_start = std::chrono::steady_clock::now();
+		ts_t now = trace.Begin();
+		ts_t end = trace.End();
+		SetVirtualClock(&now);
+
+		size_t next_packet = 0;
+		DatagramRing &to_controller = link.rings[1];
+		DatagramRing &from_controller = link.rings[0];
+		hduVector3Dd last_force(0, 0, 0);
+		double force_sum = 0;
+		for (; now < end + REPLAY_TICK_US; now += REPLAY_TICK_US) {
+			// remote packets due by this tick, in arrival order
+			for (; next_packet < trace.remote.size() && trace.remote[next_packet].arrival <= now; next_packet++) {
+				const ReplayPacket &recorded = trace.remote[next_packet];
+				HapticPacket packet(recorded.pos, recorded.num, recorded.timestamp);
+				char *slot = to_controller.Reserve();
+				if (slot == NULL)
+					break;		// LOCAL_RING_SLOTS due in one tick: the rest goes in with the next
+				memcpy(slot, packet.ToArray(), packet.GetSize());
+				to_controller.Commit(packet.GetSize());
+				result.packets_injected++;
+			}
+
+			controller->tick();
+
+			const char *datagram;
+			int len;
+			while ((datagram = from_controller.Peek(len)) != NULL) {
+				result.datagrams_sent++;
+				if (len != TIMING_SIZE && len != PARITY_SIZE)
+					result.packets_sent++;
+				Hash(result.digest, datagram, len);
+				from_controller.Release();
+			}
+
+			hduVector3Dd pos;
+			device.GetPosition(pos);
+			const hduVector3Dd &force = device.getForce();
+			double magnitude = force.magnitude();
+			double jump = (force - last_force).magnitude();
+			force_sum += magnitude;
+			result.force_max = std::max(result.force_max, magnitude);
+			if (result.ticks > 0)
+				result.force_jump_max = std::max(result.force_jump_max, jump);
+			last_force = force;
+			Hash(result.digest, &force[0], 3 * sizeof(double));
+			forces << now << "," << pos[0] << "," << pos[1] << "," << pos[2] << ","
+				   << force[0] << "," << force[1] << "," << force[2] << "\n";
+			result.ticks++;
+		}
+
+		SetVirtualClock(NULL);
+		forces.flush();
+		result.force_mean = result.ticks ? force_sum / result.ticks : 0;
+		result.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+		return result;
+	}
+};
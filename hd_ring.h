@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#define RING_ALIGNMENT 64	// cache line: producer and consumer indices never share one
+
+inline void* AlignedAlloc(size_t size, size_t alignment = RING_ALIGNMENT) {
+	/* heap block aligned beyond what plain new guarantees before C++17 */
+#ifdef _WIN32
+	void *p = _aligned_malloc(size, alignment);
+#else
+	void *p = NULL;
+	if (posix_memalign(&p, alignment, size) != 0)
+		p = NULL;
+#endif
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+inline void AlignedFree(void *p) {
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+template <typename T, size_t N>
+class SPSCRing {
+	/* Lock-free single-producer/single-consumer ring buffer.
+	   Storage is preallocated, so Push/Pop never allocate or block. */
+	static_assert((N & (N - 1)) == 0, "SPSCRing capacity must be a power of two");
+
+private:
+	alignas(RING_ALIGNMENT) std::atomic<size_t> head;	// next slot to write, owned by producer
+	alignas(RING_ALIGNMENT) std::atomic<size_t> tail;	// next slot to read, owned by consumer
+	alignas(RING_ALIGNMENT) T slots[N];
+
+public:
+	SPSCRing() : head(0), tail(0) {}
+
+	// heap instances keep the cache line alignment of the indices (-std=c++11 new does not)
+	static void* operator new(size_t size) {
+		return AlignedAlloc(size);
+	}
+
+	static void operator delete(void *p) {
+		AlignedFree(p);
+	}
+
+	bool Push(const T& item) {
+		// producer side. returns false (and drops item) if the ring is full
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) >= N)
+			return false;
+		slots[h & (N - 1)] = item;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Pop(T& item) {
+		// consumer side. returns false if the ring is empty
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire))
+			return false;
+		item = slots[t & (N - 1)];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool IsEmpty() const {
+		return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+	}
+
+	size_t Capacity() const {
+		return N;
+	}
+};
+
+template <typename T, size_t N>
+class MPSCRing {
+	/* Lock-free multi-producer/single-consumer ring buffer for loggers fed
+	   by several threads. Each slot carries a sequence number: producers
+	   claim a slot by advancing head with a CAS, write it and publish it
+	   through its sequence; the consumer takes slots in order. Storage is
+	   preallocated, so Push/Pop never allocate. */
+	static_assert((N & (N - 1)) == 0, "MPSCRing capacity must be a power of two");
+
+private:
+	struct Slot {
+		std::atomic<size_t> seq;	// index + 1 once written, index + N once read (free for the next lap)
+		T item;
+	};
+
+	alignas(RING_ALIGNMENT) std::atomic<size_t> head;	// next slot to claim, shared by producers
+	alignas(RING_ALIGNMENT) std::atomic<size_t> tail;	// next slot to read, owned by consumer
+	alignas(RING_ALIGNMENT) Slot slots[N];
+
+public:
+	MPSCRing() : head(0), tail(0) {
+		for (size_t i = 0; i < N; i++)
+			slots[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	static void* operator new(size_t size) {
+		return AlignedAlloc(size);
+	}
+
+	static void operator delete(void *p) {
+		AlignedFree(p);
+	}
+
+	bool Push(const T& item) {
+		// any thread. returns false (and drops item) if the ring is full
+		size_t h = head.load(std::memory_order_relaxed);
+		while (true) {
+			Slot &slot = slots[h & (N - 1)];
+			size_t seq = slot.seq.load(std::memory_order_acquire);
+			if (seq == h) {
+				if (head.compare_exchange_weak(h, h + 1, std::memory_order_relaxed)) {
+					slot.item = item;
+					slot.seq.store(h + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (seq < h) {
+				return false;		// still holds an item from the previous lap
+			}
+			else {
+				h = head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool Pop(T& item) {
+		// consumer side. returns false if the ring is empty (or the oldest slot is still being written)
+		size_t t = tail.load(std::memory_order_relaxed);
+		Slot &slot = slots[t & (N - 1)];
+		if (slot.seq.load(std::memory_order_acquire) != t + 1)
+			return false;
+		item = slot.item;
+		slot.seq.store(t + N, std::memory_order_release);
+		tail.store(t + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	size_t Capacity() const {
+		return N;
+	}
+};
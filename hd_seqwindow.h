@@ -0,0 +1,181 @@
+#pragma once
+
+#include <bitset>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hd_types.h"
+
+#define SEQ_WINDOW_SIZE 64		// packet numbers tracked behind the highest one
+
+enum SequenceStatus {
+	SEQ_NEWEST,			// higher than anything before: deliver
+	SEQ_REORDERED,		// fills a gap behind the newest: history only
+	SEQ_DUPLICATE,		// already received
+	SEQ_STALE			// too old to tell, dropped
+};
+
+struct SequenceStats {
+	uint64_t received;			// distinct packets received (newest or reordered)
+	uint64_t duplicates;
+	uint64_t stale;
+	uint64_t reordered;
+	uint32_t max_reorder_depth;	// largest distance behind the newest a reordered packet arrived at
+	uint64_t restarts;			// peer restarted its numbering, window reset
+
+	SequenceStats() {
+		memset(this, 0, sizeof(SequenceStats));
+	}
+};
+
+struct SequenceInterval {
+	/* numbers that left the window since the previous Interval() call */
+	uint64_t expected;
+	uint64_t lost;
+
+	double LossFraction() const {
+		return expected ? (double)lost / expected : 0;
+	}
+};
+
+class SequenceWindow {
+	/* RTP-style sliding window over the last SEQ_WINDOW_SIZE packet numbers.
+	   Bit i of the mask stands for (highest - i). A number that leaves the
+	   window without having been marked is counted as lost, so loss is
+	   exact but settles SEQ_WINDOW_SIZE numbers late. Everything is a few
+	   shifts and a popcount per packet. */
+private:
+	cnt_t highest;
+	uint64_t mask;
+	bool started;
+	uint64_t lost;
+	uint64_t finalized;			// numbers that left the window, received or not
+	uint64_t interval_lost;
+	uint64_t interval_finalized;
+	cnt_t bad_num;				// RTP-style resync: a stale number followed by its successor
+	bool has_bad_num;
+	SequenceStats stats;
+
+	static uint64_t CountMissing(uint64_t bits, uint32_t n) {
+		// zero bits among the n oldest entries of the window
+		uint64_t oldest = n >= 64 ? bits : bits >> (64 - n);
+		return n - std::bitset<64>(oldest).count();
+	}
+
+	void Restart(cnt_t num) {
+		// numbers still missing from the abandoned window are lost
+		lost += CountMissing(mask, SEQ_WINDOW_SIZE);
+		finalized += SEQ_WINDOW_SIZE;
+		started = false;
+		has_bad_num = false;
+		stats.restarts++;
+		Mark(num);
+	}
+
+public:
+	SequenceWindow() : highest(0), mask(0), started(false), lost(0), finalized(0),
+					   interval_lost(0), interval_finalized(0), bad_num(0), has_bad_num(false) {}
+
+	bool Contains(cnt_t num) const {
+		/* num was received (or is too old to tell, which counts as received) */
+		if (!started || (int32_t)(num - highest) > 0)
+			return false;
+		uint32_t age = highest - num;
+		return age >= SEQ_WINDOW_SIZE || (mask >> age) & 1;
+	}
+
+	bool InWindow(cnt_t num) const {
+		/* num is newer than the oldest tracked number */
+		return !started || (int32_t)(num - highest) > -SEQ_WINDOW_SIZE;
+	}
+
+	SequenceStatus Mark(cnt_t num) {
+		/* record num as present without touching the receive counters (used for recovered packets) */
+		if (!started) {
+			highest = num;
+			mask = ~(uint64_t)0;	// nothing before the first packet is missing
+			started = true;
+			return SEQ_NEWEST;
+		}
+		int32_t ahead = (int32_t)(num - highest);
+		if (ahead > 0) {
+			if (ahead >= SEQ_WINDOW_SIZE) {
+				lost += CountMissing(mask, SEQ_WINDOW_SIZE) + (ahead - SEQ_WINDOW_SIZE);
+				mask = 0;
+			}
+			else {
+				lost += CountMissing(mask, ahead);
+				mask <<= ahead;
+			}
+			finalized += ahead;
+			mask |= 1;
+			highest = num;
+			return SEQ_NEWEST;
+		}
+		uint32_t age = (uint32_t)-ahead;
+		if (age >= SEQ_WINDOW_SIZE)
+			return SEQ_STALE;
+		if ((mask >> age) & 1)
+			return SEQ_DUPLICATE;
+		mask |= (uint64_t)1 << age;
+		return SEQ_REORDERED;
+	}
+
+	SequenceStatus Receive(cnt_t num) {
+		/* classify a packet from the wire and update the counters */
+		SequenceStatus status = Mark(num);
+		if (status == SEQ_STALE) {
+			// far behind twice in a row, consecutively: the peer restarted, follow it
+			if (!has_bad_num || num != bad_num) {
+				bad_num = num + 1;
+				has_bad_num = true;
+				stats.stale++;
+				return status;
+			}
+			Restart(num);
+			status = SEQ_NEWEST;
+		}
+		has_bad_num = false;
+		if (status == SEQ_DUPLICATE) {
+			stats.duplicates++;
+			return status;
+		}
+		stats.received++;
+		if (status == SEQ_REORDERED) {
+			stats.reordered++;
+			uint32_t depth = highest - num;
+			if (depth > stats.max_reorder_depth)
+				stats.max_reorder_depth = depth;
+		}
+		return status;
+	}
+
+	SequenceInterval Interval() {
+		/* loss over the numbers settled since the previous call (RTCP receiver report style) */
+		SequenceInterval interval;
+		interval.expected = finalized - interval_finalized;
+		interval.lost = lost - interval_lost;
+		interval_finalized = finalized;
+		interval_lost = lost;
+		return interval;
+	}
+
+	cnt_t getHighest() const {
+		return highest;
+	}
+
+	uint32_t getMissing() const {
+		/* numbers in the window not received yet: lost unless they still arrive */
+		return started ? (uint32_t)CountMissing(mask, SEQ_WINDOW_SIZE) : 0;
+	}
+
+	uint64_t getLost() const {
+		/* numbers that left the window unreceived */
+		return lost;
+	}
+
+	const SequenceStats& getStats() const {
+		return stats;
+	}
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <vector>
+
+#include "hd_api.h"
+#include "hd_device.h"
+#include "hd_comm.h"
+#include "hd_controller.h"
+#include "hd_logger.h"
+
+class SessionDevice : public HapticDevice {
+	/* What a controller of a SessionManager sees of its device: the
+	   position gathered at the start of the pass and a force slot the
+	   manager scatters at the end. Frames belong to the manager. */
+private:
+	const std::vector<hduVector3Dd> &positions;
+	std::vector<hduVector3Dd> &forces;
+	size_t index;
+
+public:
+	SessionDevice(const std::vector<hduVector3Dd> &positions, std::vector<hduVector3Dd> &forces, size_t index) :
+		positions(positions), forces(forces), index(index) {}
+
+	void BeginFrame() {}
+	void EndFrame() {}
+
+	void GetPosition(hduVector3Dd &pos) {
+		pos = positions[index];
+	}
+
+	void SetForce(const hduVector3Dd &force) {
+		forces[index] = force;
+	}
+};
+
+class SessionManager {
+	/* Any number of device/communicator/controller triples serviced from
+	   one scheduler callback (ServoCallback). Each Tick is a batched pass:
+	   gather every device's position, tick every controller against the
+	   gathered positions, scatter every force, then flush every deferred
+	   packet, so the scheduler overhead stays one callback however many
+	   devices there are and no force waits on another device's send.
+	   Positions and forces live in contiguous arrays indexed by device.
+	   Add all devices before the callback is scheduled. */
+private:
+	struct Entry {
+		HapticDevice *device;			// backend, owned
+		SessionDevice *view;			// what the controller sees, owned
+		HDCommunicator *hdcomm;			// owned
+		HapticDeviceController *controller;	// owned
+	};
+
+	std::vector<Entry> entries;
+	std::vector<hduVector3Dd> positions;	// gathered this pass
+	std::vector<hduVector3Dd> forces;		// to scatter this pass
+	uint64_t ticks;
+
+public:
+	SessionManager() : ticks(0) {}
+
+	~SessionManager() {
+		for (size_t i = 0; i < entries.size(); i++) {
+			delete entries[i].controller;
+			delete entries[i].view;
+			delete entries[i].hdcomm;
+			delete entries[i].device;
+		}
+	}
+
+	HapticDeviceController* AddDevice(HapticDevice* device, HDCommunicator* hdcomm, const char alias,
+									  SNDLogger* sndlogger, RCVLogger* rcvlogger, Logger* errlogger) {
+		/* takes ownership of device and hdcomm. returns the controller to configure (predictors, deadband, ...). */
+		size_t index = entries.size();
+		positions.push_back(hduVector3Dd(0, 0, 0));
+		forces.push_back(hduVector3Dd(0, 0, 0));
+		Entry entry;
+		entry.device = device;
+		entry.view = new SessionDevice(positions, forces, index);
+		entry.hdcomm = hdcomm;
+		entry.controller = new HapticDeviceController(entry.view, alias, hdcomm, sndlogger, rcvlogger, errlogger);
+		entry.controller->SetDeferredSend(true);
+		entries.push_back(entry);
+		return entry.controller;
+	}
+
+	size_t getDeviceCount() const {
+		return entries.size();
+	}
+
+	HapticDeviceController* getController(size_t index) {
+		return entries[index].controller;
+	}
+
+	HDCommunicator* getCommunicator(size_t index) {
+		return entries[index].hdcomm;
+	}
+
+	HapticDevice* getDevice(size_t index) {
+		return entries[index].device;
+	}
+
+	uint64_t getTickCount() const {
+		return ticks;
+	}
+
+	void Tick() {
+		/* one servo pass over all devices */
+		size_t count = entries.size();
+
+		// gather: BeginFrame makes the device current, so read it right away
+		for (size_t i = 0; i < count; i++) {
+			entries[i].device->BeginFrame();
+			entries[i].device->GetPosition(positions[i]);
+		}
+
+		// receive, predict, compute forces and decide sends; packets are held back
+		for (size_t i = 0; i < count; i++)
+			entries[i].controller->tick();
+
+		// scatter
+		for (size_t i = 0; i < count; i++) {
+			entries[i].device->MakeCurrent();
+			entries[i].device->SetForce(forces[i]);
+			entries[i].device->EndFrame();
+		}
+
+		// forces are out: now the sends
+		for (size_t i = 0; i < count; i++)
+			entries[i].controller->FlushSend();
+		ticks++;
+	}
+
+	static HDCallbackCode HDCALLBACK ServoCallback(void *data) {
+		/* scheduler callback, data is the SessionManager */
+		static_cast<SessionManager *>(data)->Tick();
+		return HD_CALLBACK_CONTINUE;
+	}
+};
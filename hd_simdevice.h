@@ -0,0 +1,194 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "hd_api.h"
+#include "hd_device.h"
+
+#define SIM_TICK_SECONDS 0.001		// servo period (s)
+#define SIM_DEVICE_MASS 0.05		// effective end-effector mass (kg)
+#define SIM_HAND_STIFFNESS 200.0	// hand grip spring (N/m)
+#define SIM_HAND_DAMPING 3.0		// hand grip damping (N*s/m)
+#define SIM_MAX_FORCE 3.3			// device force saturation (N), Touch nominal max
+
+enum SimTrajectoryType {
+	SIM_HOLD,			// hand stays at center
+	SIM_CIRCLE,			// circle in the x-y plane
+	SIM_SINE,			// sine along x
+	SIM_RANDOM_WALK,	// bounded random motion, deterministic for a given seed
+	SIM_SCRIPT			// waypoints loaded from file, linearly interpolated
+};
+
+class SimTrajectory {
+	/* where the simulated hand wants to be at time t. positions in mm, like HD_CURRENT_POSITION. */
+private:
+	SimTrajectoryType type;
+	hduVector3Dd center;
+	double amplitude;		// mm
+	double frequency;		// Hz
+	uint32_t rng;
+	hduVector3Dd walk_pos;
+	hduVector3Dd walk_vel;
+	double walk_time;
+	std::vector<double> script_time;
+	std::vector<hduVector3Dd> script_pos;
+	size_t script_cursor;	// segment of the last Script query
+
+	double NextRandom() {
+		// xorshift32, uniform in [-1, 1]
+		rng ^= rng << 13;
+		rng ^= rng >> 17;
+		rng ^= rng << 5;
+		return (rng / 4294967295.0) * 2 - 1;
+	}
+
+	hduVector3Dd Walk(double t) {
+		// advance the random walk in SIM_TICK_SECONDS steps up to t
+		while (walk_time < t) {
+			for (int i = 0; i < 3; i++) {
+				walk_vel[i] += NextRandom() * amplitude * frequency * 0.05;
+				walk_vel[i] *= 0.995;
+				walk_pos[i] += walk_vel[i] * SIM_TICK_SECONDS;
+				if (fabs(walk_pos[i]) > amplitude) {
+					walk_pos[i] = walk_pos[i] > 0 ? amplitude : -amplitude;
+					walk_vel[i] = -walk_vel[i];
+				}
+			}
+			walk_time += SIM_TICK_SECONDS;
+		}
+		return center + walk_pos;
+	}
+
+	hduVector3Dd Script(double t) {
+		if (script_time.empty())
+			return center;
+		if (t <= script_time.front())
+			return script_pos.front();
+		if (t >= script_time.back())
+			return script_pos.back();
+		// time mostly moves forward: resume from the last segment, so long recorded scripts stay O(1) per tick
+		if (script_cursor < 1 || script_cursor >= script_time.size() || script_time[script_cursor - 1] > t)
+			script_cursor = 1;
+		while (t >= script_time[script_cursor])
+			script_cursor++;
+		size_t i = script_cursor;
+		double a = (t - script_time[i - 1]) / (script_time[i] - script_time[i - 1]);
+		return script_pos[i - 1] + (script_pos[i] - script_pos[i - 1]) * a;
+	}
+
+public:
+	SimTrajectory(SimTrajectoryType type = SIM_HOLD, double amplitude = 50, double frequency = 0.5, uint32_t seed = 1) :
+		type(type), amplitude(amplitude), frequency(frequency), rng(seed ? seed : 1), walk_time(0), script_cursor(1) {}
+
+	void SetCenter(const hduVector3Dd &c) {
+		center = c;
+	}
+
+	bool LoadScript(const std::string &filename) {
+		/* waypoint file, one "time_s,x,y,z" per line (mm). lines that do not parse are skipped. */
+		std::ifstream in(filename.c_str());
+		if (!in.is_open())
+			return false;
+		script_time.clear();
+		script_pos.clear();
+		std::string line;
+		while (std::getline(in, line)) {
+			double t, x, y, z;
+			char c1, c2, c3;
+			std::istringstream fields(line);
+			if (fields >> t >> c1 >> x >> c2 >> y >> c3 >> z) {
+				script_time.push_back(t);
+				script_pos.push_back(hduVector3Dd(x, y, z));
+			}
+		}
+		type = SIM_SCRIPT;
+		script_cursor = 1;
+		return !script_time.empty();
+	}
+
+	void AddWaypoint(double t, const hduVector3Dd &pos) {
+		/* append a waypoint (time_s ascending, mm) and switch to SIM_SCRIPT, e.g. for recorded positions */
+		script_time.push_back(t);
+		script_pos.push_back(pos);
+		type = SIM_SCRIPT;
+	}
+
+	hduVector3Dd At(double t) {
+		const double w = 2 * M_PI * frequency;
+		switch (type) {
+		case SIM_CIRCLE:
+			return center + hduVector3Dd(amplitude * cos(w * t), amplitude * sin(w * t), 0);
+		case SIM_SINE:
+			return center + hduVector3Dd(amplitude * sin(w * t), 0, 0);
+		case SIM_RANDOM_WALK:
+			return Walk(t);
+		case SIM_SCRIPT:
+			return Script(t);
+		default:
+			return center;
+		}
+	}
+};
+
+class SimulatedDevice : public HapticDevice {
+	/* Mass-spring model of a hand holding the stylus. The hand pulls the
+	   end-effector towards the trajectory through a spring-damper, the
+	   rendered force pushes against it. Integrated once per frame with
+	   semi-implicit Euler at SIM_TICK_SECONDS. */
+private:
+	SimTrajectory trajectory;
+	hduVector3Dd pos;		// end-effector position (m)
+	hduVector3Dd vel;		// end-effector velocity (m/s)
+	hduVector3Dd force;		// last commanded force (N)
+	double time;			// simulated time (s)
+	uint64_t frames;
+
+public:
+	SimulatedDevice(const SimTrajectory &trajectory = SimTrajectory()) :
+		trajectory(trajectory), time(0), frames(0) {
+		pos = this->trajectory.At(0) * 0.001;
+	}
+
+	void BeginFrame() {}
+
+	void EndFrame() {
+		hduVector3Dd hand = trajectory.At(time) * 0.001;
+		hduVector3Dd f = (hand - pos) * SIM_HAND_STIFFNESS - vel * SIM_HAND_DAMPING + force;
+		vel += f * (SIM_TICK_SECONDS / SIM_DEVICE_MASS);
+		pos += vel * SIM_TICK_SECONDS;
+		time += SIM_TICK_SECONDS;
+		frames++;
+	}
+
+	void GetPosition(hduVector3Dd &p) {
+		p = pos * 1000.0;
+	}
+
+	void SetForce(const hduVector3Dd &f) {
+		force = f;
+		double mag = force.magnitude();
+		if (mag > SIM_MAX_FORCE)
+			force *= SIM_MAX_FORCE / mag;
+	}
+
+	hduVector3Dd GetForce() const {
+		return force;
+	}
+
+	hduVector3Dd GetHandPosition() {
+		return trajectory.At(time);
+	}
+
+	double GetTime() const {
+		return time;
+	}
+
+	uint64_t GetFrameCount() const {
+		return frames;
+	}
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "hd_api.h"
+#include "hd_profiler.h"
+
+#define SIM_SCHEDULER_RATE 1000		// servo rate (Hz)
+
+typedef HDCallbackCode (HDCALLBACK *SimCallback)(void *data);
+
+class SimScheduler {
+	/* Stand-in for the HDAPI servo scheduler: one thread calling every
+	   scheduled callback once per tick at SIM_SCHEDULER_RATE, on absolute
+	   deadlines. Callbacks returning HD_CALLBACK_DONE are unscheduled. */
+private:
+	struct Entry {
+		SimCallback callback;
+		void *data;
+		bool active;
+	};
+
+	std::vector<Entry> entries;
+	std::mutex entries_mutex;
+	std::thread *thread;
+	std::atomic<bool> running;
+	int64_t spin_us;						// busy-wait this long before each deadline for precision
+
+	std::atomic<uint64_t> ticks;
+	std::atomic<uint64_t> overruns;			// ticks that started a full period late
+	std::atomic<int64_t> max_lateness_ns;	// worst tick start after its deadline
+	LatencyHistogram lateness_ns;			// tick start after its deadline, every tick
+	std::atomic<int64_t> max_busy_ns;		// worst time spent in callbacks per tick
+	std::atomic<int64_t> total_busy_ns;
+
+	void Run() {
+		using namespace std::chrono;
+		const nanoseconds period(1000000000LL / SIM_SCHEDULER_RATE);
+		steady_clock::time_point deadline = steady_clock::now();
+
+		while (running.load(std::memory_order_acquire)) {
+			steady_clock::time_point start = steady_clock::now();
+			int64_t lateness = duration_cast<nanoseconds>(start - deadline).count();
+			if (lateness > max_lateness_ns.load(std::memory_order_relaxed))
+				max_lateness_ns.store(lateness, std::memory_order_relaxed);
+			lateness_ns.Record(lateness > 0 ? (uint64_t)lateness : 0);
+
+			{
+				std::lock_guard<std::mutex> lock(entries_mutex);
+				for (size_t i = 0; i < entries.size(); i++) {
+					if (entries[i].active && entries[i].callback(entries[i].data) == HD_CALLBACK_DONE)
+						entries[i].active = false;
+				}
+			}
+
+			int64_t busy = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+			total_busy_ns.fetch_add(busy, std::memory_order_relaxed);
+			if (busy > max_busy_ns.load(std::memory_order_relaxed))
+				max_busy_ns.store(busy, std::memory_order_relaxed);
+			ticks.fetch_add(1, std::memory_order_relaxed);
+
+			deadline += period;
+			steady_clock::time_point now = steady_clock::now();
+			if (now > deadline + period) {
+				// fell behind by more than a tick: skip missed ticks instead of bursting
+				overruns.fetch_add(1, std::memory_order_relaxed);
+				deadline = now;
+				continue;
+			}
+			if (spin_us > 0) {
+				std::this_thread::sleep_until(deadline - microseconds(spin_us));
+				while (steady_clock::now() < deadline);
+			}
+			else {
+				std::this_thread::sleep_until(deadline);
+			}
+		}
+	}
+
+public:
+	SimScheduler(int64_t spin_us = 0) :
+		thread(NULL), running(false), spin_us(spin_us),
+		ticks(0), overruns(0), max_lateness_ns(0), max_busy_ns(0), total_busy_ns(0) {}
+
+	~SimScheduler() {
+		Stop();
+	}
+
+	HDSchedulerHandle Schedule(SimCallback callback, void *data) {
+		std::lock_guard<std::mutex> lock(entries_mutex);
+		Entry entry = { callback, data, true };
+		entries.push_back(entry);
+		return (HDSchedulerHandle)(entries.size() - 1);
+	}
+
+	void Unschedule(HDSchedulerHandle handle) {
+		std::lock_guard<std::mutex> lock(entries_mutex);
+		if (handle < entries.size())
+			entries[handle].active = false;
+	}
+
+	void Start() {
+		if (thread)
+			return;
+		running = true;
+		thread = new std::thread(&SimScheduler::Run, this);
+	}
+
+	void Stop() {
+		if (thread == NULL)
+			return;
+		running.store(false, std::memory_order_release);
+		thread->join();
+		delete thread;
+		thread = NULL;
+	}
+
+	uint64_t getTickCount() const { return ticks.load(); }
+	uint64_t getOverrunCount() const { return overruns.load(); }
+	int64_t getMaxLatenessNs() const { return max_lateness_ns.load(); }
+	const LatencyHistogram& getLatenessHistogram() const { return lateness_ns; }
+	int64_t getMaxBusyNs() const { return max_busy_ns.load(); }
+	double getMeanBusyNs() const {
+		uint64_t t = ticks.load();
+		return t ? (double)total_busy_ns.load() / t : 0;
+	}
+};
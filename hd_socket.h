@@ -0,0 +1,192 @@
+#pragma once
+
+/* Portable UDP socket layer (plus a TCP listener for the metrics endpoint).
+   Winsock on Windows, native POSIX sockets with epoll readiness on Linux.
+   HDCommunicator and the programs only use the helpers below, so the same
+   code drives both platforms. */
+
+#if defined(linux) || defined(__linux__)
+#define HD_LINUX_SOCKETS
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+typedef int SOCKET;
+#define SOCKET_ERROR -1
+#define INVALID_SOCKET -1
+#define closesocket close
+#else
+#include <WS2tcpip.h>
+#pragma comment (lib, "ws2_32.lib")
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#define SOCKET_BUFFER_SIZE (1 << 20)	// default SO_RCVBUF/SO_SNDBUF request (bytes)
+
+struct UDPSocketOptions {
+	/* tuning applied by CreateUDPSocket. 0 leaves the system default. */
+	int rcvbuf;			// SO_RCVBUF (bytes)
+	int sndbuf;			// SO_SNDBUF (bytes)
+	int busy_poll_us;	// SO_BUSY_POLL (Linux only, us of busy polling on blocking reads/epoll)
+	bool reuse_port;	// SO_REUSEPORT (Linux only, for sharded receivers)
+
+	UDPSocketOptions() : rcvbuf(SOCKET_BUFFER_SIZE), sndbuf(SOCKET_BUFFER_SIZE), busy_poll_us(0), reuse_port(false) {}
+};
+
+inline int SocketStartup() {
+	/* call once before using sockets. returns 0 on success. */
+#ifdef HD_LINUX_SOCKETS
+	return 0;
+#else
+	WSADATA data;
+	return WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+}
+
+inline void SocketCleanup() {
+#ifndef HD_LINUX_SOCKETS
+	WSACleanup();
+#endif
+}
+
+inline int SocketLastError() {
+#ifdef HD_LINUX_SOCKETS
+	return errno;
+#else
+	return WSAGetLastError();
+#endif
+}
+
+inline bool SetNonBlocking(SOCKET sock) {
+#ifdef HD_LINUX_SOCKETS
+	int flags = fcntl(sock, F_GETFL, 0);
+	return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#else
+	u_long isNonBlocking = 1;
+	return ioctlsocket(sock, FIONBIO, &isNonBlocking) == 0;
+#endif
+}
+
+inline bool SetSocketOptions(SOCKET sock, const UDPSocketOptions &options) {
+	/* apply buffer sizes and (on Linux) busy polling / port reuse. returns false if any option failed. */
+	bool ok = true;
+	if (options.rcvbuf > 0)
+		ok &= setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char*)&options.rcvbuf, sizeof(int)) == 0;
+	if (options.sndbuf > 0)
+		ok &= setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (const char*)&options.sndbuf, sizeof(int)) == 0;
+#ifdef HD_LINUX_SOCKETS
+#ifdef SO_BUSY_POLL
+	if (options.busy_poll_us > 0)
+		ok &= setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &options.busy_poll_us, sizeof(int)) == 0;
+#endif
+	if (options.reuse_port) {
+		int one = 1;
+		ok &= setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(int)) == 0;
+	}
+#endif
+	return ok;
+}
+
+inline void MakeAddress(sockaddr_in &addr, const char *host, uint32_t port) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, host, &addr.sin_addr);
+}
+
+inline SOCKET CreateUDPSocket(const sockaddr_in *bind_addr = NULL, const UDPSocketOptions &options = UDPSocketOptions()) {
+	/* non-blocking UDP socket, tuned and optionally bound. returns INVALID_SOCKET on failure. */
+	SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock == INVALID_SOCKET)
+		return INVALID_SOCKET;
+	SetNonBlocking(sock);
+	SetSocketOptions(sock, options);	// best effort: limits may clamp buffer sizes
+	if (bind_addr && ::bind(sock, (const sockaddr*)bind_addr, sizeof(sockaddr_in)) == SOCKET_ERROR) {
+		closesocket(sock);
+		return INVALID_SOCKET;
+	}
+	return sock;
+}
+
+inline SOCKET CreateTCPListener(const sockaddr_in *bind_addr, int backlog = 16) {
+	/* non-blocking listening TCP socket (SO_REUSEADDR), e.g. for the metrics endpoint. INVALID_SOCKET on failure. */
+	SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock == INVALID_SOCKET)
+		return INVALID_SOCKET;
+	int one = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(int));
+	SetNonBlocking(sock);
+	if (::bind(sock, (const sockaddr*)bind_addr, sizeof(sockaddr_in)) == SOCKET_ERROR || listen(sock, backlog) == SOCKET_ERROR) {
+		closesocket(sock);
+		return INVALID_SOCKET;
+	}
+	return sock;
+}
+
+class SocketPoller {
+	/* Readiness wait on a set of sockets: epoll on Linux, select elsewhere. */
+private:
+#ifdef HD_LINUX_SOCKETS
+	int epoll_fd;
+#else
+	fd_set watched;
+#endif
+
+public:
+	SocketPoller() {
+#ifdef HD_LINUX_SOCKETS
+		epoll_fd = epoll_create1(0);
+#else
+		FD_ZERO(&watched);
+#endif
+	}
+
+	~SocketPoller() {
+#ifdef HD_LINUX_SOCKETS
+		if (epoll_fd >= 0)
+			close(epoll_fd);
+#endif
+	}
+
+	bool Add(SOCKET sock, uint64_t tag = 0) {
+		/* watch sock for readability. tag is returned by Wait (Linux) to identify it. */
+#ifdef HD_LINUX_SOCKETS
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u64 = tag;
+		return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev) == 0;
+#else
+		FD_SET(sock, &watched);
+		return true;
+#endif
+	}
+
+	int Wait(int timeout_us, uint64_t *ready_tags = NULL, int max_tags = 0) {
+		/* block until a watched socket is readable or timeout. returns number of ready sockets. */
+#ifdef HD_LINUX_SOCKETS
+		epoll_event events[16];
+		int max_events = (ready_tags && max_tags > 0 && max_tags < 16) ? max_tags : 16;
+		int n = -1;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+		// microsecond timeout; older kernels return ENOSYS and fall back to epoll_wait
+		timespec ts = { timeout_us / 1000000, (timeout_us % 1000000) * 1000L };
+		n = epoll_pwait2(epoll_fd, events, max_events, timeout_us < 0 ? NULL : &ts, NULL);
+		if (n < 0 && errno == ENOSYS)
+#endif
+			n = epoll_wait(epoll_fd, events, max_events, timeout_us < 0 ? -1 : (timeout_us + 999) / 1000);
+		for (int i = 0; ready_tags && i < n && i < max_tags; i++)
+			ready_tags[i] = events[i].data.u64;
+		return n < 0 ? 0 : n;
+#else
+		fd_set readable = watched;
+		timeval tv = { timeout_us / 1000000, timeout_us % 1000000 };
+		int n = select(0, &readable, NULL, NULL, timeout_us < 0 ? NULL : &tv);
+		return n < 0 ? 0 : n;
+#endif
+	}
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hd_api.h"
+#include "hd_types.h"
+#include "hd_predictor.h"
+#include "hd_deadband.h"
+#include "hd_ratecontrol.h"
+#include "hd_upsampler.h"
+#include "hd_simdevice.h"
+#include "hd_locallink.h"
+#include "hd_logger.h"
+#include "hd_comm.h"
+#include "hd_controller.h"
+
+/* Offline parameter sweep of the teleoperation loop. Every point runs a
+   master/slave pair of HapticDeviceControllers on simulated devices over a
+   modelled link: their communicators exchange datagrams through in-process
+   LocalLinks that a SweepWire joins with delay, jitter and loss, and both
+   read the point's own clock (SetTimeSource). No sockets and no global
+   state, so points are deterministic and run in parallel. */
+
+#define SWEEP_TICK_US 1000				// servo period of the model
+#define SWEEP_START_US 1000000			// model clock at the first tick, clear of timestamp 0
+
+struct SweepLink {
+	/* one-way link model, the same in both directions */
+	double delay_ms;
+	double jitter_ms;				// uniform extra delay, packets stay in order
+	double loss;					// independent loss probability
+
+	SweepLink() : delay_ms(10), jitter_ms(2), loss(0.01) {}
+};
+
+struct SweepParams {
+	PredictorType predictor;		// on both sides, for sending and receiving
+	int history;					// samples kept by avg/poly predictors
+	double deadband_k;				// DeadbandConfig::k
+	double deadband_floor;			// DeadbandConfig::floor_mm
+	double force_strength;			// HapticDeviceController::SetForceStrength
+	double send_hz;					// fixed send rate instead of the deadband, 0: deadband decides
+	bool adaptive;					// velocity-adaptive RateController (SetRateControl): up to send_hz, or in front of the deadband
+	bool upsample;					// render through an Upsampler (SetUpsampler) instead of packet + predictor
+
+	SweepParams() : predictor(PREDICTOR_AVERAGE), history(PREDICTOR_QUEUE_SIZE),
+		deadband_k(DEADBAND_K), deadband_floor(DEADBAND_FLOOR_MM), force_strength(FORCE_STRENGTH),
+		send_hz(0), adaptive(false), upsample(false) {}
+
+	std::string Describe() const {
+		std::ostringstream out;
+		out << PredictorTypeName(predictor);
+		if (UsesHistory(predictor))
+			out << "/" << history;
+		if (send_hz > 0)
+			out << (adaptive ? " <=" : " ") << send_hz << "Hz";
+		else
+			out << " k=" << deadband_k << " floor=" << deadband_floor;
+		if (adaptive && send_hz <= 0)
+			out << " rate";
+		out << " f=" << force_strength;
+		if (upsample)
+			out << " up";
+		return out.str();
+	}
+};
+
+struct SweepResult {
+	SweepParams params;
+	double packet_rate;				// packets/s, both directions
+	double error_mean;				// master-slave position error (mm)
+	double error_p99;
+	double render_error_mean;		// rendered remote position vs the actual one, both sides (mm)
+	double force_jump_p99;			// per-tick force change, both devices (N)
+	double force_jump_max;
+	bool pareto;					// no other point is at least as good on rate, both errors and force jumps
+
+	SweepResult() : packet_rate(0), error_mean(0), error_p99(0), render_error_mean(0), force_jump_p99(0), force_jump_max(0),
+		pareto(false) {}
+
+	bool Dominates(const SweepResult &o) const {
+		/* at least as good on every objective, better on one. the master-slave error mostly follows the
+		   force strength, the rendering error the predictor and deadband, so both are objectives. */
+		bool no_worse = packet_rate <= o.packet_rate && error_mean <= o.error_mean &&
+						render_error_mean <= o.render_error_mean && force_jump_p99 <= o.force_jump_p99;
+		bool better = packet_rate < o.packet_rate || error_mean < o.error_mean ||
+					  render_error_mean < o.render_error_mean || force_jump_p99 < o.force_jump_p99;
+		return no_worse && better;
+	}
+};
+
+class SweepChannel {
+	/* one direction of the link: FIFO of datagrams with delay, jitter and loss from a seeded generator */
+private:
+	struct InFlight {
+		ts_t deliver_at;
+		int len;
+		char data[BUNDLE_MAX_SIZE];
+	};
+
+	const SweepLink &link;
+	std::mt19937 &rng;
+	std::uniform_real_distribution<double> uniform;
+	std::deque<InFlight> in_flight;
+	ts_t last_due;
+
+public:
+	SweepChannel(const SweepLink &link, std::mt19937 &rng) : link(link), rng(rng), uniform(0, 1), last_due(0) {}
+
+	void Take(DatagramRing &from, ts_t now) {
+		/* everything the sender put on the link since the last call goes out at now */
+		const char *data;
+		int len;
+		while ((data = from.Peek(len)) != NULL) {
+			if (uniform(rng) >= link.loss) {
+				in_flight.push_back(InFlight());
+				InFlight &p = in_flight.back();
+				p.deliver_at = std::max(now + (ts_t)((link.delay_ms + link.jitter_ms * uniform(rng)) * 1000), last_due);
+				last_due = p.deliver_at;
+				p.len = len;
+				memcpy(p.data, data, len);
+			}
+			from.Release();
+		}
+	}
+
+	void Deliver(DatagramRing &to, ts_t now) {
+		/* datagrams due by now to the receiver, oldest first. a full ring drops them like a socket buffer. */
+		while (!in_flight.empty() && in_flight.front().deliver_at <= now) {
+			char *slot = to.Reserve();
+			if (slot) {
+				memcpy(slot, in_flight.front().data, in_flight.front().len);
+				to.Commit(in_flight.front().len);
+			}
+			in_flight.pop_front();
+		}
+	}
+};
+
+class SweepWire {
+	/* the modelled link between two communicators of one process. each attaches to its own LocalLink
+	   as side 0 (HDCommunicator::AttachLocalLink); the wire is side 1 of both and carries what one end
+	   sends across a SweepChannel to the other. */
+private:
+	LocalLink links[2];
+	std::mt19937 rng;
+	SweepChannel channels[2];		// channels[i]: from the end on links[i] to the other
+
+public:
+	SweepWire(const SweepLink &link, uint32_t seed) : rng(seed), channels{ SweepChannel(link, rng), SweepChannel(link, rng) } {
+		for (int i = 0; i < 2; i++) {
+			links[i].pid[1].store(LocalProcessId());
+			links[i].attached[1].store(1, std::memory_order_release);
+		}
+	}
+
+	void Attach(HDCommunicator &comm, int end) {
+		comm.AttachLocalLink(&links[end], 0);
+	}
+
+	void Take(ts_t now) {
+		/* what both ends sent so far leaves at now */
+		for (int i = 0; i < 2; i++)
+			channels[i].Take(links[i].rings[0], now);
+	}
+
+	void Deliver(ts_t now) {
+		for (int i = 0; i < 2; i++)
+			channels[i].Deliver(links[1 - i].rings[1], now);
+	}
+};
+
+struct SweepSide {
+	/* one end of a sweep point: a HapticDeviceController on a simulated device, with its communicator
+	   on the wire and its own time source. a send rate is a RateController (fixed, or adaptive up to
+	   send_hz) in front of a disabled deadband. logging is off: the loggers have no file. */
+	SimulatedDevice device;
+	SNDLogger sndlogger;
+	RCVLogger rcvlogger;
+	ERRLogger errlogger;
+	HDCommunicator comm;
+	Upsampler upsampler;
+	HapticDeviceController controller;
+
+	SweepSide(const SimTrajectory &hand, const SweepParams &params, char alias, SweepWire &wire, int end, const ts_t *now) :
+		device(hand), sndlogger(""), rcvlogger(""), errlogger(""),
+		comm(0, INVALID_SOCKET, NULL, 0, alias, &sndlogger, &rcvlogger, &errlogger),
+		controller(&device, alias, &comm, &sndlogger, &rcvlogger, &errlogger) {
+		wire.Attach(comm, end);
+		controller.SetTimeSource(now);
+		controller.SetPredictors(params.predictor, params.predictor, params.history);
+		controller.SetForceStrength(params.force_strength);
+		DeadbandConfig cfg;
+		cfg.k = params.deadband_k;
+		cfg.floor_mm = params.deadband_floor;
+		cfg.enabled = params.send_hz <= 0;
+		controller.SetDeadband(cfg);
+		RateControlConfig rate_cfg;
+		rate_cfg.enabled = params.adaptive;
+		if (params.send_hz > 0 && params.adaptive)
+			rate_cfg.max_hz = params.send_hz;
+		else if (params.send_hz > 0)
+			rate_cfg.SetFixed(params.send_hz);
+		controller.SetRateControl(rate_cfg);
+		if (params.upsample)
+			controller.SetUpsampler(&upsampler);
+	}
+};
+
+inline double SweepPercentile(std::vector<double> &values, double p) {
+	/* p-quantile, reorders values */
+	if (values.empty())
+		return 0;
+	size_t k = std::min(values.size() - 1, (size_t)(p * values.size()));
+	std::nth_element(values.begin(), values.begin() + k, values.end());
+	return values[k];
+}
+
+inline SweepResult RunSweepPoint(const SweepParams &params, const SimTrajectory &hand, const SweepLink &link,
+								 double seconds, uint32_t seed = 1) {
+	/* one point of the sweep: master follows hand, slave holds still at its start. same seed, same result. */
+	SimTrajectory hold(SIM_HOLD);
+	hold.SetCenter(SimTrajectory(hand).At(0));
+	ts_t now = SWEEP_START_US;		// the clock of this point only: points run side by side
+	SweepWire wire(link, seed);
+	SweepSide master(hand, params, 'M', wire, 0, &now);
+	SweepSide slave(hold, params, 'S', wire, 1, &now);
+
+	size_t ticks = (size_t)(seconds * 1e6 / SWEEP_TICK_US);
+	std::vector<double> errors;
+	std::vector<double> jumps;
+	errors.reserve(ticks);
+	jumps.reserve(2 * ticks);
+	double render_sum = 0;
+	hduVector3Dd master_force(0, 0, 0), slave_force(0, 0, 0);
+	for (size_t i = 0; i < ticks; i++, now += SWEEP_TICK_US) {
+		hduVector3Dd m, s;
+		master.device.GetPosition(m);
+		slave.device.GetPosition(s);
+		// each packet leaves right after the tick that sent it: the master's reaches a slave with no delay the same tick
+		wire.Deliver(now);
+		master.controller.tick();
+		wire.Take(now);
+		wire.Deliver(now);
+		slave.controller.tick();
+		wire.Take(now);
+
+		render_sum += (slave.controller.getRenderedTarget() - m).magnitude() +
+					  (master.controller.getRenderedTarget() - s).magnitude();
+		jumps.push_back((master.device.GetForce() - master_force).magnitude());
+		jumps.push_back((slave.device.GetForce() - slave_force).magnitude());
+		master_force = master.device.GetForce();
+		slave_force = slave.device.GetForce();
+		master.device.GetPosition(m);
+		slave.device.GetPosition(s);
+		errors.push_back((m - s).magnitude());
+	}
+
+	SweepResult result;
+	result.params = params;
+	result.packet_rate = (master.controller.getSentPacketCount() + slave.controller.getSentPacketCount()) / seconds;
+	double sum = 0;
+	for (size_t i = 0; i < errors.size(); i++)
+		sum += errors[i];
+	result.error_mean = errors.empty() ? 0 : sum / errors.size();
+	result.error_p99 = SweepPercentile(errors, 0.99);
+	result.render_error_mean = ticks ? render_sum / (2 * ticks) : 0;
+	result.force_jump_max = jumps.empty() ? 0 : *std::max_element(jumps.begin(), jumps.end());
+	result.force_jump_p99 = SweepPercentile(jumps, 0.99);
+	return result;
+}
+
+inline size_t MarkPareto(std::vector<SweepResult> &results) {
+	/* flag the points no other point dominates. returns how many there are. */
+	size_t count = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		results[i].pareto = true;
+		for (size_t j = 0; j < results.size() && results[i].pareto; j++)
+			if (j != i && results[j].Dominates(results[i]))
+				results[i].pareto = false;
+		if (results[i].pareto)
+			count++;
+	}
+	return count;
+}
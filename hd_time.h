@@ -3,7 +3,26 @@
 #include "hd_types.h"
 #include <chrono>
 
+#ifdef HD_SIMULATION
+inline const ts_t*& VirtualClock() {
+	static const ts_t *now = NULL;
+	return now;
+}
+
+inline void SetVirtualClock(const ts_t *now) {
+	// simulation builds only: getCurrentTime returns *now until reset with NULL (see hd_replay.h).
+	// set it while no other thread is reading the clock.
+	VirtualClock() = now;
+}
+#endif
+
 ts_t getCurrentTime() {
+	// monotonic: never jumps with NTP or manual adjustments. the epoch is arbitrary per host,
+	// so remote timestamps are only compared through ClockEstimator (hd_clock.h).
+#ifdef HD_SIMULATION
+	if (VirtualClock())
+		return *VirtualClock();
+#endif
 	using namespace std::chrono;
-	return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
 }
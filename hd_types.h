@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 #define pos_t float
 #define cnt_t uint32_t
 #define ts_t int64_t
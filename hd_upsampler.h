@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hd_api.h"
+#include "hd_types.h"
+
+#define UPSAMPLER_SAMPLES 4					// remote samples kept (Catmull-Rom needs the neighbours of a segment)
+#define UPSAMPLER_DELAY_MS 2				// render one sample interval plus this far behind the newest sample
+#define UPSAMPLER_MAX_DELAY_MS 20			// cap on the render delay, for sparse (deadband) streams
+#define UPSAMPLER_INTERVAL_SMOOTHING 0.1	// EWMA weight of a new sample interval
+#define UPSAMPLER_BLEND_MS 8				// a correction fades out over this long
+#define UPSAMPLER_EXTRAPOLATE_MS 50			// past the newest sample the velocity ramps down to 0 over this long
+#define UPSAMPLER_CLOCK_SMOOTHING 0.05		// EWMA weight of a new transit time (arrival - sender timestamp)
+
+enum UpsamplerRender {
+	RENDER_INTERPOLATED,	// render time between two samples
+	RENDER_EXTRAPOLATED,	// past the newest sample, velocity ramping down
+	RENDER_HELD				// past the extrapolation window (or before the oldest sample)
+};
+
+struct UpsamplerConfig {
+	/* rendering delay and blending, all in ms */
+	double delay_ms;			// margin on top of the sample interval, for transit jitter
+	double max_delay_ms;		// 0: pure extrapolation, every sample is a correction
+	double blend_ms;			// 0: corrections jump
+	double extrapolate_ms;		// 0: hold the newest sample
+
+	UpsamplerConfig() : delay_ms(UPSAMPLER_DELAY_MS), max_delay_ms(UPSAMPLER_MAX_DELAY_MS), blend_ms(UPSAMPLER_BLEND_MS),
+		extrapolate_ms(UPSAMPLER_EXTRAPOLATE_MS) {}
+
+	bool Set(const std::string &key, double value) {
+		/* set a field by name (key=value on the command line). returns false for unknown keys. */
+		if (key == "delay") delay_ms = value;
+		else if (key == "maxdelay") max_delay_ms = value;
+		else if (key == "blend") blend_ms = value;
+		else if (key == "extrap") extrapolate_ms = value;
+		else return false;
+		return true;
+	}
+};
+
+struct UpsamplerStats {
+	uint64_t observed;
+	uint64_t stale;				// not newer than the newest sample, ignored
+	uint64_t renders;
+	uint64_t interpolated;		// renders of each UpsamplerRender kind
+	uint64_t extrapolated;
+	uint64_t held;
+	uint64_t corrections;		// new samples that moved the rendered curve
+	double correction_sum_mm;	// distance between the old and the new curve at the correction
+	double correction_max_mm;
+
+	UpsamplerStats() {
+		memset(this, 0, sizeof(UpsamplerStats));
+	}
+
+	double MeanCorrection() const {
+		return corrections ? correction_sum_mm / corrections : 0;
+	}
+};
+
+class Upsampler {
+	/* Reconstructs a smooth servo rate position from sparse timestamped
+	   remote samples. The curve is a cubic Hermite spline through the
+	   samples with Catmull-Rom tangents (velocity estimates from the
+	   neighbouring samples), rendered one sample interval (plus delay_ms)
+	   behind the newest one on the sender's clock, so the render point
+	   normally lies between two samples. Past the newest sample it
+	   continues with that sample's velocity, decelerating to a stop over
+	   extrapolate_ms. A new
+	   sample changes the curve around the render point; the difference in
+	   position, velocity and acceleration is faded out with a quintic over
+	   blend_ms, so all three stay continuous and jerk stays bounded. A
+	   correction during a blend adds to where that blend has got to and
+	   starts a new quintic from there, so offsets keep decaying even when
+	   every tick brings a sample. */
+private:
+	struct Sample {
+		hduVector3Dd pos;
+		ts_t ts;
+	};
+
+	UpsamplerConfig cfg;
+	UpsamplerStats stats;
+	Sample samples[UPSAMPLER_SAMPLES];	// oldest first
+	int count;
+	double transit_us;					// smoothed arrival - sender timestamp (delay plus clock offset)
+	double interval_us;					// smoothed spacing of the samples
+	double lag_us;						// render time = now - lag_us: transit plus render delay
+	bool changed;						// samples changed since the last Render
+	Sample previous[UPSAMPLER_SAMPLES];	// the curve the last Render was on, while changed
+	int previous_count;
+	double previous_lag_us;
+	hduVector3Dd blend_pos;				// offset at blend_start, fading out
+	hduVector3Dd blend_vel;
+	hduVector3Dd blend_acc;
+	ts_t blend_start;
+	bool blending;
+
+	static hduVector3Dd Tangent(const Sample *samples, int count, int i) {
+		/* velocity estimate at sample i (mm/s): central difference, one-sided at the ends */
+		if (count < 2)
+			return hduVector3Dd(0, 0, 0);
+		int a = i > 0 ? i - 1 : i;
+		int b = i < count - 1 ? i + 1 : i;
+		return (samples[b].pos - samples[a].pos) / ((samples[b].ts - samples[a].ts) * 1e-6);
+	}
+
+	int Evaluate(const Sample *samples, int count, double t, hduVector3Dd &pos, hduVector3Dd &vel, hduVector3Dd &acc) const {
+		/* the curve through samples and its first two derivatives at sender time t (us).
+		   returns which part of it t is on: RENDER_INTERPOLATED, RENDER_EXTRAPOLATED or RENDER_HELD */
+		const Sample &newest = samples[count - 1];
+		if (t >= newest.ts) {
+			double tau = (t - newest.ts) * 1e-6;
+			double window = cfg.extrapolate_ms * 1e-3;
+			hduVector3Dd v = Tangent(samples, count, count - 1);
+			if (tau < window) {
+				pos = newest.pos + v * (tau - tau * tau / (2 * window));
+				vel = v * (1 - tau / window);
+				acc = v * (-1 / window);
+				return RENDER_EXTRAPOLATED;
+			}
+			pos = newest.pos + v * (window / 2);
+			vel = acc = hduVector3Dd(0, 0, 0);
+			return RENDER_HELD;
+		}
+		if (t <= samples[0].ts) {
+			pos = samples[0].pos;
+			vel = acc = hduVector3Dd(0, 0, 0);
+			return RENDER_HELD;
+		}
+		int k = count - 2;
+		while (samples[k].ts > t)
+			k--;
+		double h = (samples[k + 1].ts - samples[k].ts) * 1e-6;
+		double u = (t - samples[k].ts) * 1e-6 / h;
+		double u2 = u * u, u3 = u2 * u;
+		hduVector3Dd m0 = Tangent(samples, count, k) * h;
+		hduVector3Dd m1 = Tangent(samples, count, k + 1) * h;
+		pos = samples[k].pos * (2 * u3 - 3 * u2 + 1) + m0 * (u3 - 2 * u2 + u) +
+			  samples[k + 1].pos * (-2 * u3 + 3 * u2) + m1 * (u3 - u2);
+		vel = (samples[k].pos * (6 * u2 - 6 * u) + m0 * (3 * u2 - 4 * u + 1) +
+			   samples[k + 1].pos * (-6 * u2 + 6 * u) + m1 * (3 * u2 - 2 * u)) / h;
+		acc = (samples[k].pos * (12 * u - 6) + m0 * (6 * u - 4) +
+			   samples[k + 1].pos * (-12 * u + 6) + m1 * (6 * u - 2)) / (h * h);
+		return RENDER_INTERPOLATED;
+	}
+
+	void Blend(ts_t now, hduVector3Dd &pos, hduVector3Dd &vel, hduVector3Dd &acc) {
+		/* add the running blend at now, quintic from (blend_pos, blend_vel, blend_acc) to (0, 0, 0) */
+		if (!blending)
+			return;
+		double window = cfg.blend_ms * 1e-3;
+		double s = (now - blend_start) * 1e-6 / window;
+		if (s >= 1) {
+			blending = false;
+			return;
+		}
+		double s2 = s * s, s3 = s2 * s, s4 = s3 * s, s5 = s4 * s;
+		double w2 = window * window;
+		pos += blend_pos * (1 - 10 * s3 + 15 * s4 - 6 * s5) + blend_vel * (window * (s - 6 * s3 + 8 * s4 - 3 * s5)) +
+			   blend_acc * (w2 * (0.5 * s2 - 1.5 * s3 + 1.5 * s4 - 0.5 * s5));
+		vel += blend_pos * ((-30 * s2 + 60 * s3 - 30 * s4) / window) + blend_vel * (1 - 18 * s2 + 32 * s3 - 15 * s4) +
+			   blend_acc * (window * (s - 4.5 * s2 + 6 * s3 - 2.5 * s4));
+		acc += blend_pos * ((-60 * s + 180 * s2 - 120 * s3) / w2) + blend_vel * ((-36 * s + 96 * s2 - 60 * s3) / window) +
+			   blend_acc * (1 - 9 * s + 18 * s2 - 10 * s3);
+	}
+
+public:
+	Upsampler(const UpsamplerConfig &cfg = UpsamplerConfig()) : cfg(cfg) {
+		Reset();
+	}
+
+	void Configure(const UpsamplerConfig &config) {
+		cfg = config;
+	}
+
+	const UpsamplerConfig& getConfig() const {
+		return cfg;
+	}
+
+	void Reset() {
+		count = 0;
+		transit_us = 0;
+		interval_us = 0;
+		lag_us = 0;
+		changed = false;
+		previous_count = 0;
+		previous_lag_us = 0;
+		blending = false;
+		blend_start = 0;
+	}
+
+	void Observe(const hduVector3Dd &pos, ts_t ts, ts_t arrival) {
+		/* remote sample stamped ts on the sender's clock, arrived at local time arrival */
+		if (count > 0 && ts <= samples[count - 1].ts) {
+			stats.stale++;
+			return;
+		}
+		if (!changed) {
+			memcpy(previous, samples, sizeof(samples));
+			previous_count = count;
+			previous_lag_us = lag_us;
+		}
+		double transit = (double)arrival - (double)ts;
+		transit_us = count == 0 ? transit : transit_us + UPSAMPLER_CLOCK_SMOOTHING * (transit - transit_us);
+		if (count > 0) {
+			double interval = (double)(ts - samples[count - 1].ts);
+			interval_us = count == 1 ? interval : interval_us + UPSAMPLER_INTERVAL_SMOOTHING * (interval - interval_us);
+		}
+		double delay_us = std::min(interval_us + cfg.delay_ms * 1000, cfg.max_delay_ms * 1000);
+		lag_us = transit_us + delay_us;
+		if (count == UPSAMPLER_SAMPLES) {
+			for (int i = 1; i < UPSAMPLER_SAMPLES; i++)
+				samples[i - 1] = samples[i];
+			count--;
+		}
+		samples[count].pos = pos;
+		samples[count].ts = ts;
+		count++;
+		changed = true;
+		stats.observed++;
+	}
+
+	bool Render(ts_t now, hduVector3Dd &out) {
+		/* position to render at local time now. false before the first sample. */
+		if (count == 0)
+			return false;
+		stats.renders++;
+
+		hduVector3Dd pos, vel, acc;
+		int kind = Evaluate(samples, count, (double)now - lag_us, pos, vel, acc);
+		if (kind == RENDER_INTERPOLATED)
+			stats.interpolated++;
+		else if (kind == RENDER_EXTRAPOLATED)
+			stats.extrapolated++;
+		else
+			stats.held++;
+
+		if (changed && previous_count > 0 && cfg.blend_ms > 0) {
+			// the old curve plus its running blend is what we were rendering: start a blend from there to the new curve
+			hduVector3Dd old_pos, old_vel, old_acc;
+			Evaluate(previous, previous_count, (double)now - previous_lag_us, old_pos, old_vel, old_acc);
+			Blend(now, old_pos, old_vel, old_acc);
+			blend_pos = old_pos - pos;
+			blend_vel = old_vel - vel;
+			blend_acc = old_acc - acc;
+			blend_start = now;
+			blending = true;
+			double correction = blend_pos.magnitude();
+			stats.corrections++;
+			stats.correction_sum_mm += correction;
+			if (correction > stats.correction_max_mm)
+				stats.correction_max_mm = correction;
+		}
+		changed = false;
+
+		Blend(now, pos, vel, acc);
+		out = pos;
+		return true;
+	}
+
+	const UpsamplerStats& getStats() const {
+		return stats;
+	}
+};
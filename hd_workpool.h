@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+#define WORKPOOL_IDLE_MS 1		// sleep of a worker that found nothing to run or steal
+
+class WorkStealingPool {
+	/* Fixed set of worker threads with one task deque each. Submit deals
+	   tasks round-robin; a worker runs its own deque from the back (newest
+	   first) and, once it is empty, steals from the front of the others
+	   (oldest first), so uneven task durations still keep every core busy.
+	   Meant for coarse tasks of a millisecond and up: every deque has its
+	   own mutex, held only to push or pop. Wait blocks until all submitted
+	   tasks have finished. */
+private:
+	struct Worker {
+		std::deque<std::function<void()> > tasks;
+		std::mutex mutex;
+	};
+
+	std::vector<Worker*> workers;
+	std::vector<std::thread> threads;
+	std::atomic<bool> running;
+	std::atomic<uint64_t> pending;		// submitted, not finished
+	std::atomic<uint32_t> next_worker;	// round-robin target of Submit
+	std::atomic<uint64_t> steals;
+	std::mutex done_mutex;
+	std::condition_variable done;
+
+	bool Pop(size_t self, std::function<void()> &task) {
+		{
+			Worker *own = workers[self];
+			std::lock_guard<std::mutex> lock(own->mutex);
+			if (!own->tasks.empty()) {
+				task.swap(own->tasks.back());
+				own->tasks.pop_back();
+				return true;
+			}
+		}
+		for (size_t i = 1; i < workers.size(); i++) {
+			Worker *victim = workers[(self + i) % workers.size()];
+			std::lock_guard<std::mutex> lock(victim->mutex);
+			if (!victim->tasks.empty()) {
+				task.swap(victim->tasks.front());
+				victim->tasks.pop_front();
+				steals.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Run(size_t self) {
+		std::function<void()> task;
+		while (running.load(std::memory_order_acquire)) {
+			if (!Pop(self, task)) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(WORKPOOL_IDLE_MS));
+				continue;
+			}
+			task();
+			task = nullptr;
+			if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				std::lock_guard<std::mutex> lock(done_mutex);
+				done.notify_all();
+			}
+		}
+	}
+
+public:
+	WorkStealingPool(unsigned threads_count = 0) : running(true), pending(0), next_worker(0), steals(0) {
+		/* threads_count 0: one worker per hardware thread */
+		if (threads_count == 0)
+			threads_count = std::thread::hardware_concurrency();
+		if (threads_count == 0)
+			threads_count = 1;
+		for (unsigned i = 0; i < threads_count; i++)
+			workers.push_back(new Worker());
+		for (unsigned i = 0; i < threads_count; i++)
+			threads.push_back(std::thread(&WorkStealingPool::Run, this, (size_t)i));
+	}
+
+	~WorkStealingPool() {
+		Wait();
+		running.store(false, std::memory_order_release);
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+		for (size_t i = 0; i < workers.size(); i++)
+			delete workers[i];
+	}
+
+	void Submit(const std::function<void()> &task) {
+		pending.fetch_add(1, std::memory_order_acq_rel);
+		Worker *worker = workers[next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size()];
+		std::lock_guard<std::mutex> lock(worker->mutex);
+		worker->tasks.push_back(task);
+	}
+
+	void Wait() {
+		std::unique_lock<std::mutex> lock(done_mutex);
+		done.wait(lock, [this] { return pending.load(std::memory_order_acquire) == 0; });
+	}
+
+	size_t getThreadCount() const {
+		return threads.size();
+	}
+
+	uint64_t getStealCount() const {
+		/* tasks run by another worker than the one they were dealt to */
+		return steals.load(std::memory_order_relaxed);
+	}
+};
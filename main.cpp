@@ -3,8 +3,7 @@
 #include <cstdio>
 #include <cassert>
 
-#include <WS2tcpip.h>
-#pragma comment (lib, "ws2_32.lib")
+#include "hd_socket.h"
 
 #define _CRT_SECURE_NO_WARNINGS
 
@@ -16,6 +15,8 @@
 #include "hd_controller.h"
 #include "hd_comm.h"
 #include "hd_logger.h"
+#include "hd_lifecycle.h"
+#include "hd_realtime.h"
 
 using namespace std;
 
@@ -25,11 +26,6 @@ HDSchedulerHandle gSchedulerCallback = HD_INVALID_HANDLE;
 hduVector3Dd forceField(hduVector3Dd pos);
 
 /* Global variable declaration*/
-int modC = 10;   // default: 1000 Hz -> 1000%modC HZ
-
-hduVector3Dd posMasterHold(0, 0, 0);
-HDdouble velThreshold = 300;
-
 const int Vband[3] = { 3,3,3 };
 double Vhold[3];
 int Vcount[3] = { 0,0,0 };
@@ -47,11 +43,18 @@ SOCKET sock;
 sockaddr_in server_addr;
 
 HDCommunicator* HDComm;
+HDNetworkThread* NetThread;
 HapticDeviceController* DeviceCon;
 
 char* DEVICE_NAME;
 char* SERVER_ADDR;
 uint32_t SERVER_PORT = 50000;
+bool USE_NET_THREAD = false;	// socket I/O on a dedicated thread instead of the servo callback
+bool USE_COMPACT = false;		// quantized, delta coded packets (see hd_codec.h); the peer accepts both
+uint32_t METRICS_PORT = 0;		// Prometheus endpoint port (see hd_metrics.h), 0 disables
+bool USE_RATE_CONTROL = false;	// "rate": send rate follows the hand's speed (see hd_ratecontrol.h)
+RealtimeProfile REALTIME;		// "rt" or "rt=servo,net,log cpus": memory locking, pinning, priorities (hd_realtime.h)
+std::string RELAY_SESSION;		// "session=KEY": join the peer with the same key on a relay (hd_relay.h)
 
 /******************************************************************************
 Makes a device specified in the pUserData current.
@@ -85,24 +88,6 @@ void ifErrorHold(hduVector3Dd pos)
 	}
 }
 
-//velocity-adaptive device control
-void velCon(hduVector3Dd pos)
-{
-	// Device Hz control 
-	HDdouble velMaster = ((pos - posMasterHold)*(1000 / modC)).magnitude();
-	if (velMaster > velThreshold)
-	{
-		modC = 5;
-		//cout << velMaster << " / " << 1000 / modC << endl;
-	}
-	else
-	{
-		modC = 1;
-		//cout << velMaster << " / " << 1000 / modC << endl;
-	}
-	posMasterHold = pos;
-}
-
 /******************************************************************************
 Main callback.  Retrieves position from both devices, calculates forces,
 and sets forces for both devices.
@@ -121,16 +106,12 @@ HDCallbackCode HDCALLBACK deviceCallback(void *data)
 }
 
 int initSocket() {
-	ULONG isNonBlocking = 1;
-
 	// create a hint structure for the server
-	memset(&server_addr, 0, sizeof(server_addr));
-	server_addr.sin_family = AF_INET;
-	server_addr.sin_port = htons(SERVER_PORT);
-	inet_pton(AF_INET, SERVER_ADDR, &server_addr.sin_addr);
+	MakeAddress(server_addr, SERVER_ADDR, SERVER_PORT);
 
-	sock = socket(AF_INET, SOCK_DGRAM, 0);
-	ioctlsocket(sock, FIONBIO, &isNonBlocking);
+	sock = CreateUDPSocket();
+	if (sock == INVALID_SOCKET)
+		return -1;
 
 	return 0;
 }
@@ -141,6 +122,11 @@ properly shutdown.
 ******************************************************************************/
 void exitHandler()
 {
+	// runs on the normal shutdown path and again at exit
+	static bool done = false;
+	if (done)
+		return;
+	done = true;
 
 	if (!lastError.errorCode)
 	{
@@ -155,6 +141,14 @@ void exitHandler()
 	}
 }
 
+/******************************************************************************
+Dumps the servo stage timing on SIGUSR1 / Ctrl+Break (builds with HD_PROFILE).
+******************************************************************************/
+void dumpHandler()
+{
+	DeviceCon->DumpProfile(stdout);
+}
+
 /******************************************************************************
 Main entry point.
 ******************************************************************************/
@@ -162,19 +156,35 @@ int main(int argc, char* argv[])
 {
 	HDErrorInfo error;
 
-	if (argc == 4) {
+	if (argc >= 4 && argc <= 10) {
 		SERVER_ADDR = argv[1];
 		SERVER_PORT = atoi(argv[2]);
 		DEVICE_NAME = argv[3];
+		for (int i = 4; i < argc; i++) {
+			USE_NET_THREAD |= strcmp(argv[i], "netthread") == 0;
+			USE_COMPACT |= strcmp(argv[i], "compact") == 0;
+			USE_RATE_CONTROL |= strcmp(argv[i], "rate") == 0;
+			if (strncmp(argv[i], "metrics=", 8) == 0)
+				METRICS_PORT = atoi(argv[i] + 8);
+			if (strncmp(argv[i], "session=", 8) == 0)
+				RELAY_SESSION = argv[i] + 8;
+			REALTIME.Parse(argv[i]);
+		}
 	}
 	else {
-		printf("Usage: ./CouloumbForceDual.exe <server HOST> <server PORT> <device name>n");
+		printf("Usage: ./CouloumbForceDual.exe <server HOST> <server PORT> <device name> [netthread] [compact] [rate] [metrics=PORT] [rt|rt=SERVO,NET,LOG] [session=KEY]\n");
 		return 0;
 	}
 
 	printf("Starting application\n");
 
 	atexit(exitHandler);
+	InstallShutdownHandlers();
+
+	// before anything allocates: later allocations and thread stacks are locked as they come
+	int rt_applied = 0;
+	if (REALTIME.enabled && REALTIME.lock_memory && LockMemory())
+		rt_applied |= RT_MEMORY_LOCKED;
 
 	// Initialize device
 	deviceID = hdInitDevice(DEVICE_NAME);
@@ -202,10 +212,8 @@ int main(int argc, char* argv[])
 
 	hdMakeCurrentDevice(deviceID);
 
-	// startup winsock
-	WSADATA data;
-	WORD version = MAKEWORD(2, 2);
-	int wsOK = WSAStartup(version, &data);
+	// startup socket layer (winsock on windows)
+	int wsOK = SocketStartup();
 	if (wsOK != 0)
 	{
 		cout << "Can't start Winsock! " << wsOK;
@@ -217,14 +225,42 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
-	SNDLogger m_sndlogger("m_snd.csv");
-	RCVLogger m_rcvlogger("m_rcv.csv");
-	ERRLogger m_errlogger("m_err.csv");
+	// asynchronous loggers: the servo callback only enqueues records
+	SNDLogger m_sndlogger("m_snd.csv", true);
+	RCVLogger m_rcvlogger("m_rcv.csv", true);
+	ERRLogger m_errlogger("m_err.csv", true);
 
 	// haptics callback
 	std::cout << "haptics callback" << std::endl;
 	HDComm = new HDCommunicator(deviceID, sock, &server_addr, sizeof(server_addr), 'S', &m_sndlogger, &m_rcvlogger, &m_errlogger);
+	if (USE_COMPACT)
+		HDComm->SetEncoding(ENCODING_COMPACT);
+	if (!RELAY_SESSION.empty())
+		HDComm->SetRelaySession(RELAY_SESSION);
 	DeviceCon = new HapticDeviceController(deviceID, 'S', HDComm, &m_sndlogger, &m_rcvlogger, &m_errlogger);
+	if (USE_RATE_CONTROL) {
+		RateControlConfig rate;
+		rate.enabled = true;
+		DeviceCon->SetRateControl(rate);
+	}
+
+	// live counters for Prometheus, served from a low priority thread; register before any I/O thread starts
+	MetricsRegistry metrics;
+	MetricsServer metrics_server(&metrics, METRICS_PORT);
+	if (METRICS_PORT) {
+		DeviceCon->SetMetrics(&metrics, DEVICE_NAME);
+		if (metrics_server.Start())
+			printf("Metrics on port %u\n", METRICS_PORT);
+		else
+			printf("Can't bind metrics port %u\n", METRICS_PORT);
+	}
+	if (USE_NET_THREAD) {
+		NetThread = new HDNetworkThread(HDComm);
+		if (REALTIME.enabled)
+			NetThread->SetRealtime(REALTIME.network);
+		NetThread->Start();
+		DeviceCon->SetNetworkThread(NetThread);
+	}
 
 	gSchedulerCallback = hdScheduleAsynchronous(
 		deviceCallback, 0, HD_MAX_SCHEDULER_PRIORITY);
@@ -237,11 +273,38 @@ int main(int argc, char* argv[])
 		exit(-1);
 	}
 
-	while (true);
+	if (REALTIME.enabled) {
+		// the servo thread belongs to HDAPI: configure it from a one-shot callback running on it
+		RealtimeServoSetup servo_setup(REALTIME.servo);
+		hdScheduleSynchronous(ConfigureServoThread, &servo_setup, HD_MAX_SCHEDULER_PRIORITY);
+		rt_applied |= m_sndlogger.ApplyRealtime(REALTIME.logger) | m_rcvlogger.ApplyRealtime(REALTIME.logger) |
+					  m_errlogger.ApplyRealtime(REALTIME.logger);
+		printf("Real-time profile:%s; servo:%s", RealtimeSummary(rt_applied).c_str(),
+			   RealtimeSummary(servo_setup.applied.load()).c_str());
+		if (NetThread) {
+			while (NetThread->getRealtimeApplied() < 0 && !ShutdownRequested())
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			printf("; network:%s", RealtimeSummary(NetThread->getRealtimeApplied()).c_str());
+		}
+		printf("\n");
+	}
+
+	// park until Ctrl+C / SIGTERM, then stop the servo callback before tearing down what it uses
+	WaitForShutdown(dumpHandler);
+	printf("Shutting down\n");
+	exitHandler();
+	// the registry points into the controller and communicator: no scrape may render them once they go
+	metrics_server.Stop();
+	if (NetThread) {
+		NetThread->Stop();
+		delete NetThread;
+	}
+	delete DeviceCon;
+	delete HDComm;
 
-	// close socket
+	// close socket; the loggers flush when they go out of scope
 	closesocket(sock);
-	WSACleanup();
+	SocketCleanup();
 
 	return 0;
 }
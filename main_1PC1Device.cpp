@@ -2,9 +2,10 @@
 #include <iostream>
 #include <cstdio>
 #include <cassert>
+#include <cctype>
+#include <string>
 
-#include <WS2tcpip.h>
-#pragma comment (lib, "ws2_32.lib")
+#include "hd_socket.h"
 
 #define _CRT_SECURE_NO_WARNINGS
 
@@ -15,6 +16,9 @@
 
 #include "hd_controller.h"
 #include "hd_comm.h"
+#include "hd_logger.h"
+#include "hd_lifecycle.h"
+#include "hd_realtime.h"
 
 using namespace std;
 
@@ -24,11 +28,6 @@ HDSchedulerHandle gSchedulerCallback = HD_INVALID_HANDLE;
 hduVector3Dd forceField(hduVector3Dd pos);
 
 /* Global variable declaration*/
-int modC = 10;   // default: 1000 Hz -> 1000%modC HZ
-
-hduVector3Dd posMasterHold(0, 0, 0);
-HDdouble velThreshold = 300;
-
 const int Vband[3] = { 3,3,3 };
 double Vhold[3];
 int Vcount[3] = { 0,0,0 };
@@ -42,8 +41,7 @@ struct DeviceDisplayStates
 	hduVector3Dd force;
 };
 
-SOCKET master_sock;
-SOCKET slave_sock;
+SOCKET sock;					// bound to our own side's address
 sockaddr_in master_addr;
 sockaddr_in slave_addr;
 
@@ -57,6 +55,7 @@ char MASTER_ADDR[32] = "127.0.0.1"; //"192.168.1.158";
 uint32_t MASTER_PORT = 25000;
 char SLAVE_ADDR[32] = "127.0.0.1"; // "192.168.1.136";
 uint32_t SLAVE_PORT = 25001;
+RealtimeProfile REALTIME;		// "rt" or "rt=servo,net,log cpus" after the device name (hd_realtime.h)
 
 /******************************************************************************
  Makes a device specified in the pUserData current.
@@ -95,24 +94,6 @@ void ifErrorHold(hduVector3Dd pos)
 	}
 }
 
-//velocity-adaptive device control
-void velCon(hduVector3Dd pos)
-{
-	// Device Hz control 
-	HDdouble velMaster = ((pos - posMasterHold)*(1000 / modC)).magnitude();
-	if (velMaster > velThreshold)
-	{
-		modC = 5;
-		//cout << velMaster << " / " << 1000 / modC << endl;
-	}
-	else
-	{
-		modC = 1;
-		//cout << velMaster << " / " << 1000 / modC << endl;
-	}
-	posMasterHold = pos;
-}
-
 /******************************************************************************
  Main callback.  Retrieves position from both devices, calculates forces,
  and sets forces for both devices.
@@ -131,41 +112,19 @@ HDCallbackCode HDCALLBACK deviceCallback(void *data)
 }
 
 int initSocket() {
-	// create a hint structure for the server
-	memset(&master_addr, 0, sizeof(master_addr));
-	master_addr.sin_family = AF_INET;
-	master_addr.sin_port = htons(MASTER_PORT);
-	inet_pton(AF_INET, MASTER_ADDR, &master_addr.sin_addr);
-
-	memset(&slave_addr, 0, sizeof(master_addr));
-	slave_addr.sin_family = AF_INET;
-	slave_addr.sin_port = htons(SLAVE_PORT);
-	inet_pton(AF_INET, SLAVE_ADDR, &slave_addr.sin_addr);
-
-	ULONG isNonBlocking = 1;
-
-	// socket creation
-
-	if (ALIAS == 'S') {
-		slave_sock = socket(AF_INET, SOCK_DGRAM, 0);
-		ioctlsocket(slave_sock, FIONBIO, &isNonBlocking);
-		if (::bind(slave_sock, (sockaddr*)&slave_addr, sizeof(sockaddr_in)) == SOCKET_ERROR) {
-			cout << "Can't bind slave socket! " << WSAGetLastError() << endl;
-			return -1;
-		}
-	}
-	else if (ALIAS == 'M') {
-		master_sock = socket(AF_INET, SOCK_DGRAM, 0);
-		ioctlsocket(master_sock, FIONBIO, &isNonBlocking);
-		if (::bind(master_sock, (sockaddr*)&master_addr, sizeof(sockaddr_in)) == SOCKET_ERROR) {
-			cout << "Can't bind master socket! " << WSAGetLastError() << endl;
-			return -1;
-		}
-	}
-	else {
+	// both ends' addresses; we bind our own and send to the other
+	MakeAddress(master_addr, MASTER_ADDR, MASTER_PORT);
+	MakeAddress(slave_addr, SLAVE_ADDR, SLAVE_PORT);
+
+	if (ALIAS != 'M' && ALIAS != 'S') {
 		printf("Err: Alias should be either M or S\n");
 		return -1;
 	}
+	sock = CreateUDPSocket(ALIAS == 'M' ? &master_addr : &slave_addr);
+	if (sock == INVALID_SOCKET) {
+		cout << "Can't bind " << (ALIAS == 'M' ? "master" : "slave") << " socket! " << SocketLastError() << endl;
+		return -1;
+	}
 
 	return 0;
 }
@@ -176,6 +135,11 @@ int initSocket() {
 ******************************************************************************/
 void exitHandler()
 {
+	// runs on the normal shutdown path and again at exit
+	static bool done = false;
+	if (done)
+		return;
+	done = true;
 
 	if (!lastError.errorCode)
 	{
@@ -190,6 +154,14 @@ void exitHandler()
 	}
 }
 
+/******************************************************************************
+ Dumps the servo stage timing on SIGUSR1 / Ctrl+Break (builds with HD_PROFILE).
+******************************************************************************/
+void dumpHandler()
+{
+	DeviceCon->DumpProfile(stdout);
+}
+
 /******************************************************************************
  Main entry point.
 ******************************************************************************/
@@ -198,7 +170,7 @@ int main(int argc, char* argv[])
 	HDErrorInfo error;
 
 	if (argc > 1) {
-		if (argc == 5) {
+		if (argc == 5 || (argc == 6 && REALTIME.Parse(argv[5]))) {
 			ALIAS = argv[1][0];
 			if (ALIAS == 'M') {
 				strcpy(SLAVE_ADDR, argv[2]);
@@ -211,19 +183,26 @@ int main(int argc, char* argv[])
 			strcpy(DEVICE_NAME_1, argv[4]);
 		}
 		else {
-			printf("Usage: ./CouloumbForceDual.exe <alias> <target IP> <target PORT> <device name>n");
+			printf("Usage: ./CouloumbForceDual.exe <alias> <target IP> <target PORT> <device name> [rt|rt=SERVO,NET,LOG]\n");
+			return 0;
 		}
 	}
 
 	printf("Starting application\n");
 
 	atexit(exitHandler);
+	InstallShutdownHandlers();
+
+	// before anything allocates: later allocations and thread stacks are locked as they come
+	int rt_applied = 0;
+	if (REALTIME.enabled && REALTIME.lock_memory && LockMemory())
+		rt_applied |= RT_MEMORY_LOCKED;
 
 	// Initialize device
 	phantomId_1 = hdInitDevice(DEVICE_NAME_1);
 	if (HD_DEVICE_ERROR(lastError = hdGetError()))
 	{
-		hduPrintError(stderr, &error, "Failed to initialize first haptic device");
+		hduPrintError(stderr, &lastError, "Failed to initialize first haptic device");
 		fprintf(stderr, "Make sure the configuration \"%s\" exists\n", DEVICE_NAME_1);
 		fprintf(stderr, "\nPress any key to quit.\n");
 		getchar();
@@ -245,10 +224,8 @@ int main(int argc, char* argv[])
 
 	hdMakeCurrentDevice(phantomId_1);
 
-	// startup winsock
-	WSADATA data;
-	WORD version = MAKEWORD(2, 2);
-	int wsOK = WSAStartup(version, &data);
+	// startup socket layer (winsock on windows)
+	int wsOK = SocketStartup();
 	if (wsOK != 0)
 	{
 		cout << "Can't start Winsock! " << wsOK;
@@ -260,10 +237,19 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
+	// asynchronous loggers: the servo callback only enqueues records
+	string prefix(1, (char)tolower(ALIAS));
+	SNDLogger sndlogger(prefix + "_snd.csv", true);
+	RCVLogger rcvlogger(prefix + "_rcv.csv", true);
+	ERRLogger errlogger(prefix + "_err.csv", true);
+
 	// haptics callback
 	std::cout << "haptics callback" << std::endl;
-	HDComm = new HDCommunicator(phantomId_1, master_sock, &slave_addr, sizeof(slave_addr), ALIAS);
-	DeviceCon = new HapticDeviceController(phantomId_1, ALIAS, HDComm);
+	sockaddr_in* peer_addr = ALIAS == 'M' ? &slave_addr : &master_addr;
+	HDComm = new HDCommunicator(phantomId_1, sock, peer_addr, sizeof(sockaddr_in), ALIAS, &sndlogger, &rcvlogger, &errlogger);
+	// both ends bind their port: a peer on this host is reached through shared memory instead of UDP
+	HDComm->EnableLocalTransport();
+	DeviceCon = new HapticDeviceController(phantomId_1, ALIAS, HDComm, &sndlogger, &rcvlogger, &errlogger);
 
 	gSchedulerCallback = hdScheduleAsynchronous(
 		deviceCallback, 0, HD_MAX_SCHEDULER_PRIORITY);
@@ -276,12 +262,26 @@ int main(int argc, char* argv[])
 		exit(-1);
 	}
 
-	while (true);
+	if (REALTIME.enabled) {
+		// the servo thread belongs to HDAPI: configure it from a one-shot callback running on it
+		RealtimeServoSetup servo_setup(REALTIME.servo);
+		hdScheduleSynchronous(ConfigureServoThread, &servo_setup, HD_MAX_SCHEDULER_PRIORITY);
+		rt_applied |= sndlogger.ApplyRealtime(REALTIME.logger) | rcvlogger.ApplyRealtime(REALTIME.logger) |
+					  errlogger.ApplyRealtime(REALTIME.logger);
+		printf("Real-time profile:%s; servo:%s\n", RealtimeSummary(rt_applied).c_str(),
+			   RealtimeSummary(servo_setup.applied.load()).c_str());
+	}
+
+	// park until Ctrl+C / SIGTERM, then stop the servo callback before tearing down what it uses
+	WaitForShutdown(dumpHandler);
+	printf("Shutting down\n");
+	exitHandler();
+	delete DeviceCon;
+	delete HDComm;
 
-	// close socket
-	closesocket(master_sock);
-	closesocket(slave_sock);
-	WSACleanup();
+	// close socket; the loggers flush when they go out of scope
+	closesocket(sock);
+	SocketCleanup();
 
 	return 0;
 }
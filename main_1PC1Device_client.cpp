@@ -3,8 +3,7 @@
 #include <cstdio>
 #include <cassert>
 
-#include <WS2tcpip.h>
-#pragma comment (lib, "ws2_32.lib")
+#include "hd_socket.h"
 
 #define _CRT_SECURE_NO_WARNINGS
 
@@ -15,7 +14,9 @@
 
 #include "hd_controller.h"
 #include "hd_comm.h"
+#include "hd_lifecycle.h"
 #include "hd_logger.h"
+#include "hd_realtime.h"
 
 using namespace std;
 
@@ -25,11 +26,6 @@ HDSchedulerHandle gSchedulerCallback = HD_INVALID_HANDLE;
 hduVector3Dd forceField(hduVector3Dd pos);
 
 /* Global variable declaration*/
-int modC = 10;   // default: 1000 Hz -> 1000%modC HZ
-
-hduVector3Dd posMasterHold(0, 0, 0);
-HDdouble velThreshold = 300;
-
 const int Vband[3] = { 3,3,3 };
 double Vhold[3];
 int Vcount[3] = { 0,0,0 };
@@ -43,7 +39,7 @@ struct DeviceDisplayStates
 	hduVector3Dd force;
 };
 
-SOCKET socket;
+SOCKET sock;
 sockaddr_in server_addr;
 
 HDCommunicator* HDComm;
@@ -52,6 +48,7 @@ HapticDeviceController* DeviceCon;
 char* DEVICE_NAME;
 char* SERVER_ADDR;
 uint32_t SERVER_PORT = 50000;
+RealtimeProfile REALTIME;		// "rt" or "rt=servo,net,log cpus" after the device name (hd_realtime.h)
 
 /******************************************************************************
 Makes a device specified in the pUserData current.
@@ -85,24 +82,6 @@ void ifErrorHold(hduVector3Dd pos)
 	}
 }
 
-//velocity-adaptive device control
-void velCon(hduVector3Dd pos)
-{
-	// Device Hz control 
-	HDdouble velMaster = ((pos - posMasterHold)*(1000 / modC)).magnitude();
-	if (velMaster > velThreshold)
-	{
-		modC = 5;
-		//cout << velMaster << " / " << 1000 / modC << endl;
-	}
-	else
-	{
-		modC = 1;
-		//cout << velMaster << " / " << 1000 / modC << endl;
-	}
-	posMasterHold = pos;
-}
-
 /******************************************************************************
 Main callback.  Retrieves position from both devices, calculates forces,
 and sets forces for both devices.
@@ -121,16 +100,12 @@ HDCallbackCode HDCALLBACK deviceCallback(void *data)
 }
 
 int initSocket() {
-	ULONG isNonBlocking = 1;
-
 	// create a hint structure for the server
-	memset(&server_addr, 0, sizeof(server_addr));
-	server_addr.sin_family = AF_INET;
-	server_addr.sin_port = htons(MASTER_PORT);
-	inet_pton(AF_INET, SERVER_ADDR, &server_addr.sin_addr);
+	MakeAddress(server_addr, SERVER_ADDR, SERVER_PORT);
 
-    sock = socket(AF_INET, SOCK_DGRAM, 0);
-    ioctlsocket(sock, FIONBIO, &isNonBlocking);
+	sock = CreateUDPSocket();
+	if (sock == INVALID_SOCKET)
+		return -1;
 
 	return 0;
 }
@@ -141,6 +116,11 @@ properly shutdown.
 ******************************************************************************/
 void exitHandler()
 {
+	// runs on the normal shutdown path and again at exit
+	static bool done = false;
+	if (done)
+		return;
+	done = true;
 
 	if (!lastError.errorCode)
 	{
@@ -155,6 +135,14 @@ void exitHandler()
 	}
 }
 
+/******************************************************************************
+Dumps the servo stage timing on SIGUSR1 / Ctrl+Break (builds with HD_PROFILE).
+******************************************************************************/
+void dumpHandler()
+{
+	DeviceCon->DumpProfile(stdout);
+}
+
 /******************************************************************************
 Main entry point.
 ******************************************************************************/
@@ -162,26 +150,32 @@ int main(int argc, char* argv[])
 {
 	HDErrorInfo error;
 
-    if (argc == 4) {
-        SERVER_ADDR = argv[1];
-        SERVER_PORT = atoi(argv[2]);
-        DEVICE_NAME = argv[3];
-    }
-    else {
-        printf("Usage: ./CouloumbForceDual.exe <server HOST> <server PORT> <device name>n");
-        return 0;
-    }
+	if (argc == 4 || (argc == 5 && REALTIME.Parse(argv[4]))) {
+		SERVER_ADDR = argv[1];
+		SERVER_PORT = atoi(argv[2]);
+		DEVICE_NAME = argv[3];
+	}
+	else {
+		printf("Usage: ./CouloumbForceDual.exe <server HOST> <server PORT> <device name> [rt|rt=SERVO,NET,LOG]\n");
+		return 0;
+	}
 
 	printf("Starting application\n");
 
 	atexit(exitHandler);
+	InstallShutdownHandlers();
+
+	// before anything allocates: later allocations and thread stacks are locked as they come
+	int rt_applied = 0;
+	if (REALTIME.enabled && REALTIME.lock_memory && LockMemory())
+		rt_applied |= RT_MEMORY_LOCKED;
 
 	// Initialize device
 	deviceID = hdInitDevice(DEVICE_NAME);
 	if (HD_DEVICE_ERROR(lastError = hdGetError()))
 	{
-		hduPrintError(stderr, &error, "Failed to initialize first haptic device");
-		fprintf(stderr, "Make sure the configuration \"%s\" exists\n", DEVICE_NAME_1);
+		hduPrintError(stderr, &lastError, "Failed to initialize first haptic device");
+		fprintf(stderr, "Make sure the configuration \"%s\" exists\n", DEVICE_NAME);
 		fprintf(stderr, "\nPress any key to quit.\n");
 		getchar();
 		exit(-1);
@@ -202,10 +196,8 @@ int main(int argc, char* argv[])
 
 	hdMakeCurrentDevice(deviceID);
 
-	// startup winsock
-	WSADATA data;
-	WORD version = MAKEWORD(2, 2);
-	int wsOK = WSAStartup(version, &data);
+	// startup socket layer (winsock on windows)
+	int wsOK = SocketStartup();
 	if (wsOK != 0)
 	{
 		cout << "Can't start Winsock! " << wsOK;
@@ -217,9 +209,10 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
-	SNDLogger m_sndlogger("m_snd.csv");
-	RCVLogger m_rcvlogger("m_rcv.csv");
-	ERRLogger m_errlogger("m_err.csv");
+	// asynchronous loggers: the servo callback only enqueues records
+	SNDLogger m_sndlogger("m_snd.csv", true);
+	RCVLogger m_rcvlogger("m_rcv.csv", true);
+	ERRLogger m_errlogger("m_err.csv", true);
 
 	// haptics callback
 	std::cout << "haptics callback" << std::endl;
@@ -237,12 +230,26 @@ int main(int argc, char* argv[])
 		exit(-1);
 	}
 
-	while (true);
+	if (REALTIME.enabled) {
+		// the servo thread belongs to HDAPI: configure it from a one-shot callback running on it
+		RealtimeServoSetup servo_setup(REALTIME.servo);
+		hdScheduleSynchronous(ConfigureServoThread, &servo_setup, HD_MAX_SCHEDULER_PRIORITY);
+		rt_applied |= m_sndlogger.ApplyRealtime(REALTIME.logger) | m_rcvlogger.ApplyRealtime(REALTIME.logger) |
+					  m_errlogger.ApplyRealtime(REALTIME.logger);
+		printf("Real-time profile:%s; servo:%s\n", RealtimeSummary(rt_applied).c_str(),
+			   RealtimeSummary(servo_setup.applied.load()).c_str());
+	}
+
+	// park until Ctrl+C / SIGTERM, then stop the servo callback before tearing down what it uses
+	WaitForShutdown(dumpHandler);
+	printf("Shutting down\n");
+	exitHandler();
+	delete DeviceCon;
+	delete HDComm;
 
-	// close socket
-	closesocket(master_sock);
-	closesocket(slave_sock);
-	WSACleanup();
+	// close socket; the loggers flush when they go out of scope
+	closesocket(sock);
+	SocketCleanup();
 
 	return 0;
 }
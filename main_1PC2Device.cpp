@@ -2,9 +2,10 @@
 #include <iostream>
 #include <cstdio>
 #include <cassert>
+#include <string>
+#include <vector>
 
-#include <WS2tcpip.h>
-#pragma comment (lib, "ws2_32.lib")
+#include "hd_socket.h"
 
 #define _CRT_SECURE_NO_WARNINGS
 
@@ -15,21 +16,26 @@
 
 #include "hd_controller.h"
 #include "hd_comm.h"
+#include "hd_logger.h"
+#include "hd_session.h"
+#include "hd_lifecycle.h"
+#include "hd_realtime.h"
 
 using namespace std;
 
-HHD phantomId_1, phantomId_2; // Dual Phantom devices.
+/******************************************************************************
+Several Phantoms on one PC. Devices are paired in order (1st master with 2nd
+slave, 3rd with 4th, ...) and all of them are serviced by one SessionManager
+from a single scheduler callback. Paired communicators exchange datagrams
+through an in-memory link instead of UDP loopback (EnableLocalTransport).
+******************************************************************************/
+
+vector<HHD> phantomIds;
 HDSchedulerHandle gSchedulerCallback = HD_INVALID_HANDLE;
-HDSchedulerHandle gSchedulerCallback2 = HD_INVALID_HANDLE;
 
 hduVector3Dd forceField(hduVector3Dd pos);
 
 /* Global variable declaration*/
-int modC = 10;   // default: 1000 Hz -> 1000%modC HZ
-
-hduVector3Dd posMasterHold(0, 0, 0);
-HDdouble velThreshold = 300;
-
 const int Vband[3] = { 3,3,3 };
 double Vhold[3];
 int Vcount[3] = { 0,0,0 };
@@ -43,25 +49,15 @@ struct DeviceDisplayStates
 	hduVector3Dd force;
 };
 
-SOCKET master_sock;
-SOCKET slave_sock;
-sockaddr_in master_addr;
-sockaddr_in slave_addr;
-
-HDCommunicator* HDComm;
-HDCommunicator* HDComm2;
+vector<SOCKET> socks;
+vector<sockaddr_in> addrs;
 
-HapticDeviceController* DeviceCon;
-HapticDeviceController* DeviceCon2;
+SessionManager Session;
 
 // FOR INITIAL SETTINGS
-char DEVICE_NAME_1[32] = "PHANToM 1";
-char DEVICE_NAME_2[32] = "PHANToM 2";
-char ALIAS = 'S';
-char MASTER_ADDR[32] = "127.0.0.1"; //"192.168.1.158";
-uint32_t MASTER_PORT = 25000;
-char SLAVE_ADDR[32] = "127.0.0.1"; // "192.168.1.136";
-uint32_t SLAVE_PORT = 25001;
+vector<const char*> DEVICE_NAMES = { "PHANToM 1", "PHANToM 2" };
+uint32_t BASE_PORT = 25000;	// device i binds BASE_PORT + i on loopback
+RealtimeProfile REALTIME;	// "rt" or "rt=servo,net,log cpus" anywhere after the port (hd_realtime.h)
 
 /******************************************************************************
 Makes a device specified in the pUserData current.
@@ -100,44 +96,13 @@ void ifErrorHold(hduVector3Dd pos)
 	}
 }
 
-//velocity-adaptive device control
-void velCon(hduVector3Dd pos)
-{
-	// Device Hz control 
-	HDdouble velMaster = ((pos - posMasterHold)*(1000 / modC)).magnitude();
-	if (velMaster > velThreshold)
-	{
-		modC = 5;
-		//cout << velMaster << " / " << 1000 / modC << endl;
-	}
-	else
-	{
-		modC = 1;
-		//cout << velMaster << " / " << 1000 / modC << endl;
-	}
-	posMasterHold = pos;
-}
-
 /******************************************************************************
-Main callback.  Retrieves position from both devices, calculates forces,
-and sets forces for both devices.
+Main callback.  One batched pass over all devices: gather positions, compute
+forces, set forces, then send.
 ******************************************************************************/
 HDCallbackCode HDCALLBACK deviceCallback(void *data)
 {
-	DeviceCon->tick();
-
-	HDErrorInfo error;
-	if (HD_DEVICE_ERROR(error = hdGetError())) {
-		hduPrintError(stderr, &error, "Error during scheduler callback");
-		if (hduIsSchedulerError(&error)) return HD_CALLBACK_DONE;
-	}
-
-	return HD_CALLBACK_CONTINUE;
-}
-
-HDCallbackCode HDCALLBACK deviceCallback2(void *data)
-{
-	DeviceCon2->tick();
+	Session.Tick();
 
 	HDErrorInfo error;
 	if (HD_DEVICE_ERROR(error = hdGetError())) {
@@ -149,43 +114,17 @@ HDCallbackCode HDCALLBACK deviceCallback2(void *data)
 }
 
 int initSocket() {
-	// create a hint structure for the server
-	memset(&master_addr, 0, sizeof(master_addr));
-	master_addr.sin_family = AF_INET;
-	master_addr.sin_port = htons(MASTER_PORT);
-	inet_pton(AF_INET, MASTER_ADDR, &master_addr.sin_addr);
-
-	memset(&slave_addr, 0, sizeof(slave_addr));
-	slave_addr.sin_family = AF_INET;
-	slave_addr.sin_port = htons(SLAVE_PORT);
-	inet_pton(AF_INET, SLAVE_ADDR, &slave_addr.sin_addr);
-
-	ULONG isNonBlocking = 1;
-
-	// socket creation
-
-	//if (ALIAS == 'S') {
-	{
-		slave_sock = socket(AF_INET, SOCK_DGRAM, 0);
-		ioctlsocket(slave_sock, FIONBIO, &isNonBlocking);
-		if (::bind(slave_sock, (sockaddr*)&slave_addr, sizeof(sockaddr_in)) == SOCKET_ERROR) {
-			cout << "Can't bind slave socket! " << WSAGetLastError() << endl;
+	// one loopback socket per device, bound to BASE_PORT + i
+	socks.resize(DEVICE_NAMES.size());
+	addrs.resize(DEVICE_NAMES.size());
+	for (size_t i = 0; i < DEVICE_NAMES.size(); i++) {
+		MakeAddress(addrs[i], "127.0.0.1", BASE_PORT + (uint32_t)i);
+		socks[i] = CreateUDPSocket(&addrs[i]);
+		if (socks[i] == INVALID_SOCKET) {
+			cout << "Can't bind socket on port " << BASE_PORT + i << "! " << SocketLastError() << endl;
 			return -1;
 		}
 	}
-	//else if (ALIAS == 'M') {
-	{
-		master_sock = socket(AF_INET, SOCK_DGRAM, 0);
-		ioctlsocket(master_sock, FIONBIO, &isNonBlocking);
-		if (::bind(master_sock, (sockaddr*)&master_addr, sizeof(sockaddr_in)) == SOCKET_ERROR) {
-			cout << "Can't bind master socket! " << WSAGetLastError() << endl;
-			return -1;
-		}
-	}
-	/*else {
-	printf("Err: Alias should be either M or S\n");
-	return -1;
-	}*/
 
 	return 0;
 }
@@ -196,25 +135,36 @@ properly shutdown.
 ******************************************************************************/
 void exitHandler()
 {
+	// runs on the normal shutdown path and again at exit
+	static bool done = false;
+	if (done)
+		return;
+	done = true;
 
 	if (!lastError.errorCode)
 	{
 		hdStopScheduler();
 		hdUnschedule(gSchedulerCallback);
-		hdUnschedule(gSchedulerCallback2);
 	}
 
-	if (phantomId_1 != HD_INVALID_HANDLE)
+	for (size_t i = 0; i < phantomIds.size(); i++)
 	{
-		hdDisableDevice(phantomId_1);
-		phantomId_1 = HD_INVALID_HANDLE;
+		if (phantomIds[i] != HD_INVALID_HANDLE)
+		{
+			hdDisableDevice(phantomIds[i]);
+			phantomIds[i] = HD_INVALID_HANDLE;
+		}
 	}
+}
 
-	if (phantomId_2 != HD_INVALID_HANDLE)
-	{
-		hdDisableDevice(phantomId_2);
-		phantomId_2 = HD_INVALID_HANDLE;
-	}
+/******************************************************************************
+Dumps the servo stage timing of every device on SIGUSR1 / Ctrl+Break (builds
+with HD_PROFILE).
+******************************************************************************/
+void dumpHandler()
+{
+	for (size_t i = 0; i < Session.getDeviceCount(); i++)
+		Session.getController(i)->DumpProfile(stdout);
 }
 
 /******************************************************************************
@@ -225,55 +175,47 @@ int main(int argc, char* argv[])
 	HDErrorInfo error;
 
 	if (argc > 1) {
-		if (argc == 5) {
-			ALIAS = argv[1][0];
-			if (ALIAS == 'M') {
-				strcpy(SLAVE_ADDR, argv[2]);
-				SLAVE_PORT = atoi(argv[3]);
-			}
-			else {
-				strcpy(MASTER_ADDR, argv[2]);
-				MASTER_PORT = atoi(argv[3]);
-			}
-			strcpy(DEVICE_NAME_1, argv[4]);
+		vector<const char*> names;
+		for (int i = 2; i < argc; i++) {
+			if (!REALTIME.Parse(argv[i]))
+				names.push_back(argv[i]);
+		}
+		if (names.size() >= 2 && names.size() % 2 == 0) {
+			BASE_PORT = atoi(argv[1]);
+			DEVICE_NAMES = names;
 		}
 		else {
-			printf("Usage: ./CouloumbForceDual.exe <alias> <target IP> <target PORT> <device name>n");
+			printf("Usage: ./CouloumbForceDual.exe <base PORT> <device name> <device name> [<device name> <device name> ...] [rt|rt=SERVO,NET,LOG]\n");
+			return 0;
 		}
 	}
 
 	printf("Starting application\n");
 
 	atexit(exitHandler);
+	InstallShutdownHandlers();
 
-	// First device.
-	phantomId_1 = hdInitDevice(DEVICE_NAME_1);
-	if (HD_DEVICE_ERROR(lastError = hdGetError()))
-	{
-		hduPrintError(stderr, &error, "Failed to initialize first haptic device");
-		fprintf(stderr, "Make sure the configuration \"%s\" exists\n", DEVICE_NAME_1);
-		fprintf(stderr, "\nPress any key to quit.\n");
-		exit(-1);
-	}
+	// before anything allocates: later allocations and thread stacks are locked as they come
+	int rt_applied = 0;
+	if (REALTIME.enabled && REALTIME.lock_memory && LockMemory())
+		rt_applied |= RT_MEMORY_LOCKED;
 
-	printf("1. Found device %s\n", hdGetString(HD_DEVICE_MODEL_TYPE));
-	hdEnable(HD_FORCE_OUTPUT);
-	hdEnable(HD_FORCE_RAMPING);
+	for (size_t i = 0; i < DEVICE_NAMES.size(); i++) {
+		HHD id = hdInitDevice(DEVICE_NAMES[i]);
+		if (HD_DEVICE_ERROR(lastError = hdGetError()))
+		{
+			hduPrintError(stderr, &lastError, "Failed to initialize haptic device");
+			fprintf(stderr, "Make sure the configuration \"%s\" exists\n", DEVICE_NAMES[i]);
+			fprintf(stderr, "\nPress any key to quit.\n");
+			exit(-1);
+		}
+		phantomIds.push_back(id);
 
-	// Second device.
-	phantomId_2 = hdInitDevice(DEVICE_NAME_2);
-	if (HD_DEVICE_ERROR(lastError = hdGetError()))
-	{
-		hduPrintError(stderr, &error, "Failed to initialize second haptic device");
-		fprintf(stderr, "Make sure the configuration \"%s\" exists\n", DEVICE_NAME_2);
-		fprintf(stderr, "\nPress any key to quit.\n");
-		exit(-1);
+		printf("%zu. Found device %s\n", i + 1, hdGetString(HD_DEVICE_MODEL_TYPE));
+		hdEnable(HD_FORCE_OUTPUT);
+		hdEnable(HD_FORCE_RAMPING);
 	}
 
-	printf("2. Found device %s\n", hdGetString(HD_DEVICE_MODEL_TYPE));
-	hdEnable(HD_FORCE_OUTPUT);
-	hdEnable(HD_FORCE_RAMPING);
-
 	hdStartScheduler();
 	if (HD_DEVICE_ERROR(error = hdGetError()))
 	{
@@ -283,12 +225,8 @@ int main(int argc, char* argv[])
 		exit(-1);
 	}
 
-	hdMakeCurrentDevice(phantomId_1);
-
-	// startup winsock
-	WSADATA data;
-	WORD version = MAKEWORD(2, 2);
-	int wsOK = WSAStartup(version, &data);
+	// startup socket layer (winsock on windows)
+	int wsOK = SocketStartup();
 	if (wsOK != 0)
 	{
 		cout << "Can't start Winsock! " << wsOK;
@@ -300,19 +238,30 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
-	// haptics callback
-	std::cout << "haptics callback" << std::endl;
-	HDComm = new HDCommunicator(phantomId_1, master_sock, &slave_addr, sizeof(slave_addr), 'M');
-	DeviceCon = new HapticDeviceController(phantomId_1, 'M', HDComm);
+	// asynchronous loggers, one set per device: the servo callback only enqueues records
+	vector<SNDLogger*> sndloggers;
+	vector<RCVLogger*> rcvloggers;
+	vector<ERRLogger*> errloggers;
+	for (size_t i = 0; i < DEVICE_NAMES.size(); i++) {
+		string prefix = "dev" + to_string(i);
+		sndloggers.push_back(new SNDLogger(prefix + "_snd.csv", true));
+		rcvloggers.push_back(new RCVLogger(prefix + "_rcv.csv", true));
+		errloggers.push_back(new ERRLogger(prefix + "_err.csv", true));
+	}
 
-	HDComm2 = new HDCommunicator(phantomId_2, slave_sock, &master_addr, sizeof(master_addr), 'S');
-	DeviceCon2 = new HapticDeviceController(phantomId_2, 'S', HDComm2);
+	// haptics callback: even devices are masters, each paired with the next one
+	std::cout << "haptics callback" << std::endl;
+	for (size_t i = 0; i < DEVICE_NAMES.size(); i++) {
+		char alias = i % 2 == 0 ? 'M' : 'S';
+		size_t peer = i ^ 1;
+		HDCommunicator* comm = new HDCommunicator(phantomIds[i], socks[i], &addrs[peer], sizeof(sockaddr_in), alias,
+												  sndloggers[i], rcvloggers[i], errloggers[i]);
+		comm->EnableLocalTransport();
+		Session.AddDevice(new OpenHapticsDevice(phantomIds[i]), comm, alias, sndloggers[i], rcvloggers[i], errloggers[i]);
+	}
 
 	gSchedulerCallback = hdScheduleAsynchronous(
-		deviceCallback, 0, HD_DEFAULT_SCHEDULER_PRIORITY);
-
-	gSchedulerCallback2 = hdScheduleAsynchronous(
-		deviceCallback2, 0, HD_DEFAULT_SCHEDULER_PRIORITY);
+		deviceCallback, 0, HD_MAX_SCHEDULER_PRIORITY);
 
 	if (HD_DEVICE_ERROR(error = hdGetError()))
 	{
@@ -322,12 +271,31 @@ int main(int argc, char* argv[])
 		exit(-1);
 	}
 
-	while (true);
+	if (REALTIME.enabled) {
+		// the servo thread belongs to HDAPI: configure it from a one-shot callback running on it
+		RealtimeServoSetup servo_setup(REALTIME.servo);
+		hdScheduleSynchronous(ConfigureServoThread, &servo_setup, HD_MAX_SCHEDULER_PRIORITY);
+		for (size_t i = 0; i < DEVICE_NAMES.size(); i++)
+			rt_applied |= sndloggers[i]->ApplyRealtime(REALTIME.logger) | rcvloggers[i]->ApplyRealtime(REALTIME.logger) |
+						  errloggers[i]->ApplyRealtime(REALTIME.logger);
+		printf("Real-time profile:%s; servo:%s\n", RealtimeSummary(rt_applied).c_str(),
+			   RealtimeSummary(servo_setup.applied.load()).c_str());
+	}
+
+	// park until Ctrl+C / SIGTERM, then stop the servo callback before tearing down what it uses
+	WaitForShutdown(dumpHandler);
+	printf("Shutting down\n");
+	exitHandler();
+	for (size_t i = 0; i < DEVICE_NAMES.size(); i++) {
+		delete sndloggers[i];
+		delete rcvloggers[i];
+		delete errloggers[i];
+	}
 
-	// close socket
-	closesocket(master_sock);
-	closesocket(slave_sock);
-	WSACleanup();
+	// close sockets
+	for (size_t i = 0; i < socks.size(); i++)
+		closesocket(socks[i]);
+	SocketCleanup();
 
 	return 0;
 }
@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <iostream>
+#include <cstdio>
+#include <vector>
+#include <random>
+#include <chrono>
+
+#include "hd_api.h"
+#include "hd_packet.h"
+#include "hd_codec.h"
+#include "hd_simdevice.h"
+
+using namespace std;
+
+/******************************************************************************
+Wire encoding check and benchmark. A trajectory is streamed through a pair of
+CompactCodecs over a lossy link with acks flowing back; every decoded sample
+is compared with the quantized original (round trip), then encode/decode
+cost and bytes per sample are measured against the raw 24 byte layout.
+Exits non-zero on any round-trip mismatch. Build with -DHD_SIMULATION.
+******************************************************************************/
+
+#define TICK_US 1000
+
+uint32_t NUM_SAMPLES = 100000;		// crosses the 16-bit sequence wrap
+double LOSS = 0.05;
+uint32_t ACK_INTERVAL = 10;			// reverse packets (carrying acks) every N ticks
+
+uint64_t failures = 0;
+volatile uint64_t sink = 0;		// keeps the timed loops from being optimized out
+
+void check(bool ok, const char *what, uint64_t sample) {
+	if (!ok && failures++ < 10)
+		printf("  FAIL %s (sample %llu)\n", what, (unsigned long long)sample);
+}
+
+bool samePosition(HapticPacket &a, HapticPacket &b) {
+	// half a quantization step, plus float rounding of the packet fields
+	const double tolerance = COMPACT_STEP_MM / 2 + 1e-4;
+	hduVector3Dd d = a.GetPos() - b.GetPos();
+	return fabs(d[0]) <= tolerance && fabs(d[1]) <= tolerance && fabs(d[2]) <= tolerance;
+}
+
+void roundTrip(const char *name, SimTrajectory trajectory, cnt_t first_num) {
+	CompactCodec sender, receiver;
+	mt19937 rng(3);
+	uniform_real_distribution<double> u(0, 1);
+	char wire[PACKET_SIZE];
+	uint64_t delivered = 0;
+	ts_t start = 1700000000000000LL;
+
+	for (uint32_t i = 0; i < NUM_SAMPLES; i++) {
+		ts_t ts = start + (ts_t)i * TICK_US + (i % 7 == 0 ? 300 : 0);
+		HapticPacket packet(trajectory.At(i * TICK_US * 1e-6), first_num + i, ts);
+		int len = sender.Encode(packet, wire);
+		check(len > 0 && len < PACKET_SIZE, "encoded length", i);
+
+		// every truncation must be rejected, not misparsed
+		if (i % 1000 == 0) {
+			for (int cut = 0; cut < len; cut++) {
+				CompactCodec probe;
+				HapticPacket out;
+				check(!probe.Decode(wire, cut, out), "truncated datagram accepted", i);
+			}
+		}
+
+		if (u(rng) >= LOSS) {
+			HapticPacket out;
+			if (receiver.Decode(wire, len, out)) {
+				delivered++;
+				check(out.GetPacketNum() == packet.GetPacketNum(), "packet number", i);
+				check(out.GetTimestamp() == packet.GetTimestamp(), "timestamp", i);
+				check(samePosition(out, packet), "position", i);
+			}
+		}
+
+		// reverse direction carries the ack, lossy as well
+		if (i % ACK_INTERVAL == 0 && u(rng) >= LOSS) {
+			HapticPacket back(hduVector3Dd(0, 0, 0), i / ACK_INTERVAL + 1, ts);
+			int back_len = receiver.Encode(back, wire);
+			HapticPacket out;
+			sender.Decode(wire, back_len, out);
+		}
+	}
+
+	const CodecStats &tx = sender.getStats();
+	const CodecStats &rx = receiver.getStats();
+	printf("%-12s %8llu %8llu %8llu %7.2f %7.1f%%\n", name, (unsigned long long)tx.encoded,
+		   (unsigned long long)delivered, (unsigned long long)rx.missing_refs, tx.MeanBytes(),
+		   100.0 * tx.keyframes / tx.encoded);
+}
+
+void benchmark() {
+	// encode/decode cost without loss, acks every tick
+	SimTrajectory trajectory(SIM_CIRCLE, 50, 1.0);
+	vector<HapticPacket> packets(NUM_SAMPLES);
+	for (uint32_t i = 0; i < NUM_SAMPLES; i++)
+		packets[i].UpdatePacket(trajectory.At(i * TICK_US * 1e-6), i + 1, (ts_t)i * TICK_US);
+	vector<char> wire(NUM_SAMPLES * PACKET_SIZE);
+	vector<int> lens(NUM_SAMPLES);
+
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	for (uint32_t i = 0; i < NUM_SAMPLES; i++)
+		memcpy(&wire[i * PACKET_SIZE], packets[i].ToArray(), PACKET_SIZE);
+	chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+	HapticPacket out;
+	for (uint32_t i = 0; i < NUM_SAMPLES; i++) {
+		out.UpdatePacket(&wire[i * PACKET_SIZE]);
+		sink += out.GetPacketNum();
+	}
+	chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+
+	// cost of the clock reads around each call below, subtracted from the result
+	double clock_ns = 0;
+	for (uint32_t i = 0; i < NUM_SAMPLES; i++) {
+		chrono::steady_clock::time_point a = chrono::steady_clock::now();
+		chrono::steady_clock::time_point b = chrono::steady_clock::now();
+		clock_ns += chrono::duration_cast<chrono::nanoseconds>(b - a).count();
+	}
+	clock_ns /= NUM_SAMPLES;
+
+	// compact: the receiver acks every sample, as in a full-rate duplex session
+	CompactCodec sender, receiver;
+	uint64_t bytes = 0;
+	double encode_ns = 0, decode_ns = 0;
+	char ack[PACKET_SIZE];
+	for (uint32_t i = 0; i < NUM_SAMPLES; i++) {
+		chrono::steady_clock::time_point a = chrono::steady_clock::now();
+		lens[i] = sender.Encode(packets[i], &wire[i * PACKET_SIZE]);
+		chrono::steady_clock::time_point b = chrono::steady_clock::now();
+		receiver.Decode(&wire[i * PACKET_SIZE], lens[i], out);
+		chrono::steady_clock::time_point c = chrono::steady_clock::now();
+		sink += out.GetPacketNum();
+		bytes += lens[i];
+		encode_ns += chrono::duration_cast<chrono::nanoseconds>(b - a).count();
+		decode_ns += chrono::duration_cast<chrono::nanoseconds>(c - b).count();
+
+		HapticPacket back(hduVector3Dd(0, 0, 0), i + 1, (ts_t)i * TICK_US);
+		int back_len = receiver.Encode(back, ack);
+		sender.Decode(ack, back_len, out);
+	}
+
+	double raw_encode = chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count() / (double)NUM_SAMPLES;
+	double raw_decode = chrono::duration_cast<chrono::nanoseconds>(t2 - t1).count() / (double)NUM_SAMPLES;
+	printf("\n%-12s %8s %10s %10s\n", "encoding", "bytes", "encode_ns", "decode_ns");
+	printf("%-12s %8d %10.1f %10.1f\n", "raw", PACKET_SIZE, raw_encode, raw_decode);
+	printf("%-12s %8.2f %10.1f %10.1f\n", "compact", (double)bytes / NUM_SAMPLES,
+		   encode_ns / NUM_SAMPLES - clock_ns, decode_ns / NUM_SAMPLES - clock_ns);
+}
+
+/******************************************************************************
+Main entry point.
+******************************************************************************/
+int main(int argc, char* argv[])
+{
+	if (argc > 1) NUM_SAMPLES = atoi(argv[1]);
+	if (argc > 2) LOSS = atof(argv[2]);
+	if (argc > 3 || NUM_SAMPLES == 0) {
+		printf("Usage: ./hd_codec [samples] [loss]\n");
+		return 0;
+	}
+
+	printf("%u samples, %.1f%% loss both ways, ack every %u ticks\n", NUM_SAMPLES, LOSS * 100, ACK_INTERVAL);
+	printf("%-12s %8s %8s %8s %7s %8s\n", "trajectory", "sent", "decoded", "no_ref", "bytes", "keyfr");
+	roundTrip("circle", SimTrajectory(SIM_CIRCLE, 50, 1.0), 1);
+	roundTrip("random_walk", SimTrajectory(SIM_RANDOM_WALK, 40, 1.0, 7), 1);
+	roundTrip("fast_sine", SimTrajectory(SIM_SINE, 300, 5.0), 65000);	// large deltas, wraps early
+	benchmark();
+
+	if (failures) {
+		printf("\n%llu round-trip failures\n", (unsigned long long)failures);
+		return 1;
+	}
+	printf("\nround trip OK\n");
+	return 0;
+}
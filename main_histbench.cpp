@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <iostream>
+#include <cstdio>
+#include <list>
+#include <chrono>
+#include <algorithm>
+
+#include <math.h>
+
+#include "hd_api.h"
+#include "hd_packet.h"
+#include "hd_predictor.h"
+
+using namespace std;
+
+/******************************************************************************
+Prediction history benchmark. Runs the same push+predict loop (one received
+sample and one prediction per servo tick) over the two layouts the controller
+has used for its predictive coding queues:
+  list  the original std::list<HapticPacket*>: a heap packet per sample,
+        deleted when it falls off the front, prediction walks the list
+  ring  PositionHistory behind AveragePredictor (hd_history.h): fixed
+        struct-of-arrays ring, prediction is O(1)
+and prints the best ns/tick of several runs and the largest difference between
+the two predictions (they implement the same formula). No sockets or threads;
+build with -DHD_SIMULATION.
+******************************************************************************/
+
+uint32_t TICKS = 1000000;
+uint32_t QUEUE_SIZE = PREDICTOR_QUEUE_SIZE;
+const int RUNS = 5;							// best of
+hduVector3Dd *samples;						// trajectory, computed up front so the loops time only the history
+
+hduVector3Dd Sample(uint32_t tick) {
+	// smooth hand-like motion, a few cm at about 1 Hz
+	double t = tick * 1e-3;
+	return hduVector3Dd(30 * sin(6.1 * t), 20 * sin(4.3 * t + 1), 10 * cos(2.9 * t));
+}
+
+hduVector3Dd PredictList(const hduVector3Dd &base_pos, list<HapticPacket*> &queue) {
+	/* the controller's PredictPos before PositionHistory: mean successive difference over the list */
+	list<HapticPacket*>::iterator iter;
+	hduVector3Dd prev(0, 0, 0);
+	if (queue.size() > 1)
+		prev = queue.front()->GetPos();
+	else
+		return base_pos;
+
+	hduVector3Dd acc(0, 0, 0);
+	for (iter = ++queue.begin(); iter != queue.end(); ++iter) {
+		acc += ((**iter).GetPos() - prev);
+		prev = (**iter).GetPos();
+	}
+	acc /= queue.size() - 1;
+	acc += base_pos;
+	return acc;
+}
+
+double RunList(hduVector3Dd *predictions) {
+	/* ns/tick; predictions[tick] is written for the comparison */
+	list<HapticPacket*> queue;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (uint32_t tick = 0; tick < TICKS; tick++) {
+		HapticPacket *packet = new HapticPacket(samples[tick], tick, tick * 1000);	// one per received datagram
+		queue.push_back(packet);
+		if (queue.size() > QUEUE_SIZE) {
+			delete queue.front();
+			queue.pop_front();
+		}
+		predictions[tick] = PredictList(queue.back()->GetPos(), queue);
+	}
+	double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+	for (list<HapticPacket*>::iterator it = queue.begin(); it != queue.end(); ++it)
+		delete *it;
+	return ns / TICKS;
+}
+
+double RunRing(hduVector3Dd *predictions) {
+	AveragePredictor predictor(QUEUE_SIZE);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (uint32_t tick = 0; tick < TICKS; tick++) {
+		// positions go through a packet as on the wire, so both layouts see the same float samples
+		HapticPacket packet(samples[tick], tick, tick * 1000);
+		predictor.Observe(packet.GetPos(), packet.GetTimestamp());
+		predictor.Predict(packet.GetTimestamp(), predictions[tick]);
+	}
+	double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+	return ns / TICKS;
+}
+
+/******************************************************************************
+Main entry point.
+******************************************************************************/
+int main(int argc, char* argv[])
+{
+	if (argc > 3) {
+		printf("Usage: ./hd_histbench [ticks] [queue size]\n");
+		return 0;
+	}
+	if (argc > 1) TICKS = atoi(argv[1]);
+	if (argc > 2) QUEUE_SIZE = atoi(argv[2]);
+	if (TICKS == 0 || QUEUE_SIZE < 2 || QUEUE_SIZE > PREDICTOR_QUEUE_MAX) {
+		printf("ticks must be positive and the queue size 2..%d\n", PREDICTOR_QUEUE_MAX);
+		return 0;
+	}
+
+	samples = new hduVector3Dd[TICKS];
+	for (uint32_t tick = 0; tick < TICKS; tick++)
+		samples[tick] = Sample(tick);
+	hduVector3Dd *list_predictions = new hduVector3Dd[TICKS];
+	hduVector3Dd *ring_predictions = new hduVector3Dd[TICKS];
+	double list_ns = 0, ring_ns = 0;
+	for (int run = 0; run < RUNS; run++) {
+		double l = RunList(list_predictions);
+		double r = RunRing(ring_predictions);
+		list_ns = run == 0 ? l : min(list_ns, l);
+		ring_ns = run == 0 ? r : min(ring_ns, r);
+	}
+
+	double max_diff = 0;
+	for (uint32_t tick = 0; tick < TICKS; tick++)
+		max_diff = max(max_diff, (list_predictions[tick] - ring_predictions[tick]).magnitude());
+
+	printf("%u ticks, queue size %u, best of %d runs\n", TICKS, QUEUE_SIZE, RUNS);
+	printf("list  %7.1f ns/tick\n", list_ns);
+	printf("ring  %7.1f ns/tick  (%.1fx)\n", ring_ns, ring_ns > 0 ? list_ns / ring_ns : 0);
+	printf("max prediction difference %.6f mm\n", max_diff);
+
+	delete[] list_predictions;
+	delete[] ring_predictions;
+	delete[] samples;
+	return 0;
+}
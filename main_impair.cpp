@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <iostream>
+#include <cstdio>
+#include <string>
+
+#include "hd_socket.h"
+#include "hd_impair.h"
+
+using namespace std;
+
+/******************************************************************************
+Standalone network impairment proxy for two endpoints on localhost.
+
+Point endpoint A at PORT_A and endpoint B at PORT_B; datagrams are forwarded
+to the peer's port through an emulated link (same settings both directions):
+	delay=ms jitter=ms dist=0|1|2 (uniform, normal, pareto)
+	loss=p p_gb=p p_bg=p loss_bad=p (Gilbert-Elliott burst loss)
+	reorder=p duplicate=p bandwidth=kbps queue=ms seed=n
+******************************************************************************/
+
+int main(int argc, char* argv[])
+{
+	if (argc < 5) {
+		printf("Usage: ./hd_impair <PORT_A> <peer A PORT> <PORT_B> <peer B PORT> [key=value ...]\n");
+		return 0;
+	}
+
+	uint32_t port_a = atoi(argv[1]);
+	uint32_t peer_a_port = atoi(argv[2]);
+	uint32_t port_b = atoi(argv[3]);
+	uint32_t peer_b_port = atoi(argv[4]);
+
+	ImpairmentConfig cfg;
+	for (int i = 5; i < argc; i++) {
+		string arg(argv[i]);
+		size_t eq = arg.find('=');
+		if (eq == string::npos || !cfg.Set(arg.substr(0, eq), atof(arg.substr(eq + 1).c_str()))) {
+			printf("Unknown option %s\n", argv[i]);
+			return -1;
+		}
+	}
+
+	if (SocketStartup() != 0) {
+		cout << "Can't start Winsock!" << endl;
+		return -1;
+	}
+
+	sockaddr_in peer_a, peer_b;
+	MakeAddress(peer_a, "127.0.0.1", peer_a_port);
+	MakeAddress(peer_b, "127.0.0.1", peer_b_port);
+
+	ImpairmentConfig cfg_back = cfg;
+	cfg_back.seed = cfg.seed + 1;
+	ImpairmentProxy proxy(port_a, peer_a, port_b, peer_b, cfg, cfg_back);
+	if (!proxy.IsOpen()) {
+		cout << "Failed to bind proxy ports" << endl;
+		return -1;
+	}
+	proxy.Start();
+
+	printf("Forwarding :%u -> :%u and :%u -> :%u\n", port_a, peer_b_port, port_b, peer_a_port);
+	while (true) {
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		const ImpairmentStats &ab = proxy.getStatsAToB();
+		const ImpairmentStats &ba = proxy.getStatsBToA();
+		const std::memory_order r = std::memory_order_relaxed;
+		printf("A->B in %llu out %llu lost %llu | B->A in %llu out %llu lost %llu\n",
+			   (unsigned long long)ab.submitted.load(r), (unsigned long long)ab.delivered.load(r),
+			   (unsigned long long)(ab.lost.load(r) + ab.queue_drops.load(r)),
+			   (unsigned long long)ba.submitted.load(r), (unsigned long long)ba.delivered.load(r),
+			   (unsigned long long)(ba.lost.load(r) + ba.queue_drops.load(r)));
+	}
+
+	SocketCleanup();
+	return 0;
+}
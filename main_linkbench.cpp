@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "hd_api.h"
+#include "hd_socket.h"
+#include "hd_comm.h"
+#include "hd_logger.h"
+#include "hd_profiler.h"
+
+#ifdef HD_LINUX_SOCKETS
+#include <sys/wait.h>
+#endif
+
+using namespace std;
+
+/******************************************************************************
+Transport latency benchmark. Ping-pongs HapticPackets between two
+HDCommunicators, one echoing everything back, and prints the round trip time
+distribution for UDP loopback, the in-process memory link and (Linux) the
+shared memory link to a forked process (hd_locallink.h). Both ends busy-poll
+ReceivePacket, yielding between polls so one core is enough.
+Build with -DHD_SIMULATION.
+******************************************************************************/
+
+enum BenchTransport { BENCH_UDP, BENCH_MEMORY, BENCH_SHARED };
+const char *BENCH_NAMES[] = { "udp loopback", "memory link", "shared memory" };
+
+uint32_t ROUND_TRIPS = 20000;
+uint32_t BASE_PORT = 27900;
+const uint32_t WARMUP = 200;				// round trips not recorded: link switch-over, caches
+const int64_t ECHO_TIMEOUT_US = 100000;		// give up on one round trip after this long
+const int64_t ECHO_IDLE_EXIT_US = 2000000;	// a forked echo leaves after this much silence
+
+ERRLogger errlogger("/dev/null");
+SNDLogger sndlogger("/dev/null");
+RCVLogger rcvlogger("/dev/null");
+
+int64_t nowNs() {
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct BenchEnd {
+	/* one endpoint: socket bound to port, talking to peer_port */
+	SOCKET sock;
+	sockaddr_in addr;
+	sockaddr_in peer;
+	HDCommunicator *comm;
+
+	BenchEnd(uint32_t port, uint32_t peer_port, bool memory) {
+		MakeAddress(addr, "127.0.0.1", port);
+		MakeAddress(peer, "127.0.0.1", peer_port);
+		sock = CreateUDPSocket(&addr);
+		comm = NULL;
+		if (sock == INVALID_SOCKET)
+			return;
+		comm = new HDCommunicator(0, sock, &peer, sizeof(sockaddr_in), 'M', &sndlogger, &rcvlogger, &errlogger);
+		if (memory)
+			comm->EnableLocalTransport();
+	}
+
+	~BenchEnd() {
+		delete comm;
+		if (sock != INVALID_SOCKET)
+			closesocket(sock);
+	}
+};
+
+void echo(HDCommunicator *comm, const atomic<bool> *stop, uint32_t last) {
+	/* send every packet straight back, until stop is set or packet last went back (then after a silence) */
+	int64_t last_seen = nowNs();
+	while (stop ? !stop->load() : nowNs() - last_seen < ECHO_IDLE_EXIT_US * 1000) {
+		HapticPacket *packet = comm->ReceivePacket(false);
+		if (packet == NULL) {
+			this_thread::yield();
+			continue;
+		}
+		last_seen = nowNs();
+		HapticPacket reply = *packet;
+		comm->SendPacket(&reply, false);
+		if (stop == NULL && reply.GetPacketNum() == last)
+			break;
+	}
+}
+
+void ping(HDCommunicator *comm, LatencyHistogram &rtt_ns, uint32_t &lost, bool &active) {
+	/* one packet at a time, wait for its echo. active: the memory link was up for the last round trip
+	   (checked before the echo side can leave and hand the link back to UDP) */
+	lost = 0;
+	for (uint32_t i = 1; i <= ROUND_TRIPS + WARMUP; i++) {
+		if (i == ROUND_TRIPS + WARMUP)
+			active = comm->IsLocalTransportActive();
+		HapticPacket packet(hduVector3Dd(i, 0, 0), i, getCurrentTime());
+		int64_t start = nowNs();
+		comm->SendPacket(&packet, false);
+		bool answered = false;
+		while (nowNs() - start < ECHO_TIMEOUT_US * 1000) {
+			HapticPacket *reply = comm->ReceivePacket(false);
+			if (reply && reply->GetPacketNum() == i) {
+				answered = true;
+				break;
+			}
+			this_thread::yield();
+		}
+		if (i <= WARMUP)
+			continue;
+		if (!answered)
+			lost++;
+		else
+			rtt_ns.Record(nowNs() - start);
+	}
+}
+
+bool run(BenchTransport transport, uint32_t port) {
+	LatencyHistogram rtt_ns;
+	uint32_t lost = 0;
+	bool memory = transport != BENCH_UDP;
+	bool active = false;
+#ifdef HD_LINUX_SOCKETS
+	if (transport == BENCH_SHARED) {
+		pid_t child = fork();
+		if (child == 0) {
+			{
+				BenchEnd end(port + 1, port, true);
+				if (end.comm)
+					echo(end.comm, NULL, ROUND_TRIPS + WARMUP);
+			}
+			_exit(0);
+		}
+		{
+			BenchEnd end(port, port + 1, true);
+			if (end.comm == NULL)
+				return false;
+			ping(end.comm, rtt_ns, lost, active);
+		}
+		waitpid(child, NULL, 0);
+	}
+	else
+#endif
+	{
+		BenchEnd a(port, port + 1, memory);
+		BenchEnd b(port + 1, port, memory);
+		if (a.comm == NULL || b.comm == NULL)
+			return false;
+		atomic<bool> stop(false);
+		thread echoer(echo, b.comm, &stop, 0);
+		ping(a.comm, rtt_ns, lost, active);
+		stop = true;
+		echoer.join();
+	}
+	if (memory && !active)
+		printf("%-14s  memory link did not come up\n", BENCH_NAMES[transport]);
+	printf("%-14s %8.2f %8.2f %8.2f %8.2f %8.2f %6u\n", BENCH_NAMES[transport],
+		   rtt_ns.Count() ? rtt_ns.Sum() / 1000.0 / rtt_ns.Count() : 0, rtt_ns.Percentile(0.5) / 1000.0,
+		   rtt_ns.Percentile(0.99) / 1000.0, rtt_ns.Percentile(0.999) / 1000.0, rtt_ns.Max() / 1000.0, lost);
+	return true;
+}
+
+/******************************************************************************
+Main entry point.
+******************************************************************************/
+int main(int argc, char* argv[])
+{
+	if (argc > 1) ROUND_TRIPS = atoi(argv[1]);
+	if (argc > 2) BASE_PORT = atoi(argv[2]);
+	if (argc > 3 || ROUND_TRIPS == 0) {
+		printf("Usage: ./hd_linkbench [round trips] [base port]\n");
+		return 0;
+	}
+
+	if (SocketStartup() != 0) {
+		cout << "Can't start Winsock!" << endl;
+		return -1;
+	}
+	printf("%u round trips, rtt in us\n", ROUND_TRIPS);
+	printf("%-14s %8s %8s %8s %8s %8s %6s\n", "transport", "mean", "p50", "p99", "p99.9", "max", "lost");
+	for (int t = BENCH_UDP; t <= BENCH_SHARED; t++) {
+#ifndef HD_LINUX_SOCKETS
+		if (t == BENCH_SHARED)
+			break;
+#endif
+		if (!run((BenchTransport)t, BASE_PORT + 2 * t))
+			printf("%-14s  can't bind ports %u/%u\n", BENCH_NAMES[t], BASE_PORT + 2 * t, BASE_PORT + 2 * t + 1);
+	}
+	SocketCleanup();
+	return 0;
+}
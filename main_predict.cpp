@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <iostream>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "hd_api.h"
+#include "hd_predictor.h"
+#include "hd_deadband.h"
+#include "hd_simdevice.h"
+
+using namespace std;
+
+/******************************************************************************
+Offline predictor benchmark. A trajectory is sampled at 1 kHz; the sender
+transmits a sample whenever its own copy of the predictor is off by more than
+the perceptual deadband (DeadbandCodec, floor from the command line), packets
+reach the receiver after a jittered delay (with loss), and the receiver's
+prediction is compared to the true position every tick.
+No sockets or threads; build with -DHD_SIMULATION.
+******************************************************************************/
+
+#define TICK_US 1000
+
+struct InFlight
+{
+	int64_t deliver_at;
+	hduVector3Dd pos;
+	ts_t ts;
+};
+
+uint32_t DURATION_S = 30;
+double DEADBAND_MM = 0.5;
+double DELAY_MS = 10;
+double JITTER_MS = 2;
+double LOSS = 0.01;
+
+void runPredictor(PredictorType type, const vector<hduVector3Dd> &truth) {
+	Predictor *sender = CreatePredictor(type);
+	Predictor *receiver = CreatePredictor(type);
+	DeadbandConfig cfg;
+	cfg.floor_mm = DEADBAND_MM;
+	DeadbandCodec deadband(cfg);
+	mt19937 rng(1);
+	uniform_real_distribution<double> u(0, 1);
+	deque<InFlight> in_flight;
+	vector<double> errors;
+	errors.reserve(truth.size());
+	int64_t last_due = 0;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (size_t i = 0; i < truth.size(); i++) {
+		ts_t now = (ts_t)i * TICK_US;
+		const hduVector3Dd &pos = truth[i];
+
+		// sender: deadband against its own extrapolation
+		hduVector3Dd pred;
+		bool has_prediction = sender->Predict(now, pred);
+		DeadbandDecision decision = deadband.Decide(pos, has_prediction, pred, now);
+		if (decision != DEADBAND_SKIP) {
+			sender->Observe(pos, now);
+			deadband.OnSent(decision, now);
+			if (u(rng) >= LOSS) {
+				InFlight p;
+				p.deliver_at = now + (int64_t)((DELAY_MS + JITTER_MS * u(rng)) * 1000);
+				p.deliver_at = max(p.deliver_at, last_due);	// FIFO link
+				last_due = p.deliver_at;
+				p.pos = pos;
+				p.ts = now;
+				in_flight.push_back(p);
+			}
+		}
+
+		// receiver: deliveries, then the position rendered this tick
+		while (!in_flight.empty() && in_flight.front().deliver_at <= now) {
+			receiver->Observe(in_flight.front().pos, in_flight.front().ts);
+			in_flight.pop_front();
+		}
+		hduVector3Dd rendered;
+		if (receiver->Predict(now, rendered))
+			errors.push_back((rendered - pos).magnitude());
+	}
+	double elapsed_ns = (double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+	sort(errors.begin(), errors.end());
+	double mean = 0;
+	for (size_t i = 0; i < errors.size(); i++)
+		mean += errors[i];
+	mean = errors.size() ? mean / errors.size() : 0;
+	double p99 = errors.size() ? errors[(size_t)(errors.size() * 0.99)] : 0;
+	double max_err = errors.size() ? errors.back() : 0;
+	printf("  %-8s %8.3f %8.3f %8.3f %7.1f%% %8.1f\n", sender->Name(), mean, p99, max_err,
+		   100.0 * deadband.getStats().SendRatio(), elapsed_ns / truth.size());
+
+	delete sender;
+	delete receiver;
+}
+
+void runTrajectory(const char *name, SimTrajectory trajectory) {
+	vector<hduVector3Dd> truth(DURATION_S * (1000000 / TICK_US));
+	for (size_t i = 0; i < truth.size(); i++)
+		truth[i] = trajectory.At(i * TICK_US * 1e-6);
+
+	printf("%s\n", name);
+	const PredictorType types[] = { PREDICTOR_AVERAGE, PREDICTOR_KALMAN_CV, PREDICTOR_KALMAN_CA, PREDICTOR_POLY1, PREDICTOR_POLY2 };
+	for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+		runPredictor(types[i], truth);
+}
+
+/******************************************************************************
+Main entry point.
+******************************************************************************/
+int main(int argc, char* argv[])
+{
+	if (argc > 1) DURATION_S = atoi(argv[1]);
+	if (argc > 2) DEADBAND_MM = atof(argv[2]);
+	if (argc > 3) DELAY_MS = atof(argv[3]);
+	if (argc > 4) LOSS = atof(argv[4]);
+	if (argc > 6 || DURATION_S == 0) {
+		printf("Usage: ./hd_predict [seconds] [deadband mm] [delay ms] [loss] [script file]\n");
+		return 0;
+	}
+
+	printf("%d s at 1 kHz, deadband floor %.2f mm, delay %.1f+%.1f ms, loss %.1f%%\n",
+		   DURATION_S, DEADBAND_MM, DELAY_MS, JITTER_MS, LOSS * 100);
+	printf("  %-8s %8s %8s %8s %8s %8s\n", "pred", "err_mean", "err_p99", "err_max", "sent", "ns/tick");
+
+	if (argc == 6) {
+		SimTrajectory script(SIM_SCRIPT);
+		if (!script.LoadScript(argv[5])) {
+			cout << "Can't read script " << argv[5] << endl;
+			return -1;
+		}
+		runTrajectory(argv[5], script);
+		return 0;
+	}
+	runTrajectory("circle", SimTrajectory(SIM_CIRCLE, 50, 1.0));
+	runTrajectory("sine", SimTrajectory(SIM_SINE, 50, 2.0));
+	runTrajectory("random_walk", SimTrajectory(SIM_RANDOM_WALK, 40, 1.0, 7));
+	return 0;
+}
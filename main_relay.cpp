@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <iostream>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "hd_socket.h"
+#include "hd_relay.h"
+
+using namespace std;
+
+/******************************************************************************
+UDP relay server for RELAY_SERVER_HOSTNAME/RELAY_SERVER_PORT in main.cpp.
+
+Endpoints are paired into sessions by the key in their join datagrams (the
+main program's session=KEY), from a pairs file (one "hostA portA hostB portB"
+per line) or, with "auto", in arrival order. Every datagram from one endpoint
+is forwarded to its peer. Joined and arrival-order endpoints silent for
+RELAY_IDLE_S expire. THREADS shards share the port via SO_REUSEPORT.
+******************************************************************************/
+
+uint32_t RELAY_PORT = 50000;
+uint32_t NUM_THREADS = 0;			// 0: one per core
+uint32_t REPORT_INTERVAL_S = 5;
+bool AUTO_PAIR = false;				// "auto": pair endpoints without a key in arrival order
+
+void printStats(RelaySessionTable &table, vector<RelayShard*> &shards) {
+	uint64_t datagrams = 0, unpaired = 0, failures = 0;
+	double batch = 0;
+	for (size_t i = 0; i < shards.size(); i++) {
+		datagrams += shards[i]->getDatagrams();
+		unpaired += shards[i]->getUnpairedDrops();
+		failures += shards[i]->getSendFailures();
+		batch += shards[i]->getMeanBatch() / shards.size();
+	}
+	printf("relay: %llu datagrams, mean batch %.1f, unpaired %llu, send failures %llu, joins %llu (refused %llu), %u sessions\n",
+		   (unsigned long long)datagrams, batch, (unsigned long long)unpaired, (unsigned long long)failures,
+		   (unsigned long long)table.getJoins(), (unsigned long long)table.getRefusedJoins(), (unsigned)table.SessionCount());
+
+	for (size_t i = 0; i < table.SessionCount(); i++) {
+		RelaySession *s = table.Session(i);
+		if (!s || !s->paired.load())
+			continue;
+		sockaddr_in endpoint[2];
+		table.Endpoints(s, endpoint);
+		for (int side = 0; side < 2; side++) {
+			RelayDirection &d = s->forward[side];
+			uint64_t packets = d.packets.load();
+			char from[INET_ADDRSTRLEN], to[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &endpoint[side].sin_addr, from, sizeof(from));
+			inet_ntop(AF_INET, &endpoint[1 - side].sin_addr, to, sizeof(to));
+			printf("  session %u%s%s %s:%u -> %s:%u: %llu pkts, lost %llu, reordered %llu, relay latency mean %.1f us / max %.1f us\n",
+				   s->id, s->key.empty() ? "" : " ", s->key.c_str(), from, ntohs(endpoint[side].sin_port), to, ntohs(endpoint[1 - side].sin_port),
+				   (unsigned long long)packets, (unsigned long long)d.lost.load(), (unsigned long long)d.reordered.load(),
+				   packets ? d.residence_ns.load() / 1000.0 / packets : 0, d.max_residence_ns.load() / 1000.0);
+		}
+	}
+}
+
+/******************************************************************************
+Main entry point.
+******************************************************************************/
+int main(int argc, char* argv[])
+{
+	if (argc < 2 || argc > 5) {
+		printf("Usage: ./hd_relay <PORT> [threads] [pairs file] [auto]\n");
+		return 0;
+	}
+	RELAY_PORT = atoi(argv[1]);
+	if (argc > 2) NUM_THREADS = atoi(argv[2]);
+	const char *pairs_file = NULL;
+	for (int i = 3; i < argc; i++) {
+		if (strcmp(argv[i], "auto") == 0)
+			AUTO_PAIR = true;
+		else
+			pairs_file = argv[i];
+	}
+	if (NUM_THREADS == 0) NUM_THREADS = std::thread::hardware_concurrency();
+	if (NUM_THREADS == 0) NUM_THREADS = 1;
+
+	if (SocketStartup() != 0) {
+		cout << "Can't start Winsock!" << endl;
+		return -1;
+	}
+
+	RelaySessionTable table(AUTO_PAIR);
+	if (pairs_file && !table.LoadPairs(pairs_file)) {
+		cout << "Can't read pairs file " << pairs_file << endl;
+		return -1;
+	}
+
+	vector<RelayShard*> shards;
+	for (uint32_t i = 0; i < NUM_THREADS; i++) {
+		RelayShard *shard = new RelayShard(&table, RELAY_PORT);
+		if (!shard->IsOpen()) {
+			cout << "Can't bind relay port " << RELAY_PORT << " (" << SocketLastError() << ")" << endl;
+			return -1;
+		}
+		shards.push_back(shard);
+	}
+	for (size_t i = 0; i < shards.size(); i++)
+		shards[i]->Start();
+
+	printf("Relaying on port %u with %u thread(s)%s\n", RELAY_PORT, NUM_THREADS, AUTO_PAIR ? ", arrival-order pairing" : "");
+	for (uint32_t seconds = 1; ; seconds++) {
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		table.Expire(RelayNowMs(), RELAY_IDLE_S * 1000);
+		if (seconds % REPORT_INTERVAL_S == 0) {
+			printStats(table, shards);
+			fflush(stdout);
+		}
+	}
+
+	SocketCleanup();
+	return 0;
+}
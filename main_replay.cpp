@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <iostream>
+#include <cstdio>
+#include <string>
+
+#include "hd_api.h"
+#include "hd_controller.h"
+#include "hd_jitter.h"
+#include "hd_upsampler.h"
+#include "hd_predictor.h"
+#include "hd_deadband.h"
+#include "hd_replay.h"
+
+using namespace std;
+
+/******************************************************************************
+Trace replay. Re-runs one side of a recorded session (its SNDLogger and
+RCVLogger csv files, e.g. m_snd.csv/m_rcv.csv of the main program) through
+HapticDeviceController on a virtual clock, faster than real time, with the
+predictor ("pred=<name>", see ParsePredictorType), deadband ("db_<key>=
+<value>", see DeadbandConfig::Set), send rate control ("rate", "rate_<key>=
+<value>", see RateControlConfig::Set), jitter buffer ("jb") and upsampler
+("up", "up_<key>=<value>", see UpsamplerConfig::Set) under test.
+Forces are written to <out>_force.csv, sent and received packets to
+<out>_snd.csv/<out>_rcv.csv. The printed digest covers all forces and sent
+datagrams; with "expect=<digest>" a different one exits with status 1, which
+makes a recorded trace a deterministic regression test. Build with
+-DHD_SIMULATION.
+******************************************************************************/
+
+char ALIAS = 'S';
+string OUT_PREFIX = "replay";
+bool USE_JITTER_BUFFER = false;
+bool USE_UPSAMPLER = false;
+UpsamplerConfig UPSAMPLER;
+PredictorType PREDICTOR = PREDICTOR_AVERAGE;
+DeadbandConfig DEADBAND;
+RateControlConfig RATE;
+string EXPECTED_DIGEST;
+
+template <typename Config>
+bool SetFromArgument(const string &arg, size_t prefix_length, Config &config) {
+	/* "<prefix><key>=<value>" into config.Set(key, value). false if malformed or the key is unknown */
+	string item = arg.substr(prefix_length);
+	size_t eq = item.find('=');
+	return eq != string::npos && config.Set(item.substr(0, eq), atof(item.substr(eq + 1).c_str()));
+}
+
+/******************************************************************************
+Main entry point.
+******************************************************************************/
+int main(int argc, char* argv[])
+{
+	if (argc < 3) {
+		printf("Usage: ./hd_replay <snd csv> <rcv csv> [M|S] [jb] [up] [up_key=value ...] [pred=avg|kcv|kca|poly1|poly2] [db_key=value ...] [rate] [rate_key=value ...] [out=prefix] [expect=digest]\n");
+		return 0;
+	}
+
+	for (int i = 3; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "M" || arg == "S")
+			ALIAS = arg[0];
+		else if (arg == "jb")
+			USE_JITTER_BUFFER = true;
+		else if (arg == "up")
+			USE_UPSAMPLER = true;
+		else if (arg == "rate")
+			RATE.enabled = true;
+		else if (arg.compare(0, 4, "out=") == 0)
+			OUT_PREFIX = arg.substr(4);
+		else if (arg.compare(0, 7, "expect=") == 0)
+			EXPECTED_DIGEST = arg.substr(7);
+		else if (arg.compare(0, 5, "pred=") == 0) {
+			if (!ParsePredictorType(arg.substr(5), PREDICTOR)) {
+				printf("Unknown predictor %s\n", arg.c_str() + 5);
+				return 0;
+			}
+		}
+		else if (arg.compare(0, 3, "up_") == 0) {
+			if (!SetFromArgument(arg, 3, UPSAMPLER)) {
+				printf("Bad upsampler setting %s\n", arg.c_str());
+				return 0;
+			}
+			USE_UPSAMPLER = true;
+		}
+		else if (arg.compare(0, 5, "rate_") == 0) {
+			if (!SetFromArgument(arg, 5, RATE)) {
+				printf("Bad rate control setting %s\n", arg.c_str());
+				return 0;
+			}
+			RATE.enabled = true;
+		}
+		else if (arg.compare(0, 3, "db_") == 0) {
+			if (!SetFromArgument(arg, 3, DEADBAND)) {
+				printf("Bad deadband setting %s\n", arg.c_str());
+				return 0;
+			}
+		}
+		else {
+			printf("Unknown argument %s\n", arg.c_str());
+			return 0;
+		}
+	}
+
+	ReplayTrace trace;
+	if (!trace.LoadSend(argv[1]) || !trace.LoadReceive(argv[2])) {
+		printf("Can't read %s or %s\n", argv[1], argv[2]);
+		return -1;
+	}
+	printf("Trace: %zu local samples, %zu remote packets, %.1f s\n", trace.local.size(), trace.remote.size(),
+		   (trace.End() - trace.Begin()) * 1e-6);
+
+	ReplayResult result;
+	{
+		ReplayEngine engine(trace, ALIAS, OUT_PREFIX);
+		JitterBuffer jitter;
+		Upsampler upsampler(UPSAMPLER);
+		HapticDeviceController *controller = engine.getController();
+		controller->SetPredictors(PREDICTOR, PREDICTOR);
+		controller->SetDeadband(DEADBAND);
+		controller->SetRateControl(RATE);
+		if (USE_JITTER_BUFFER)
+			controller->SetJitterBuffer(&jitter);
+		if (USE_UPSAMPLER)
+			controller->SetUpsampler(&upsampler);
+		result = engine.Run();
+	}
+
+	printf("replayed %llu ticks in %.2f s (%.0fx real time)\n", (unsigned long long)result.ticks, result.wall_seconds,
+		   result.Speedup());
+	printf("packets: %llu injected, %llu sent (%llu datagrams)\n", (unsigned long long)result.packets_injected,
+		   (unsigned long long)result.packets_sent, (unsigned long long)result.datagrams_sent);
+	printf("force: mean %.4f N, max %.4f N, max jump %.4f N\n", result.force_mean, result.force_max, result.force_jump_max);
+
+	char digest[32];
+	snprintf(digest, sizeof(digest), "%016llx", (unsigned long long)result.digest);
+	printf("digest %s\n", digest);
+	if (!EXPECTED_DIGEST.empty() && EXPECTED_DIGEST != digest) {
+		printf("digest mismatch: expected %s\n", EXPECTED_DIGEST.c_str());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "hd_api.h"
+#include "hd_socket.h"
+#include "hd_comm.h"
+#include "hd_logger.h"
+#include "hd_simdevice.h"
+#include "hd_simscheduler.h"
+#include "hd_session.h"
+#include "hd_realtime.h"
+
+using namespace std;
+
+/******************************************************************************
+Servo jitter benchmark. Runs simulated master/slave pairs in one session
+callback on SimScheduler twice and prints the tick start lateness
+distribution of each run:
+  spin  the old station layout: the main thread busy-waits (while (true);)
+        next to the servo thread, nothing is pinned or locked
+  rt    the main thread sleeps (WaitForShutdown), memory is locked, the servo
+        thread is pinned at RT_SERVO_PRIORITY and the loggers are configured
+        as in the real-time profile (hd_realtime.h)
+Real-time steps need privileges (CAP_SYS_NICE, memlock limit); what took is
+printed. Build with -DHD_SIMULATION.
+******************************************************************************/
+
+uint32_t DURATION_S = 5;
+uint32_t NUM_PAIRS = 2;
+uint32_t BASE_PORT = 27700;
+RealtimeProfile REALTIME;
+
+struct BenchRun {
+	/* one phase: session, sockets and loggers */
+	SessionManager *session;
+	vector<SOCKET> socks;
+	SNDLogger sndlogger;
+	RCVLogger rcvlogger;
+	ERRLogger errlogger;
+
+	BenchRun() : session(new SessionManager()),
+		sndlogger("/dev/null", true), rcvlogger("/dev/null", true), errlogger("/dev/null", true) {}
+
+	~BenchRun() {
+		delete session;
+		for (size_t i = 0; i < socks.size(); i++)
+			closesocket(socks[i]);
+	}
+
+	bool Build(uint32_t port) {
+		for (uint32_t i = 0; i < NUM_PAIRS; i++) {
+			sockaddr_in addr[2];
+			for (int side = 0; side < 2; side++) {
+				MakeAddress(addr[side], "127.0.0.1", port + 2 * i + side);
+				SOCKET sock = CreateUDPSocket(&addr[side]);
+				if (sock == INVALID_SOCKET) {
+					printf("Can't bind socket on port %u\n", port + 2 * i + side);
+					return false;
+				}
+				socks.push_back(sock);
+			}
+			for (int side = 0; side < 2; side++) {
+				char alias = side == 0 ? 'M' : 'S';
+				HDCommunicator *comm = new HDCommunicator(2 * i + side, socks[2 * i + side], &addr[1 - side],
+														  sizeof(sockaddr_in), alias, &sndlogger, &rcvlogger, &errlogger);
+				SimulatedDevice *device = side == 0 ? new SimulatedDevice(SimTrajectory(SIM_CIRCLE, 40, 0.5 + 0.1 * i))
+													: new SimulatedDevice(SimTrajectory(SIM_HOLD));
+				session->AddDevice(device, comm, alias, &sndlogger, &rcvlogger, &errlogger);
+			}
+		}
+		return true;
+	}
+};
+
+void printRow(const char *name, const SimScheduler &scheduler) {
+	const LatencyHistogram &lateness = scheduler.getLatenessHistogram();
+	printf("%-6s %8llu %8llu %8.1f %8.1f %8.1f %8.1f %8.1f\n", name,
+		   (unsigned long long)scheduler.getTickCount(), (unsigned long long)scheduler.getOverrunCount(),
+		   lateness.Count() ? lateness.Sum() / 1000.0 / lateness.Count() : 0, lateness.Percentile(0.5) / 1000.0,
+		   lateness.Percentile(0.99) / 1000.0, lateness.Percentile(0.999) / 1000.0, lateness.Max() / 1000.0);
+}
+
+bool runSpin(uint32_t port) {
+	BenchRun run;
+	if (!run.Build(port))
+		return false;
+	SimScheduler scheduler;
+	scheduler.Schedule(SessionManager::ServoCallback, run.session);
+
+	atomic<bool> stop(false);
+	thread spinner([&stop]() { while (!stop.load(memory_order_relaxed)); });
+	scheduler.Start();
+	this_thread::sleep_for(chrono::seconds(DURATION_S));
+	scheduler.Stop();
+	stop = true;
+	spinner.join();
+
+	printRow("spin", scheduler);
+	return true;
+}
+
+bool runRealtime(uint32_t port) {
+	int applied = LockMemory() ? RT_MEMORY_LOCKED : 0;
+
+	BenchRun run;
+	if (!run.Build(port))
+		return false;
+	SimScheduler scheduler;
+	RealtimeThreadConfig servo = REALTIME.servo;
+	servo.priority = RT_SERVO_PRIORITY;
+	RealtimeServoSetup servo_setup(servo);
+	scheduler.Schedule(ConfigureServoThread, &servo_setup);
+	scheduler.Schedule(SessionManager::ServoCallback, run.session);
+	applied |= run.sndlogger.ApplyRealtime(REALTIME.logger) | run.rcvlogger.ApplyRealtime(REALTIME.logger) |
+			   run.errlogger.ApplyRealtime(REALTIME.logger);
+
+	scheduler.Start();
+	this_thread::sleep_for(chrono::seconds(DURATION_S));
+	scheduler.Stop();
+
+	printRow("rt", scheduler);
+	printf("  applied:%s; servo:%s\n", RealtimeSummary(applied).c_str(), RealtimeSummary(servo_setup.applied.load()).c_str());
+	return true;
+}
+
+/******************************************************************************
+Main entry point.
+******************************************************************************/
+int main(int argc, char* argv[])
+{
+	REALTIME.EnableDefault();
+	bool bad_argument = false;
+	int position = 0;
+	for (int i = 1; i < argc; i++) {
+		if (REALTIME.Parse(argv[i]))
+			continue;
+		switch (position++) {
+		case 0: DURATION_S = atoi(argv[i]); break;
+		case 1: NUM_PAIRS = atoi(argv[i]); break;
+		case 2: BASE_PORT = atoi(argv[i]); break;
+		default: bad_argument = true;
+		}
+	}
+	if (bad_argument || DURATION_S == 0 || NUM_PAIRS == 0) {
+		printf("Usage: ./hd_rtbench [seconds per run] [pairs] [base port] [rt=SERVO,NET,LOG]\n");
+		return 0;
+	}
+
+	if (SocketStartup() != 0) {
+		cout << "Can't start Winsock!" << endl;
+		return -1;
+	}
+	printf("%u pair(s), %u s per run, %u cores, tick lateness in us\n", NUM_PAIRS, DURATION_S,
+		   thread::hardware_concurrency());
+	printf("%-6s %8s %8s %8s %8s %8s %8s %8s\n", "run", "ticks", "overruns", "mean", "p50", "p99", "p99.9", "max");
+	// the real-time run last: memory locking can't be undone
+	bool ok = runSpin(BASE_PORT) && runRealtime(BASE_PORT + 2 * NUM_PAIRS);
+	SocketCleanup();
+	return ok ? 0 : -1;
+}
@@ -0,0 +1,372 @@
+#include <stdlib.h>
+#include <iostream>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "hd_api.h"
+#include "hd_socket.h"
+#include "hd_controller.h"
+#include "hd_comm.h"
+#include "hd_logger.h"
+#include "hd_impair.h"
+#include "hd_simdevice.h"
+#include "hd_simscheduler.h"
+
+using namespace std;
+
+/******************************************************************************
+Scenario runner for predictive coding under network impairment. For every
+scenario a simulated master/slave pair runs through an ImpairmentProxy on
+localhost, and position error, force discontinuities and packet rates are
+reported. With "jb" both sides play out through a JitterBuffer and its
+underrun rate and added latency are reported as well; with "up" they render
+through an Upsampler ("up_<key>=<value>", see UpsamplerConfig::Set);
+"pred=<name>" selects the predictor (see ParsePredictorType) on both sides and
+"db_<key>=<value>" configures the deadband (see DeadbandConfig::Set) and
+"rate" or "rate_<key>=<value>" the velocity-adaptive send rate (see
+RateControlConfig::Set), with time and packets per rate band reported;
+"compact" switches both sides to the compact wire encoding; "red=<n>"
+repeats the previous n samples in every packet and "parity=<g>" adds an xor
+parity packet per g packets, with recovered and lost counts reported. Build
+with -DHD_SIMULATION.
+******************************************************************************/
+
+#define FORCE_JUMP_THRESHOLD 0.1	// per-tick force change counted as a discontinuity (N)
+
+struct Scenario
+{
+	const char *name;
+	const char *settings;	// key=value list, see ImpairmentConfig::Set
+};
+
+const Scenario SCENARIOS[] = {
+	{ "clean",		"" },
+	{ "delay20",	"delay=20" },
+	{ "jitter",		"delay=20 jitter=10 dist=1" },
+	{ "wifi_stall",	"delay=5 jitter=15 dist=2" },
+	{ "burst_loss",	"delay=10 p_gb=0.01 p_bg=0.2 loss_bad=0.8" },
+	{ "reorder",	"delay=10 jitter=5 reorder=0.05" },
+	{ "duplicate",	"delay=5 duplicate=0.1" },
+	{ "bandwidth",	"delay=5 bandwidth=150 queue=50" },
+};
+
+/* Per-tick measurements for one run. */
+struct ScenarioRun
+{
+	SimulatedDevice *master_dev;
+	SimulatedDevice *slave_dev;
+	HapticDeviceController *master;
+	HapticDeviceController *slave;
+	vector<double> errors;
+	hduVector3Dd last_force;
+	double max_force_jump;
+	uint64_t force_jumps;
+};
+
+uint32_t DURATION_S = 10;
+uint32_t BASE_PORT = 28000;
+bool USE_JITTER_BUFFER = false;
+bool USE_UPSAMPLER = false;
+UpsamplerConfig UPSAMPLER;
+bool USE_COMPACT = false;
+RedundancyMode REDUNDANCY = REDUNDANCY_OFF;
+int REDUNDANCY_LEVEL = 0;
+PredictorType PREDICTOR = PREDICTOR_AVERAGE;
+DeadbandConfig DEADBAND;
+RateControlConfig RATE;
+
+HDCallbackCode HDCALLBACK scenarioCallback(void *data)
+{
+	ScenarioRun *run = static_cast<ScenarioRun *>(data);
+
+	run->master->tick();
+	run->slave->tick();
+
+	hduVector3Dd master_pos, slave_pos;
+	run->master_dev->GetPosition(master_pos);
+	run->slave_dev->GetPosition(slave_pos);
+	run->errors.push_back((master_pos - slave_pos).magnitude());
+
+	hduVector3Dd force = run->slave_dev->GetForce();
+	double jump = (force - run->last_force).magnitude();
+	if (jump > run->max_force_jump)
+		run->max_force_jump = jump;
+	if (jump > FORCE_JUMP_THRESHOLD)
+		run->force_jumps++;
+	run->last_force = force;
+
+	return HD_CALLBACK_CONTINUE;
+}
+
+bool parseSettings(const string &settings, ImpairmentConfig &cfg) {
+	size_t pos = 0;
+	while (pos < settings.size()) {
+		size_t end = settings.find(' ', pos);
+		if (end == string::npos)
+			end = settings.size();
+		string item = settings.substr(pos, end - pos);
+		size_t eq = item.find('=');
+		if (!item.empty() && (eq == string::npos || !cfg.Set(item.substr(0, eq), atof(item.substr(eq + 1).c_str()))))
+			return false;
+		pos = end + 1;
+	}
+	return true;
+}
+
+bool runScenario(const Scenario &scenario, uint32_t port) {
+	ImpairmentConfig cfg;
+	if (!parseSettings(scenario.settings, cfg)) {
+		printf("%-12s bad settings \"%s\"\n", scenario.name, scenario.settings);
+		return false;
+	}
+	ImpairmentConfig cfg_back = cfg;
+	cfg_back.seed = cfg.seed + 1;
+
+	// M <-> proxy(A) ... proxy(B) <-> S
+	sockaddr_in master_addr, slave_addr, proxy_a_addr, proxy_b_addr;
+	MakeAddress(master_addr, "127.0.0.1", port);
+	MakeAddress(slave_addr, "127.0.0.1", port + 1);
+	MakeAddress(proxy_a_addr, "127.0.0.1", port + 2);
+	MakeAddress(proxy_b_addr, "127.0.0.1", port + 3);
+
+	SOCKET master_sock = CreateUDPSocket(&master_addr);
+	SOCKET slave_sock = CreateUDPSocket(&slave_addr);
+	ImpairmentProxy proxy(port + 2, master_addr, port + 3, slave_addr, cfg, cfg_back);
+	if (master_sock == INVALID_SOCKET || slave_sock == INVALID_SOCKET || !proxy.IsOpen()) {
+		printf("%-12s failed to bind ports %u-%u\n", scenario.name, port, port + 3);
+		return false;
+	}
+
+	SNDLogger m_sndlogger("scn_m_snd.csv", true);
+	RCVLogger m_rcvlogger("scn_m_rcv.csv", true);
+	ERRLogger m_errlogger("scn_m_err.csv", true);
+	SNDLogger s_sndlogger("scn_s_snd.csv", true);
+	RCVLogger s_rcvlogger("scn_s_rcv.csv", true);
+	ERRLogger s_errlogger("scn_s_err.csv", true);
+
+	SimulatedDevice master_dev(SimTrajectory(SIM_RANDOM_WALK, 40, 1.0, 7));
+	SimulatedDevice slave_dev((SimTrajectory(SIM_HOLD)));
+	HDCommunicator master_comm(0, master_sock, &proxy_a_addr, sizeof(sockaddr_in), 'M', &m_sndlogger, &m_rcvlogger, &m_errlogger);
+	HDCommunicator slave_comm(1, slave_sock, &proxy_b_addr, sizeof(sockaddr_in), 'S', &s_sndlogger, &s_rcvlogger, &s_errlogger);
+	if (USE_COMPACT) {
+		master_comm.SetEncoding(ENCODING_COMPACT);
+		slave_comm.SetEncoding(ENCODING_COMPACT);
+	}
+	master_comm.SetRedundancy(REDUNDANCY, REDUNDANCY_LEVEL);
+	slave_comm.SetRedundancy(REDUNDANCY, REDUNDANCY_LEVEL);
+	HapticDeviceController master(&master_dev, 'M', &master_comm, &m_sndlogger, &m_rcvlogger, &m_errlogger);
+	HapticDeviceController slave(&slave_dev, 'S', &slave_comm, &s_sndlogger, &s_rcvlogger, &s_errlogger);
+	master.SetPredictors(PREDICTOR, PREDICTOR);
+	slave.SetPredictors(PREDICTOR, PREDICTOR);
+	master.SetDeadband(DEADBAND);
+	slave.SetDeadband(DEADBAND);
+	master.SetRateControl(RATE);
+	slave.SetRateControl(RATE);
+	JitterBuffer master_jb, slave_jb;
+	if (USE_JITTER_BUFFER) {
+		master.SetJitterBuffer(&master_jb);
+		slave.SetJitterBuffer(&slave_jb);
+	}
+	Upsampler master_up(UPSAMPLER), slave_up(UPSAMPLER);
+	if (USE_UPSAMPLER) {
+		master.SetUpsampler(&master_up);
+		slave.SetUpsampler(&slave_up);
+	}
+
+	ScenarioRun run;
+	run.master_dev = &master_dev;
+	run.slave_dev = &slave_dev;
+	run.master = &master;
+	run.slave = &slave;
+	run.errors.reserve(DURATION_S * SIM_SCHEDULER_RATE + SIM_SCHEDULER_RATE);
+	run.max_force_jump = 0;
+	run.force_jumps = 0;
+
+	proxy.Start();
+	SimScheduler scheduler;
+	scheduler.Schedule(scenarioCallback, &run);
+	scheduler.Start();
+	std::this_thread::sleep_for(std::chrono::seconds(DURATION_S));
+	scheduler.Stop();
+	proxy.Stop();
+
+	vector<double> sorted = run.errors;
+	sort(sorted.begin(), sorted.end());
+	double mean = 0;
+	for (size_t i = 0; i < sorted.size(); i++)
+		mean += sorted[i];
+	mean = sorted.size() ? mean / sorted.size() : 0;
+	double p99 = sorted.size() ? sorted[(size_t)(sorted.size() * 0.99)] : 0;
+	double max = sorted.size() ? sorted.back() : 0;
+
+	const ImpairmentStats &ab = proxy.getStatsAToB();
+	const ImpairmentStats &ba = proxy.getStatsBToA();
+	const std::memory_order r = std::memory_order_relaxed;
+	printf("%-12s %8.3f %8.3f %8.3f %8llu %8.3f %9.1f %9.1f %9.1f %6llu\n", scenario.name, mean, p99, max,
+		   (unsigned long long)run.force_jumps, run.max_force_jump,
+		   (double)ab.submitted.load(r) / DURATION_S,
+		   (double)slave_comm.getReceivedPacketCount() / DURATION_S,
+		   (double)master_comm.getReceivedPacketCount() / DURATION_S,
+		   (unsigned long long)(ab.lost.load(r) + ab.queue_drops.load(r) + ba.lost.load(r) + ba.queue_drops.load(r)));
+	const DeadbandStats &mdb = master.getDeadbandStats();
+	const DeadbandStats &sdb = slave.getDeadbandStats();
+	printf("%-12s M: sent %5.1f%% (heartbeats %llu), recon err mean %.3f / max %.3f mm | S: sent %5.1f%%\n", "  deadband",
+		   mdb.SendRatio() * 100, (unsigned long long)mdb.heartbeats, mdb.MeanError(), mdb.error_max, sdb.SendRatio() * 100);
+	if (RATE.enabled) {
+		const RateStats &mr = master.getRateStats();
+		const RateStats &sr = slave.getRateStats();
+		printf("%-12s M:", "  rate");
+		for (int b = 0; b < RATE_BANDS; b++)
+			printf(" %s %5.1f%% at %6.1f/s", RATE_BAND_NAMES[b], mr.TimeShare(b) * 100, mr.SendRate(b));
+		printf(", held %llu | S: still %5.1f%%, held %llu\n", (unsigned long long)mr.held, sr.TimeShare(RATE_STILL) * 100,
+			   (unsigned long long)sr.held);
+	}
+	if (USE_COMPACT) {
+		const CodecStats &mc = master_comm.getCodecStats();
+		const CodecStats &sc = slave_comm.getCodecStats();
+		printf("%-12s M: %.2f bytes/pkt, keyframes %llu | S: %.2f bytes/pkt, keyframes %llu, missing refs %llu\n", "  compact",
+			   mc.MeanBytes(), (unsigned long long)mc.keyframes, sc.MeanBytes(), (unsigned long long)sc.keyframes,
+			   (unsigned long long)(mc.missing_refs + sc.missing_refs));
+	}
+	const SequenceStats &mq = master_comm.getSequenceStats();
+	const SequenceStats &sq = slave_comm.getSequenceStats();
+	printf("%-12s S: lost %llu, dup %llu, reordered %llu (depth %u), stale %llu | M: lost %llu, dup %llu, reordered %llu (depth %u), stale %llu\n", "  sequence",
+		   (unsigned long long)slave_comm.getLostPacketCount(), (unsigned long long)sq.duplicates, (unsigned long long)sq.reordered,
+		   sq.max_reorder_depth, (unsigned long long)sq.stale,
+		   (unsigned long long)master_comm.getLostPacketCount(), (unsigned long long)mq.duplicates, (unsigned long long)mq.reordered,
+		   mq.max_reorder_depth, (unsigned long long)mq.stale);
+	const ClockStats &mk = master_comm.getClockStats();
+	const ClockStats &sk = slave_comm.getClockStats();
+	printf("%-12s S: one-way %6.2f ms, rtt %6.2f ms, offset %+7.3f ms | M: one-way %6.2f ms, rtt %6.2f ms, offset %+7.3f ms\n", "  clock",
+		   sk.one_way_us / 1000, sk.rtt_us / 1000, sk.offset_us / 1000, mk.one_way_us / 1000, mk.rtt_us / 1000, mk.offset_us / 1000);
+	if (REDUNDANCY != REDUNDANCY_OFF) {
+		const RedundancyStats &mr = master_comm.getRedundancyStats();
+		const RedundancyStats &sr = slave_comm.getRedundancyStats();
+		printf("%-12s S: recovered %llu, lost %llu | M: recovered %llu, lost %llu | overhead M->S %llu bytes, parity unusable %llu\n", "  redundancy",
+			   (unsigned long long)sr.recovered, (unsigned long long)slave_comm.getLostPacketCount(),
+			   (unsigned long long)mr.recovered, (unsigned long long)master_comm.getLostPacketCount(),
+			   (unsigned long long)mr.redundant_bytes, (unsigned long long)(mr.parity_unusable + sr.parity_unusable));
+	}
+	if (USE_JITTER_BUFFER) {
+		const JitterStats &ms = master_jb.getStats();
+		const JitterStats &ss = slave_jb.getStats();
+		printf("%-12s S: underrun %5.1f%%, added latency %6.2f ms, late %llu | M: underrun %5.1f%%, added latency %6.2f ms, late %llu\n", "  jitterbuf",
+			   ss.UnderrunRate() * 100, ss.MeanAddedLatencyUs() / 1000, (unsigned long long)ss.late,
+			   ms.UnderrunRate() * 100, ms.MeanAddedLatencyUs() / 1000, (unsigned long long)ms.late);
+	}
+	if (USE_UPSAMPLER && !USE_JITTER_BUFFER) {
+		const UpsamplerStats &mu = master_up.getStats();
+		const UpsamplerStats &su = slave_up.getStats();
+		printf("%-12s S: interpolated %5.1f%%, held %llu, correction mean %.3f / max %.3f mm | M: interpolated %5.1f%%, correction mean %.3f / max %.3f mm\n", "  upsample",
+			   su.renders ? 100.0 * su.interpolated / su.renders : 0, (unsigned long long)su.held, su.MeanCorrection(), su.correction_max_mm,
+			   mu.renders ? 100.0 * mu.interpolated / mu.renders : 0, mu.MeanCorrection(), mu.correction_max_mm);
+	}
+
+	closesocket(master_sock);
+	closesocket(slave_sock);
+	return true;
+}
+
+/******************************************************************************
+Main entry point.
+******************************************************************************/
+int main(int argc, char* argv[])
+{
+	// optional: duration, "jb", "up", "up_<key>=<value>", "compact", "red=<n>" or "parity=<g>", "pred=<name>", "db_<key>=<value>", "rate", "rate_<key>=<value>", then a single custom scenario as key=value arguments
+	if (argc > 1) DURATION_S = atoi(argv[1]);
+	if (DURATION_S == 0) {
+		printf("Usage: ./hd_scenario [seconds] [jb] [up] [up_key=value ...] [compact] [red=n|parity=g] [pred=avg|kcv|kca|poly1|poly2] [db_key=value ...] [rate] [rate_key=value ...] [key=value ...]\n");
+		return 0;
+	}
+
+	string custom;
+	for (int i = 2; i < argc; i++) {
+		if (string(argv[i]) == "jb") {
+			USE_JITTER_BUFFER = true;
+			continue;
+		}
+		if (string(argv[i]) == "up") {
+			USE_UPSAMPLER = true;
+			continue;
+		}
+		if (string(argv[i]).compare(0, 3, "up_") == 0) {
+			string item = argv[i] + 3;
+			size_t eq = item.find('=');
+			if (eq == string::npos || !UPSAMPLER.Set(item.substr(0, eq), atof(item.substr(eq + 1).c_str()))) {
+				printf("Bad upsampler setting %s\n", argv[i]);
+				return 0;
+			}
+			USE_UPSAMPLER = true;
+			continue;
+		}
+		if (string(argv[i]) == "compact") {
+			USE_COMPACT = true;
+			continue;
+		}
+		if (string(argv[i]).compare(0, 4, "red=") == 0) {
+			REDUNDANCY = REDUNDANCY_REPEAT;
+			REDUNDANCY_LEVEL = atoi(argv[i] + 4);
+			continue;
+		}
+		if (string(argv[i]).compare(0, 7, "parity=") == 0) {
+			REDUNDANCY = REDUNDANCY_PARITY;
+			REDUNDANCY_LEVEL = atoi(argv[i] + 7);
+			continue;
+		}
+		if (string(argv[i]).compare(0, 5, "pred=") == 0) {
+			if (!ParsePredictorType(argv[i] + 5, PREDICTOR)) {
+				printf("Unknown predictor %s\n", argv[i] + 5);
+				return 0;
+			}
+			continue;
+		}
+		if (string(argv[i]).compare(0, 3, "db_") == 0) {
+			string item = argv[i] + 3;
+			size_t eq = item.find('=');
+			if (eq == string::npos || !DEADBAND.Set(item.substr(0, eq), atof(item.substr(eq + 1).c_str()))) {
+				printf("Bad deadband setting %s\n", argv[i]);
+				return 0;
+			}
+			continue;
+		}
+		if (string(argv[i]) == "rate") {
+			RATE.enabled = true;
+			continue;
+		}
+		if (string(argv[i]).compare(0, 5, "rate_") == 0) {
+			string item = argv[i] + 5;
+			size_t eq = item.find('=');
+			if (eq == string::npos || !RATE.Set(item.substr(0, eq), atof(item.substr(eq + 1).c_str()))) {
+				printf("Bad rate control setting %s\n", argv[i]);
+				return 0;
+			}
+			RATE.enabled = true;
+			continue;
+		}
+		custom += argv[i];
+		custom += " ";
+	}
+
+	if (SocketStartup() != 0) {
+		cout << "Can't start Winsock!" << endl;
+		return -1;
+	}
+
+	printf("%-12s %8s %8s %8s %8s %8s %9s %9s %9s %6s\n", "scenario", "err_mean", "err_p99", "err_max",
+		   "f_jumps", "max_dF", "M_tx/s", "S_rx/s", "M_rx/s", "lost");
+	printf("%-12s %8s %8s %8s %8s %8s\n", "", "(mm)", "(mm)", "(mm)", "", "(N)");
+
+	if (!custom.empty()) {
+		Scenario scenario = { "custom", custom.c_str() };
+		runScenario(scenario, BASE_PORT);
+	}
+	else {
+		for (size_t i = 0; i < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); i++)
+			runScenario(SCENARIOS[i], BASE_PORT + 4 * (uint32_t)i);
+	}
+
+	SocketCleanup();
+	return 0;
+}
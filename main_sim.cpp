@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "hd_api.h"
+#include "hd_socket.h"
+#include "hd_controller.h"
+#include "hd_comm.h"
+#include "hd_logger.h"
+#include "hd_simdevice.h"
+#include "hd_simscheduler.h"
+#include "hd_session.h"
+
+using namespace std;
+
+/******************************************************************************
+Headless load test. Runs NUM_PAIRS master/slave controller pairs on simulated
+devices, exchanging packets over UDP loopback, driven by SimScheduler at 1 kHz.
+With "session" all devices run in one SessionManager pass (hd_session.h) from a
+single callback instead of one callback per pair; with "local" each pair talks
+through a memory link (hd_locallink.h) instead of UDP loopback.
+Build with -DHD_SIMULATION; no OpenHaptics needed.
+******************************************************************************/
+
+/* One master/slave pair and its accumulated tracking error. */
+struct SimPair
+{
+	SimulatedDevice *master_dev;
+	SimulatedDevice *slave_dev;
+	SOCKET master_sock;
+	SOCKET slave_sock;
+	sockaddr_in master_addr;
+	sockaddr_in slave_addr;
+	HDCommunicator *master_comm;
+	HDCommunicator *slave_comm;
+	HapticDeviceController *master;
+	HapticDeviceController *slave;
+	double error_sum;
+	double error_max;
+	uint64_t ticks;
+};
+
+uint32_t NUM_PAIRS = 1;
+uint32_t DURATION_S = 10;
+uint32_t BASE_PORT = 27000;
+uint32_t DEADLINE_US = DEADLINE_BUDGET_US;	// tick budget for load shedding, 0 disables
+uint32_t METRICS_PORT = 0;					// Prometheus endpoint port (see hd_metrics.h), 0 disables
+bool USE_SESSION = false;					// one SessionManager callback for all devices
+bool USE_LOCAL = false;						// memory link instead of UDP loopback between the two sides
+
+vector<SimPair*> pairs;
+SessionManager session;
+
+void recordError(SimPair *pair) {
+	hduVector3Dd master_pos, slave_pos;
+	pair->master_dev->GetPosition(master_pos);
+	pair->slave_dev->GetPosition(slave_pos);
+	double err = (master_pos - slave_pos).magnitude();
+	pair->error_sum += err;
+	if (err > pair->error_max)
+		pair->error_max = err;
+	pair->ticks++;
+}
+
+/******************************************************************************
+Servo callback for one pair: tick both controllers, then record how far the
+slave device is from the master device.
+******************************************************************************/
+HDCallbackCode HDCALLBACK pairCallback(void *data)
+{
+	SimPair *pair = static_cast<SimPair *>(data);
+
+	pair->master->tick();
+	pair->slave->tick();
+	recordError(pair);
+
+	return HD_CALLBACK_CONTINUE;
+}
+
+/******************************************************************************
+Servo callback in session mode: one pass over every device, then the errors.
+******************************************************************************/
+HDCallbackCode HDCALLBACK sessionCallback(void *data)
+{
+	session.Tick();
+	for (size_t i = 0; i < pairs.size(); i++)
+		recordError(pairs[i]);
+
+	return HD_CALLBACK_CONTINUE;
+}
+
+SOCKET openSocket(sockaddr_in &addr, uint32_t port) {
+	MakeAddress(addr, "127.0.0.1", port);
+
+	SOCKET sock = CreateUDPSocket(&addr);
+	if (sock == INVALID_SOCKET)
+		cout << "Can't bind socket on port " << port << " (" << SocketLastError() << ")" << endl;
+	return sock;
+}
+
+/******************************************************************************
+Main entry point.
+******************************************************************************/
+int main(int argc, char* argv[])
+{
+	if (argc > 1) NUM_PAIRS = atoi(argv[1]);
+	if (argc > 2) DURATION_S = atoi(argv[2]);
+	if (argc > 3) BASE_PORT = atoi(argv[3]);
+	if (argc > 4) DEADLINE_US = atoi(argv[4]);
+	if (argc > 5) METRICS_PORT = atoi(argv[5]);
+	bool bad_argument = false;
+	for (int i = 6; i < argc; i++) {
+		if (strcmp(argv[i], "session") == 0) USE_SESSION = true;
+		else if (strcmp(argv[i], "local") == 0) USE_LOCAL = true;
+		else bad_argument = true;
+	}
+	if (bad_argument || NUM_PAIRS == 0) {
+		printf("Usage: ./hd_sim [pairs] [seconds] [base port] [tick budget us] [metrics port] [session] [local]\n");
+		return 0;
+	}
+
+	printf("Starting simulation: %u pair(s), %u s%s%s\n", NUM_PAIRS, DURATION_S, USE_SESSION ? ", one session callback" : "",
+		   USE_LOCAL ? ", memory link" : "");
+
+	SNDLogger m_sndlogger("sim_m_snd.csv", true);
+	RCVLogger m_rcvlogger("sim_m_rcv.csv", true);
+	ERRLogger m_errlogger("sim_m_err.csv", true);
+	SNDLogger s_sndlogger("sim_s_snd.csv", true);
+	RCVLogger s_rcvlogger("sim_s_rcv.csv", true);
+	ERRLogger s_errlogger("sim_s_err.csv", true);
+
+	SimScheduler scheduler;
+	MetricsRegistry metrics;
+	MetricsServer metrics_server(&metrics, METRICS_PORT, "127.0.0.1");
+
+	for (uint32_t i = 0; i < NUM_PAIRS; i++) {
+		SimPair *pair = new SimPair();
+
+		// master hand draws circles, slave hand just holds the stylus
+		pair->master_dev = new SimulatedDevice(SimTrajectory(SIM_CIRCLE, 40, 0.5 + 0.1 * i));
+		pair->slave_dev = new SimulatedDevice(SimTrajectory(SIM_HOLD));
+
+		pair->master_sock = openSocket(pair->master_addr, BASE_PORT + 2 * i);
+		pair->slave_sock = openSocket(pair->slave_addr, BASE_PORT + 2 * i + 1);
+		if (pair->master_sock == INVALID_SOCKET || pair->slave_sock == INVALID_SOCKET)
+			return -1;
+
+		pair->master_comm = new HDCommunicator(2 * i, pair->master_sock, &pair->slave_addr, sizeof(sockaddr_in), 'M',
+											   &m_sndlogger, &m_rcvlogger, &m_errlogger);
+		pair->slave_comm = new HDCommunicator(2 * i + 1, pair->slave_sock, &pair->master_addr, sizeof(sockaddr_in), 'S',
+											  &s_sndlogger, &s_rcvlogger, &s_errlogger);
+		if (USE_LOCAL && !(pair->master_comm->EnableLocalTransport() && pair->slave_comm->EnableLocalTransport()))
+			printf("pair %u: no memory link, staying on UDP\n", i);
+		if (USE_SESSION) {
+			// the session owns devices and communicators from here on
+			pair->master = session.AddDevice(pair->master_dev, pair->master_comm, 'M', &m_sndlogger, &m_rcvlogger, &m_errlogger);
+			pair->slave = session.AddDevice(pair->slave_dev, pair->slave_comm, 'S', &s_sndlogger, &s_rcvlogger, &s_errlogger);
+		}
+		else {
+			pair->master = new HapticDeviceController(pair->master_dev, 'M', pair->master_comm,
+													  &m_sndlogger, &m_rcvlogger, &m_errlogger);
+			pair->slave = new HapticDeviceController(pair->slave_dev, 'S', pair->slave_comm,
+													 &s_sndlogger, &s_rcvlogger, &s_errlogger);
+		}
+		pair->master->SetDeadline(DEADLINE_US);
+		pair->slave->SetDeadline(DEADLINE_US);
+		if (METRICS_PORT) {
+			char session[16];
+			snprintf(session, sizeof(session), "pair%u", i);
+			pair->master->SetMetrics(&metrics, session);
+			pair->slave->SetMetrics(&metrics, session);
+		}
+
+		pairs.push_back(pair);
+		if (!USE_SESSION)
+			scheduler.Schedule(pairCallback, pair);
+	}
+	if (USE_SESSION)
+		scheduler.Schedule(sessionCallback, NULL);
+
+	if (METRICS_PORT && !metrics_server.Start())
+		printf("Can't bind metrics port %u\n", METRICS_PORT);
+	scheduler.Start();
+	std::this_thread::sleep_for(std::chrono::seconds(DURATION_S));
+	scheduler.Stop();
+	metrics_server.Stop();
+
+	printf("ticks %llu, overruns %llu, max lateness %.1f us, busy mean %.1f us / max %.1f us\n",
+		   (unsigned long long)scheduler.getTickCount(), (unsigned long long)scheduler.getOverrunCount(),
+		   scheduler.getMaxLatenessNs() / 1000.0, scheduler.getMeanBusyNs() / 1000.0, scheduler.getMaxBusyNs() / 1000.0);
+
+	for (uint32_t i = 0; i < pairs.size(); i++) {
+		SimPair *pair = pairs[i];
+		printf("pair %u: tracking error mean %.3f mm / max %.3f mm, M->S %u pkts, S->M %u pkts\n", i,
+			   pair->ticks ? pair->error_sum / pair->ticks : 0, pair->error_max,
+			   pair->slave_comm->getReceivedPacketCount(), pair->master_comm->getReceivedPacketCount());
+		const DeadlineStats &md = pair->master->getDeadlineStats();
+		const DeadlineStats &sd = pair->slave->getDeadlineStats();
+		printf("  deadline: M overruns %llu, max %lld us, shed %llu / restored %llu, level %s | S overruns %llu, max %lld us, shed %llu / restored %llu, level %s\n",
+			   (unsigned long long)md.overruns, (long long)md.max_tick_us, (unsigned long long)md.sheds, (unsigned long long)md.restores,
+			   SHED_LEVEL_NAMES[pair->master->getShedLevel()],
+			   (unsigned long long)sd.overruns, (long long)sd.max_tick_us, (unsigned long long)sd.sheds, (unsigned long long)sd.restores,
+			   SHED_LEVEL_NAMES[pair->slave->getShedLevel()]);
+		closesocket(pair->master_sock);
+		closesocket(pair->slave_sock);
+		if (!USE_SESSION) {
+			// detaches and removes their memory links; with a session it does that on exit
+			delete pair->master_comm;
+			delete pair->slave_comm;
+		}
+	}
+	if (!pairs.empty()) {
+		// stage timing of the first pair (builds with HD_PROFILE only)
+		pairs[0]->master->DumpProfile(stdout);
+		pairs[0]->slave->DumpProfile(stdout);
+	}
+	printf("logger drops: %llu\n", (unsigned long long)(m_sndlogger.getDroppedCount() + m_rcvlogger.getDroppedCount() +
+		   s_sndlogger.getDroppedCount() + s_rcvlogger.getDroppedCount()));
+
+	return 0;
+}
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "hd_api.h"
+#include "hd_predictor.h"
+#include "hd_simdevice.h"
+#include "hd_replay.h"
+#include "hd_sweep.h"
+#include "hd_workpool.h"
+
+using namespace std;
+
+/******************************************************************************
+Parallel parameter sweep. Every combination of predictor, history length,
+deadband k and floor, force strength, send rate (fixed or velocity-adaptive)
+and upsampling runs a simulated master/slave pair over a modelled link
+(RunSweepPoint, hd_sweep.h) on a WorkStealingPool with one worker per core.
+Prints the Pareto front of packet rate, position and rendering error and
+force discontinuity (all points with "all"), optionally as csv.
+The master follows a built-in trajectory, a waypoint script or the sent
+positions of a recorded SNDLogger file. Build with -DHD_SIMULATION.
+******************************************************************************/
+
+uint32_t DURATION_S = 20;
+SweepLink LINK;
+SimTrajectory HAND(SIM_CIRCLE, 40, 0.5);
+string HAND_NAME = "circle";
+vector<PredictorType> PREDICTORS = { PREDICTOR_AVERAGE, PREDICTOR_KALMAN_CV, PREDICTOR_KALMAN_CA, PREDICTOR_POLY1, PREDICTOR_POLY2 };
+vector<double> HISTORIES = { 3, 5, 8 };
+vector<double> DEADBAND_KS = { 0.05, 0.1, 0.2 };
+vector<double> DEADBAND_FLOORS = { 0.1, 0.3, 0.6 };
+vector<double> FORCE_STRENGTHS = { 0.1, 0.2, 0.3, 0.5 };
+vector<double> SEND_RATES = { 0 };				// fixed send rates (Hz), 0: deadband
+vector<double> ADAPTIVE = { 0 };				// 1: velocity-adaptive rate, up to hz or in front of the deadband
+vector<double> UPSAMPLE = { 0 };				// 1: render through an Upsampler
+unsigned THREADS = 0;
+bool PRINT_ALL = false;
+string CSV_FILE;
+
+bool parseList(const string &text, vector<double> &values) {
+	/* comma separated numbers */
+	values.clear();
+	size_t start = 0;
+	while (start <= text.size()) {
+		size_t end = text.find(',', start);
+		if (end == string::npos)
+			end = text.size();
+		string item = text.substr(start, end - start);
+		if (item.empty())
+			return false;
+		values.push_back(atof(item.c_str()));
+		start = end + 1;
+	}
+	return !values.empty();
+}
+
+bool parsePredictors(const string &text, vector<PredictorType> &types) {
+	types.clear();
+	size_t start = 0;
+	while (start <= text.size()) {
+		size_t end = text.find(',', start);
+		if (end == string::npos)
+			end = text.size();
+		PredictorType type;
+		if (!ParsePredictorType(text.substr(start, end - start), type))
+			return false;
+		types.push_back(type);
+		start = end + 1;
+	}
+	return !types.empty();
+}
+
+bool loadTrace(const string &path) {
+	/* master hand from the sent positions of an SNDLogger file */
+	ReplayTrace trace;
+	if (!trace.LoadSend(path) || trace.local.empty())
+		return false;
+	HAND = SimTrajectory(SIM_SCRIPT);
+	ts_t t0 = trace.local.front().time;
+	for (size_t i = 0; i < trace.local.size(); i++)
+		HAND.AddWaypoint((trace.local[i].time - t0) * 1e-6, trace.local[i].pos);
+	if (DURATION_S > (trace.local.back().time - t0) / 1000000)
+		DURATION_S = (uint32_t)((trace.local.back().time - t0) / 1000000);
+	return DURATION_S > 0;
+}
+
+bool parseArgument(const string &arg) {
+	size_t eq = arg.find('=');
+	if (arg == "all") {
+		PRINT_ALL = true;
+		return true;
+	}
+	if (eq == string::npos)
+		return false;
+	string key = arg.substr(0, eq);
+	string value = arg.substr(eq + 1);
+	if (key == "traj") {
+		HAND_NAME = value;
+		if (value == "circle") HAND = SimTrajectory(SIM_CIRCLE, 40, 0.5);
+		else if (value == "sine") HAND = SimTrajectory(SIM_SINE, 50, 1.0);
+		else if (value == "walk") HAND = SimTrajectory(SIM_RANDOM_WALK, 40, 1.0, 7);
+		else return false;
+		return true;
+	}
+	if (key == "script") {
+		HAND_NAME = value;
+		return HAND.LoadScript(value);
+	}
+	if (key == "trace") {
+		HAND_NAME = value;
+		return loadTrace(value);
+	}
+	if (key == "delay") { LINK.delay_ms = atof(value.c_str()); return true; }
+	if (key == "jitter") { LINK.jitter_ms = atof(value.c_str()); return true; }
+	if (key == "loss") { LINK.loss = atof(value.c_str()); return true; }
+	if (key == "threads") { THREADS = atoi(value.c_str()); return true; }
+	if (key == "csv") { CSV_FILE = value; return true; }
+	if (key == "pred") return parsePredictors(value, PREDICTORS);
+	if (key == "hist") return parseList(value, HISTORIES);
+	if (key == "k") return parseList(value, DEADBAND_KS);
+	if (key == "floor") return parseList(value, DEADBAND_FLOORS);
+	if (key == "f") return parseList(value, FORCE_STRENGTHS);
+	if (key == "hz") return parseList(value, SEND_RATES);
+	if (key == "rate") return parseList(value, ADAPTIVE);
+	if (key == "up") return parseList(value, UPSAMPLE);
+	return false;
+}
+
+vector<SweepParams> makeGrid() {
+	/* full cartesian grid; the history only multiplies the predictors that use one, the deadband
+	   settings only the deadband rate (hz=0) */
+	vector<SweepParams> grid;
+	for (size_t r = 0; r < SEND_RATES.size(); r++)
+		for (size_t a = 0; a < ADAPTIVE.size(); a++)
+			for (size_t u = 0; u < UPSAMPLE.size(); u++)
+				for (size_t p = 0; p < PREDICTORS.size(); p++)
+					for (size_t h = 0; h < (UsesHistory(PREDICTORS[p]) ? HISTORIES.size() : 1); h++)
+						for (size_t k = 0; k < (SEND_RATES[r] > 0 ? 1 : DEADBAND_KS.size()); k++)
+							for (size_t fl = 0; fl < (SEND_RATES[r] > 0 ? 1 : DEADBAND_FLOORS.size()); fl++)
+								for (size_t f = 0; f < FORCE_STRENGTHS.size(); f++) {
+									SweepParams params;
+									params.predictor = PREDICTORS[p];
+									params.history = (int)HISTORIES[h];
+									params.deadband_k = DEADBAND_KS[k];
+									params.deadband_floor = DEADBAND_FLOORS[fl];
+									params.force_strength = FORCE_STRENGTHS[f];
+									params.send_hz = SEND_RATES[r];
+									params.adaptive = ADAPTIVE[a] != 0;
+									params.upsample = UPSAMPLE[u] != 0;
+									grid.push_back(params);
+								}
+	return grid;
+}
+
+/******************************************************************************
+Main entry point.
+******************************************************************************/
+int main(int argc, char* argv[])
+{
+	if (argc > 1) DURATION_S = atoi(argv[1]);
+	if (DURATION_S == 0) {
+		printf("Usage: ./hd_sweep [seconds] [traj=circle|sine|walk | script=file | trace=snd.csv] [delay=ms] [jitter=ms] [loss=p]\n"
+			   "                  [pred=avg,kcv,...] [hist=3,5,8] [k=...] [floor=...] [f=...] [hz=0,100,250] [rate=0,1] [up=0,1] [threads=n] [all] [csv=file]\n");
+		return 0;
+	}
+	for (int i = 2; i < argc; i++) {
+		if (!parseArgument(argv[i])) {
+			printf("Bad argument %s\n", argv[i]);
+			return 0;
+		}
+	}
+
+	vector<SweepParams> grid = makeGrid();
+	vector<SweepResult> results(grid.size());
+	printf("%s, %u s, delay %.1f+%.1f ms, loss %.1f%%: %zu points\n", HAND_NAME.c_str(), DURATION_S,
+		   LINK.delay_ms, LINK.jitter_ms, LINK.loss * 100, grid.size());
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	size_t threads;
+	uint64_t steals;
+	{
+		WorkStealingPool pool(THREADS);
+		for (size_t i = 0; i < grid.size(); i++) {
+			// every point gets its own copy of the hand (random walk state) and the same link seed
+			pool.Submit([i, &grid, &results] {
+				results[i] = RunSweepPoint(grid[i], HAND, LINK, DURATION_S);
+			});
+		}
+		pool.Wait();
+		threads = pool.getThreadCount();
+		steals = pool.getStealCount();
+	}
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	size_t front = MarkPareto(results);
+	printf("%.2f s on %zu threads (%llu steals), %zu Pareto optimal\n", elapsed, threads, (unsigned long long)steals, front);
+
+	sort(results.begin(), results.end(), [](const SweepResult &a, const SweepResult &b) {
+		return a.packet_rate != b.packet_rate ? a.packet_rate < b.packet_rate : a.error_mean < b.error_mean;
+	});
+	printf("  %-36s %8s %8s %8s %8s %8s %8s\n", "settings", "pkt/s", "err_mean", "err_p99", "render", "dF_p99", "dF_max");
+	printf("  %-36s %8s %8s %8s %8s %8s %8s\n", "", "", "(mm)", "(mm)", "(mm)", "(N)", "(N)");
+	for (size_t i = 0; i < results.size(); i++) {
+		const SweepResult &r = results[i];
+		if (!r.pareto && !PRINT_ALL)
+			continue;
+		printf("%c %-36s %8.1f %8.3f %8.3f %8.3f %8.4f %8.4f\n", r.pareto ? '*' : ' ', r.params.Describe().c_str(),
+			   r.packet_rate, r.error_mean, r.error_p99, r.render_error_mean, r.force_jump_p99, r.force_jump_max);
+	}
+
+	if (!CSV_FILE.empty()) {
+		ofstream csv(CSV_FILE);
+		csv << "pred,history,k,floor,force,send_hz,adaptive,upsample,pkt_rate,err_mean,err_p99,render_mean,df_p99,df_max,pareto\n";
+		for (size_t i = 0; i < results.size(); i++) {
+			const SweepResult &r = results[i];
+			csv << PredictorTypeName(r.params.predictor) << "," << r.params.history << "," << r.params.deadband_k << ","
+				<< r.params.deadband_floor << "," << r.params.force_strength << "," << r.params.send_hz << ","
+				<< (r.params.adaptive ? 1 : 0) << "," << (r.params.upsample ? 1 : 0) << "," << r.packet_rate << ","
+				<< r.error_mean << "," << r.error_p99 << "," << r.render_error_mean << "," << r.force_jump_p99 << "," << r.force_jump_max << ","
+				<< (r.pareto ? 1 : 0) << "\n";
+		}
+	}
+	return 0;
+}